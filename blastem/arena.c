@@ -87,3 +87,24 @@ void *try_alloc_arena()
 	track_block(ret);
 	return ret;
 }
+
+size_t arena_block_count()
+{
+	return current_arena ? current_arena->used_count : 0;
+}
+
+void release_blocks_after(size_t mark)
+{
+	arena *cur = get_current_arena();
+	if (cur->used_count <= mark) {
+		return;
+	}
+	if (cur->free_storage < cur->used_count - mark + cur->free_count) {
+		cur->free_storage = cur->used_count - mark + cur->free_count;
+		cur->free_blocks = realloc(cur->free_blocks, cur->free_storage * sizeof(void*));
+	}
+	for (; cur->used_count > mark; cur->used_count--)
+	{
+		cur->free_blocks[cur->free_count++] = cur->used_blocks[cur->used_count-1];
+	}
+}
@@ -5,6 +5,7 @@
 */
 #ifndef ARENA_H_
 #define ARENA_H_
+#include <stddef.h>
 
 typedef struct arena arena;
 
@@ -14,5 +15,7 @@ arena *start_new_arena();
 void track_block(void *block);
 void mark_all_free();
 void *try_alloc_arena();
+size_t arena_block_count();
+void release_blocks_after(size_t mark);
 
 #endif //ARENA_H_
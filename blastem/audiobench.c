@@ -0,0 +1,213 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures the throughput of the audio mixer for a range of output buffer sizes and the cost of
+//resampling each kind of source to the output rate
+//The sources mimic a Genesis, a stereo YM2612 and a mono PSG, with the YM2612 data wrapping around its ring buffer
+#include "render_audio.h"
+#include "tern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+tern_node *config;
+int headless = 1;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+//the benchmark acts as an asynchronous render backend that never has a real output device
+uint8_t render_is_audio_sync(void)
+{
+	return 0;
+}
+
+void render_buffer_consumed(audio_source *src)
+{
+}
+
+void *render_new_audio_opaque(void)
+{
+	return NULL;
+}
+
+void render_free_audio_opaque(void *opaque)
+{
+}
+
+void render_lock_audio(void)
+{
+}
+
+void render_unlock_audio(void)
+{
+}
+
+static uint32_t min_buffered;
+uint32_t render_min_buffered(void)
+{
+	return min_buffered;
+}
+
+uint32_t render_audio_syncs_per_sec(void)
+{
+	return 0;
+}
+
+void render_audio_created(audio_source *src)
+{
+}
+
+void render_do_audio_ready(audio_source *src)
+{
+}
+
+void render_source_paused(audio_source *src, uint8_t remaining_sources)
+{
+}
+
+void render_source_resumed(audio_source *src)
+{
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void fill_source(audio_source *src)
+{
+	for (uint32_t i = 0; i <= src->mask; i++)
+	{
+		src->back[i] = rand() % 0x4000 - 0x2000;
+	}
+}
+
+//makes frames worth of samples available starting where the last mix left off
+static void produce(audio_source *src, uint32_t frames)
+{
+	src->read_end = (src->read_start + frames * src->num_channels) & src->mask;
+}
+
+static void bench(render_audio_format format, uint32_t frames, uint32_t total_frames)
+{
+	int sample_size = format == RENDER_AUDIO_S16 ? sizeof(int16_t) : sizeof(float);
+	min_buffered = frames;
+	render_audio_initialized(format, 48000, 2, frames, sample_size);
+	audio_source *ym = render_audio_source(53693175, 1008, 2);
+	audio_source *psg = render_audio_source(53693175, 240, 1);
+	fill_source(ym);
+	fill_source(psg);
+	//start the YM2612 at the end of its buffer so the wraparound is exercised
+	ym->read_start = (ym->mask + 1) - frames;
+	uint8_t *stream = malloc(frames * 2 * sample_size);
+	uint32_t iterations = total_frames / frames;
+	double start = now();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		produce(ym, frames);
+		produce(psg, frames);
+		mix_and_convert(stream, frames * 2 * sample_size, NULL);
+	}
+	double elapsed = now() - start;
+	printf("%s %5u frames: %.2f ns/frame\n", format == RENDER_AUDIO_S16 ? "s16" : "f32", frames, elapsed * 1000000000.0 / ((double)iterations * frames));
+	free(stream);
+	render_free_source(ym);
+	render_free_source(psg);
+}
+
+//square waves with a period that changes every so often, roughly what a YM2612 or PSG channel puts out
+static int16_t *test_wave(uint32_t samples, uint32_t base_period)
+{
+	int16_t *wave = malloc(samples * sizeof(int16_t));
+	for (uint32_t i = 0; i < samples; i++)
+	{
+		uint32_t period = base_period + (i >> 12) % 37;
+		wave[i] = (i / period) & 1 ? 0x1800 : -0x1800;
+	}
+	return wave;
+}
+
+//Reports the time spent resampling one emulated second of input from each source
+static void bench_resample(uint32_t seconds)
+{
+	min_buffered = 1024;
+	render_audio_initialized(RENDER_AUDIO_S16, 48000, 2, 1024, sizeof(int16_t));
+	audio_source *ym = render_audio_source(53693175, 1008, 2);
+	audio_source *psg = render_audio_source(53693175, 240, 1);
+	uint32_t ym_samples = 53693175 / 1008 * seconds, psg_samples = 53693175 / 240 * seconds;
+	int16_t *ym_left = test_wave(ym_samples, 60), *ym_right = test_wave(ym_samples, 97);
+	int16_t *psg_wave = test_wave(psg_samples, 250);
+	double start = now();
+	for (uint32_t i = 0; i < ym_samples; i++)
+	{
+		render_put_stereo_sample(ym, ym_left[i], ym_right[i]);
+		//the benchmark backend never consumes anything so keep the ring from filling
+		ym->read_start = ym->read_end = ym->buffer_pos;
+	}
+	double ym_time = now() - start;
+	start = now();
+	for (uint32_t i = 0; i < psg_samples; i++)
+	{
+		render_put_mono_sample(psg, psg_wave[i]);
+		psg->read_start = psg->read_end = psg->buffer_pos;
+	}
+	double psg_time = now() - start;
+	//the PSG core emits runs of identical samples as spans
+	audio_source *span_psg = render_audio_source(53693175, 240, 1);
+	uint32_t *span_starts = malloc((psg_samples + 1) * sizeof(uint32_t)), num_spans = 0;
+	for (uint32_t i = 0; i < psg_samples; i++)
+	{
+		if (!i || psg_wave[i] != psg_wave[i - 1]) {
+			span_starts[num_spans++] = i;
+		}
+	}
+	span_starts[num_spans] = psg_samples;
+	start = now();
+	for (uint32_t i = 0; i < num_spans; i++)
+	{
+		render_put_mono_span(span_psg, psg_wave[span_starts[i]], span_starts[i + 1] - span_starts[i]);
+		span_psg->read_start = span_psg->read_end = span_psg->buffer_pos;
+	}
+	double span_time = now() - start;
+	printf("resample YM2612: %.3f ms per emulated second, %.2f ns/input sample\n", ym_time * 1000.0 / seconds, ym_time * 1000000000.0 / ym_samples);
+	printf("resample PSG: %.3f ms per emulated second, %.2f ns/input sample\n", psg_time * 1000.0 / seconds, psg_time * 1000000000.0 / psg_samples);
+	printf("PSG spans: %.3f ms per emulated second, %.2f ns/span\n", span_time * 1000.0 / seconds, span_time * 1000000000.0 / num_spans);
+	free(span_starts);
+	free(ym_left);
+	free(ym_right);
+	free(psg_wave);
+	render_free_source(ym);
+	render_free_source(psg);
+	render_free_source(span_psg);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t total_frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000000;
+	static const uint32_t sizes[] = {64, 256, 512, 1024, 2048, 4096};
+	for (int i = 0; i < sizeof(sizes)/sizeof(*sizes); i++)
+	{
+		bench(RENDER_AUDIO_S16, sizes[i], total_frames);
+	}
+	for (int i = 0; i < sizeof(sizes)/sizeof(*sizes); i++)
+	{
+		bench(RENDER_AUDIO_FLOAT, sizes[i], total_frames);
+	}
+	bench_resample(total_frames / 1000000 + 1);
+	return 0;
+}
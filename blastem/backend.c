@@ -5,6 +5,7 @@
 */
 #include "backend.h"
 #include <stdlib.h>
+#include <string.h>
 
 deferred_addr * defer_address(deferred_addr * old_head, uint32_t address, uint8_t *dest)
 {
@@ -293,3 +294,212 @@ uint32_t ram_size(cpu_options *opts)
 	}
 	return size;
 }
+
+uint32_t code_page_index(cpu_options *opts, uint32_t address)
+{
+	uint32_t meta_off;
+	address &= opts->address_mask;
+	memmap_chunk const *chunk = find_map_chunk(address, opts, MMAP_CODE, &meta_off);
+	if (!chunk || !(chunk->flags & MMAP_CODE)) {
+		return CODE_PAGE_NONE;
+	}
+	return (meta_off + ((address - chunk->start) & chunk->mask)) >> opts->ram_flags_shift;
+}
+
+//Returns the invalidation count of a page after applying the decay for the time since it was last updated
+static uint32_t *decayed_count(cpu_options *opts, uint32_t page, uint32_t cycle)
+{
+	uint32_t last = opts->smc_cycles[page];
+	uint32_t periods = (cycle - last) / (SMC_DECAY_CYCLES * opts->clock_divider);
+	if (cycle < last || periods >= 32) {
+		//cycle counts get adjusted down now and then, a page last touched before that has long since cooled off
+		opts->smc_counts[page] = 0;
+		opts->smc_cycles[page] = cycle;
+	} else if (periods) {
+		opts->smc_counts[page] >>= periods;
+		opts->smc_cycles[page] = cycle;
+	}
+	return opts->smc_counts + page;
+}
+
+uint8_t code_page_interpreted(cpu_options *opts, uint32_t address, uint32_t cycle)
+{
+	uint32_t page = code_page_index(opts, address);
+	return page != CODE_PAGE_NONE && *decayed_count(opts, page, cycle) >= SMC_INTERP_THRESHOLD;
+}
+
+void flag_code_page(cpu_options *opts, uint8_t *ram_code_flags, uint32_t code_off)
+{
+	uint32_t page = code_off >> opts->ram_flags_shift;
+	//pages that are written too often no longer contain translated code so writes don't need to be trapped
+	if (opts->smc_counts[page] < SMC_INTERP_THRESHOLD) {
+		ram_code_flags[page >> 3] |= 1 << (page & 7);
+	}
+}
+
+//Flags the pages an instruction occupies for code that was retranslated without being remapped
+void flag_code_pages(cpu_options *opts, uint8_t *ram_code_flags, uint32_t address, uint32_t size)
+{
+	uint32_t meta_off;
+	address &= opts->address_mask;
+	memmap_chunk const *chunk = find_map_chunk(address, opts, MMAP_CODE, &meta_off);
+	if (!chunk || !(chunk->flags & MMAP_CODE)) {
+		return;
+	}
+	flag_code_page(opts, ram_code_flags, meta_off + ((address - chunk->start) & chunk->mask));
+	flag_code_page(opts, ram_code_flags, meta_off + ((address + size - 1 - chunk->start) & chunk->mask));
+}
+
+uint8_t code_page_flagged(cpu_options *opts, uint8_t *ram_code_flags, uint32_t page)
+{
+	return page != CODE_PAGE_NONE && (ram_code_flags[page >> 3] & (1 << (page & 7)));
+}
+
+void code_page_invalidated(cpu_options *opts, uint8_t *ram_code_flags, uint32_t page, uint32_t cycle)
+{
+	//all translated code in the page has been patched for retranslation so
+	//further writes can be ignored until something is translated there again
+	ram_code_flags[page >> 3] &= ~(1 << (page & 7));
+	code_page_modified(opts, page, cycle);
+}
+
+void code_page_modified(cpu_options *opts, uint32_t page, uint32_t cycle)
+{
+	(*decayed_count(opts, page, cycle))++;
+}
+
+//Forgets how often pages were modified, used when the code they held is gone or the CPU is reset
+//Interpreted instructions get translated normally again the next time they run
+void reset_code_page_counts(cpu_options *opts)
+{
+	uint32_t pages = ram_size(opts) >> opts->ram_flags_shift;
+	memset(opts->smc_counts, 0, pages * sizeof(uint32_t));
+	memset(opts->smc_cycles, 0, pages * sizeof(uint32_t));
+}
+
+void account_translated_code(cpu_options *opts, uint32_t native_size)
+{
+	opts->translated_bytes += native_size;
+	if (opts->translated_bytes > opts->translated_peak) {
+		opts->translated_peak = opts->translated_bytes;
+	}
+}
+
+//Discards all translated code along with the RAM code metadata, native_code_map uses a CPU specific
+//chunk size so it needs to be cleared by the caller
+//Callers are responsible for making sure nothing still points into the discarded code
+void reset_translated_code(cpu_options *opts, uint8_t *ram_code_flags)
+{
+	uint32_t code_ram = ram_size(opts);
+	uint32_t ram_inst_slots = code_ram / 1024;
+	for (uint32_t i = 0; i < ram_inst_slots; i++)
+	{
+		free(opts->ram_inst_sizes[i]);
+		opts->ram_inst_sizes[i] = NULL;
+	}
+	memset(ram_code_flags, 0, code_ram >> (opts->ram_flags_shift + 3));
+	reset_code_page_counts(opts);
+	//the cache slots live in the code space that's being discarded
+	free(opts->smc_cache);
+	opts->smc_cache = NULL;
+	opts->code = opts->flush_code;
+	opts->deferred = NULL;
+	opts->translated_bytes = 0;
+}
+
+//Starts profiling the instruction at address, the translator emits its counter with profile_count
+void profile_begin(cpu_options *opts, uint32_t address)
+{
+	block_profile *prof = opts->profile;
+	if (!prof) {
+		return;
+	}
+	if (!prof->num_pages || prof->used == PROFILE_PAGE_ENTRIES) {
+		if (prof->num_pages == prof->page_storage) {
+			prof->page_storage = prof->page_storage ? prof->page_storage * 2 : 16;
+			prof->pages = realloc(prof->pages, prof->page_storage * sizeof(profile_entry *));
+		}
+		prof->pages[prof->num_pages++] = calloc(PROFILE_PAGE_ENTRIES, sizeof(profile_entry));
+		prof->used = 0;
+	}
+	prof->current = prof->pages[prof->num_pages - 1] + prof->used++;
+	prof->current->address = address;
+	prof->start_cycles = opts->emitted_cycles;
+}
+
+void profile_end(cpu_options *opts, uint32_t bytes, uint32_t native_size, uint8_t ends_block)
+{
+	block_profile *prof = opts->profile;
+	if (!prof || !prof->current) {
+		return;
+	}
+	prof->current->cycles = (opts->emitted_cycles - prof->start_cycles) / opts->clock_divider;
+	prof->current->bytes = bytes;
+	prof->current->native_size = native_size;
+	prof->current->ends_block = ends_block;
+	prof->current = NULL;
+}
+
+static int profile_entry_cmp(const void *av, const void *bv)
+{
+	const profile_entry *a = *(profile_entry * const *)av, *b = *(profile_entry * const *)bv;
+	return a->address < b->address ? -1 : a->address > b->address;
+}
+
+static int profile_block_cmp(const void *av, const void *bv)
+{
+	const profile_block *a = av, *b = bv;
+	return a->cycles > b->cycles ? -1 : a->cycles < b->cycles;
+}
+
+//Groups the instruction counters into blocks that end at control flow instructions, gaps in the
+//translated code or branch targets, which show up as a change in the execution count
+//Returns the blocks sorted by executed cycles, caller is responsible for freeing the result
+profile_block *profile_collect(cpu_options *opts, uint32_t *num_blocks)
+{
+	block_profile *prof = opts->profile;
+	*num_blocks = 0;
+	if (!prof || !prof->num_pages) {
+		return NULL;
+	}
+	uint32_t num_entries = (prof->num_pages - 1) * PROFILE_PAGE_ENTRIES + prof->used;
+	profile_entry **sorted = malloc(num_entries * sizeof(profile_entry *));
+	for (uint32_t i = 0; i < num_entries; i++)
+	{
+		sorted[i] = prof->pages[i / PROFILE_PAGE_ENTRIES] + i % PROFILE_PAGE_ENTRIES;
+	}
+	qsort(sorted, num_entries, sizeof(profile_entry *), profile_entry_cmp);
+	profile_block *blocks = malloc(num_entries * sizeof(profile_block));
+	profile_block *cur = NULL;
+	uint8_t block_done = 1;
+	uint64_t last_executions = 0;
+	for (uint32_t i = 0; i < num_entries;)
+	{
+		//an instruction can have several counters when it was retranslated or duplicated in a superblock
+		profile_entry *entry = sorted[i];
+		uint64_t executions = 0;
+		uint32_t native_size = 0;
+		uint8_t ends_block = 0;
+		for (; i < num_entries && sorted[i]->address == entry->address; i++)
+		{
+			executions += sorted[i]->executions;
+			native_size += sorted[i]->native_size;
+			ends_block |= sorted[i]->ends_block;
+		}
+		if (block_done || cur->end != entry->address || executions != last_executions) {
+			cur = blocks + (*num_blocks)++;
+			cur->executions = executions;
+			cur->cycles = 0;
+			cur->address = entry->address;
+			cur->native_size = 0;
+		}
+		cur->cycles += executions * entry->cycles;
+		cur->native_size += native_size;
+		cur->end = entry->address + entry->bytes;
+		block_done = ends_block;
+		last_executions = executions;
+	}
+	free(sorted);
+	qsort(blocks, *num_blocks, sizeof(profile_block), profile_block_cmp);
+	return blocks;
+}
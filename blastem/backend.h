@@ -13,6 +13,14 @@
 #define INVALID_OFFSET 0xFFFFFFFF
 #define EXTENSION_WORD 0xFFFFFFFE
 #define CYCLE_NEVER 0xFFFFFFFF
+#define CODE_PAGE_NONE 0xFFFFFFFF
+//number of self-modifying code invalidations after which a code page is interpreted rather than translated
+#define SMC_INTERP_THRESHOLD 16
+//invalidation counts are halved every SMC_DECAY_CYCLES CPU cycles so pages that stop being modified get translated again
+#define SMC_DECAY_CYCLES 65536
+//instructions from interpreted pages are kept in a small cache so unmodified ones aren't translated on every execution
+#define SMC_CACHE_BITS 7
+#define SMC_CACHE_INST_BYTES 10
 
 #if defined(X86_32) || defined(X86_64)
 typedef struct {
@@ -43,12 +51,55 @@ typedef struct deferred_addr {
 #include "memmap.h"
 #include "system.h"
 
+//execution counter for a single translated guest instruction
+typedef struct {
+	uint64_t executions;
+	uint32_t address;
+	uint32_t cycles;      //cycles charged by the translated code, excluding wait states
+	uint32_t native_size;
+	uint8_t  bytes;
+	uint8_t  ends_block;
+} profile_entry;
+
+#define PROFILE_PAGE_ENTRIES 4096
+
+//entries are allocated in fixed pages because translated code holds pointers to their counters
+typedef struct {
+	profile_entry **pages;
+	profile_entry *current;
+	uint32_t      num_pages;
+	uint32_t      page_storage;
+	uint32_t      used;
+	uint32_t      start_cycles;
+} block_profile;
+
+//straight-line run of profiled instructions, built when the profile is dumped
+typedef struct {
+	uint64_t executions;
+	uint64_t cycles;
+	uint32_t address;
+	uint32_t end;
+	uint32_t native_size;
+} profile_block;
+
+typedef struct {
+	code_ptr native;
+	uint32_t address;
+	uint8_t  size;
+	uint8_t  bytes[SMC_CACHE_INST_BYTES];
+} smc_cache_entry;
+
 typedef struct {
 	uint32_t flags;
 	native_map_slot    *native_code_map;
 	deferred_addr      *deferred;
 	code_info          code;
+	code_info          flush_code;
 	uint8_t            **ram_inst_sizes;
+	uint32_t           *smc_counts;
+	uint32_t           *smc_cycles; //cycle at which each page's invalidation count was last decayed
+	smc_cache_entry    *smc_cache;
+	block_profile      *profile;
 	memmap_chunk const *memmap;
 	code_ptr           save_context;
 	code_ptr           load_context;
@@ -59,6 +110,9 @@ typedef struct {
 	code_ptr           handle_align_error_read;
 	system_str_fun_r8  debug_cmd_handler;
 	uint32_t           memmap_chunks;
+	uint32_t           translated_bytes;
+	uint32_t           translated_peak;
+	uint32_t           emitted_cycles; //running total of cycles passed to cycles(), used to size superblock checks
 	uint32_t           address_mask;
 	uint32_t           max_address;
 	uint32_t           bus_cycles;
@@ -92,6 +146,7 @@ void log_address(cpu_options *opts, uint32_t address, char * format);
 
 void retranslate_calc(cpu_options *opts);
 void patch_for_retranslate(cpu_options *opts, code_ptr native_address, code_ptr handler);
+code_ptr smc_cache_lookup(cpu_options *opts, uint32_t address, void *bytes, uint8_t size, uint32_t cycle, uint32_t slot_size, code_ptr *slot);
 
 code_ptr gen_mem_fun(cpu_options * opts, memmap_chunk const * memmap, uint32_t num_chunks, ftype fun_type, code_ptr *after_inc);
 void * get_native_pointer(uint32_t address, void ** mem_pointers, cpu_options * opts);
@@ -103,6 +158,20 @@ void write_byte(uint32_t address, uint8_t value, void **mem_pointers, cpu_option
 memmap_chunk const *find_map_chunk(uint32_t address, cpu_options *opts, uint16_t flags, uint32_t *size_sum);
 uint32_t chunk_size(cpu_options *opts, memmap_chunk const *chunk);
 uint32_t ram_size(cpu_options *opts);
+uint32_t code_page_index(cpu_options *opts, uint32_t address);
+uint8_t code_page_interpreted(cpu_options *opts, uint32_t address, uint32_t cycle);
+void flag_code_page(cpu_options *opts, uint8_t *ram_code_flags, uint32_t code_off);
+void flag_code_pages(cpu_options *opts, uint8_t *ram_code_flags, uint32_t address, uint32_t size);
+uint8_t code_page_flagged(cpu_options *opts, uint8_t *ram_code_flags, uint32_t page);
+void code_page_invalidated(cpu_options *opts, uint8_t *ram_code_flags, uint32_t page, uint32_t cycle);
+void code_page_modified(cpu_options *opts, uint32_t page, uint32_t cycle);
+void reset_code_page_counts(cpu_options *opts);
+void account_translated_code(cpu_options *opts, uint32_t native_size);
+void reset_translated_code(cpu_options *opts, uint8_t *ram_code_flags);
+void profile_begin(cpu_options *opts, uint32_t address);
+void profile_count(cpu_options *opts);
+void profile_end(cpu_options *opts, uint32_t bytes, uint32_t native_size, uint8_t ends_block);
+profile_block *profile_collect(cpu_options *opts, uint32_t *num_blocks);
 
 #endif //BACKEND_H_
 
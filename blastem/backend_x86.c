@@ -1,9 +1,11 @@
 #include "backend.h"
 #include "gen_x86.h"
+#include <stdlib.h>
 #include <string.h>
 
 void cycles(cpu_options *opts, uint32_t num)
 {
+	opts->emitted_cycles += num*opts->clock_divider;
 	if (opts->limit < 0) {
 		sub_ir(&opts->code, num*opts->clock_divider, opts->cycles, SZ_D);
 	} else {
@@ -11,6 +13,23 @@ void cycles(cpu_options *opts, uint32_t num)
 	}
 }
 
+//Emits the execution counter increment for the instruction passed to profile_begin
+//It's emitted after the cycle check so breakpoint and retranslation patches are unaffected
+void profile_count(cpu_options *opts)
+{
+	if (!opts->profile || !opts->profile->current) {
+		return;
+	}
+	code_info *code = &opts->code;
+	mov_ir(code, (intptr_t)&opts->profile->current->executions, opts->scratch1, SZ_PTR);
+#ifdef X86_64
+	add_irdisp(code, 1, opts->scratch1, 0, SZ_Q);
+#else
+	add_irdisp(code, 1, opts->scratch1, 0, SZ_D);
+	adc_irdisp(code, 0, opts->scratch1, 4, SZ_D);
+#endif
+}
+
 void check_cycles_int(cpu_options *opts, uint32_t address)
 {
 	code_info *code = &opts->code;
@@ -64,6 +83,39 @@ void patch_for_retranslate(cpu_options *opts, code_ptr native_address, code_ptr
 	jmp(&tmp, handler);
 }
 
+//Looks up an instruction from an interpreted page in the translation cache. Returns the cached code if
+//the instruction hasn't changed since it was translated, otherwise returns NULL and sets slot to the
+//slot_size bytes of code space the caller should translate it into
+code_ptr smc_cache_lookup(cpu_options *opts, uint32_t address, void *bytes, uint8_t size, uint32_t cycle, uint32_t slot_size, code_ptr *slot)
+{
+	if (!opts->smc_cache) {
+		opts->smc_cache = calloc(1 << SMC_CACHE_BITS, sizeof(smc_cache_entry));
+		check_alloc_code(&opts->code, slot_size << SMC_CACHE_BITS);
+		for (uint32_t i = 0; i < 1 << SMC_CACHE_BITS; i++)
+		{
+			opts->smc_cache[i].native = opts->code.cur;
+			opts->code.cur += slot_size;
+		}
+	}
+	smc_cache_entry *entry = opts->smc_cache + ((address * 2654435769U) >> (32 - SMC_CACHE_BITS));
+	if (entry->size && entry->address == address) {
+		if (entry->size == size && !memcmp(entry->bytes, bytes, size)) {
+			return entry->native;
+		}
+		//writes to interpreted pages aren't trapped, this is how we find out the page is still being modified
+		uint32_t page = code_page_index(opts, address);
+		if (page != CODE_PAGE_NONE) {
+			code_page_modified(opts, page, cycle);
+		}
+	}
+	entry->address = address;
+	//an entry with a size of 0 never matches so instructions that don't fit are translated every time
+	entry->size = size <= SMC_CACHE_INST_BYTES ? size : 0;
+	memcpy(entry->bytes, bytes, entry->size);
+	*slot = entry->native;
+	return NULL;
+}
+
 void check_cycles(cpu_options * opts)
 {
 	code_info *code = &opts->code;
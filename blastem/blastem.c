@@ -31,6 +31,8 @@
 #include "menu.h"
 #include "zip.h"
 #include "event_log.h"
+#include "rollback.h"
+#include "gen_player.h"
 #ifndef DISABLE_NUKLEAR
 #include "nuklear_ui/blastem_nuklear.h"
 #endif
@@ -472,7 +474,9 @@ int main(int argc, char ** argv)
 	char * romfname = NULL;
 	char * statefile = NULL;
 	char *reader_addr = NULL, *reader_port = NULL;
+	char *netplay_addr = NULL, *netplay_port = NULL;
 	event_reader reader = {0};
+	uint32_t start_frame = 0;
 	debugger_type dtype = DEBUGGER_NATIVE;
 	uint8_t start_in_debugger = 0;
 	uint8_t fullscreen = FULLSCREEN_DEFAULT, use_gl = 1;
@@ -513,6 +517,25 @@ int main(int argc, char ** argv)
 					event_log_file(argv[i]);
 				}
 				break;
+			case 'j':
+				i++;
+				if (i >= argc) {
+					fatal_error("-j must be followed by a frame number\n");
+				}
+				start_frame = strtoul(argv[i], NULL, 10);
+				break;
+			case 'N':
+				i++;
+				if (i >= argc) {
+					fatal_error("-N must be followed by a port or an address and port\n");
+				}
+				netplay_port = parse_addr_port(argv[i]);
+				if (netplay_port) {
+					netplay_addr = argv[i];
+				} else {
+					netplay_port = argv[i];
+				}
+				break;
 			case 'f':
 				fullscreen = !fullscreen;
 				break;
@@ -522,6 +545,9 @@ int main(int argc, char ** argv)
 			case 'l':
 				opts |= OPT_ADDRESS_LOG;
 				break;
+			case 'p':
+				opts |= OPT_BLOCK_PROFILE;
+				break;
 			case 'v':
 				info_message("blastem %s\n", BLASTEM_VERSION);
 				return 0;
@@ -599,8 +625,12 @@ int main(int argc, char ** argv)
 					"	-n          Disable Z80\n"
 					"	-v          Display version number and exit\n"
 					"	-l          Log 68K code addresses (useful for assemblers)\n"
-					"	-y          Log individual YM-2612 channels to WAVE files\n"
+					"	-p          Count executions of translated code (see tp debugger command)\n"
+					"	-y          Log individual YM-2612 and PSG channels to WAVE files\n"
 					"   -e FILE     Write hardware event log to FILE\n"
+					"	-j FRAME    Start playing an event log file at FRAME\n"
+					"	-N PORT     Host a two player netplay game on PORT\n"
+					"	-N ADDR:PORT Join the netplay game hosted at ADDR:PORT\n"
 				);
 				return 0;
 			default:
@@ -627,6 +657,21 @@ int main(int argc, char ** argv)
 		}
 	}
 	
+	if (netplay_port) {
+		if (!loaded || reader_addr) {
+			fatal_error("-N requires a ROM file\n");
+		}
+		if (event_log_active()) {
+			//frames that get rolled back would already have been sent to whoever follows the log
+			fatal_error("-N can't be combined with -e\n");
+		}
+		if (netplay_addr) {
+			rollback_connect(netplay_addr, netplay_port);
+		} else {
+			rollback_listen(NULL, netplay_port);
+		}
+	}
+	
 	int def_width = 0, def_height = 0;
 	char *config_width = tern_find_path(config, "video\0width\0", TVAL_PTR).ptrval;
 	if (config_width) {
@@ -741,6 +786,10 @@ int main(int argc, char ** argv)
 		update_title(current_system->info.name);
 	}
 	
+	if (start_frame && current_system->type == SYSTEM_GENESIS_PLAYER && !reader_addr) {
+		gen_player_seek((gen_player *)current_system, start_frame);
+	}
+	
 	current_system->debugger_type = dtype;
 	current_system->enter_debugger = start_in_debugger && menu == debug_target;
 	current_system->start_context(current_system,  menu ? NULL : statefile);
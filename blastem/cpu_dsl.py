@@ -146,7 +146,7 @@ class Instruction(Block):
 			funName += '_{0}_{1:0>{2}}'.format(name, bin(fieldVals[name])[2:], fieldBits[name])
 		return funName
 		
-	def generateBody(self, value, prog, otype):
+	def generateBody(self, value, prog, otype, label = None):
 		output = []
 		prog.meta = {}
 		prog.pushScope(self)
@@ -159,8 +159,8 @@ class Instruction(Block):
 		
 		if prog.dispatch == 'call':
 			begin = '\nvoid ' + self.generateName(value) + '(' + prog.context_type + ' *context, uint32_t target_cycle)\n{'
-		elif prog.dispatch == 'goto':
-			begin = '\n' + self.generateName(value) + ': {'
+		elif prog.dispatch in ('goto', 'threaded'):
+			begin = '\n' + (label or self.generateName(value)) + ': {'
 		else:
 			raise Exception('Unsupported dispatch type ' + prog.dispatch)
 		if prog.needFlagCoalesce:
@@ -172,7 +172,7 @@ class Instruction(Block):
 		for size in prog.temp:
 			begin += '\n\tuint{sz}_t gen_tmp{sz}__;'.format(sz=size)
 		prog.popScope()
-		if prog.dispatch == 'goto':
+		if prog.dispatch in ('goto', 'threaded'):
 			output += prog.nextInstruction(otype)
 		return begin + ''.join(output) + '\n}'
 		
@@ -415,6 +415,14 @@ def _dispatchCImpl(prog, params):
 		return '\n\timpl_{tbl}[{op}](context, target_cycle);'.format(tbl = table, op = params[0])
 	elif prog.dispatch == 'goto':
 		return '\n\tgoto *impl_{tbl}[{op}];'.format(tbl = table, op = params[0])
+	elif prog.dispatch == 'threaded':
+		output = []
+		if table == 'main':
+			#check for the instructions this one is fused with before the indirect jump
+			for value,label in prog.fuseTargets:
+				output.append('\n\tif ({op} == {val}) {{ goto {label}; }}'.format(op = params[0], val = value, label = label))
+		output.append('\n\tgoto *impl_{tbl}[{op}];'.format(tbl = table, op = params[0]))
+		return ''.join(output)
 	else:
 		raise Exception('Unsupported dispatch type ' + prog.dispatch)
 
@@ -846,8 +854,8 @@ _opMap = {
 		typ = params[1], fun = params[0], args = ', '.join([str(p) for p in params[2:]])
 	)),
 	'cycles': Op().addImplementation('c', None,
-		lambda prog, params: '\n\tcontext->cycles += context->opts->gen.clock_divider * {0};'.format(
-			params[0]
+		lambda prog, params: '\n\tcontext->cycles += {div} * {0};'.format(
+			params[0], div = 'clock_divider__' if prog.dispatch == 'threaded' else 'context->opts->gen.clock_divider'
 		)
 	),
 	'addsize': Op(
@@ -1457,6 +1465,12 @@ class Program:
 		self.prefix = info.get('prefix', [''])[0]
 		self.opsize = int(info.get('opcode_size', ['8'])[0])
 		self.extra_tables = info.get('extra_tables', [])
+		self.fuse = {}
+		for pair in info.get('fuse', []):
+			first,_,second = pair.partition(':')
+			self.fuse.setdefault(int(first, 0), []).append(int(second, 0))
+		self.fuseTargets = []
+		self.pendingFuse = []
 		self.context_type = self.prefix + 'context'
 		self.body = info.get('body', [None])[0]
 		self.interrupt = info.get('interrupt', [None])[0]
@@ -1507,6 +1521,13 @@ class Program:
 		hFile.write('\n')
 		hFile.close()
 		
+	def _resetState(self):
+		self.meta = {}
+		self.temp = {}
+		self.needFlagCoalesce = False
+		self.needFlagDisperse = False
+		self.lastOp = None
+	
 	def _buildTable(self, otype, table, body, lateBody):
 		pieces = []
 		opmap = [None] * (1 << self.opsize)
@@ -1514,16 +1535,29 @@ class Program:
 		if table in self.instructions:
 			instructions = self.instructions[table]
 			instructions.sort()
+			owners = [None] * (1 << self.opsize)
 			for inst in instructions:
 				for val in inst.allValues():
-					if opmap[val] is None:
-						self.meta = {}
-						self.temp = {}
-						self.needFlagCoalesce = False
-						self.needFlagDisperse = False
-						self.lastOp = None
-						opmap[val] = inst.generateName(val)
-						bodymap[val] = inst.generateBody(val, self, otype)
+					if owners[val] is None:
+						owners[val] = inst
+			for val in range(0, len(owners)):
+				inst = owners[val]
+				if inst is None:
+					continue
+				self._resetState()
+				opmap[val] = inst.generateName(val)
+				fused = []
+				if self.dispatch == 'threaded' and table == 'main':
+					for second in self.fuse.get(val, []):
+						if not owners[second] is None:
+							fused.append((second, 'fused_{0}__{1}'.format(opmap[val], owners[second].generateName(second))))
+				self.pendingFuse = fused
+				bodymap[val] = inst.generateBody(val, self, otype)
+				self.pendingFuse = []
+				for second,label in fused:
+					#private copy of the second instruction so the C compiler can optimize across the pair
+					self._resetState()
+					bodymap[val] += owners[second].generateBody(second, self, otype, label)
 		
 		if self.dispatch == 'call':
 			pieces.append('\nstatic impl_fun impl_{name}[{sz}] = {{'.format(name = table, sz=len(opmap)))
@@ -1535,7 +1569,7 @@ class Program:
 					pieces.append('\n\t' + op + ',')
 					body.append(bodymap[inst])
 			pieces.append('\n};')
-		elif self.dispatch == 'goto':
+		elif self.dispatch in ('goto', 'threaded'):
 			body.append('\n\tstatic void *impl_{name}[{sz}] = {{'.format(name = table, sz=len(opmap)))
 			for inst in range(0, len(opmap)):
 				op = opmap[inst]
@@ -1549,9 +1583,17 @@ class Program:
 			raise Exception("unimplmeneted dispatch type " + self.dispatch)
 		body.extend(pieces)
 		
-	def nextInstruction(self, otype):
+	def nextInstruction(self, otype, shared = False):
 		output = []
-		if self.dispatch == 'goto':
+		if self.dispatch == 'threaded' and self.interrupt in self.subroutines and not shared:
+			#interrupt and cycle limit handling is shared between all instructions
+			output.append('\n\tif (context->cycles >= context->sync_cycle) { goto handle_sync; }')
+			self.meta = {}
+			self.temp = {}
+			self.fuseTargets = self.pendingFuse
+			self.subroutines[self.body].inline(self, [], output, otype, None)
+			self.fuseTargets = []
+		elif self.dispatch in ('goto', 'threaded'):
 			if self.interrupt in self.subroutines:
 				output.append('\n\tif (context->cycles >= context->sync_cycle) {')
 			output.append('\n\tif (context->cycles >= target_cycle) { return; }')
@@ -1580,9 +1622,11 @@ class Program:
 			for table in self.extra_tables:
 				body.append('\nstatic impl_fun impl_{name}[{sz}];'.format(name = table, sz=(1 << self.opsize)))
 			body.append('\nstatic impl_fun impl_main[{sz}];'.format(sz=(1 << self.opsize)))
-		elif self.dispatch == 'goto':
+		elif self.dispatch in ('goto', 'threaded'):
 			body.append('\nvoid {pre}execute({type} *context, uint32_t target_cycle)'.format(pre = self.prefix, type = self.context_type))
 			body.append('\n{')
+			if self.dispatch == 'threaded':
+				body.append('\n\tuint32_t clock_divider__ = context->opts->gen.clock_divider;')
 			
 		for table in self.extra_tables:
 			self._buildTable(otype, table, body, pieces)
@@ -1608,7 +1652,16 @@ class Program:
 			self.subroutines[self.body].inline(self, [], pieces, otype, None)
 			pieces.append('\n\t}')
 			pieces.append('\n}')
-		elif self.dispatch == 'goto':
+		elif self.dispatch == 'threaded' and self.interrupt in self.subroutines:
+			body.append('\n\t{sync}(context, target_cycle);'.format(sync=self.sync_cycle))
+			body.append('\n\tgoto handle_sync;')
+			pieces.append('\nhandle_sync: {')
+			pieces += self.nextInstruction(otype, True)
+			pieces.append('\n}')
+			pieces.append('\nunimplemented:')
+			pieces.append('\n\tfatal_error("Unimplemented instruction\\n");')
+			pieces.append('\n}')
+		elif self.dispatch in ('goto', 'threaded'):
 			body.append('\n\t{sync}(context, target_cycle);'.format(sync=self.sync_cycle))
 			body += self.nextInstruction(otype)
 			pieces.append('\nunimplemented:')
@@ -1868,7 +1921,7 @@ def main(argv):
 	argParser = ArgumentParser(description='CPU emulator DSL compiler')
 	argParser.add_argument('source', type=FileType('r'))
 	argParser.add_argument('-D', '--define', action='append')
-	argParser.add_argument('-d', '--dispatch', choices=('call', 'switch', 'goto'), default='call')
+	argParser.add_argument('-d', '--dispatch', choices=('call', 'switch', 'goto', 'threaded'), default='call')
 	parse(argParser.parse_args(argv[1:]))
 
 if __name__ == '__main__':
@@ -0,0 +1,85 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <string.h>
+#include "cpu_harness.h"
+#include "mem.h"
+
+int headless = 1;
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+uint8_t harness_z80_ram[HARNESS_Z80_RAM_SIZE];
+uint16_t harness_m68k_ram[HARNESS_M68K_RAM_SIZE / 2];
+
+static uint8_t z80_unmapped_read(uint32_t location, void * context)
+{
+	return 0xFF;
+}
+
+static void * z80_unmapped_write(uint32_t location, void * context, uint8_t value)
+{
+	return context;
+}
+
+static const memmap_chunk z80_map[] = {
+	{ 0x0000, 0x4000,  0x1FFF, 0, 0, MMAP_READ | MMAP_WRITE | MMAP_CODE, harness_z80_ram, NULL, NULL, NULL,              NULL },
+	{ 0x4000, 0x10000, 0xFFFF, 0, 0, 0,                                  NULL,            NULL, NULL, z80_unmapped_read, z80_unmapped_write}
+};
+
+static const memmap_chunk port_map[] = {
+	{ 0x0000, 0x100, 0xFF, 0, 0, 0,                                  NULL,    NULL, NULL, z80_unmapped_read, z80_unmapped_write}
+};
+
+//the options keep a pointer to the map so it has to outlive the call that sets it up
+static memmap_chunk m68k_map[2];
+
+z80_context *harness_z80_init(z80_options *opts)
+{
+	init_z80_opts(opts, z80_map, 2, port_map, 1, 1, 0xFF);
+	z80_context *context = init_z80_context(opts);
+#ifndef NEW_CORE
+	context->mem_pointers[0] = harness_z80_ram;
+#endif
+	return context;
+}
+
+m68k_context *harness_m68k_init(m68k_options *opts, uint16_t *rom, m68k_reset_handler reset_handler)
+{
+	memset(m68k_map, 0, sizeof(m68k_map));
+	m68k_map[0].end = HARNESS_M68K_ROM_SIZE;
+	m68k_map[0].mask = HARNESS_M68K_ROM_SIZE - 1;
+	m68k_map[0].flags = MMAP_READ;
+	m68k_map[0].buffer = rom;
+	m68k_map[1].start = HARNESS_M68K_RAM_START;
+	m68k_map[1].end = 0x1000000;
+	m68k_map[1].mask = HARNESS_M68K_RAM_SIZE - 1;
+	m68k_map[1].flags = MMAP_READ | MMAP_WRITE | MMAP_CODE;
+	m68k_map[1].buffer = harness_m68k_ram;
+	init_m68k_opts(opts, m68k_map, 2, 1);
+	m68k_context *context = init_68k_context(opts, reset_handler);
+	context->mem_pointers[0] = m68k_map[0].buffer;
+	context->mem_pointers[1] = m68k_map[1].buffer;
+	return context;
+}
+
+#ifndef NEW_CORE
+//Returns to the caller once the 68K reaches its sync point, callers set a new one before resuming
+m68k_context * sync_components(m68k_context * context, uint32_t address)
+{
+	if (context->current_cycle >= context->sync_cycle) {
+		//move the sync point out of the way so the core takes its return path on the next check
+		context->sync_cycle = CYCLE_NEVER;
+		context->target_cycle = context->current_cycle;
+		context->should_return = 1;
+	}
+	return context;
+}
+#endif
@@ -0,0 +1,29 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef CPU_HARNESS_H_
+#define CPU_HARNESS_H_
+//Runs the Z80 and 68K cores on their own for the small test and benchmark programs. The Z80
+//gets 8KB of RAM and nothing else, the 68K gets a 64KB ROM at 0 and 64KB of RAM at $E00000
+#ifdef NEW_CORE
+#include "z80.h"
+#include "m68k.h"
+#else
+#include "z80_to_x86.h"
+#include "m68k_core.h"
+#endif
+
+#define HARNESS_Z80_RAM_SIZE 0x2000
+#define HARNESS_M68K_ROM_SIZE 0x10000
+#define HARNESS_M68K_RAM_START 0xE00000
+#define HARNESS_M68K_RAM_SIZE 0x10000
+
+extern uint8_t harness_z80_ram[HARNESS_Z80_RAM_SIZE];
+extern uint16_t harness_m68k_ram[HARNESS_M68K_RAM_SIZE / 2];
+
+z80_context *harness_z80_init(z80_options *opts);
+m68k_context *harness_m68k_init(m68k_options *opts, uint16_t *rom, m68k_reset_handler reset_handler);
+
+#endif //CPU_HARNESS_H_
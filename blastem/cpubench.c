@@ -0,0 +1,162 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures the throughput of the Z80 and 68K cores on small synthetic workloads
+//Build normally to measure the x86 dynarecs and with NEW_CORE=1 to measure the generated interpreters
+#include "cpu_harness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//cycles to run between returns to the benchmark loop, roughly one frame
+#define SLICE_CYCLES 60000
+
+static const uint8_t z80_program[] = {
+	0x31, 0x00, 0x20, //ld sp, $2000
+	0x21, 0x00, 0x10, //ld hl, $1000
+	0x11, 0x00, 0x18, //ld de, $1800
+	0x06, 0x00,       //ld b, 0
+	//loop:
+	0x7E,             //ld a, (hl)
+	0x23,             //inc hl
+	0x81,             //add a, c
+	0x4F,             //ld c, a
+	0x12,             //ld (de), a
+	0x13,             //inc de
+	0xCB, 0x01,       //rlc c
+	0xA8,             //xor b
+	0xB7,             //or a
+	0x20, 0x01,       //jr nz, skip
+	0x3C,             //inc a
+	//skip:
+	0xFE, 0x10,       //cp $10
+	0x38, 0x01,       //jr c, skip2
+	0x0B,             //dec bc
+	//skip2:
+	0x10, 0xEC,       //djnz loop
+	0x21, 0x00, 0x10, //ld hl, $1000
+	0x11, 0x00, 0x18, //ld de, $1800
+	0xC3, 0x0B, 0x00  //jp loop
+};
+
+#define M68K_PROGRAM_START 0x100
+//register only and memory ops that are implemented by both 68K cores
+static const uint16_t m68k_block[] = {
+	0xD081, //add.l d1, d0
+	0x5681, //addq.l #3, d1
+	0xB182, //eor.l d0, d2
+	0xE58B, //lsl.l #2, d3
+	0x8682, //or.l d2, d3
+	0x2803, //move.l d3, d4
+	0x9284, //sub.l d4, d1
+	0x30C0, //move.w d0, (a0)+
+	0x3A20, //move.w -(a0), d5
+	0xCC85  //and.l d5, d6
+};
+#define M68K_BLOCK_REPEAT 16
+
+static uint16_t *m68k_rom;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void report(char *cpu, uint32_t cycles, double elapsed)
+{
+#ifdef NEW_CORE
+	char *core = "interpreter";
+#else
+	char *core = "dynarec";
+#endif
+	printf("%s %s: %u cycles in %.3f seconds, %.2f MHz\n", cpu, core, cycles, elapsed, cycles / elapsed / 1000000.0);
+}
+
+m68k_context *reset_handler(m68k_context *context)
+{
+#ifdef NEW_CORE
+	//the interpreter has no branch instructions yet so the reset at the end of the program is used to loop
+	context->prefetch = m68k_rom[M68K_PROGRAM_START / 2];
+	context->pc = M68K_PROGRAM_START + 2;
+#endif
+	return context;
+}
+
+static void bench_z80(uint32_t total)
+{
+	z80_options opts;
+	memcpy(harness_z80_ram, z80_program, sizeof(z80_program));
+	z80_context *context = harness_z80_init(&opts);
+	double start = now();
+	for (uint32_t cycles = 0; cycles < total; cycles += SLICE_CYCLES)
+	{
+		z80_run(context, SLICE_CYCLES);
+		z80_adjust_cycles(context, SLICE_CYCLES);
+	}
+	report("Z80", total, now() - start);
+}
+
+static void bench_m68k(uint32_t total)
+{
+	m68k_options opts;
+	m68k_rom = calloc(HARNESS_M68K_ROM_SIZE, 1);
+	//initial SSP and PC
+	m68k_rom[0] = 0x00FF;
+	m68k_rom[3] = M68K_PROGRAM_START;
+	uint16_t *cur = m68k_rom + M68K_PROGRAM_START / 2;
+	//movea.l #$E00000, a0
+	*(cur++) = 0x207C;
+	*(cur++) = 0x00E0;
+	*(cur++) = 0x0000;
+	for (int i = 0; i < M68K_BLOCK_REPEAT; i++)
+	{
+		memcpy(cur, m68k_block, sizeof(m68k_block));
+		cur += sizeof(m68k_block) / sizeof(uint16_t);
+	}
+	//reset
+	*(cur++) = 0x4E70;
+	//bra.w start
+	*(cur++) = 0x6000;
+	*cur = M68K_PROGRAM_START - ((cur - m68k_rom) * 2);
+	cur++;
+
+	m68k_context *context = harness_m68k_init(&opts, m68k_rom, reset_handler);
+	double start = now();
+#ifdef NEW_CORE
+	m68k_reset(context);
+	m68k_execute(context, total);
+	uint32_t ran = context->cycles;
+#else
+	context->target_cycle = context->sync_cycle = SLICE_CYCLES;
+	m68k_reset(context);
+	while (context->current_cycle < total)
+	{
+		context->target_cycle = context->sync_cycle = context->current_cycle + SLICE_CYCLES;
+		resume_68k(context);
+	}
+	uint32_t ran = context->current_cycle;
+#endif
+	report("68K", ran, now() - start);
+}
+
+int main(int argc, char ** argv)
+{
+	char *cpu = argc > 1 ? argv[1] : "all";
+	uint32_t total = argc > 2 ? strtoul(argv[2], NULL, 10) : 500000000;
+	if (!strcmp(cpu, "z80") || !strcmp(cpu, "all")) {
+		bench_z80(total);
+	}
+	if (!strcmp(cpu, "68k") || !strcmp(cpu, "all")) {
+		bench_m68k(total);
+	}
+	if (strcmp(cpu, "z80") && strcmp(cpu, "68k") && strcmp(cpu, "all")) {
+		fputs("usage: cpubench [z80|68k|all] [cycles]\n", stderr);
+		return 1;
+	}
+	return 0;
+}
@@ -3,6 +3,7 @@
 #include "68kinst.h"
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #ifndef _WIN32
 #include <sys/select.h>
 #endif
@@ -188,6 +189,36 @@ void debugger_print(m68k_context *context, char format_char, char *param, uint32
 
 #ifndef NO_Z80
 
+void z80_print_profile(z80_context *context, uint32_t count)
+{
+	char disbuf[80];
+	z80_options *opts = context->Z80_OPTS;
+	if (!opts->gen.profile) {
+		puts("Z80 block profiling is not enabled, run with -p to enable it");
+		return;
+	}
+	uint32_t num_blocks;
+	profile_block *blocks = profile_collect(&opts->gen, &num_blocks);
+	for (uint32_t i = 0; i < num_blocks && i < count; i++)
+	{
+		printf("Z80 block %X: %" PRIu64 " cycles, %" PRIu64 " executions, %u bytes of host code\n",
+			blocks[i].address, blocks[i].cycles, blocks[i].executions, blocks[i].native_size);
+		for (uint32_t address = blocks[i].address; address < blocks[i].end;)
+		{
+			uint8_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+			if (!encoded) {
+				break;
+			}
+			z80inst inst;
+			uint8_t *next = z80_decode(encoded, &inst);
+			z80_disasm(&inst, disbuf, address);
+			printf("\t%X: %s\n", address, disbuf);
+			address += next - encoded;
+		}
+	}
+	free(blocks);
+}
+
 void zdebugger_print(z80_context * context, char format_char, char * param)
 {
 	uint32_t value;
@@ -528,6 +559,12 @@ z80_context * zdebugger(z80_context * context, uint16_t address)
 				puts("Quitting");
 				exit(0);
 				break;
+			case 't':
+				if (input_buf[1] == 'p') {
+					param = find_param(input_buf);
+					z80_print_profile(context, param ? atoi(param) : 10);
+				}
+				break;
 			case 's': {
 				param = find_param(input_buf);
 				if (!param) {
@@ -585,6 +622,36 @@ z80_context * zdebugger(z80_context * context, uint16_t address)
 static uint32_t branch_t;
 static uint32_t branch_f;
 
+void m68k_print_profile(m68k_context *context, uint32_t count)
+{
+	char disbuf[1024];
+	m68k_options *opts = context->options;
+	if (!opts->gen.profile) {
+		puts("68K block profiling is not enabled, run with -p to enable it");
+		return;
+	}
+	uint32_t num_blocks;
+	profile_block *blocks = profile_collect(&opts->gen, &num_blocks);
+	for (uint32_t i = 0; i < num_blocks && i < count; i++)
+	{
+		printf("68K block %X: %" PRIu64 " cycles, %" PRIu64 " executions, %u bytes of host code\n",
+			blocks[i].address, blocks[i].cycles, blocks[i].executions, blocks[i].native_size);
+		for (uint32_t address = blocks[i].address; address < blocks[i].end;)
+		{
+			uint16_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+			if (!encoded) {
+				break;
+			}
+			m68kinst inst;
+			uint16_t *next = m68k_decode(encoded, &inst, address);
+			m68k_disasm(&inst, disbuf);
+			printf("\t%X: %s\n", address, disbuf);
+			address += (next - encoded) * 2;
+		}
+	}
+	free(blocks);
+}
+
 int run_debugger_command(m68k_context *context, uint32_t address, char *input_buf, m68kinst inst, uint32_t after)
 {
 	char * param;
@@ -915,6 +982,28 @@ int run_debugger_command(m68k_context *context, uint32_t address, char *input_bu
 			}
 			break;
 		}
+		case 't': {
+			if (input_buf[1] == 'p') {
+				//hottest translated code
+				param = find_param(input_buf);
+				value = param ? atoi(param) : 10;
+				m68k_print_profile(context, value);
+#ifndef NO_Z80
+				genesis_context * gen = context->system;
+				z80_print_profile(gen->z80, value);
+#endif
+				break;
+			}
+			//translation cache info
+			m68k_options *opts = context->options;
+			printf("68K translated code: %u bytes, peak: %u bytes\n", opts->gen.translated_bytes, opts->gen.translated_peak);
+#ifndef NO_Z80
+			genesis_context * gen = context->system;
+			z80_options *zopts = gen->z80->Z80_OPTS;
+			printf("Z80 translated code: %u bytes, peak: %u bytes\n", zopts->gen.translated_bytes, zopts->gen.translated_peak);
+#endif
+			break;
+		}
 #ifndef NO_Z80
 		case 'z': {
 			genesis_context * gen = context->system;
@@ -986,6 +1075,9 @@ void print_m68k_help()
 	printf("    yt                   - Print YM-2612 timer info\n");
 	printf("    zb ADDRESS           - Set a Z80 breakpoint\n");
 	printf("    zp[/(x|X|d|c)] VALUE - Display a Z80 value\n");
+	printf("    t                    - Print the amount of translated code\n");
+	printf("    tp [COUNT]           - Print the COUNT 68K and Z80 blocks with the most\n");
+	printf("                           executed cycles, requires -p\n");
 	printf("    ?                    - Display help\n");
 	printf("    q                    - Quit BlastEm\n");
 }
@@ -1001,6 +1093,8 @@ void print_z80_help()
 	printf("    p[/(x|X|d|c)] VALUE  - Print a register or memory location\n");
 	printf("    di[/(x|X|d|c)] VALUE - Print a register or memory location each time\n");
 	printf("                           a breakpoint is hit\n");
+	printf("    tp [COUNT]           - Print the COUNT blocks with the most executed\n");
+	printf("                           cycles, requires -p\n");
 	printf("    q                    - Quit BlastEm\n");
 }
 
@@ -31,5 +31,7 @@ void debugger(m68k_context * context, uint32_t address);
 z80_context * zdebugger(z80_context * context, uint16_t address);
 void print_m68k_help();
 void print_z80_help();
+void m68k_print_profile(m68k_context *context, uint32_t count);
+void z80_print_profile(z80_context *context, uint32_t count);
 
 #endif //DEBUG_H_
@@ -0,0 +1,189 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdint.h>
+#include "drc.h"
+#include "util.h"
+
+//most the speed may be moved away from the estimate of the right rate in response to the buffer level
+#define MAX_SKEW 0.005f
+//how quickly the estimate of the right rate follows the buffer level
+#define RATE_GAIN 0.00002f
+//the estimate doesn't wander further than this from the nominal rate
+#define MAX_RATE_ERROR 0.02f
+//weight of the newest level in the smoothed level
+#define LEVEL_SMOOTHING 0.1f
+//frames the target is kept for before it's lowered if the buffer never came close to running dry
+#define TARGET_WINDOW 300
+
+static uint64_t pack_levels(int32_t buffered, int32_t remaining)
+{
+	return ((uint64_t)(uint32_t)buffered) << 32 | (uint32_t)remaining;
+}
+
+#define NO_LEVELS pack_levels(INT32_MAX, INT32_MAX)
+
+static int32_t levels_buffered(uint64_t levels)
+{
+	return (int32_t)(uint32_t)(levels >> 32);
+}
+
+static int32_t levels_remaining(uint64_t levels)
+{
+	return (int32_t)(uint32_t)levels;
+}
+
+void drc_init(drc_state *drc, uint32_t target, uint32_t sample_rate)
+{
+	//the audio callback may already be running
+	__atomic_store_n(&drc->levels, NO_LEVELS, __ATOMIC_RELAXED);
+	drc->last_levels = NO_LEVELS;
+	drc->level = target;
+	drc->rate = 1.0f;
+	drc->speed = 1.0f;
+	drc->target = drc->max_target = target;
+	drc->window_min = INT32_MAX;
+	drc->window_frames = 0;
+	drc->sample_rate = sample_rate;
+	drc->stats = (drc_stats){
+		.min_level = INT32_MAX,
+		.max_level = INT32_MIN
+	};
+}
+
+//Called by the audio callback after each buffer it mixes, only the lowest levels since the
+//controller last ran are kept as those are the ones that matter for avoiding underflow/overflow
+void drc_report_levels(drc_state *drc, int32_t buffered, int32_t remaining)
+{
+	uint64_t old = __atomic_load_n(&drc->levels, __ATOMIC_RELAXED);
+	uint64_t levels;
+	do {
+		int32_t old_buffered = levels_buffered(old), old_remaining = levels_remaining(old);
+		if (old_buffered <= buffered && old_remaining <= remaining) {
+			return;
+		}
+		levels = pack_levels(
+			buffered < old_buffered ? buffered : old_buffered,
+			remaining < old_remaining ? remaining : old_remaining
+		);
+	} while (!__atomic_compare_exchange_n(&drc->levels, &old, levels, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//An underflow stays pending until the backend has paused output and called drc_clear_underflow,
+//the callback should not mix anything in the meantime
+uint8_t drc_underflow_pending(drc_state *drc)
+{
+	return levels_buffered(__atomic_load_n(&drc->levels, __ATOMIC_RELAXED)) < 0;
+}
+
+void drc_clear_underflow(drc_state *drc)
+{
+	drc->last_levels = NO_LEVELS;
+	__atomic_store_n(&drc->levels, NO_LEVELS, __ATOMIC_RELAXED);
+}
+
+//Called once per emulated frame, returns the adjustment to pass to render_audio_adjust_speed
+//or 0 if none is needed
+//The speed is kept at an estimate of the rate that keeps the buffer level steady, skewed in
+//proportion to how far the level is from the target. The estimate slowly integrates the error
+//so a constant mismatch between the emulated and real audio clocks doesn't leave the level offset
+float drc_frame(drc_state *drc, uint8_t *underflow)
+{
+	uint64_t levels = __atomic_load_n(&drc->levels, __ATOMIC_RELAXED);
+	*underflow = levels_buffered(levels) < 0;
+	if (!*underflow) {
+		//the callback may have reported lower levels since the load, those are picked up next frame
+		levels = __atomic_exchange_n(&drc->levels, NO_LEVELS, __ATOMIC_RELAXED);
+	}
+	if (levels == NO_LEVELS) {
+		//no buffers were mixed since the last frame, either output hasn't started or it was
+		//short enough that the previous levels still apply
+		levels = drc->last_levels;
+		if (levels == NO_LEVELS) {
+			return 0.0f;
+		}
+	}
+	drc->last_levels = levels;
+	int32_t cur_min = levels_buffered(levels);
+	int32_t min_remaining = levels_remaining(levels);
+
+	drc->stats.frames++;
+	if (cur_min < drc->window_min) {
+		drc->window_min = cur_min;
+	}
+	if (cur_min < 0) {
+		drc->stats.underflows++;
+		cur_min = 0;
+		//the target was too optimistic for how unevenly samples are produced and consumed
+		drc->target *= 1.5f;
+		if (drc->target > drc->max_target) {
+			drc->target = drc->max_target;
+		}
+		drc->window_frames = 0;
+		drc->window_min = INT32_MAX;
+	} else {
+		drc->stats.level_sum += cur_min;
+		if (cur_min < drc->stats.min_level) {
+			drc->stats.min_level = cur_min;
+		}
+		if (cur_min > drc->stats.max_level) {
+			drc->stats.max_level = cur_min;
+		}
+	}
+	if (++drc->window_frames == TARGET_WINDOW) {
+		//the level never dropped below window_min so the target can come down by part of that margin
+		//while leaving a couple of milliseconds to spare
+		float margin = drc->window_min - drc->sample_rate / 500.0f;
+		if (margin > 0) {
+			drc->target -= margin / 8;
+			if (drc->target < drc->max_target / 8) {
+				drc->target = drc->max_target / 8;
+			}
+		}
+		drc->window_frames = 0;
+		drc->window_min = INT32_MAX;
+	}
+	drc->level += (cur_min - drc->level) * LEVEL_SMOOTHING;
+	float error = (drc->target - drc->level) / drc->target;
+	if (error > 1.0f) {
+		error = 1.0f;
+	} else if (error < -1.0f) {
+		error = -1.0f;
+	}
+	if (min_remaining < drc->target / 2 && error > -1.0f) {
+		//close to overflowing, slow down as much as possible
+		error = -1.0f;
+	}
+	drc->rate *= 1.0f + RATE_GAIN * error;
+	if (drc->rate > 1.0f + MAX_RATE_ERROR) {
+		drc->rate = 1.0f + MAX_RATE_ERROR;
+	} else if (drc->rate < 1.0f - MAX_RATE_ERROR) {
+		drc->rate = 1.0f - MAX_RATE_ERROR;
+	}
+	float speed = drc->rate * (1.0f + MAX_SKEW * error);
+	float adjust_ratio = speed / drc->speed - 1.0f;
+	drc->speed = speed;
+	if (adjust_ratio != 0.0f) {
+		drc->stats.adjustments++;
+	}
+	return adjust_ratio;
+}
+
+void drc_print_stats(drc_state *drc)
+{
+	drc_stats *stats = &drc->stats;
+	uint64_t measured = stats->frames - stats->underflows;
+	if (!measured) {
+		return;
+	}
+	float ms_per_sample = 1000.0f / drc->sample_rate;
+	float average = (float)stats->level_sum / measured;
+	debug_message(
+		"Audio rate control: %llu frames, lowest buffer level per frame averaged %.0f samples (%.1fms), "
+		"ranged from %d to %d samples, %u underflows, %u adjustments, final target %.0f samples\n",
+		(unsigned long long)stats->frames, average, average * ms_per_sample,
+		stats->min_level, stats->max_level, stats->underflows, stats->adjustments, drc->target
+	);
+}
@@ -0,0 +1,48 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef DRC_H_
+#define DRC_H_
+
+#include <stdint.h>
+
+//Dynamic rate control for backends that present frames at the display's pace rather than the audio
+//device's. The audio callback reports how full the source buffers are and once per emulated frame the
+//controller turns that into a small change in the speed of the emulated audio clocks so that the
+//buffers stay close to the target level without running dry or overflowing
+
+typedef struct {
+	uint64_t frames;
+	int64_t  level_sum;
+	int32_t  min_level;
+	int32_t  max_level;
+	uint32_t underflows;
+	uint32_t adjustments;
+} drc_stats;
+
+typedef struct {
+	//lowest buffered and remaining sample counts reported by the audio callback since the controller
+	//last ran, packed together so the callback can hand them over without taking a lock
+	uint64_t  levels;
+	uint64_t  last_levels;
+	float     level; //smoothed lowest buffer level
+	float     rate;  //estimate of the speed that would keep the level steady
+	float     speed; //speed relative to the nominal rate the emulated clocks are currently adjusted to
+	float     target;     //level the controller aims for, lowered while that leaves room to spare
+	float     max_target;
+	int32_t   window_min; //lowest level since the target last changed
+	uint32_t  window_frames;
+	uint32_t  sample_rate;
+	drc_stats stats;
+} drc_state;
+
+void drc_init(drc_state *drc, uint32_t target, uint32_t sample_rate);
+void drc_report_levels(drc_state *drc, int32_t buffered, int32_t remaining);
+uint8_t drc_underflow_pending(drc_state *drc);
+void drc_clear_underflow(drc_state *drc);
+float drc_frame(drc_state *drc, uint8_t *underflow);
+void drc_print_stats(drc_state *drc);
+
+#endif //DRC_H_
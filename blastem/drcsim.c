@@ -0,0 +1,216 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Runs the dynamic rate controller offline against a simulated audio device and frame timing or
+//against a trace of buffer levels, one "buffered remaining" pair per line, and reports how well
+//it kept the buffers filled
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "drc.h"
+#include "tern.h"
+
+tern_node *config;
+int headless = 1;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+static uint32_t nearest_pow2(uint32_t val)
+{
+	uint32_t ret = 1;
+	while (ret < val)
+	{
+		ret = ret << 1;
+	}
+	return ret;
+}
+
+//uniform in [-1, 1), fixed seed so runs are repeatable
+static double jitter(void)
+{
+	static uint32_t state = 0x12345678;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state / 2147483648.0 - 1.0;
+}
+
+static int replay_trace(drc_state *drc, char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s for reading\n", path);
+		return 1;
+	}
+	int buffered, remaining;
+	while (fscanf(f, "%d %d", &buffered, &remaining) == 2)
+	{
+		drc_report_levels(drc, buffered, remaining);
+		uint8_t underflow;
+		float adjust = drc_frame(drc, &underflow);
+		if (underflow) {
+			drc_clear_underflow(drc);
+		}
+		printf("%d %d %f\n", buffered, remaining, adjust);
+	}
+	fclose(f);
+	return 0;
+}
+
+static void usage(void)
+{
+	fputs(
+		"Usage: drcsim [OPTIONS]\n"
+		"\t-r SAMPLE_RATE    output sample rate\n"
+		"\t-b SAMPLES        audio device buffer size\n"
+		"\t-d DISPLAY_HZ     display refresh rate\n"
+		"\t-s SOURCE_HZ      real frame rate of the emulated system\n"
+		"\t-j JITTER_MS      how late emulated frames may finish\n"
+		"\t-t SECONDS        length of the simulation\n"
+		"\t-m SAMPLES        override the initial target level\n"
+		"\t-l                only report the level after the last device callback of each frame\n"
+		"\t-f TRACE_FILE     feed the levels in TRACE_FILE to the controller instead of simulating\n",
+		stderr
+	);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t sample_rate = 48000, device_samples = 512, seconds = 600;
+	double display_hz = 60.0, source_hz = 53693175.0 / (3420.0 * 262.0), jitter_ms = 2.0;
+	char *trace = NULL;
+	uint8_t latest_only = 0;
+	uint32_t target = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-l")) {
+			latest_only = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		if (!strcmp(argv[i], "-r")) {
+			sample_rate = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-b")) {
+			device_samples = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-d")) {
+			display_hz = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-s")) {
+			source_hz = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-j")) {
+			jitter_ms = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-t")) {
+			seconds = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-m")) {
+			target = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-f")) {
+			trace = argv[++i];
+		} else {
+			usage();
+			return 1;
+		}
+	}
+	uint32_t nominal_hz = source_hz < 55.0 ? 50 : 60;
+	//same calculation render_sdl.c does for the target level
+	uint32_t max_repeat = fabs(nominal_hz - display_hz) < 2 ? 1 : (uint32_t)ceil(display_hz / nominal_hz);
+	uint32_t min_buffered = (float)max_repeat * (float)sample_rate / (float)nominal_hz;
+	drc_state drc;
+	if (target) {
+		min_buffered = target;
+	}
+	drc_init(&drc, min_buffered, sample_rate);
+	if (trace) {
+		return replay_trace(&drc, trace);
+	}
+	int32_t capacity = nearest_pow2(min_buffered * 4 * 2) / 2;
+
+	//emulated audio is generated at the source's real rate scaled by the accumulated adjustments
+	double speed = 1.0, level = 0.0, produced_frac = 0.0;
+	double device_period = (double)device_samples / sample_rate;
+	double next_callback = device_period, next_frame = 0.0, frame_accum = 0.0;
+	uint64_t refreshes = 0;
+	uint8_t playing = 0;
+	uint64_t callbacks = 0, silent_callbacks = 0;
+	int32_t last_buffered = 0;
+	double max_level = 0.0;
+	while (next_frame < seconds)
+	{
+		if (next_callback <= next_frame) {
+			if (playing) {
+				callbacks++;
+				if (level < device_samples) {
+					last_buffered = (int32_t)level - device_samples;
+					level = 0;
+				} else {
+					level -= device_samples;
+					last_buffered = level;
+				}
+				if (!latest_only || last_buffered < 0) {
+					drc_report_levels(&drc, last_buffered, capacity - (last_buffered > 0 ? last_buffered : 0));
+				}
+			} else {
+				silent_callbacks++;
+			}
+			next_callback += device_period;
+			continue;
+		}
+		//a frame is emulated on each display refresh unless the rates differ enough for repeats
+		uint8_t emulate = 1;
+		if (fabs(nominal_hz - display_hz) >= 2) {
+			frame_accum += nominal_hz;
+			emulate = frame_accum >= display_hz;
+			if (emulate) {
+				frame_accum -= display_hz;
+			}
+		}
+		if (emulate) {
+			produced_frac += sample_rate / source_hz * speed;
+			uint32_t produced = produced_frac;
+			produced_frac -= produced;
+			level += produced;
+			if (level > capacity) {
+				level = capacity;
+			}
+			if (level > max_level) {
+				max_level = level;
+			}
+			if (!playing && level >= min_buffered) {
+				playing = 1;
+			}
+			if (latest_only && last_buffered >= 0) {
+				drc_report_levels(&drc, last_buffered, capacity - last_buffered);
+			}
+			uint8_t underflow;
+			float adjust = drc_frame(&drc, &underflow);
+			if (underflow) {
+				playing = 0;
+				drc_clear_underflow(&drc);
+			}
+			speed += speed * adjust;
+		}
+		//refreshes are evenly spaced, but the emulated frame may finish late by up to the jitter
+		refreshes++;
+		next_frame = refreshes / display_hz + (jitter() + 1.0) * jitter_ms / 2000.0;
+	}
+	printf("%u Hz output, %u sample device buffer, %.3f Hz source on a %.3f Hz display, up to %.1fms frame jitter\n",
+		sample_rate, device_samples, source_hz, display_hz, jitter_ms);
+	printf("target %u samples, ring %d samples, final speed %.5f, highest level %.0f, %llu silent callbacks\n",
+		min_buffered, capacity, speed, max_level, (unsigned long long)silent_callbacks);
+	drc_print_stats(&drc);
+	return 0;
+}
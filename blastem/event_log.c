@@ -1,47 +1,122 @@
 #ifdef _WIN32
-#define WINVER 0x501
+#define WINVER 0x600
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#define poll WSAPoll
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <poll.h>
 #endif
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
 #include "event_log.h"
 #include "util.h"
 #include "blastem.h"
 #include "saves.h"
 #include "zlib/zlib.h"
 
+//Events are encoded on the emulation thread straight into the buffer of a chunk, full chunks are
+//handed to a writer thread that owns the deflate stream, the file and all the sockets so the
+//emulation thread never pays for compression or network I/O
 enum {
-	CMD_GAMEPAD_DOWN,
-	CMD_GAMEPAD_UP,
+	CHUNK_EVENTS, //compressed as part of the stream
+	CHUNK_FLUSH,  //compressed and then everything so far is written out
+	CHUNK_STATE,  //state that starts the stream for remotes that just connected or a keyframe in a file
+	CHUNK_FINISH  //end of an event log file
 };
 
+typedef struct {
+	serialize_buffer data;
+	uint32_t         frame; //number of frames logged when the chunk was submitted
+	uint8_t          kind;
+} event_chunk;
+
+//Single producer, single consumer queue. head is only written by the producer and tail only by
+//the consumer so no lock is needed
+#define CHUNK_QUEUE_SIZE 256
+typedef struct {
+	event_chunk *entries[CHUNK_QUEUE_SIZE];
+	uint32_t    head;
+	uint32_t    tail;
+} chunk_queue;
+
+//events are handed to the writer once this many bytes have been encoded
+#define CHUNK_SUBMIT_SIZE 4096
+#define MAX_REMOTES 7
+#define INPUT_QUEUE_SIZE 256
+//how often the writer checks for new remotes and remote input when there are no chunks to write
+#define WRITER_POLL_MS 10
+
+//emulation thread state
 static uint8_t active, fully_active;
 static FILE *event_file;
 static serialize_buffer buffer;
+static uint32_t last;
+static uint32_t states_queued;
+static uint32_t frames_logged;
+
+//shared between the two threads
+static chunk_queue pending; //chunks waiting to be written
+static chunk_queue spare;   //chunks the writer is done with
+static uint32_t input_queue[INPUT_QUEUE_SIZE]; //gamepad commands from remotes
+static uint32_t input_head, input_tail;
+static uint32_t idle_stream; //value of states_written when the last remote receiving the stream left
+static uint8_t state_requested;
+static uint8_t writer_idle;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static uint8_t writer_started;
+
+//writer thread state
 static uint8_t *compressed;
 static size_t compressed_storage;
+static size_t compressed_size;
 static z_stream output_stream;
-static uint32_t last;
+static uint32_t states_written;
+static uint64_t file_offset; //bytes of compressed data written to the file so far
+static event_keyframe *keyframes;
+static uint32_t num_keyframes, keyframe_storage;
+
+static uint8_t queue_push(chunk_queue *queue, event_chunk *chunk)
+{
+	uint32_t head = queue->head;
+	if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == CHUNK_QUEUE_SIZE) {
+		return 0;
+	}
+	queue->entries[head % CHUNK_QUEUE_SIZE] = chunk;
+	//sequentially consistent so it can't be reordered with the check of writer_idle in wake_writer
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+	return 1;
+}
+
+static event_chunk *queue_pop(chunk_queue *queue)
+{
+	uint32_t tail = queue->tail;
+	if (tail == __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST)) {
+		return NULL;
+	}
+	event_chunk *chunk = queue->entries[tail % CHUNK_QUEUE_SIZE];
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+	return chunk;
+}
 
 static void event_log_common_init(void)
 {
 	init_serialize(&buffer);
 	compressed_storage = 128*1024;
 	compressed = malloc(compressed_storage);
+	compressed_size = 0;
 	deflateInit(&output_stream, 9);
-	output_stream.avail_out = compressed_storage;
-	output_stream.next_out = compressed;
-	output_stream.avail_in = 0;
-	output_stream.next_in = buffer.data;
 	last = 0;
 	active = 1;
 }
@@ -54,20 +129,160 @@ static void finish_multi(void)
 	multi_count = 0;
 }
 
+static void wake_writer(void)
+{
+	if (__atomic_load_n(&writer_idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&writer_lock);
+			pthread_cond_signal(&writer_wake);
+		pthread_mutex_unlock(&writer_lock);
+	}
+}
+
+uint8_t wrote_since_last_flush;
+//Hands the events encoded so far to the writer thread and continues in the buffer of a spare chunk
+static void submit_chunk(uint8_t kind)
+{
+	event_chunk *chunk = queue_pop(&spare);
+	if (!chunk) {
+		chunk = malloc(sizeof(event_chunk));
+		init_serialize(&chunk->data);
+	}
+	serialize_buffer full = buffer;
+	buffer = chunk->data;
+	reset_serialize(&buffer);
+	chunk->data = full;
+	chunk->frame = frames_logged;
+	chunk->kind = kind;
+	while (!queue_push(&pending, chunk))
+	{
+		//the writer is a long way behind, this is the only place the emulation thread waits on it
+		wake_writer();
+		sched_yield();
+	}
+	wake_writer();
+	if (kind == CHUNK_EVENTS) {
+		wrote_since_last_flush = 1;
+	}
+}
+
+//Compresses data into the end of compressed, growing it as needed
+static void compress_data(uint8_t *data, size_t size, int flush)
+{
+	output_stream.next_in = data;
+	output_stream.avail_in = size;
+	for (;;)
+	{
+		if (compressed_size == compressed_storage) {
+			compressed_storage *= 2;
+			compressed = realloc(compressed, compressed_storage);
+		}
+		output_stream.next_out = compressed + compressed_size;
+		output_stream.avail_out = compressed_storage - compressed_size;
+		int result = deflate(&output_stream, flush);
+		compressed_size = output_stream.next_out - compressed;
+		if (result == Z_STREAM_END) {
+			result = deflateReset(&output_stream);
+			if (result != Z_OK) {
+				fatal_error("deflateReset returned %d\n", result);
+			}
+			return;
+		}
+		if (result == Z_BUF_ERROR) {
+			//no progress possible, so everything has been consumed
+			return;
+		}
+		if (result != Z_OK) {
+			fatal_error("deflate returned %d\n", result);
+		}
+		if (flush != Z_FINISH && !output_stream.avail_in && output_stream.avail_out) {
+			return;
+		}
+	}
+}
+
+static void write_compressed(void)
+{
+	fwrite(compressed, 1, compressed_size, event_file);
+	file_offset += compressed_size;
+	compressed_size = 0;
+}
+
+//The keyframe index goes after the last zlib stream, followed by the number of keyframes and an
+//identifier so a reader can find it from the end of the file
+static const char index_ident[] = "BLSTKEYS";
+#define INDEX_ENTRY_SIZE 12
+#define INDEX_TRAILER_SIZE (4 + sizeof(index_ident) - 1)
+static void write_keyframe_index(void)
+{
+	serialize_buffer index;
+	init_serialize_sized(&index, num_keyframes * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE);
+	for (uint32_t i = 0; i < num_keyframes; i++)
+	{
+		save_int32(&index, keyframes[i].frame);
+		save_int32(&index, keyframes[i].offset >> 32);
+		save_int32(&index, keyframes[i].offset);
+	}
+	save_int32(&index, num_keyframes);
+	save_buffer8(&index, (void *)index_ident, sizeof(index_ident) - 1);
+	fwrite(index.data, 1, index.size, event_file);
+	free(index.data);
+}
+
+static void write_file_chunk(event_chunk *chunk)
+{
+	switch (chunk->kind)
+	{
+	case CHUNK_EVENTS:
+		compress_data(chunk->data.data, chunk->data.size, Z_NO_FLUSH);
+		if (compressed_size >= 128*1024) {
+			write_compressed();
+		}
+		break;
+	case CHUNK_FLUSH:
+		compress_data(chunk->data.data, chunk->data.size, Z_SYNC_FLUSH);
+		write_compressed();
+		fflush(event_file);
+		break;
+	case CHUNK_STATE:
+		//finish the current zlib stream so the keyframe can be decompressed without it
+		compress_data(NULL, 0, Z_FINISH);
+		write_compressed();
+		if (num_keyframes == keyframe_storage) {
+			keyframe_storage = keyframe_storage ? keyframe_storage * 2 : 64;
+			keyframes = realloc(keyframes, keyframe_storage * sizeof(event_keyframe));
+		}
+		keyframes[num_keyframes++] = (event_keyframe){
+			.offset = file_offset,
+			.frame = chunk->frame
+		};
+		compress_data(chunk->data.data, chunk->data.size, Z_NO_FLUSH);
+		break;
+	case CHUNK_FINISH:
+		compress_data(chunk->data.data, chunk->data.size, Z_FINISH);
+		write_compressed();
+		write_keyframe_index();
+		fclose(event_file);
+		break;
+	}
+}
+
+static void finish_block(void);
+static uint16_t block_count;
 static void file_finish(void)
 {
-	fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
-	output_stream.next_out = compressed;
-	output_stream.avail_out = compressed_storage;
-	int result = deflate(&output_stream, Z_FINISH);
-	if (Z_STREAM_END != result) {
-		fatal_error("Final deflate call returned %d\n", result);
+	if (block_count) {
+		finish_block();
+	}
+	if (multi_count) {
+		finish_multi();
+	}
+	submit_chunk(CHUNK_FINISH);
+	if (writer_started) {
+		pthread_join(writer, NULL);
 	}
-	fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
-	fclose(event_file);
 }
 
-static const char el_ident[] = "BLSTEL\x02\x00";
+static const char el_ident[] = "BLSTEL\x04\x00";
 void event_log_file(char *fname)
 {
 	event_file = fopen(fname, "wb");
@@ -82,17 +297,19 @@ void event_log_file(char *fname)
 }
 
 typedef struct {
-	uint8_t  *send_progress;
+	size_t   send_progress;
 	int      sock;
 	uint8_t  players[1]; //TODO: Expand when support for multiple players per remote is added
 	uint8_t  num_players;
+	uint8_t  started; //system start and a state have been sent so it's receiving the stream
+	uint8_t  keyframe; //wants the next state in the stream itself
 } remote;
 
 static int listen_sock;
-static remote remotes[7];
+static remote remotes[MAX_REMOTES];
 static int num_remotes;
-static uint8_t available_players[7] = {2,3,4,5,6,7,8};
-static int num_available_players = 7;
+static uint8_t available_players[MAX_REMOTES] = {2,3,4,5,6,7,8};
+static int num_available_players = MAX_REMOTES;
 void event_log_tcp(char *address, char *port)
 {
 	struct addrinfo request, *result;
@@ -102,7 +319,7 @@ void event_log_tcp(char *address, char *port)
 	request.ai_socktype = SOCK_STREAM;
 	request.ai_flags = AI_PASSIVE;
 	getaddrinfo(address, port, &request, &result);
-	
+
 	listen_sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
 	if (listen_sock < 0) {
 		warning("Failed to open event log listen socket on %s:%s\n", address, port);
@@ -126,8 +343,347 @@ cleanup_address:
 	freeaddrinfo(result);
 }
 
+static uint8_t next_available_player(void)
+{
+	uint8_t lowest = 0xFF;
+	int lowest_index = -1;
+	for (int i = 0; i < num_available_players; i++)
+	{
+		if (available_players[i] < lowest) {
+			lowest = available_players[i];
+			lowest_index = i;
+		}
+	}
+	if (lowest_index >= 0) {
+		available_players[lowest_index] = available_players[num_available_players - 1];
+		--num_available_players;
+	}
+	return lowest;
+}
+
+static int started_remotes(void)
+{
+	int count = 0;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		count += remotes[i].started;
+	}
+	return count;
+}
+
+//Lets the emulation thread know nobody is receiving the stream it's currently writing
+static void stream_idle(void)
+{
+	deflateReset(&output_stream);
+	compressed_size = 0;
+	__atomic_store_n(&idle_stream, states_written, __ATOMIC_RELEASE);
+}
+
+static void drop_remote(int index)
+{
+	uint8_t was_started = remotes[index].started;
+	socket_close(remotes[index].sock);
+	for (int j = 0; j < remotes[index].num_players; j++) {
+		available_players[num_available_players++] = remotes[index].players[j];
+	}
+	remotes[index] = remotes[num_remotes-1];
+	num_remotes--;
+	if (was_started && !started_remotes()) {
+		//last remote disconnected, reset buffers/deflate
+		stream_idle();
+	}
+}
+
+static void accept_remote(void)
+{
+	int remote_sock = accept(listen_sock, NULL, NULL);
+	if (remote_sock == -1) {
+		return;
+	}
+	if (num_remotes == MAX_REMOTES) {
+		socket_close(remote_sock);
+		return;
+	}
+	printf("remote %d connected\n", num_remotes);
+	uint8_t player = next_available_player();
+	remotes[num_remotes++] = (remote){
+		.sock = remote_sock,
+		.players = {player},
+		.num_players = player == 0xFF ? 0 : 1
+	};
+	//the new remote needs a state to start from, which can only be taken by the emulation thread
+	__atomic_store_n(&state_requested, 1, __ATOMIC_RELEASE);
+}
+
+static void queue_input(uint8_t cmd, uint8_t pad, uint8_t button)
+{
+	uint32_t head = input_head;
+	if (head - __atomic_load_n(&input_tail, __ATOMIC_ACQUIRE) == INPUT_QUEUE_SIZE) {
+		warning("Dropped remote command %X, input queue is full\n", cmd);
+		return;
+	}
+	input_queue[head % INPUT_QUEUE_SIZE] = cmd << 16 | pad << 8 | button;
+	__atomic_store_n(&input_head, head + 1, __ATOMIC_RELEASE);
+}
+
+//Returns 0 if the remote disconnected
+static uint8_t receive_commands(remote *r)
+{
+	uint8_t recv_buffer[1500];
+	int bytes = recv(r->sock, recv_buffer, sizeof(recv_buffer), 0);
+	if (!bytes || (bytes < 0 && !socket_error_is_wouldblock())) {
+		return 0;
+	}
+	for (int j = 0; j < bytes; j++)
+	{
+		uint8_t cmd = recv_buffer[j];
+		switch(cmd)
+		{
+		case CMD_GAMEPAD_DOWN:
+		case CMD_GAMEPAD_UP: {
+			++j;
+			if (j < bytes) {
+				uint8_t button = recv_buffer[j];
+				uint8_t pad = (button >> 5) - 1;
+				button &= 0x1F;
+				if (pad <  r->num_players) {
+					queue_input(cmd, r->players[pad], button);
+				}
+			} else {
+				warning("Received incomplete command %X\n", cmd);
+			}
+			break;
+		}
+		case CMD_KEYFRAME:
+			r->keyframe = 1;
+			__atomic_store_n(&state_requested, 1, __ATOMIC_RELEASE);
+			break;
+		default:
+			warning("Unrecognized remote command %X\n", cmd);
+			j = bytes;
+		}
+	}
+	return 1;
+}
+
+//Sends as much of the stream as each remote will take without blocking
+static void send_pending(void)
+{
+	for (int i = num_remotes - 1; i >= 0; i--)
+	{
+		remote *r = remotes + i;
+		if (!r->started) {
+			continue;
+		}
+		while (r->send_progress < compressed_size)
+		{
+			int sent = send(r->sock, compressed + r->send_progress, compressed_size - r->send_progress, 0);
+			if (sent > 0) {
+				r->send_progress += sent;
+			} else {
+				if (sent < 0 && !socket_error_is_wouldblock()) {
+					drop_remote(i);
+				}
+				break;
+			}
+		}
+	}
+	if (!started_remotes()) {
+		return;
+	}
+	size_t min_progress = compressed_size;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		if (remotes[i].started && remotes[i].send_progress < min_progress) {
+			min_progress = remotes[i].send_progress;
+		}
+	}
+	if (min_progress == compressed_size || min_progress > compressed_size / 2) {
+		//drop the part every remote has received so the buffer doesn't keep growing
+		memmove(compressed, compressed + min_progress, compressed_size - min_progress);
+		compressed_size -= min_progress;
+		for (int i = 0; i < num_remotes; i++)
+		{
+			if (remotes[i].started) {
+				remotes[i].send_progress -= min_progress;
+			}
+		}
+	}
+}
+
+static size_t send_all(int sock, uint8_t *data, size_t size, int flags)
+{
+	size_t total = 0, sent = 1;
+	while(sent > 0 && total < size)
+	{
+		sent = send(sock, data + total, size - total, flags);
+		if (sent > 0) {
+			total += sent;
+		}
+	}
+	return total;
+}
+
 static uint8_t *system_start;
 static size_t system_start_size;
+static void write_state(event_chunk *chunk)
+{
+	if (started_remotes()) {
+		//full flush is needed so new and old clients can share a stream
+		compress_data(NULL, 0, Z_FINISH);
+	} else {
+		deflateReset(&output_stream);
+		compressed_size = 0;
+	}
+	size_t state_start = compressed_size;
+	compress_data(chunk->data.data, chunk->data.size, Z_FINISH);
+	size_t state_size = compressed_size - state_start;
+	//a relay that asked for a keyframe needs the state in the stream it's already receiving, since
+	//there's only one stream this means every remote gets it
+	uint8_t keyframe = 0;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		keyframe |= remotes[i].started && remotes[i].keyframe;
+		remotes[i].keyframe = 0;
+	}
+	for (int i = num_remotes - 1; i >= 0; i--)
+	{
+		if (remotes[i].started) {
+			continue;
+		}
+		if (
+			send_all(remotes[i].sock, system_start, system_start_size, 0) == system_start_size
+			&& send_all(remotes[i].sock, compressed + state_start, state_size, 0) == state_size
+		) {
+			remotes[i].started = 1;
+			remotes[i].send_progress = keyframe ? compressed_size : state_start;
+			socket_blocking(remotes[i].sock, 0);
+			int flag = 1;
+			setsockopt(remotes[i].sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+		} else {
+			drop_remote(i);
+		}
+	}
+	if (!keyframe) {
+		//the state was only for the new remotes, everybody continues with the stream that follows it
+		compressed_size = state_start;
+	}
+	states_written++;
+	if (started_remotes()) {
+		send_pending();
+	} else {
+		stream_idle();
+	}
+}
+
+static void write_socket_chunk(event_chunk *chunk)
+{
+	if (chunk->kind == CHUNK_STATE) {
+		write_state(chunk);
+		return;
+	}
+	if (!started_remotes()) {
+		//events from before the emulation thread noticed everyone left
+		return;
+	}
+	if (chunk->kind == CHUNK_FLUSH) {
+		compress_data(chunk->data.data, chunk->data.size, Z_SYNC_FLUSH);
+		send_pending();
+	} else {
+		compress_data(chunk->data.data, chunk->data.size, Z_NO_FLUSH);
+		if (compressed_size > 1280) {
+			send_pending();
+		}
+	}
+}
+
+//Accepts new remotes, takes input from connected ones and sends to any that have room again
+static void service_sockets(void)
+{
+	struct pollfd fds[MAX_REMOTES + 1];
+	fds[0].fd = listen_sock;
+	fds[0].events = POLLIN;
+	for (int i = 0; i < num_remotes; i++)
+	{
+		fds[i + 1].fd = remotes[i].sock;
+		fds[i + 1].events = POLLIN;
+		if (remotes[i].started && remotes[i].send_progress < compressed_size) {
+			fds[i + 1].events |= POLLOUT;
+		}
+	}
+	int polled = num_remotes;
+	if (poll(fds, polled + 1, 0) <= 0) {
+		return;
+	}
+	uint8_t writable = 0;
+	//backwards so dropping a remote doesn't move one that hasn't been checked yet
+	for (int i = polled - 1; i >= 0; i--)
+	{
+		short revents = fds[i + 1].revents;
+		if (revents & POLLOUT) {
+			writable = 1;
+		}
+		if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive_commands(remotes + i)) {
+			drop_remote(i);
+		}
+	}
+	if (writable) {
+		send_pending();
+	}
+	if (fds[0].revents & POLLIN) {
+		accept_remote();
+	}
+}
+
+static void *event_writer(void *data)
+{
+	for (;;)
+	{
+		event_chunk *chunk;
+		while ((chunk = queue_pop(&pending)))
+		{
+			uint8_t kind = chunk->kind;
+			if (event_file) {
+				write_file_chunk(chunk);
+			} else {
+				write_socket_chunk(chunk);
+			}
+			if (!queue_push(&spare, chunk)) {
+				free(chunk->data.data);
+				free(chunk);
+			}
+			if (kind == CHUNK_FINISH) {
+				return NULL;
+			}
+			if (kind == CHUNK_FLUSH && listen_sock) {
+				//once a frame even when there's always more to write so remotes aren't ignored
+				service_sockets();
+			}
+		}
+		if (listen_sock) {
+			service_sockets();
+		}
+		pthread_mutex_lock(&writer_lock);
+			__atomic_store_n(&writer_idle, 1, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&pending.head, __ATOMIC_SEQ_CST) == pending.tail) {
+				if (listen_sock) {
+					struct timespec until;
+					clock_gettime(CLOCK_REALTIME, &until);
+					until.tv_nsec += WRITER_POLL_MS * 1000000;
+					if (until.tv_nsec >= 1000000000) {
+						until.tv_nsec -= 1000000000;
+						until.tv_sec++;
+					}
+					pthread_cond_timedwait(&writer_wake, &writer_lock, &until);
+				} else {
+					pthread_cond_wait(&writer_wake, &writer_lock);
+				}
+			}
+			__atomic_store_n(&writer_idle, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&writer_lock);
+	}
+}
+
 void event_system_start(system_type stype, vid_std video_std, char *name)
 {
 	if (!active) {
@@ -150,6 +706,10 @@ void event_system_start(system_type stype, vid_std video_std, char *name)
 		fwrite(buffer.data, 1, buffer.size, event_file);
 	}
 	buffer.size = 0;
+	if (!writer_started) {
+		pthread_create(&writer, NULL, event_writer, NULL);
+		writer_started = 1;
+	}
 }
 
 //header formats
@@ -162,6 +722,9 @@ static uint8_t last_event_type = 0xFF;
 static uint32_t last_delta;
 static void event_header(uint8_t type, uint32_t cycle)
 {
+	if (block_count) {
+		finish_block();
+	}
 	uint32_t delta = cycle - last;
 	if (multi_count) {
 		if (type != last_event_type || delta != last_delta) {
@@ -186,12 +749,12 @@ static void event_header(uint8_t type, uint32_t cycle)
 	multi_start = buffer.size;
 	last_event_type = type;
 	last_delta = delta;
-	
+
 	if (delta > 65535) {
 		save_int8(&buffer, FORMAT_4BYTE | type);
 		save_int8(&buffer, delta >> 16);
 		save_int16(&buffer, delta);
-	} else if (delta >= 16 && delta < 32) {
+	} else if (delta >= 16 && delta < 32 && type < EVENT_VRAM_BLOCK) {
 		save_int8(&buffer, type << 4 | (delta - 16));
 	} else {
 		save_int8(&buffer, FORMAT_3BYTE | type);
@@ -209,119 +772,35 @@ void event_cycle_adjust(uint32_t cycle, uint32_t deduction)
 	save_int32(&buffer, deduction);
 }
 
-static uint8_t next_available_player(void)
+//Picks up what the writer thread has passed back from the remotes
+static void remote_updates(void)
 {
-	uint8_t lowest = 0xFF;
-	int lowest_index = -1;
-	for (int i = 0; i < num_available_players; i++)
-	{
-		if (available_players[i] < lowest) {
-			lowest = available_players[i];
-			lowest_index = i;
-		}
-	}
-	if (lowest_index >= 0) {
-		available_players[lowest_index] = available_players[num_available_players - 1];
-		--num_available_players;
+	if (fully_active && __atomic_load_n(&idle_stream, __ATOMIC_ACQUIRE) == states_queued) {
+		//every remote receiving the stream has disconnected, so stop logging until a new one connects
+		fully_active = 0;
+		multi_count = 0;
+		block_count = 0;
+		last_event_type = 0xFF;
+		reset_serialize(&buffer);
 	}
-	return lowest;
-}
-
-static void flush_socket(void)
-{
-	int remote_sock = accept(listen_sock, NULL, NULL);
-	if (remote_sock != -1) {
-		if (num_remotes == 7) {
-			socket_close(remote_sock);
+	uint32_t head = __atomic_load_n(&input_head, __ATOMIC_ACQUIRE);
+	uint32_t tail = input_tail;
+	for (; tail != head; tail++)
+	{
+		uint32_t cmd = input_queue[tail % INPUT_QUEUE_SIZE];
+		uint8_t pad = cmd >> 8, button = cmd;
+		if (cmd >> 16 == CMD_GAMEPAD_DOWN) {
+			current_system->gamepad_down(current_system, pad, button);
 		} else {
-			printf("remote %d connected\n", num_remotes);
-			uint8_t player = next_available_player();
-			remotes[num_remotes++] = (remote){
-				.sock = remote_sock,
-				.send_progress = NULL,
-				.players = {player},
-				.num_players = player == 0xFF ? 0 : 1
-			};
-			current_system->save_state = EVENTLOG_SLOT + 1;
-		}
-	}
-	uint8_t *min_progress = compressed;
-	for (int i = 0; i < num_remotes; i++) {
-		if (remotes[i].send_progress) {
-			uint8_t recv_buffer[1500];
-			int bytes = recv(remotes[i].sock, recv_buffer, sizeof(recv_buffer), 0);
-			for (int j = 0; j < bytes; j++)
-			{
-				uint8_t cmd = recv_buffer[j];
-				switch(cmd)
-				{
-				case CMD_GAMEPAD_DOWN:
-				case CMD_GAMEPAD_UP: {
-					++j;
-					if (j < bytes) {
-						uint8_t button = recv_buffer[j];
-						uint8_t pad = (button >> 5) - 1;
-						button &= 0x1F;
-						if (pad <  remotes[i].num_players) {
-							pad = remotes[i].players[pad];
-							if (cmd == CMD_GAMEPAD_DOWN) {
-								current_system->gamepad_down(current_system, pad, button);
-							} else {
-								current_system->gamepad_up(current_system, pad, button);
-							}
-						}
-					} else {
-						warning("Received incomplete command %X\n", cmd);
-					}
-					break;
-				}
-				default:
-					warning("Unrecognized remote command %X\n", cmd);
-					j = bytes;
-				}
-			}
-			int sent = 1;
-			while (sent && output_stream.next_out > remotes[i].send_progress)
-			{
-				sent = send(remotes[i].sock, remotes[i].send_progress, output_stream.next_out - remotes[i].send_progress, 0);
-				if (sent >= 0) {
-					remotes[i].send_progress += sent;
-				} else if (!socket_error_is_wouldblock()) {
-					socket_close(remotes[i].sock);
-					for (int j = 0; j < remotes[i].num_players; j++) {
-						available_players[num_available_players++] = remotes[i].players[j];
-					}
-					remotes[i] = remotes[num_remotes-1];
-					num_remotes--;
-					if (!num_remotes) {
-						//last remote disconnected, reset buffers/deflate
-						fully_active = 0;
-						deflateReset(&output_stream);
-						output_stream.next_out = compressed;
-						output_stream.avail_out = compressed_storage;
-						buffer.size = 0;
-					}
-					i--;
-					break;
-				}
-				if (remotes[i].send_progress > min_progress) {
-					min_progress = remotes[i].send_progress;
-				}
-			}
+			current_system->gamepad_up(current_system, pad, button);
 		}
 	}
-	if (min_progress == output_stream.next_out) {
-		output_stream.next_out = compressed;
-		output_stream.avail_out = compressed_storage;
-		for (int i = 0; i < num_remotes; i++) {
-			if (remotes[i].send_progress) {
-				remotes[i].send_progress = compressed;
-			}
-		}
+	__atomic_store_n(&input_tail, tail, __ATOMIC_RELEASE);
+	if (__atomic_exchange_n(&state_requested, 0, __ATOMIC_ACQUIRE)) {
+		current_system->snapshot_requests |= SNAPSHOT_BIT(EVENTLOG_SLOT);
 	}
 }
 
-uint8_t wrote_since_last_flush;
 void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
 {
 	if (!fully_active) {
@@ -332,24 +811,8 @@ void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
 	save_buffer8(&buffer, payload, size);
 	if (!multi_count) {
 		last_event_type = 0xFF;
-		output_stream.avail_in = buffer.size - (output_stream.next_in - buffer.data);
-		int result = deflate(&output_stream, Z_NO_FLUSH);
-		if (result != Z_OK) {
-			fatal_error("deflate returned %d\n", result);
-		}
-		if (listen_sock) {
-			if ((output_stream.next_out - compressed) > 1280 || !output_stream.avail_out) {
-				flush_socket();
-				wrote_since_last_flush = 1;
-			}
-		} else if (!output_stream.avail_out) {
-			fwrite(compressed, 1, compressed_storage, event_file);
-			output_stream.next_out = compressed;
-			output_stream.avail_out = compressed_storage;
-		}
-		if (!output_stream.avail_in) {
-			buffer.size = 0;
-			output_stream.next_in = buffer.data;
+		if (buffer.size >= CHUNK_SUBMIT_SIZE) {
+			submit_chunk(CHUNK_EVENTS);
 		}
 	}
 }
@@ -357,6 +820,9 @@ void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload)
 static uint32_t last_word_address;
 void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
 {
+	if (block_count) {
+		finish_block();
+	}
 	uint32_t delta = address - last_word_address;
 	if (delta < 256) {
 		uint8_t buffer[3] = {delta, value >> 8, value};
@@ -371,6 +837,9 @@ void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value)
 static uint32_t last_byte_address;
 void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc)
 {
+	if (block_count) {
+		finish_block();
+	}
 	uint32_t delta = address - last_byte_address;
 	if (delta == 1) {
 		event_log(EVENT_VRAM_BYTE_ONE, cycle, sizeof(byte), &byte);
@@ -386,58 +855,151 @@ void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t aut
 	last_byte_address = address;
 }
 
-static size_t send_all(int sock, uint8_t *data, size_t size, int flags)
+//Consecutive writes from a DMA are collected here and logged as one block event. The block has the
+//address of the first write and a fixed increment for the ones after it, along with the number of
+//cycles between each write so playback stays cycle accurate. DMA slots are evenly spaced apart from
+//refresh slots, so the cycle deltas are stored as runs
+#define MAX_BLOCK 256
+static uint8_t block_type, block_flags, block_stride, block_auto_inc, block_runs;
+static uint16_t block_start, block_next, block_last_address, block_mask;
+static uint32_t block_cycle, block_last_cycle;
+static uint16_t block_run_delta[MAX_BLOCK];
+static uint8_t block_run_length[MAX_BLOCK];
+static uint16_t block_values[MAX_BLOCK];
+
+//deltas of 255 or more are stored as 255 followed by the full 16-bit value
+static void save_block_runs(void)
 {
-	size_t total = 0, sent = 1;
-	while(sent > 0 && total < size)
+	save_int8(&buffer, block_runs);
+	for (uint8_t i = 0; i < block_runs; i++)
 	{
-		sent = send(sock, data + total, size - total, flags);
-		if (sent > 0) {
-			total += sent;
+		if (block_run_delta[i] < 255) {
+			save_int8(&buffer, block_run_delta[i]);
+		} else {
+			save_int8(&buffer, 255);
+			save_int16(&buffer, block_run_delta[i]);
 		}
+		save_int8(&buffer, block_run_length[i]);
 	}
-	return total;
 }
 
-void deflate_flush(uint8_t full)
+static void finish_block(void)
 {
-	output_stream.avail_in = buffer.size - (output_stream.next_in - buffer.data);
-	uint8_t force = full;
-	while (output_stream.avail_in || force)
-	{
-		if (!output_stream.avail_out) {
-			size_t old_storage = compressed_storage;
-			uint8_t *old_compressed = compressed;
-			compressed_storage *= 2;
-			compressed = realloc(compressed, compressed_storage);
-			output_stream.next_out = compressed + old_storage;
-			output_stream.avail_out = old_storage;
-			for (int i = 0; i < num_remotes; i++) {
-				if (remotes[i].send_progress) {
-					remotes[i].send_progress = compressed + (remotes[i].send_progress - old_compressed);
-				}
-			}
+	uint16_t count = block_count;
+	block_count = 0;
+	if (count == 1 && !(block_flags & EVENT_BLOCK_COPY)) {
+		//a lone write is smaller as a regular event
+		if (block_type == EVENT_VRAM_BLOCK) {
+			event_vram_byte(block_cycle, block_start, block_values[0], block_auto_inc);
+		} else {
+			uint8_t buffer[3] = {block_start, block_values[0] >> 8, block_values[0]};
+			event_log(EVENT_VDP_INTRAM, block_cycle, sizeof(buffer), buffer);
 		}
-		int result = deflate(&output_stream, full ? Z_FINISH : Z_SYNC_FLUSH);
-		if (result != (full ? Z_STREAM_END : Z_OK)) {
-			fatal_error("deflate returned %d\n", result);
+		return;
+	}
+	event_header(block_type, block_cycle);
+	last = block_cycle;
+	if (block_type == EVENT_VRAM_BLOCK) {
+		save_int16(&buffer, block_start);
+		save_int8(&buffer, block_stride);
+		save_int8(&buffer, block_flags);
+		save_int8(&buffer, count - 1);
+		save_block_runs();
+		for (uint16_t i = 0; i < count; i++)
+		{
+			save_int8(&buffer, block_values[i]);
 		}
-		if (full && result == Z_STREAM_END) {
-			result = deflateReset(&output_stream);
-			if (result != Z_OK) {
-				fatal_error("deflateReset returned %d\n", result);
+		last_byte_address = block_last_address;
+	} else {
+		save_int8(&buffer, block_start);
+		save_int8(&buffer, block_stride);
+		save_int8(&buffer, count - 1);
+		save_block_runs();
+		for (uint16_t i = 0; i < count; i++)
+		{
+			save_int16(&buffer, block_values[i]);
+		}
+	}
+	last_event_type = 0xFF;
+	if (buffer.size >= CHUNK_SUBMIT_SIZE) {
+		submit_chunk(CHUNK_EVENTS);
+	}
+}
+
+static void block_write(uint8_t type, uint32_t cycle, uint16_t address, uint16_t mask, uint16_t value, uint8_t flags)
+{
+	if (block_count) {
+		uint32_t delta = cycle - block_last_cycle;
+		uint8_t continues = block_type == type && block_flags == flags && delta <= 0xFFFF && block_count < MAX_BLOCK;
+		if (continues && block_count == 1) {
+			uint16_t stride = (address - block_start) & mask;
+			if (stride && stride < 256) {
+				block_stride = stride;
+			} else {
+				continues = 0;
+			}
+		} else if (continues) {
+			continues = address == block_next;
+		}
+		if (continues) {
+			if (block_runs && block_run_delta[block_runs - 1] == delta && block_run_length[block_runs - 1] < 255) {
+				//lengths are stored minus one
+				block_run_length[block_runs - 1]++;
+			} else {
+				block_run_delta[block_runs] = delta;
+				block_run_length[block_runs++] = 0;
 			}
+			block_values[block_count++] = value;
+			block_next = (address + block_stride) & mask;
+			block_last_address = address;
+			block_last_cycle = cycle;
+			return;
 		}
-		force = 0;
+		finish_block();
 	}
-	output_stream.next_in = buffer.data;
-	buffer.size = 0;
+	block_type = type;
+	block_flags = flags;
+	block_mask = mask;
+	block_start = block_last_address = address;
+	block_cycle = block_last_cycle = cycle;
+	block_values[0] = value;
+	block_count = 1;
+	block_runs = 0;
+}
+
+void event_vram_block_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc, uint8_t flags)
+{
+	if (!fully_active) {
+		return;
+	}
+	block_write(EVENT_VRAM_BLOCK, cycle, address, 0xFFFF, byte, flags);
+	block_auto_inc = auto_inc;
+}
+
+void event_intram_block_word(uint32_t cycle, uint8_t address, uint16_t value)
+{
+	if (!fully_active) {
+		return;
+	}
+	block_write(EVENT_INTRAM_BLOCK, cycle, address, 0xFF, value, 0);
 }
 
 void event_state(uint32_t cycle, serialize_buffer *state)
 {
+	if (!active) {
+		return;
+	}
 	if (!fully_active) {
 		last = cycle;
+	} else {
+		if (block_count) {
+			finish_block();
+		}
+		if (multi_count) {
+			finish_multi();
+		}
+		//events before the state still go to the remotes that were already connected
+		submit_chunk(CHUNK_EVENTS);
 	}
 	uint8_t header[] = {
 		EVENT_STATE << 4, last >> 24, last >> 16, last >> 8, last,
@@ -445,52 +1007,17 @@ void event_state(uint32_t cycle, serialize_buffer *state)
 		last_byte_address >> 8, last_byte_address,
 		state->size >> 16, state->size >> 8, state->size
 	};
-	uint8_t sent_system_start = 0;
-	for (int i = 0; i < num_remotes; i++)
-	{
-		if (!remotes[i].send_progress) {
-			if (send_all(remotes[i].sock, system_start, system_start_size, 0) == system_start_size) {
-				sent_system_start = 1;
-			} else {
-				socket_close(remotes[i].sock);
-				remotes[i] = remotes[num_remotes-1];
-				num_remotes--;
-				i--;
-			}
-		}
-	}
-	if (sent_system_start) {
-		if (fully_active) {
-			if (multi_count) {
-				finish_multi();
-			}
-			//full flush is needed so new and old clients can share a stream
-			deflate_flush(1);
-		}
-		save_buffer8(&buffer, header, sizeof(header));
-		save_buffer8(&buffer, state->data, state->size);
-		size_t old_compressed_size = output_stream.next_out - compressed;
-		deflate_flush(1);
-		size_t state_size = output_stream.next_out - compressed - old_compressed_size;
-		for (int i = 0; i < num_remotes; i++) {
-			if (!remotes[i].send_progress) {
-				if (send_all(remotes[i].sock, compressed + old_compressed_size, state_size, 0) == state_size) {
-					remotes[i].send_progress = compressed + old_compressed_size;
-					socket_blocking(remotes[i].sock, 0);
-					int flag = 1;
-					setsockopt(remotes[i].sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
-					fully_active = 1;
-				} else {
-					socket_close(remotes[i].sock);
-					remotes[i] = remotes[num_remotes-1];
-					num_remotes--;
-					i--;
-				}
-			}
-		}
-		output_stream.next_out = compressed + old_compressed_size;
-		output_stream.avail_out = compressed_storage - old_compressed_size;
-	}
+	save_buffer8(&buffer, header, sizeof(header));
+	save_buffer8(&buffer, state->data, state->size);
+	last_event_type = 0xFF;
+	submit_chunk(CHUNK_STATE);
+	states_queued++;
+	fully_active = 1;
+}
+
+uint8_t event_log_active(void)
+{
+	return active;
 }
 
 void event_flush(uint32_t cycle)
@@ -498,20 +1025,20 @@ void event_flush(uint32_t cycle)
 	if (!active) {
 		return;
 	}
+	if (listen_sock) {
+		remote_updates();
+	}
 	if (fully_active) {
 		event_header(EVENT_FLUSH, cycle);
 		last = cycle;
-		
-		deflate_flush(0);
+		submit_chunk(CHUNK_FLUSH);
 	}
+	wrote_since_last_flush = 0;
 	if (event_file) {
-		fwrite(compressed, 1, output_stream.next_out - compressed, event_file);
-		fflush(event_file);
-		output_stream.next_out = compressed;
-		output_stream.avail_out = compressed_storage;
-	} else if (listen_sock) {
-		flush_socket();
-		wrote_since_last_flush = 0;
+		if (!(frames_logged % EVENT_KEYFRAME_FRAMES)) {
+			current_system->snapshot_requests |= SNAPSHOT_BIT(EVENTLOG_SLOT);
+		}
+		frames_logged++;
 	}
 }
 
@@ -520,11 +1047,13 @@ void event_soft_flush(uint32_t cycle)
 	if (!fully_active || wrote_since_last_flush || event_file) {
 		return;
 	}
+	remote_updates();
+	if (!fully_active) {
+		return;
+	}
 	event_header(EVENT_FLUSH, cycle);
 	last = cycle;
-	
-	deflate_flush(0);
-	flush_socket();
+	submit_chunk(CHUNK_FLUSH);
 }
 
 static void init_event_reader_common(event_reader *reader)
@@ -535,7 +1064,39 @@ static void init_event_reader_common(event_reader *reader)
 	init_deserialize(&reader->buffer, malloc(reader->storage), reader->storage);
 	reader->buffer.size = 0;
 	memset(&reader->input_stream, 0, sizeof(reader->input_stream));
-	
+	reader->file_data = NULL;
+	reader->keyframes = NULL;
+	reader->num_keyframes = 0;
+}
+
+static void read_keyframe_index(event_reader *reader)
+{
+	uint8_t *end = reader->file_data + reader->file_data_size;
+	if (reader->file_data_size < INDEX_TRAILER_SIZE || memcmp(end - sizeof(index_ident) + 1, index_ident, sizeof(index_ident) - 1)) {
+		return;
+	}
+	uint8_t *trailer = end - INDEX_TRAILER_SIZE;
+	uint32_t count = trailer[0] << 24 | trailer[1] << 16 | trailer[2] << 8 | trailer[3];
+	if (count > (reader->file_data_size - INDEX_TRAILER_SIZE) / INDEX_ENTRY_SIZE) {
+		warning("Event log keyframe index is corrupt\n");
+		return;
+	}
+	uint8_t *cur = trailer - count * INDEX_ENTRY_SIZE;
+	reader->file_data_size = cur - reader->file_data;
+	reader->keyframes = calloc(count, sizeof(event_keyframe));
+	for (uint32_t i = 0; i < count; i++, cur += INDEX_ENTRY_SIZE)
+	{
+		reader->keyframes[i].frame = cur[0] << 24 | cur[1] << 16 | cur[2] << 8 | cur[3];
+		reader->keyframes[i].offset = (uint64_t)(cur[4] << 24 | cur[5] << 16 | cur[6] << 8 | cur[7]) << 32
+			| (uint32_t)(cur[8] << 24 | cur[9] << 16 | cur[10] << 8 | cur[11]);
+		if (reader->keyframes[i].offset >= reader->file_data_size) {
+			warning("Event log keyframe index is corrupt\n");
+			free(reader->keyframes);
+			reader->keyframes = NULL;
+			return;
+		}
+	}
+	reader->num_keyframes = count;
 }
 
 void init_event_reader(event_reader *reader, uint8_t *data, size_t size)
@@ -547,8 +1108,11 @@ void init_event_reader(event_reader *reader, uint8_t *data, size_t size)
 	uint8_t name_len = data[1];
 	reader->buffer.size = name_len + 2;
 	memcpy(reader->buffer.data, data, reader->buffer.size);
-	reader->input_stream.next_in = data + reader->buffer.size;
-	reader->input_stream.avail_in = size - reader->buffer.size;
+	reader->file_data = data + reader->buffer.size;
+	reader->file_data_size = size - reader->buffer.size;
+	read_keyframe_index(reader);
+	reader->input_stream.next_in = reader->file_data;
+	reader->input_stream.avail_in = reader->file_data_size;
 	
 	int result = inflateInit(&reader->input_stream);
 	if (Z_OK != result) {
@@ -605,7 +1169,10 @@ void init_event_reader_tcp(event_reader *reader, char *address, char *port)
 	reader->input_stream.next_out = reader->buffer.data + init_msg_len;
 	reader->input_stream.avail_out = reader->storage - init_msg_len;
 	res = inflate(&reader->input_stream, Z_NO_FLUSH);
-	if (Z_OK != res && Z_BUF_ERROR != res) {
+	if (Z_STREAM_END == res) {
+		//the whole stream for the first state can arrive along with the system start message
+		inflateReset(&reader->input_stream);
+	} else if (Z_OK != res && Z_BUF_ERROR != res) {
 		fatal_error("inflate returned %d in init_event_reader_tcp\n", res);
 	}
 	int flag = 1;
@@ -661,6 +1228,59 @@ static void inflate_flush(event_reader *reader)
 	
 }
 
+//Restarts decompression at offset in the compressed data of a file, stopping at end
+static void reader_restart(event_reader *reader, uint64_t offset, size_t end)
+{
+	inflateReset(&reader->input_stream);
+	reader->input_stream.next_in = reader->file_data + offset;
+	reader->input_stream.avail_in = end - offset;
+	reader->buffer.size = reader->buffer.cur_pos = 0;
+	reader->input_stream.next_out = reader->buffer.data;
+	reader->input_stream.avail_out = reader->storage;
+	reader->repeat_remaining = 0;
+	reader->repeat_event = 0xFF;
+	reader->last_cycle = 0;
+	reader->last_word_address = reader->last_byte_address = 0;
+	inflate_flush(reader);
+}
+
+void init_event_reader_keyframe(event_reader *reader, event_reader *source, uint32_t keyframe)
+{
+	init_event_reader_common(reader);
+	reader->socket = 0;
+	reader->file_data = source->file_data;
+	reader->file_data_size = source->file_data_size;
+	reader->keyframes = source->keyframes;
+	reader->num_keyframes = source->num_keyframes;
+	int result = inflateInit(&reader->input_stream);
+	if (Z_OK != result) {
+		fatal_error("inflateInit returned %d\n", result);
+	}
+	size_t end = keyframe + 1 < reader->num_keyframes ? reader->keyframes[keyframe + 1].offset : reader->file_data_size;
+	reader_restart(reader, reader->keyframes[keyframe].offset, end);
+}
+
+uint32_t reader_seek(event_reader *reader, uint32_t frame)
+{
+	//find the last keyframe at or before frame
+	uint32_t low = 0, high = reader->num_keyframes;
+	while (low < high)
+	{
+		uint32_t mid = (low + high) / 2;
+		if (reader->keyframes[mid].frame <= frame) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (!low) {
+		reader_restart(reader, 0, reader->file_data_size);
+		return 0;
+	}
+	reader_restart(reader, reader->keyframes[low - 1].offset, reader->file_data_size);
+	return reader->keyframes[low - 1].frame;
+}
+
 void reader_ensure_data(event_reader *reader, size_t bytes)
 {
 	if (reader->buffer.size - reader->buffer.cur_pos < bytes) {
@@ -15,12 +15,34 @@ enum {
 	EVENT_VRAM_WORD_DELTA = 10,
 	EVENT_VDP_INTRAM = 11,
 	EVENT_STATE = 12,
-	EVENT_MULTI = 13
-	//14 and 15 are reserved for header types
+	EVENT_MULTI = 13,
+	//14 and 15 can't be used with the single byte header format as those values mark the other formats
+	EVENT_VRAM_BLOCK = 14,
+	EVENT_INTRAM_BLOCK = 15
+};
+
+//set in the flags of a VRAM block written by a DMA copy, which doesn't update the sprite cache
+#define EVENT_BLOCK_COPY 1
+
+//commands sent back to the source of an event log stream
+enum {
+	CMD_GAMEPAD_DOWN,
+	CMD_GAMEPAD_UP,
+	CMD_KEYFRAME //include the next state in the stream, each state starts a new zlib stream
 };
 
 #include "serialize.h"
 #include "zlib/zlib.h"
+
+//Event log files have a keyframe every EVENT_KEYFRAME_FRAMES frames. Each keyframe is a state
+//event at the start of its own zlib stream, so it can be decompressed without anything before it.
+//An index of keyframes at the end of the file makes it possible to seek to any of them
+#define EVENT_KEYFRAME_FRAMES 300
+typedef struct {
+	uint64_t offset; //relative to the start of the compressed data
+	uint32_t frame;  //number of frames logged before the keyframe
+} event_keyframe;
+
 typedef struct {
 	size_t storage;
 	uint8_t *socket_buffer;
@@ -32,6 +54,10 @@ typedef struct {
 	uint32_t repeat_delta;
 	deserialize_buffer buffer;
 	z_stream input_stream;
+	uint8_t *file_data; //compressed part of an event log file
+	size_t file_data_size;
+	event_keyframe *keyframes;
+	uint32_t num_keyframes;
 	uint8_t repeat_event;
 	uint8_t repeat_remaining;
 } event_reader;
@@ -46,12 +72,21 @@ void event_cycle_adjust(uint32_t cycle, uint32_t deduction);
 void event_log(uint8_t type, uint32_t cycle, uint8_t size, uint8_t *payload);
 void event_vram_word(uint32_t cycle, uint32_t address, uint16_t value);
 void event_vram_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc);
+//writes from a DMA, which get combined into block events
+void event_vram_block_byte(uint32_t cycle, uint16_t address, uint8_t byte, uint8_t auto_inc, uint8_t flags);
+void event_intram_block_word(uint32_t cycle, uint8_t address, uint16_t value);
 void event_state(uint32_t cycle, serialize_buffer *state);
+uint8_t event_log_active(void);
 void event_flush(uint32_t cycle);
 void event_soft_flush(uint32_t cycle);
 
 void init_event_reader(event_reader *reader, uint8_t *data, size_t size);
 void init_event_reader_tcp(event_reader *reader, char *address, char *port);
+//Creates an independent reader for the part of a file from one keyframe to the next so
+//separate parts can be decoded in parallel
+void init_event_reader_keyframe(event_reader *reader, event_reader *source, uint32_t keyframe);
+//Moves a file reader to the last keyframe at or before frame and returns the frame it starts at
+uint32_t reader_seek(event_reader *reader, uint32_t frame);
 uint8_t reader_next_event(event_reader *reader, uint32_t *cycle_out);
 void reader_ensure_data(event_reader *reader, size_t bytes);
 uint8_t reader_system_type(event_reader *reader);
@@ -0,0 +1,200 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures how much time the emulation thread spends in the event log while streaming to a number
+//of remotes over loopback. Each frame logs a mix of events similar to what a game with a fair
+//amount of DMA and music produces and frames are paced at 60Hz so compression and sending get
+//the same amount of time to happen in the background as they would in a real session
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include "event_log.h"
+#include "blastem.h"
+#include "saves.h"
+#include "util.h"
+
+tern_node *config;
+int headless = 1;
+system_header *current_system;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+static void gamepad_event(system_header *system, uint8_t pad, uint8_t button)
+{
+}
+
+#define MCLKS_FRAME (262 * 3420)
+#define VRAM_WORDS_PER_FRAME 1500
+#define YM_WRITES_PER_FRAME 60
+#define PSG_WRITES_PER_FRAME 20
+#define VDP_REG_WRITES_PER_FRAME 30
+#define STATE_SIZE (140 * 1024)
+#define MAX_REMOTES 7
+
+static char *port = "7820";
+static uint64_t received[MAX_REMOTES];
+static uint8_t streaming[MAX_REMOTES];
+
+static void *remote_reader(void *data)
+{
+	int index = (intptr_t)data;
+	struct addrinfo request, *result;
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	getaddrinfo("127.0.0.1", port, &request, &result);
+	int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (sock < 0 || connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+		fatal_error("Remote %d failed to connect\n", index);
+	}
+	freeaddrinfo(result);
+	uint8_t buf[64 * 1024];
+	int bytes;
+	while ((bytes = recv(sock, buf, sizeof(buf), 0)) > 0)
+	{
+		__atomic_fetch_add(received + index, bytes, __ATOMIC_RELAXED);
+		__atomic_store_n(streaming + index, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static uint16_t tiles[4096];
+static uint32_t cycle;
+static void log_frame(uint32_t frame)
+{
+	uint32_t start = cycle;
+	for (uint32_t i = 0; i < VDP_REG_WRITES_PER_FRAME; i++)
+	{
+		uint8_t reg[2] = {i % 24, frame + i};
+		event_log(EVENT_VDP_REG, start + i * 40, sizeof(reg), reg);
+	}
+	start += VDP_REG_WRITES_PER_FRAME * 40;
+	uint32_t base = (frame * 0x800) & 0xFFFF;
+	for (uint32_t i = 0; i < VRAM_WORDS_PER_FRAME; i++)
+	{
+		event_vram_word(start + i * 18, (base + i * 2) & 0xFFFF, tiles[(frame * 7 + i) % 4096]);
+	}
+	start += VRAM_WORDS_PER_FRAME * 18;
+	for (uint32_t i = 0; i < YM_WRITES_PER_FRAME; i++)
+	{
+		uint8_t ym[3] = {i & 1, 0x30 + i % 0x80, frame * 3 + i};
+		event_log(EVENT_YM_REG, start + i * 2000, sizeof(ym), ym);
+	}
+	start += YM_WRITES_PER_FRAME * 2000;
+	for (uint32_t i = 0; i < PSG_WRITES_PER_FRAME; i++)
+	{
+		uint8_t psg = 0x80 | ((frame + i) & 0x7F);
+		event_log(EVENT_PSG_REG, start + i * 5000, sizeof(psg), &psg);
+	}
+	cycle += MCLKS_FRAME;
+	event_flush(cycle);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char ** argv)
+{
+	int num_remotes = argc > 1 ? atoi(argv[1]) : 1;
+	uint32_t frames = argc > 2 ? strtoul(argv[2], NULL, 10) : 600;
+	if (argc > 3) {
+		port = argv[3];
+	}
+	if (num_remotes < 0 || num_remotes > MAX_REMOTES || !frames) {
+		fputs("usage: eventlogbench [remotes (0-7)] [frames] [port]\n", stderr);
+		return 1;
+	}
+	current_system = calloc(1, sizeof(system_header));
+	current_system->gamepad_down = gamepad_event;
+	current_system->gamepad_up = gamepad_event;
+	for (int i = 0; i < 4096; i++)
+	{
+		//tiles repeat a fair amount like real graphics data does
+		tiles[i] = (rand() % 16) * 0x1111 ^ (i % 64 ? 0 : rand());
+	}
+	serialize_buffer state;
+	init_serialize_sized(&state, STATE_SIZE);
+	for (int i = 0; i < STATE_SIZE; i++)
+	{
+		save_int8(&state, i % 256 < 128 ? 0 : rand());
+	}
+
+	event_log_tcp("127.0.0.1", port);
+	event_system_start(SYSTEM_GENESIS, VID_NTSC, "eventlogbench");
+	pthread_t readers[MAX_REMOTES];
+	for (int i = 0; i < num_remotes; i++)
+	{
+		pthread_create(readers + i, NULL, remote_reader, (void *)(intptr_t)i);
+	}
+	//run until every remote has been sent a state and is receiving the stream
+	double deadline = now() + 10;
+	uint32_t frame = 0;
+	for (;;)
+	{
+		int ready = 0;
+		for (int i = 0; i < num_remotes; i++)
+		{
+			ready += __atomic_load_n(streaming + i, __ATOMIC_RELAXED);
+		}
+		if (ready == num_remotes) {
+			break;
+		}
+		if (now() > deadline) {
+			fatal_error("Only %d of %d remotes connected\n", ready, num_remotes);
+		}
+		log_frame(frame++);
+		if (current_system->snapshot_requests & SNAPSHOT_BIT(EVENTLOG_SLOT)) {
+			current_system->snapshot_requests = 0;
+			event_state(cycle, &state);
+		}
+		usleep(1000);
+	}
+
+	double total = 0, worst = 0;
+	double next_frame = now();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		double start = now();
+		log_frame(frame++);
+		double elapsed = now() - start;
+		total += elapsed;
+		if (elapsed > worst) {
+			worst = elapsed;
+		}
+		next_frame += 1.0 / 60.0;
+		double remaining = next_frame - now();
+		if (remaining > 0) {
+			usleep(remaining * 1000000.0);
+		}
+	}
+	printf("%d remotes: %.2f us/frame on the emulation thread, worst frame %.2f us\n", num_remotes, total * 1000000.0 / frames, worst * 1000000.0);
+	//give the writer a moment to catch up before reporting what was delivered
+	usleep(500000);
+	for (int i = 0; i < num_remotes; i++)
+	{
+		printf("remote %d received %.1f KB\n", i, __atomic_load_n(received + i, __ATOMIC_RELAXED) / 1024.0);
+	}
+	return 0;
+}
@@ -0,0 +1,490 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Rebroadcasts one event log stream to any number of viewers. The compressed stream is forwarded
+//as is and kept in a ring of chunks that every viewer reads from at its own pace. The stream is
+//only inflated to find where each zlib stream starts, since a viewer can only start at one of
+//those and only if it begins with a state. Those keyframes are requested from the source when
+//there isn't a recent enough one for a viewer that just connected. Viewers that fall so far behind
+//that the part of the stream they still need is overwritten are disconnected
+#ifdef _WIN32
+#define WINVER 0x600
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#define poll WSAPoll
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "event_log.h"
+#include "util.h"
+#include "zlib/zlib.h"
+
+tern_node *config;
+int headless = 1;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+#define CHUNK_SIZE (16 * 1024)
+//viewers that connect start from the last keyframe if at most this much of the stream follows it
+#define MAX_JOIN_TAIL (128 * 1024)
+#define KEYFRAME_RETRY_MS 1000
+//viewers waiting for a new keyframe start from the old one after this long, in case the source
+//doesn't support keyframe requests
+#define KEYFRAME_WAIT_MS 3000
+#define DEFAULT_MAX_LAG_KB 8192
+#define NO_KEYFRAME 0xFFFFFFFFFFFFFFFFULL
+
+typedef struct {
+	uint8_t  *data;
+	uint32_t size;
+} relay_chunk;
+
+typedef struct {
+	uint64_t chunk; //sequence number of the chunk being sent
+	uint32_t offset;
+	uint32_t preamble_sent; //how much of the system start message has been sent
+	uint32_t connected; //time in milliseconds the viewer connected
+	int      sock;
+	uint8_t  waiting; //hasn't been given a keyframe to start from yet
+} viewer;
+
+static int source_sock, listen_sock;
+static uint8_t *system_start;
+static uint32_t system_start_size;
+
+static relay_chunk *ring;
+static uint32_t ring_size;
+static uint64_t head; //sequence number of the chunk being filled
+static uint64_t keyframe_chunk = NO_KEYFRAME;
+static uint64_t keyframe_pos; //stream offset the latest keyframe starts at
+static uint64_t stream_chunk; //chunk the zlib stream being received started in
+static uint64_t stream_pos;
+static uint64_t total_bytes;
+static uint8_t stream_start = 1; //next byte from the source starts a new zlib stream
+static uint8_t first_byte_pending; //type of the stream being filled isn't known yet
+static z_stream input_stream;
+
+static viewer *viewers;
+static uint32_t num_viewers, viewer_storage;
+static uint32_t waiting_viewers;
+static uint32_t last_keyframe_request;
+static uint8_t keyframe_requested;
+
+static uint32_t now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int connect_source(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(address, port, &request, &result)) {
+		fatal_error("Failed to resolve event log source %s:%s\n", address, port);
+	}
+	int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (sock < 0 || connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+		fatal_error("Failed to connect to event log source %s:%s\n", address, port);
+	}
+	freeaddrinfo(result);
+	int flag = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+	return sock;
+}
+
+static int open_listen(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	request.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(address, port, &request, &result)) {
+		fatal_error("Failed to resolve relay listen address %s:%s\n", address, port);
+	}
+	int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (sock < 0) {
+		fatal_error("Failed to create relay listen socket\n");
+	}
+	int param = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&param, sizeof(param));
+	if (bind(sock, result->ai_addr, result->ai_addrlen) < 0 || listen(sock, SOMAXCONN) < 0) {
+		fatal_error("Failed to listen for viewers on %s:%s\n", address, port);
+	}
+	freeaddrinfo(result);
+	socket_blocking(sock, 0);
+	return sock;
+}
+
+static void recv_all(int sock, uint8_t *data, size_t size)
+{
+	size_t total = 0;
+	while (total < size)
+	{
+		int bytes = recv(sock, data + total, size - total, 0);
+		if (bytes <= 0) {
+			fatal_error("Event log source disconnected before the stream started\n");
+		}
+		total += bytes;
+	}
+}
+
+static void request_keyframe(void)
+{
+	uint32_t now = now_ms();
+	if (keyframe_requested && now - last_keyframe_request < KEYFRAME_RETRY_MS) {
+		return;
+	}
+	uint8_t cmd = CMD_KEYFRAME;
+	send(source_sock, &cmd, 1, 0);
+	keyframe_requested = 1;
+	last_keyframe_request = now;
+}
+
+static void drop_viewer(uint32_t index, char *reason)
+{
+	viewer *v = viewers + index;
+	printf("viewer %d %s\n", v->sock, reason);
+	if (v->waiting) {
+		waiting_viewers--;
+	}
+	socket_close(v->sock);
+	viewers[index] = viewers[--num_viewers];
+}
+
+static void start_viewer(viewer *v, uint64_t chunk)
+{
+	v->chunk = chunk;
+	v->offset = 0;
+	if (v->waiting) {
+		v->waiting = 0;
+		waiting_viewers--;
+	}
+}
+
+static void new_chunk(uint8_t starts_stream)
+{
+	if (ring[head % ring_size].size) {
+		head++;
+	}
+	relay_chunk *chunk = ring + head % ring_size;
+	chunk->size = 0;
+	if (head >= ring_size) {
+		uint64_t overwritten = head - ring_size;
+		if (keyframe_chunk == overwritten) {
+			keyframe_chunk = NO_KEYFRAME;
+		}
+		for (uint32_t i = num_viewers; i > 0; i--)
+		{
+			viewer *v = viewers + i - 1;
+			if (!v->waiting && v->chunk <= overwritten) {
+				drop_viewer(i - 1, "evicted for falling too far behind");
+			}
+		}
+	}
+	if (starts_stream) {
+		stream_chunk = head;
+		stream_pos = total_bytes;
+		first_byte_pending = 1;
+	}
+}
+
+static void keyframe_found(void)
+{
+	keyframe_chunk = stream_chunk;
+	keyframe_pos = stream_pos;
+	keyframe_requested = 0;
+	for (uint32_t i = 0; i < num_viewers; i++)
+	{
+		if (viewers[i].waiting) {
+			start_viewer(viewers + i, keyframe_chunk);
+		}
+	}
+}
+
+static void append(uint8_t *data, uint32_t size)
+{
+	while (size)
+	{
+		relay_chunk *chunk = ring + head % ring_size;
+		if (chunk->size == CHUNK_SIZE) {
+			new_chunk(0);
+			chunk = ring + head % ring_size;
+		}
+		uint32_t amount = CHUNK_SIZE - chunk->size;
+		if (amount > size) {
+			amount = size;
+		}
+		memcpy(chunk->data + chunk->size, data, amount);
+		chunk->size += amount;
+		total_bytes += amount;
+		data += amount;
+		size -= amount;
+	}
+}
+
+//Adds data from the source to the ring, starting a new chunk wherever a zlib stream starts
+static void relay_data(uint8_t *data, uint32_t size)
+{
+	static uint8_t discard[64 * 1024];
+	input_stream.next_in = data;
+	input_stream.avail_in = size;
+	while (input_stream.avail_in)
+	{
+		if (stream_start) {
+			new_chunk(1);
+			stream_start = 0;
+		}
+		uint8_t *start = input_stream.next_in;
+		input_stream.next_out = discard;
+		input_stream.avail_out = sizeof(discard);
+		uLong out_before = input_stream.total_out;
+		int result = inflate(&input_stream, Z_NO_FLUSH);
+		if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+			fatal_error("inflate returned %d, event log stream is corrupt\n", result);
+		}
+		append(start, input_stream.next_in - start);
+		if (first_byte_pending && input_stream.total_out) {
+			first_byte_pending = 0;
+			//the first byte of a state event is a single byte header for EVENT_STATE
+			if (!out_before && discard[0] == EVENT_STATE << 4) {
+				keyframe_found();
+			}
+		}
+		if (result == Z_STREAM_END) {
+			inflateReset(&input_stream);
+			stream_start = 1;
+		} else if (result == Z_BUF_ERROR) {
+			break;
+		}
+	}
+	if (keyframe_chunk != NO_KEYFRAME && head - keyframe_chunk > ring_size / 2) {
+		//get a new keyframe well before this one gets overwritten
+		request_keyframe();
+	}
+}
+
+static uint8_t has_unsent(viewer *v)
+{
+	if (v->waiting) {
+		return 0;
+	}
+	if (v->preamble_sent < system_start_size || v->chunk < head) {
+		return 1;
+	}
+	return v->offset < ring[head % ring_size].size;
+}
+
+//returns 0 if the viewer has disconnected
+static uint8_t send_viewer(viewer *v)
+{
+	while (v->preamble_sent < system_start_size)
+	{
+		int sent = send(v->sock, system_start + v->preamble_sent, system_start_size - v->preamble_sent, 0);
+		if (sent <= 0) {
+			return sent < 0 && socket_error_is_wouldblock();
+		}
+		v->preamble_sent += sent;
+	}
+	while (!v->waiting)
+	{
+		relay_chunk *chunk = ring + v->chunk % ring_size;
+		if (v->offset == chunk->size) {
+			if (v->chunk == head) {
+				break;
+			}
+			v->chunk++;
+			v->offset = 0;
+			continue;
+		}
+		int sent = send(v->sock, chunk->data + v->offset, chunk->size - v->offset, 0);
+		if (sent <= 0) {
+			return sent < 0 && socket_error_is_wouldblock();
+		}
+		v->offset += sent;
+	}
+	return 1;
+}
+
+static void accept_viewers(void)
+{
+	int sock;
+	while ((sock = accept(listen_sock, NULL, NULL)) >= 0)
+	{
+		socket_blocking(sock, 0);
+		int flag = 1;
+		setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+		if (num_viewers == viewer_storage) {
+			viewer_storage = viewer_storage ? viewer_storage * 2 : 64;
+			viewers = realloc(viewers, viewer_storage * sizeof(viewer));
+		}
+		viewer *v = viewers + num_viewers++;
+		memset(v, 0, sizeof(viewer));
+		v->sock = sock;
+		v->connected = now_ms();
+		printf("viewer %d connected\n", sock);
+		if (keyframe_chunk != NO_KEYFRAME && total_bytes - keyframe_pos <= MAX_JOIN_TAIL) {
+			v->chunk = keyframe_chunk;
+		} else {
+			//starting from an old keyframe would leave the viewer a long way behind, wait for a new one
+			v->waiting = 1;
+			waiting_viewers++;
+			request_keyframe();
+		}
+		if (!send_viewer(v)) {
+			drop_viewer(num_viewers - 1, "disconnected");
+		}
+	}
+}
+
+//Only keyframe requests are passed on to the source, viewers don't get to send input
+static uint8_t receive_viewer(viewer *v)
+{
+	uint8_t buffer[256];
+	int bytes = recv(v->sock, buffer, sizeof(buffer), 0);
+	if (!bytes || (bytes < 0 && !socket_error_is_wouldblock())) {
+		return 0;
+	}
+	for (int i = 0; i < bytes; i++)
+	{
+		if (buffer[i] == CMD_KEYFRAME) {
+			//most likely another relay, the keyframe goes to everyone so it can start a new viewer
+			request_keyframe();
+		} else if (buffer[i] == CMD_GAMEPAD_DOWN || buffer[i] == CMD_GAMEPAD_UP) {
+			i++;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 4) {
+		fputs("usage: eventrelay SOURCE_ADDRESS SOURCE_PORT LISTEN_PORT [LISTEN_ADDRESS] [MAX_LAG_KB]\n", stderr);
+		return 1;
+	}
+	uint32_t max_lag_kb = argc > 5 ? strtoul(argv[5], NULL, 10) : DEFAULT_MAX_LAG_KB;
+	ring_size = max_lag_kb * 1024 / CHUNK_SIZE;
+	if (ring_size < 4) {
+		ring_size = 4;
+	}
+	ring = calloc(ring_size, sizeof(relay_chunk));
+	for (uint32_t i = 0; i < ring_size; i++)
+	{
+		ring[i].data = malloc(CHUNK_SIZE);
+	}
+	socket_init();
+	source_sock = connect_source(argv[1], argv[2]);
+	uint8_t header[3];
+	recv_all(source_sock, header, sizeof(header));
+	system_start_size = sizeof(header) + header[2];
+	system_start = malloc(system_start_size);
+	memcpy(system_start, header, sizeof(header));
+	recv_all(source_sock, system_start + sizeof(header), header[2]);
+	if (inflateInit(&input_stream) != Z_OK) {
+		fatal_error("inflateInit failed\n");
+	}
+	listen_sock = open_listen(argc > 4 ? argv[4] : "0.0.0.0", argv[3]);
+	printf("relaying %.*s from %s:%s on port %s\n", header[2], system_start + sizeof(header), argv[1], argv[2], argv[3]);
+
+	uint8_t *recv_buffer = malloc(CHUNK_SIZE);
+	struct pollfd *fds = NULL;
+	uint32_t fd_storage = 0;
+	for (;;)
+	{
+		if (num_viewers + 2 > fd_storage) {
+			fd_storage = (num_viewers + 2) * 2;
+			fds = realloc(fds, fd_storage * sizeof(struct pollfd));
+		}
+		fds[0].fd = source_sock;
+		fds[0].events = POLLIN;
+		fds[1].fd = listen_sock;
+		fds[1].events = POLLIN;
+		uint32_t polled = num_viewers;
+		for (uint32_t i = 0; i < polled; i++)
+		{
+			fds[i + 2].fd = viewers[i].sock;
+			fds[i + 2].events = POLLIN;
+			if (has_unsent(viewers + i)) {
+				fds[i + 2].events |= POLLOUT;
+			}
+		}
+		int timeout = waiting_viewers ? KEYFRAME_RETRY_MS : -1;
+		if (poll(fds, polled + 2, timeout) < 0) {
+			fatal_error("poll failed\n");
+		}
+		//backwards so dropping a viewer doesn't move one that hasn't been checked yet
+		for (uint32_t i = polled; i > 0; i--)
+		{
+			short revents = fds[i + 1].revents;
+			viewer *v = viewers + i - 1;
+			if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive_viewer(v)) {
+				drop_viewer(i - 1, "disconnected");
+			} else if ((revents & POLLOUT) && !send_viewer(v)) {
+				drop_viewer(i - 1, "disconnected");
+			}
+		}
+		if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			int bytes = recv(source_sock, recv_buffer, CHUNK_SIZE, 0);
+			if (bytes <= 0) {
+				puts("event log source disconnected");
+				break;
+			}
+			relay_data(recv_buffer, bytes);
+			//viewers that are caught up get the new data right away, the rest are sent to when writable
+			for (uint32_t i = num_viewers; i > 0; i--)
+			{
+				viewer *v = viewers + i - 1;
+				if (!v->waiting && v->chunk + 1 >= head && !send_viewer(v)) {
+					drop_viewer(i - 1, "disconnected");
+				}
+			}
+		}
+		if (fds[1].revents & POLLIN) {
+			accept_viewers();
+		}
+		if (waiting_viewers) {
+			request_keyframe();
+			uint32_t now = now_ms();
+			for (uint32_t i = 0; i < num_viewers && keyframe_chunk != NO_KEYFRAME; i++)
+			{
+				if (viewers[i].waiting && now - viewers[i].connected >= KEYFRAME_WAIT_MS) {
+					start_viewer(viewers + i, keyframe_chunk);
+				}
+			}
+		}
+	}
+	//give viewers whatever was left of the stream before closing
+	for (uint32_t i = 0; i < num_viewers; i++)
+	{
+		socket_blocking(viewers[i].sock, 1);
+		send_viewer(viewers + i);
+		socket_close(viewers[i].sock);
+	}
+	return 0;
+}
@@ -31,6 +31,25 @@ static void sync_sound(gen_player *gen, uint32_t target)
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
+static void set_skipping(gen_player *player, uint8_t skipping)
+{
+	player->vdp->suppress_output = skipping || player->batch;
+	render_audio_discard(player->ym->audio, skipping);
+	render_audio_discard(player->psg->audio, skipping);
+}
+
+//Runs the VDP and sound chips up to cycle, in batch mode sound is never generated and
+//the VDP only runs when pixel output is wanted
+static void run_to(gen_player *player, uint32_t cycle)
+{
+	if (!player->batch) {
+		sync_sound(player, cycle);
+	}
+	if (!(player->batch_flags & PLAYER_NO_VIDEO)) {
+		vdp_run_context(player->vdp, cycle);
+	}
+}
+
 static void run(gen_player *player)
 {
 	while(player->reader.socket || player->reader.buffer.cur_pos < player->reader.buffer.size)
@@ -40,25 +59,42 @@ static void run(gen_player *player)
 		switch (event)
 		{
 		case EVENT_FLUSH:
-			sync_sound(player, cycle);
-			vdp_run_context(player->vdp, cycle);
+			run_to(player, cycle);
+			player->frame++;
+			if (player->skip_frames && !--player->skip_frames) {
+				set_skipping(player, 0);
+			}
+			if (player->frame_hook) {
+				player->frame_hook(player, player->hook_data);
+			}
 			break;
 		case EVENT_ADJUST: {
-			sync_sound(player, cycle);
-			vdp_run_context(player->vdp, cycle);
+			run_to(player, cycle);
 			uint32_t deduction = load_int32(&player->reader.buffer);
-			ym_adjust_cycles(player->ym, deduction);
-			vdp_adjust_cycles(player->vdp, deduction);
-			player->psg->cycles -= deduction;
+			if (!(player->batch_flags & PLAYER_NO_VIDEO)) {
+				vdp_adjust_cycles(player->vdp, deduction);
+			}
+			if (!player->batch) {
+				ym_adjust_cycles(player->ym, deduction);
+				player->psg->cycles -= deduction;
+			}
 			break;
 		case EVENT_PSG_REG:
-			sync_sound(player, cycle);
 			reader_ensure_data(&player->reader, 1);
+			if (player->batch) {
+				player->reader.buffer.cur_pos++;
+				break;
+			}
+			sync_sound(player, cycle);
 			psg_write(player->psg, load_int8(&player->reader.buffer));
 			break;
 		case EVENT_YM_REG: {
-			sync_sound(player, cycle);
 			reader_ensure_data(&player->reader, 3);
+			if (player->batch) {
+				player->reader.buffer.cur_pos += 3;
+				break;
+			}
+			sync_sound(player, cycle);
 			uint8_t part = load_int8(&player->reader.buffer);
 			uint8_t reg = load_int8(&player->reader.buffer);
 			uint8_t value = load_int8(&player->reader.buffer);
@@ -88,8 +124,10 @@ static void run(gen_player *player)
 			break;
 		}
 		default:
-			vdp_run_context(player->vdp, cycle);
-			vdp_replay_event(player->vdp, event, &player->reader);
+			if (!(player->batch_flags & PLAYER_NO_VIDEO)) {
+				vdp_run_context(player->vdp, cycle);
+			}
+			vdp_replay_event(player->vdp, event, &player->reader, !(player->batch_flags & PLAYER_NO_VIDEO));
 		}
 		}
 			
@@ -173,3 +211,21 @@ gen_player *alloc_config_gen_player_reader(event_reader *reader)
 	return player;
 }
 
+
+void gen_player_seek(gen_player *player, uint32_t frame)
+{
+	//playback starts at the nearest keyframe and runs without output until the requested frame
+	player->frame = reader_seek(&player->reader, frame);
+	player->skip_frames = frame - player->frame;
+	set_skipping(player, player->skip_frames != 0);
+}
+
+void gen_player_batch(gen_player *player, uint8_t flags, player_frame_hook hook, void *data)
+{
+	player->batch = 1;
+	player->batch_flags = flags;
+	player->frame_hook = hook;
+	player->hook_data = data;
+	player->vdp->suppress_output = 1;
+	run(player);
+}
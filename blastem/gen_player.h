@@ -8,7 +8,14 @@
 #include "ym2612.h"
 #include "event_log.h"
 
-typedef struct {
+typedef struct gen_player gen_player;
+//called after each frame of a batch run, the frame is complete in player->vdp
+typedef void (*player_frame_hook)(gen_player *player, void *data);
+
+//skip rendering in batch mode, VDP events only update VRAM, CRAM, VSRAM and registers
+#define PLAYER_NO_VIDEO 1
+
+struct gen_player {
 	system_header   header;
 	
 	vdp_context     *vdp;
@@ -18,9 +25,18 @@ typedef struct {
 	render_thread   thread;
 #endif
 	event_reader    reader;
-} gen_player;
+	player_frame_hook frame_hook;
+	void            *hook_data;
+	uint32_t        frame; //number of frames played so far
+	uint32_t        skip_frames; //frames left to run without output after a seek
+	uint8_t         batch; //playing as fast as possible with no sound for analysis
+	uint8_t         batch_flags;
+};
 
 gen_player *alloc_config_gen_player(void *stream, uint32_t rom_size);
 gen_player *alloc_config_gen_player_reader(event_reader *reader);
+void gen_player_seek(gen_player *player, uint32_t frame);
+//Plays the whole log as fast as possible without sound, calling hook after every frame
+void gen_player_batch(gen_player *player, uint8_t flags, player_frame_hook hook, void *data);
 
 #endif //GEN_PLAYER_H_
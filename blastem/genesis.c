@@ -16,6 +16,7 @@
 #include "debug.h"
 #include "gdb_remote.h"
 #include "saves.h"
+#include "state_file.h"
 #include "bindings.h"
 #include "jcart.h"
 #include "config.h"
@@ -50,6 +51,15 @@ uint32_t MCLKS_PER_68K;
 #define Z80_OPTS options
 #endif
 
+//My refresh emulation isn't currently good enough and causes more problems than it solves
+#define REFRESH_EMULATION
+#ifdef REFRESH_EMULATION
+#define REFRESH_INTERVAL 128
+#define REFRESH_DELAY 2
+uint32_t last_sync_cycle;
+uint32_t refresh_counter;
+#endif
+
 void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc, uint8_t all)
 {
 	if (all) {
@@ -79,6 +89,9 @@ void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68
 		save_int8(buf, gen->z80->reset);
 		save_int8(buf, gen->z80->busreq);
 		save_int16(buf, gen->z80_bank_reg);
+#ifdef REFRESH_EMULATION
+		save_int32(buf, refresh_counter);
+#endif
 		end_section(buf);
 		
 		start_section(buf, SECTION_SEGA_IO_1);
@@ -117,6 +130,189 @@ void genesis_serialize(genesis_context *gen, serialize_buffer *buf, uint32_t m68
 	}
 }
 
+//values for rollback_pending
+enum {
+	ROLLBACK_NONE,
+	ROLLBACK_RESTORE,
+	ROLLBACK_RESTORE_EXIT //an exit was requested too, so don't resume after restoring
+};
+
+//Brings both gamepads in line with button masks picked by netplay or sent to a run-ahead instance
+static void apply_pad_masks(genesis_context *gen, uint16_t *inputs, uint8_t force)
+{
+	for (int pad = 0; pad < 2; pad++)
+	{
+		//gamepad state isn't part of a save state, so everything is set again after a restore
+		uint16_t changed = force ? 0xFFFF : inputs[pad] ^ gen->applied_pads[pad];
+		for (uint8_t button = DPAD_UP; button < NUM_GAMEPAD_BUTTONS; button++)
+		{
+			if (!(changed & 1 << button)) {
+				continue;
+			}
+			if (inputs[pad] & 1 << button) {
+				io_gamepad_down(&gen->io, pad + 1, button);
+				if (gen->mapper_type == MAPPER_JCART) {
+					jcart_gamepad_down(gen, pad + 1, button);
+				}
+			} else {
+				io_gamepad_up(&gen->io, pad + 1, button);
+				if (gen->mapper_type == MAPPER_JCART) {
+					jcart_gamepad_up(gen, pad + 1, button);
+				}
+			}
+		}
+		gen->applied_pads[pad] = inputs[pad];
+	}
+}
+
+static void apply_rollback_inputs(genesis_context *gen, uint16_t *inputs, uint8_t force)
+{
+	apply_pad_masks(gen, inputs, force);
+	//frames that are being run again have already been seen and heard, discarding their audio
+	//also keeps them out of VGM logs and stem captures
+	gen->vdp->suppress_output = gen->rollback->catching_up;
+	render_audio_discard(gen->ym->audio, gen->rollback->catching_up);
+	render_audio_discard(gen->psg->audio, gen->rollback->catching_up);
+}
+
+//Prepares a buffer for states that are consumed before the next one is taken, the first call
+//sizes it with a dry run so it doesn't need to grow after that
+static serialize_buffer *snapshot_buffer(genesis_context *gen, serialize_buffer *buf, uint32_t m68k_pc)
+{
+	if (buf->data) {
+		reset_serialize(buf);
+	} else {
+		init_serialize_dry_run(buf);
+		genesis_serialize(gen, buf, m68k_pc, 1);
+		init_serialize_sized(buf, buf->size);
+	}
+	return buf;
+}
+
+static void load_snapshot(genesis_context *gen, uint8_t *data, size_t size);
+
+//Only the last of the frames run ahead of the real timeline is seen and heard, the others are also
+//kept out of VGM logs and stem captures by discarding their audio
+static void set_runahead_output(genesis_context *gen, uint8_t visible)
+{
+	gen->vdp->suppress_output = !visible;
+	render_audio_discard(gen->ym->audio, !visible);
+	render_audio_discard(gen->psg->audio, !visible);
+}
+
+//Starts over from the current state after it was changed by something other than running frames
+static void runahead_reset(genesis_context *gen)
+{
+	runahead_session *ra = gen->runahead;
+	if (ra->is_instance) {
+		return;
+	}
+	//the instance running the real timeline is replaced by a copy of the new state
+	runahead_instance_stop(ra);
+	gen->runahead_state.size = 0;
+	ra->phase = 0;
+	ra->input_sent = 0;
+	gen->runahead_pending = 0;
+	set_runahead_output(gen, 0);
+}
+
+static void runahead_instance_begin(genesis_context *gen)
+{
+	runahead_session *ra = gen->runahead;
+	serialize_buffer sizing;
+	init_serialize_dry_run(&sizing);
+	genesis_serialize(gen, &sizing, gen->m68k->last_prefetch_address, 1);
+	//the instance starts from an exact copy of the current state, including the gamepads
+	memcpy(gen->applied_pads, ra->pads, sizeof(ra->pads));
+	//it hands over this state before it needs any input
+	ra->input_sent = 1;
+	if (runahead_instance_start(ra, sizing.size * 2)) {
+		//nothing this process does is seen or heard and it must not exit on its own
+		exit_after = 0;
+		set_runahead_output(gen, 0);
+		//input only comes from the other process, polling here would take events meant for it
+		for (int i = 0; i < 3; i++)
+		{
+			gen->io.ports[i].no_poll = 1;
+		}
+		//hand over the state it starts with right away
+		gen->header.snapshot_requests |= SNAPSHOT_BIT(RUNAHEAD_SLOT);
+	}
+}
+
+//Has the instance run the frame this process started on since going back, with the input this
+//process read for it. Later changes only reach the real timeline in the next frame, but the
+//frames run ahead see them right away like they do in snapshot mode
+static void runahead_send_input(genesis_context *gen)
+{
+	runahead_session *ra = gen->runahead;
+	if (ra->started && !ra->is_instance && !ra->input_sent) {
+		runahead_instance_run(ra);
+		ra->input_sent = 1;
+	}
+}
+
+static void runahead_frame_end(genesis_context *gen, m68k_context *context)
+{
+	runahead_session *ra = gen->runahead;
+	if (ra->is_instance) {
+		//the real timeline hands over its state at the end of every frame
+		gen->header.snapshot_requests |= SNAPSHOT_BIT(RUNAHEAD_SLOT);
+		return;
+	}
+	ra->phase++;
+	if (ra->phase > ra->frames) {
+		//the frame that's shown is done, go back to where the real timeline left off
+		set_runahead_output(gen, 0);
+		gen->runahead_pending = context->should_return ? ROLLBACK_RESTORE_EXIT : ROLLBACK_RESTORE;
+		context->sync_cycle = context->current_cycle;
+		context->should_return = 1;
+		return;
+	}
+	if (ra->phase == 1) {
+		if (ra->mode == RUNAHEAD_SNAPSHOT) {
+			//the frame that just ended is the only one of each batch that's part of the real timeline
+			gen->header.snapshot_requests |= SNAPSHOT_BIT(RUNAHEAD_SLOT);
+		} else if (!ra->started) {
+			//from here on the instance owns the real timeline and this process only runs ahead of it
+			runahead_instance_begin(gen);
+			if (ra->is_instance) {
+				return;
+			}
+		} else {
+			//nothing read the gamepads during the frame, so any input will do
+			runahead_send_input(gen);
+		}
+	}
+	set_runahead_output(gen, ra->phase == ra->frames);
+}
+
+static void runahead_restore(genesis_context *gen)
+{
+	runahead_session *ra = gen->runahead;
+	if (ra->is_instance) {
+		//this process only runs the real timeline, one frame each time the other one asks for it
+		uint16_t pads[2];
+		runahead_instance_wait(ra, pads);
+		apply_pad_masks(gen, pads, 0);
+		return;
+	}
+	if (ra->started) {
+		//continue from the end of the last frame the instance ran, it runs the next one as soon as
+		//this process has read the input for it
+		size_t size;
+		uint8_t *state = runahead_instance_state(ra, &size);
+		load_snapshot(gen, state, size);
+		ra->input_sent = 0;
+	} else if (gen->runahead_state.size) {
+		load_snapshot(gen, gen->runahead_state.data, gen->runahead_state.size);
+	}
+	//the restored frame counter would otherwise look like the end of a frame
+	gen->last_frame = gen->vdp->frame;
+	ra->phase = 0;
+	set_runahead_output(gen, 0);
+}
+
 static uint8_t *serialize(system_header *sys, size_t *size_out)
 {
 	genesis_context *gen = (genesis_context *)sys;
@@ -180,6 +376,10 @@ static void bus_arbiter_deserialize(deserialize_buffer *buf, void *vgen)
 	gen->z80->reset = load_int8(buf);
 	gen->z80->busreq = load_int8(buf);
 	gen->z80_bank_reg = load_int16(buf) & 0x1FF;
+#ifdef REFRESH_EMULATION
+	//older states don't have this, so just start a fresh refresh interval
+	refresh_counter = buf->cur_pos < buf->size ? load_int32(buf) : 0;
+#endif
 }
 
 static void tmss_deserialize(deserialize_buffer *buf, void *vgen)
@@ -194,25 +394,38 @@ static void check_tmss_lock(genesis_context *gen);
 static void toggle_tmss_rom(genesis_context *gen);
 void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
 {
-	register_section_handler(buf, (section_handler){.fun = m68k_deserialize, .data = gen->m68k}, SECTION_68000);
-	register_section_handler(buf, (section_handler){.fun = z80_deserialize, .data = gen->z80}, SECTION_Z80);
-	register_section_handler(buf, (section_handler){.fun = vdp_deserialize, .data = gen->vdp}, SECTION_VDP);
-	register_section_handler(buf, (section_handler){.fun = ym_deserialize, .data = gen->ym}, SECTION_YM2612);
-	register_section_handler(buf, (section_handler){.fun = psg_deserialize, .data = gen->psg}, SECTION_PSG);
-	register_section_handler(buf, (section_handler){.fun = bus_arbiter_deserialize, .data = gen}, SECTION_GEN_BUS_ARBITER);
-	register_section_handler(buf, (section_handler){.fun = io_deserialize, .data = gen->io.ports}, SECTION_SEGA_IO_1);
-	register_section_handler(buf, (section_handler){.fun = io_deserialize, .data = gen->io.ports + 1}, SECTION_SEGA_IO_2);
-	register_section_handler(buf, (section_handler){.fun = io_deserialize, .data = gen->io.ports + 2}, SECTION_SEGA_IO_EXT);
-	register_section_handler(buf, (section_handler){.fun = ram_deserialize, .data = gen}, SECTION_MAIN_RAM);
-	register_section_handler(buf, (section_handler){.fun = zram_deserialize, .data = gen}, SECTION_SOUND_RAM);
-	register_section_handler(buf, (section_handler){.fun = cart_deserialize, .data = gen}, SECTION_MAPPER);
-	register_section_handler(buf, (section_handler){.fun = tmss_deserialize, .data = gen}, SECTION_TMSS);
+	if (!gen->section_handlers) {
+		//the handlers never change, so the table is built once and states restored every frame don't allocate
+		deserialize_buffer handlers;
+		init_deserialize(&handlers, NULL, 0);
+		register_section_handler(&handlers, (section_handler){.fun = m68k_deserialize, .data = gen->m68k}, SECTION_68000);
+		register_section_handler(&handlers, (section_handler){.fun = z80_deserialize, .data = gen->z80}, SECTION_Z80);
+		register_section_handler(&handlers, (section_handler){.fun = vdp_deserialize, .data = gen->vdp}, SECTION_VDP);
+		register_section_handler(&handlers, (section_handler){.fun = ym_deserialize, .data = gen->ym}, SECTION_YM2612);
+		register_section_handler(&handlers, (section_handler){.fun = psg_deserialize, .data = gen->psg}, SECTION_PSG);
+		register_section_handler(&handlers, (section_handler){.fun = bus_arbiter_deserialize, .data = gen}, SECTION_GEN_BUS_ARBITER);
+		register_section_handler(&handlers, (section_handler){.fun = io_deserialize, .data = gen->io.ports}, SECTION_SEGA_IO_1);
+		register_section_handler(&handlers, (section_handler){.fun = io_deserialize, .data = gen->io.ports + 1}, SECTION_SEGA_IO_2);
+		register_section_handler(&handlers, (section_handler){.fun = io_deserialize, .data = gen->io.ports + 2}, SECTION_SEGA_IO_EXT);
+		register_section_handler(&handlers, (section_handler){.fun = ram_deserialize, .data = gen}, SECTION_MAIN_RAM);
+		register_section_handler(&handlers, (section_handler){.fun = zram_deserialize, .data = gen}, SECTION_SOUND_RAM);
+		register_section_handler(&handlers, (section_handler){.fun = cart_deserialize, .data = gen}, SECTION_MAPPER);
+		register_section_handler(&handlers, (section_handler){.fun = tmss_deserialize, .data = gen}, SECTION_TMSS);
+		gen->section_handlers = handlers.handlers;
+		gen->max_section_handler = handlers.max_handler;
+	}
+	buf->handlers = gen->section_handlers;
+	buf->max_handler = gen->max_section_handler;
 	uint8_t tmss_old = gen->tmss;
 	gen->tmss = 0xFF;
 	while (buf->cur_pos < buf->size)
 	{
 		load_section(buf);
 	}
+#ifdef REFRESH_EMULATION
+	//the 68K cycle count can go backwards here, which would look like a huge gap since the last sync
+	last_sync_cycle = gen->m68k->current_cycle;
+#endif
 	if (gen->version_reg & 0xF) {
 		if (gen->tmss == 0xFF) {
 			//state lacked a TMSS section, assume that the game ROM is mapped in
@@ -228,14 +441,12 @@ void genesis_deserialize(deserialize_buffer *buf, genesis_context *gen)
 	}
 	update_z80_bank_pointer(gen);
 	adjust_int_cycle(gen->m68k, gen->vdp);
-	free(buf->handlers);
 	buf->handlers = NULL;
 }
 
 #include "m68k_internal.h" //needed for get_native_address_trans, should be eliminated once handling of PC is cleaned up
-static void deserialize(system_header *sys, uint8_t *data, size_t size)
+static void load_snapshot(genesis_context *gen, uint8_t *data, size_t size)
 {
-	genesis_context *gen = (genesis_context *)sys;
 	deserialize_buffer buffer;
 	init_deserialize(&buffer, data, size);
 	genesis_deserialize(&buffer, gen);
@@ -243,6 +454,16 @@ static void deserialize(system_header *sys, uint8_t *data, size_t size)
 	gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->last_prefetch_address);
 }
 
+static void runahead_reset(genesis_context *gen);
+static void deserialize(system_header *sys, uint8_t *data, size_t size)
+{
+	genesis_context *gen = (genesis_context *)sys;
+	load_snapshot(gen, data, size);
+	if (gen->runahead) {
+		runahead_reset(gen);
+	}
+}
+
 uint16_t read_dma_value(uint32_t address)
 {
 	genesis_context *genesis = (genesis_context *)current_system;
@@ -391,27 +612,84 @@ static void sync_sound(genesis_context * gen, uint32_t target)
 		//printf("Running PSG to cycle %d\n", cur_target);
 		psg_run(gen->psg, cur_target);
 		//printf("Running YM-2612 to cycle %d\n", cur_target);
-		ym_run(gen->ym, cur_target);
+		ym_advance(gen->ym, cur_target);
 	}
 	psg_run(gen->psg, target);
-	ym_run(gen->ym, target);
+	//YM-2612 synthesis is deferred until the audio output needs it, register writes are queued until then
+	ym_advance(gen->ym, target);
 
 	//printf("Target: %d, YM bufferpos: %d, PSG bufferpos: %d\n", target, gen->ym->buffer_pos, gen->psg->buffer_pos * 2);
 }
 
-//My refresh emulation isn't currently good enough and causes more problems than it solves
-#define REFRESH_EMULATION
-#ifdef REFRESH_EMULATION
-#define REFRESH_INTERVAL 128
-#define REFRESH_DELAY 2
-uint32_t last_sync_cycle;
-uint32_t refresh_counter;
-#endif
-
 #include <limits.h>
 #define ADJUST_BUFFER (8*MCLKS_LINE*313)
 #define MAX_NO_ADJUST (UINT_MAX-ADJUST_BUFFER)
 
+#ifndef NEW_CORE
+static uint32_t genesis_translated_bytes(genesis_context *gen)
+{
+	uint32_t total = gen->m68k->options->gen.translated_bytes;
+#ifndef NO_Z80
+	total += gen->z80->options->gen.translated_bytes;
+#endif
+	return total;
+}
+
+//Discards all translated code for both CPUs and returns the code chunks allocated for it to the arena
+//This can only be done while the 68K is stopped as translated code might otherwise still be on the stack
+static void flush_translated_code(genesis_context *gen)
+{
+	m68k_flush_code(gen->m68k);
+#ifndef NO_Z80
+	z80_flush_code(gen->z80);
+#endif
+	release_blocks_after(gen->code_arena_mark);
+	debug_message("Flushed translation cache\n");
+}
+#endif
+
+//Serializes the current state once for each internal consumer that asked for it this frame
+static void take_snapshots(genesis_context *gen, m68k_context *context, uint32_t address, uint8_t requests)
+{
+	if (requests & SNAPSHOT_BIT(EVENTLOG_SLOT)) {
+		//the event log keyframe leaves out the CPUs, so it can't share a buffer with the others
+		serialize_buffer *buf = snapshot_buffer(gen, &gen->snapshot, address);
+		genesis_serialize(gen, buf, address, 0);
+		event_state(context->current_cycle, buf);
+	}
+	if (requests & SNAPSHOT_BIT(RUNAHEAD_SLOT)) {
+		//the run-ahead snapshot has to survive until the frames run ahead are done
+		serialize_buffer *buf = snapshot_buffer(gen, &gen->runahead_state, address);
+		genesis_serialize(gen, buf, address, 1);
+		if (gen->runahead->is_instance) {
+			runahead_instance_publish(gen->runahead, buf->data, buf->size);
+			//wait for the process running ahead to ask for the next frame
+			gen->runahead_pending = ROLLBACK_RESTORE;
+			context->sync_cycle = context->current_cycle;
+			context->should_return = 1;
+		}
+	}
+	if (!(requests & (SNAPSHOT_BIT(REWIND_SLOT) | SNAPSHOT_BIT(ROLLBACK_SLOT)))) {
+		return;
+	}
+	serialize_buffer *buf = snapshot_buffer(gen, &gen->snapshot, address);
+	genesis_serialize(gen, buf, address, 1);
+	if (requests & SNAPSHOT_BIT(REWIND_SLOT)) {
+		rewind_push(gen->rewind, buf->data, buf->size);
+	}
+	if (requests & SNAPSHOT_BIT(ROLLBACK_SLOT)) {
+		uint16_t inputs[2];
+		if (rollback_frame_start(gen->rollback, buf->data, buf->size, inputs)) {
+			//the other player's input for an earlier frame was predicted wrong, so it needs to be run again
+			gen->rollback_pending = context->should_return ? ROLLBACK_RESTORE_EXIT : ROLLBACK_RESTORE;
+			context->sync_cycle = context->current_cycle;
+			context->should_return = 1;
+		} else {
+			apply_rollback_inputs(gen, inputs, 0);
+		}
+	}
+}
+
 m68k_context * sync_components(m68k_context * context, uint32_t address)
 {
 	genesis_context * gen = context->system;
@@ -443,6 +721,22 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		gen->last_frame = v_context->frame;
 		event_flush(mclks);
 		gen->last_flush_cycle = mclks;
+		if (gen->rollback) {
+			//netplay needs the state at the start of every frame
+			gen->header.snapshot_requests |= SNAPSHOT_BIT(ROLLBACK_SLOT);
+		} else if (gen->runahead) {
+			runahead_frame_end(gen, context);
+		} else if (gen->rewind) {
+			if (gen->header.rewinding) {
+				//an exit request takes priority, rewinding carries on from the next frame
+				if (!context->should_return) {
+					gen->rewind_pending = 1;
+					context->should_return = 1;
+				}
+			} else {
+				gen->header.snapshot_requests |= SNAPSHOT_BIT(REWIND_SLOT);
+			}
+		}
 
 		if(exit_after){
 			--exit_after;
@@ -462,7 +756,8 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 			context->current_cycle -= deduction;
 			z80_adjust_cycles(z_context, deduction);
 			ym_adjust_cycles(gen->ym, deduction);
-			if (gen->ym->vgm) {
+			//a frame that isn't logged is run again or thrown away, the log only follows the frames that are output
+			if (gen->ym->vgm && !gen->ym->audio->discard) {
 				vgm_adjust_cycles(gen->ym->vgm, deduction);
 			}
 			gen->psg->cycles -= deduction;
@@ -484,7 +779,7 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 		vdp_int_ack(v_context);
 		context->int_ack = 0;
 	}
-	if (!address && (gen->header.enter_debugger || gen->header.save_state)) {
+	if (!address && (gen->header.enter_debugger || gen->header.save_state || gen->header.snapshot_requests)) {
 		context->sync_cycle = context->current_cycle + 1;
 	}
 	adjust_int_cycle(context, v_context);
@@ -500,13 +795,12 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 				gdb_debug_enter(context, address);
 			}
 		}
+		uint8_t wants_state = gen->header.save_state || gen->header.snapshot_requests;
 #ifdef NEW_CORE
-		if (gen->header.save_state) {
+		if (wants_state) {
 #else
-		if (gen->header.save_state && (z_context->pc || !z_context->native_pc || z_context->reset || !z_context->busreq)) {
+		if (wants_state && (z_context->pc || !z_context->native_pc || z_context->reset || !z_context->busreq)) {
 #endif
-			uint8_t slot = gen->header.save_state - 1;
-			gen->header.save_state = 0;
 #ifndef NEW_CORE
 			if (z_context->native_pc && !z_context->reset) {
 				//advance Z80 core to the start of an instruction
@@ -516,33 +810,57 @@ m68k_context * sync_components(m68k_context * context, uint32_t address)
 				}
 			}
 #endif
-			char *save_path = slot >= SERIALIZE_SLOT ? NULL : get_slot_name(&gen->header, slot, use_native_states ? "state" : "gst");
-			if (use_native_states || slot >= SERIALIZE_SLOT) {
-				serialize_buffer state;
-				init_serialize(&state);
-				genesis_serialize(gen, &state, address, slot != EVENTLOG_SLOT);
-				if (slot == SERIALIZE_SLOT) {
-					gen->serialize_tmp = state.data;
-					gen->serialize_size = state.size;
-					context->sync_cycle = context->current_cycle;
-					context->should_return = 1;
-				} else if (slot == EVENTLOG_SLOT) {
-					event_state(context->current_cycle, &state);
+			if (gen->header.snapshot_requests) {
+				uint8_t requests = gen->header.snapshot_requests;
+				gen->header.snapshot_requests = 0;
+				take_snapshots(gen, context, address, requests);
+			}
+			if (gen->header.save_state) {
+				uint8_t slot = gen->header.save_state - 1;
+				gen->header.save_state = 0;
+				char *save_path = slot >= SERIALIZE_SLOT ? NULL : get_slot_name(&gen->header, slot, use_native_states ? "state" : "gst");
+				if (use_native_states || slot >= SERIALIZE_SLOT) {
+					serialize_buffer state;
+					init_serialize(&state);
+					genesis_serialize(gen, &state, address, 1);
+					if (slot == SERIALIZE_SLOT) {
+						gen->serialize_tmp = state.data;
+						gen->serialize_size = state.size;
+						context->sync_cycle = context->current_cycle;
+						context->should_return = 1;
+					} else {
+						//the file is written in the background
+						save_to_file(&state, save_path);
+						debug_message("Saving state to %s\n", save_path);
+					}
 				} else {
-					save_to_file(&state, save_path);
-					free(state.data);
+					save_gst(gen, save_path, address);
+					debug_message("Saved state to %s\n", save_path);
 				}
-			} else {
-				save_gst(gen, save_path, address);
+				free(save_path);
 			}
-			if (slot != SERIALIZE_SLOT) {
-				debug_message("Saved state to %s\n", save_path);
-			}
-			free(save_path);
-		} else if(gen->header.save_state) {
+		} else if (wants_state) {
 			context->sync_cycle = context->current_cycle + 1;
 		}
 	}
+#ifndef NEW_CORE
+	if (gen->code_flush_pending) {
+		//make sure the 68K returns at the next instruction boundary
+		context->target_cycle = context->current_cycle;
+	} else if (
+		gen->code_cache_limit && !context->should_return && !gen->header.save_state && !gen->header.snapshot_requests
+		&& !gen->header.enter_debugger
+		&& genesis_translated_bytes(gen) > gen->code_cache_limit
+#ifndef NO_Z80
+		//translated Z80 code can only be discarded when it's stopped at an instruction boundary
+		&& (z_context->pc || !z_context->native_pc || z_context->reset)
+#endif
+	) {
+		gen->code_flush_pending = 1;
+		context->should_return = 1;
+		context->target_cycle = context->current_cycle;
+	}
+#endif
 #ifdef REFRESH_EMULATION
 	last_sync_cycle = context->current_cycle;
 #endif
@@ -1040,6 +1358,11 @@ static uint8_t io_read(uint32_t location, m68k_context * context)
 			default:
 				value = get_open_bus_value(&gen->header) >> 8;
 			}
+			uint8_t reg = location >> 1 & 0xFF;
+			if (gen->runahead && reg >= 0x1 && reg <= 0x3) {
+				//the first read of a data port settles the input for the frame the instance runs
+				runahead_send_input(gen);
+			}
 		} else {
 			uint32_t masked = location & 0xFFF00;
 			if (masked == 0x11100) {
@@ -1286,6 +1609,7 @@ static void set_speed_percent(system_header * system, uint32_t percent)
 	context->master_clock = ((uint64_t)context->normal_clock * (uint64_t)percent) / 100;
 	while (context->ym->current_cycle != context->psg->cycles) {
 		sync_sound(context, context->psg->cycles + MCLKS_PER_PSG);
+		ym_run(context->ym, context->psg->cycles);
 	}
 	ym_adjust_master_clock(context->ym, context->master_clock);
 	psg_adjust_master_clock(context->psg, context->master_clock);
@@ -1329,6 +1653,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	if (!gen->m68k->resume_pc) {
 		system->delayed_load_slot = slot + 1;
 		gen->m68k->should_return = 1;
+		state_file_wait();
 		ret = get_modification_time(statepath) != 0;
 		if (!ret) {
 			strcpy(statepath + strlen(statepath)-strlen("state"), "gst");
@@ -1349,6 +1674,9 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	}
 	if (ret) {
 		gen->m68k->resume_pc = get_native_address_trans(gen->m68k, pc);
+		if (gen->runahead) {
+			runahead_reset(gen);
+		}
 	}
 done:
 	free(statepath);
@@ -1357,8 +1685,19 @@ done:
 
 static void handle_reset_requests(genesis_context *gen)
 {
-	while (gen->reset_requested || gen->header.delayed_load_slot)
+	while (gen->reset_requested || gen->header.delayed_load_slot || gen->code_flush_pending || gen->rewind_pending || gen->rollback_pending || gen->runahead_pending)
 	{
+#ifndef NEW_CORE
+		if (gen->code_flush_pending) {
+			gen->code_flush_pending = 0;
+			flush_translated_code(gen);
+			if (!gen->reset_requested && !gen->header.delayed_load_slot && !gen->rewind_pending && !gen->rollback_pending && !gen->runahead_pending) {
+				gen->m68k->resume_pc = get_native_address_trans(gen->m68k, gen->m68k->resume_address);
+				resume_68k(gen->m68k);
+				continue;
+			}
+		}
+#endif
 		if (gen->reset_requested) {
 			gen->reset_requested = 0;
 			gen->m68k->should_return = 0;
@@ -1367,12 +1706,46 @@ static void handle_reset_requests(genesis_context *gen)
 			ym_reset(gen->ym);
 			//Is there any sort of VDP reset?
 			m68k_reset(gen->m68k);
+			if (gen->runahead) {
+				runahead_reset(gen);
+			}
 		}
 		if (gen->header.delayed_load_slot) {
 			load_state(&gen->header, gen->header.delayed_load_slot - 1);
 			gen->header.delayed_load_slot = 0;
 			resume_68k(gen->m68k);
 		}
+		if (gen->rewind_pending) {
+			gen->rewind_pending = 0;
+			size_t size;
+			uint8_t *state = rewind_pop(gen->rewind, &size);
+			if (state) {
+				deserialize(&gen->header, state, size);
+			}
+			resume_68k(gen->m68k);
+		}
+		if (gen->rollback_pending) {
+			uint8_t resume = gen->rollback_pending == ROLLBACK_RESTORE;
+			gen->rollback_pending = 0;
+			size_t size;
+			uint16_t inputs[2];
+			uint8_t *state = rollback_restore(gen->rollback, &size, inputs);
+			deserialize(&gen->header, state, size);
+			//the restored frame counter would otherwise look like the end of a frame
+			gen->last_frame = gen->vdp->frame;
+			apply_rollback_inputs(gen, inputs, 1);
+			if (resume) {
+				resume_68k(gen->m68k);
+			}
+		}
+		if (gen->runahead_pending) {
+			uint8_t resume = gen->runahead_pending == ROLLBACK_RESTORE;
+			gen->runahead_pending = 0;
+			runahead_restore(gen);
+			if (resume) {
+				resume_68k(gen->m68k);
+			}
+		}
 	}
 	if (gen->header.force_release || render_should_release_on_exit()) {
 		bindings_release_capture();
@@ -1445,6 +1818,16 @@ static void request_exit(system_header *system)
 	genesis_context *gen = (genesis_context *)system;
 	gen->m68k->target_cycle = gen->m68k->current_cycle;
 	gen->m68k->should_return = 1;
+	//resume_pc stays valid if the flush is skipped so it can just be retried later
+	gen->code_flush_pending = 0;
+	gen->rewind_pending = 0;
+	//a netplay or run-ahead restore can't be skipped, but it shouldn't keep running afterwards
+	if (gen->rollback_pending) {
+		gen->rollback_pending = ROLLBACK_RESTORE_EXIT;
+	}
+	if (gen->runahead_pending) {
+		gen->runahead_pending = ROLLBACK_RESTORE_EXIT;
+	}
 }
 
 static void persist_save(system_header *system)
@@ -1511,6 +1894,18 @@ static void free_genesis(system_header *system)
 	free(gen->zram);
 	ym_free(gen->ym);
 	psg_free(gen->psg);
+	if (gen->rewind) {
+		rewind_free(gen->rewind);
+	}
+	if (gen->rollback) {
+		rollback_free(gen->rollback);
+	}
+	if (gen->runahead) {
+		runahead_free(gen->runahead);
+	}
+	free(gen->snapshot.data);
+	free(gen->runahead_state.data);
+	free(gen->section_handlers);
 	free(gen->header.save_dir);
 	free_rom_info(&gen->header.info);
 	free(gen->lock_on);
@@ -1520,6 +1915,17 @@ static void free_genesis(system_header *system)
 static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
+	if (gen->rollback) {
+		//netplay input is applied at the start of a frame so both sides see it at the same point
+		rollback_local_input(gen->rollback, gamepad_num, button, 1);
+		return;
+	}
+	if (gen->runahead) {
+		if (gen->runahead->is_instance) {
+			return;
+		}
+		runahead_local_input(gen->runahead, gamepad_num, button, 1);
+	}
 	io_gamepad_down(&gen->io, gamepad_num, button);
 	if (gen->mapper_type == MAPPER_JCART) {
 		jcart_gamepad_down(gen, gamepad_num, button);
@@ -1529,6 +1935,16 @@ static void gamepad_down(system_header *system, uint8_t gamepad_num, uint8_t but
 static void gamepad_up(system_header *system, uint8_t gamepad_num, uint8_t button)
 {
 	genesis_context *gen = (genesis_context *)system;
+	if (gen->rollback) {
+		rollback_local_input(gen->rollback, gamepad_num, button, 0);
+		return;
+	}
+	if (gen->runahead) {
+		if (gen->runahead->is_instance) {
+			return;
+		}
+		runahead_local_input(gen->runahead, gamepad_num, button, 0);
+	}
 	io_gamepad_up(&gen->io, gamepad_num, button);
 	if (gen->mapper_type == MAPPER_JCART) {
 		jcart_gamepad_up(gen, gamepad_num, button);
@@ -1810,6 +2226,9 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 
 	gen->psg = malloc(sizeof(psg_context));
 	psg_init(gen->psg, gen->master_clock, MCLKS_PER_PSG);
+	if (system_opts & YM_OPT_WAVE_LOG) {
+		psg_start_stems(gen->psg, gen->master_clock);
+	}
 	
 	set_audio_config(gen);
 
@@ -1820,6 +2239,9 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	gen->z80 = init_z80_context(z_opts);
 #ifndef NEW_CORE
 	gen->z80->next_int_pulse = z80_next_int_pulse;
+	if (system_opts & OPT_BLOCK_PROFILE) {
+		z_opts->gen.profile = calloc(1, sizeof(block_profile));
+	}
 #endif
 	z80_assert_reset(gen->z80, 0);
 #else
@@ -2031,6 +2453,11 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 	gen->m68k = init_68k_context(opts, NULL);
 	gen->m68k->system = gen;
 	opts->address_log = (system_opts & OPT_ADDRESS_LOG) ? fopen("address.log", "w") : NULL;
+#ifndef NEW_CORE
+	if (system_opts & OPT_BLOCK_PROFILE) {
+		opts->gen.profile = calloc(1, sizeof(block_profile));
+	}
+#endif
 	
 	//This must happen after the 68K context has been allocated
 	for (int i = 0; i < rom->map_chunks; i++)
@@ -2048,6 +2475,28 @@ genesis_context *alloc_init_genesis(rom_info *rom, void *main_rom, void *lock_on
 		}
 	}
 	gen->reset_cycle = CYCLE_NEVER;
+	//code allocated after this point only holds translations which can be thrown away
+	gen->code_arena_mark = arena_block_count();
+	char *cache_limit = tern_find_path_default(config, "system\0code_cache_limit\0", (tern_val){.ptrval = "64"}, TVAL_PTR).ptrval;
+	gen->code_cache_limit = atoi(cache_limit) * 1024 * 1024;
+	gen->rollback = rollback_claim();
+	char *runahead = tern_find_path_default(config, "system\0runahead\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval;
+	//netplay already runs ahead of the other player's input and an event log has to follow the real timeline
+	if (atoi(runahead) > 0 && !gen->rollback) {
+		if (event_log_active()) {
+			warning("Run-ahead is disabled while an event log is being written\n");
+		} else {
+			char *mode = tern_find_path_default(config, "system\0runahead_mode\0", (tern_val){.ptrval = "snapshot"}, TVAL_PTR).ptrval;
+			gen->runahead = runahead_new(atoi(runahead), strcmp(mode, "instance") ? RUNAHEAD_SNAPSHOT : RUNAHEAD_INSTANCE);
+		}
+	}
+	char *rewind_memory = tern_find_path_default(config, "system\0rewind_memory\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval;
+	//stepping back in a netplay session would make the two sides diverge and states taken while
+	//running ahead would be from the future
+	if (atoi(rewind_memory) > 0 && !gen->rollback && !gen->runahead) {
+		char *interval = tern_find_path_default(config, "system\0rewind_keyframe_interval\0", (tern_val){.ptrval = "60"}, TVAL_PTR).ptrval;
+		gen->rewind = rewind_new((size_t)atoi(rewind_memory) * 1024 * 1024, atoi(interval));
+	}
 
 	return gen;
 }
@@ -21,6 +21,9 @@
 #include "romdb.h"
 #include "arena.h"
 #include "i2c.h"
+#include "rewind.h"
+#include "rollback.h"
+#include "runahead.h"
 
 typedef struct genesis_context genesis_context;
 
@@ -46,7 +49,15 @@ struct genesis_context {
 	uint16_t        *tmss_pointers[NUM_MEM_AREAS];
 	uint8_t         *tmss_buffer;
 	uint8_t         *serialize_tmp;
+	serialize_buffer snapshot; //reused for states that are taken every frame
+	rewind_buffer   *rewind;
+	rollback_session *rollback; //netplay session, NULL when playing locally
+	runahead_session *runahead; //NULL when run-ahead is off
+	serialize_buffer runahead_state; //state the real timeline continues from after running ahead
+	section_handler *section_handlers;
 	size_t          serialize_size;
+	size_t          code_arena_mark; //number of code blocks in use once the CPU cores have been initialized
+	uint32_t        code_cache_limit; //amount of translated code that triggers a flush, 0 for never
 	uint32_t        num_eeprom;
 	uint32_t        save_size;
 	uint32_t        save_ram_mask;
@@ -64,13 +75,19 @@ struct genesis_context {
 	uint8_t         bank_regs[8];
 	uint16_t        z80_bank_reg;
 	uint16_t        tmss_lock[2];
+	uint16_t        applied_pads[2]; //button masks last applied to each gamepad for netplay or run-ahead
 	uint16_t        mapper_start_index;
+	uint16_t        max_section_handler;
 	uint8_t         mapper_type;
 	uint8_t         save_type;
 	sega_io         io;
 	uint8_t         version_reg;
 	uint8_t         bus_busy;
 	uint8_t         reset_requested;
+	uint8_t         code_flush_pending;
+	uint8_t         rewind_pending;
+	uint8_t         rollback_pending;
+	uint8_t         runahead_pending;
 	uint8_t         tmss;
 	uint8_t         vdp_unlocked;
 	eeprom_state    eeprom;
@@ -389,6 +389,7 @@ uint8_t ym_load_gst(ym2612_context * context, FILE * gstfile)
 uint8_t ym_save_gst(ym2612_context * context, FILE * gstfile)
 {
 	uint8_t regdata[GST_YM_SIZE];
+	ym_run(context, context->run_cycle);
 	for (int i = 0; i < sizeof(regdata); i++) {
 		if (i & 0x100) {
 			int reg = (i & 0xFF);
@@ -784,7 +784,7 @@ void hbpt_write_byte(io_port *port)
 			break;
 		case HBPT_POLL:
 			start_reply(port, 3, &port->device.heartbeat_trainer.bpm);
-			if (port->serial_cycle - port->last_poll_cycle > MIN_POLL_INTERVAL) {
+			if (!port->no_poll && port->serial_cycle - port->last_poll_cycle > MIN_POLL_INTERVAL) {
 				process_events();
 				port->last_poll_cycle = port->serial_cycle;
 			}
@@ -1204,7 +1204,7 @@ uint8_t io_data_read(io_port * port, uint32_t current_cycle)
 	uint8_t th = output & 0x40;
 	uint8_t input;
 	uint8_t device_driven;
-	if (current_cycle - port->last_poll_cycle > MIN_POLL_INTERVAL) {
+	if (!port->no_poll && current_cycle - port->last_poll_cycle > MIN_POLL_INTERVAL) {
 		process_events();
 		port->last_poll_cycle = current_cycle;
 	}
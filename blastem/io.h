@@ -92,6 +92,7 @@ typedef struct {
 	uint8_t  serial_receiving;
 	uint8_t  serial_ctrl;
 	uint8_t  device_type;
+	uint8_t  no_poll;     //input is applied by something other than the frontend
 } io_port;
 
 typedef struct {
@@ -702,14 +702,14 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 {
 	m68k_options * opts = context->options;
 	native_map_slot * native_code_map = opts->gen.native_code_map;
+	account_translated_code(&opts->gen, native_size);
 	uint32_t meta_off;
 	memmap_chunk const *mem_chunk = find_map_chunk(address, &opts->gen, MMAP_CODE, &meta_off);
 	if (mem_chunk) {
 		if (mem_chunk->flags & MMAP_CODE) {
 			uint32_t masked = (address - mem_chunk->start) & mem_chunk->mask;
 			uint32_t final_off = masked + meta_off;
-			uint32_t ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			flag_code_page(&opts->gen, context->ram_code_flags, final_off);
 
 			uint32_t slot = final_off / 1024;
 			if (!opts->gen.ram_inst_sizes[slot]) {
@@ -720,8 +720,7 @@ static void map_native_address(m68k_context * context, uint32_t address, code_pt
 			//TODO: Deal with case in which end of instruction is in a different memory chunk
 			masked = (address + size - 1) & mem_chunk->mask;
 			final_off = masked + meta_off;
-			ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			flag_code_page(&opts->gen, context->ram_code_flags, final_off);
 		}
 		//calculate the lowest alias for this address
 		address = mem_chunk->start + ((address - mem_chunk->start) & mem_chunk->mask);
@@ -764,6 +763,13 @@ static uint8_t get_native_inst_size(m68k_options * opts, uint32_t address)
 	return opts->gen.ram_inst_sizes[slot][(meta_off/2)%512];
 }
 
+static uint8_t m68k_is_smc_interp(m68k_context *context, uint32_t address, uint32_t size)
+{
+	m68k_options *opts = context->options;
+	return code_page_interpreted(&opts->gen, address, context->current_cycle)
+		|| code_page_interpreted(&opts->gen, address + size - 1, context->current_cycle);
+}
+
 uint8_t m68k_is_terminal(m68kinst * inst)
 {
 	return inst->op == M68K_RTS || inst->op == M68K_RTE || inst->op == M68K_RTR || inst->op == M68K_JMP
@@ -771,6 +777,12 @@ uint8_t m68k_is_terminal(m68kinst * inst)
 		|| (inst->op == M68K_BCC && inst->extra.cond == COND_TRUE);
 }
 
+//instructions that end a straight-line run of code as far as the block profiler is concerned
+static uint8_t m68k_ends_block(m68kinst * inst)
+{
+	return m68k_is_branch(inst) || m68k_is_terminal(inst);
+}
+
 static void m68k_handle_deferred(m68k_context * context)
 {
 	m68k_options * opts = context->options;
@@ -963,6 +975,7 @@ static void translate_m68k(m68k_context *context, m68kinst * inst)
 	if ((bp = find_breakpoint(context, inst->address))) {
 		m68k_breakpoint_patch(context, inst->address, bp, start);
 	}
+	profile_count(&opts->gen);
 	
 	//log_address(&opts->gen, inst->address, "M68K: %X @ %d\n");
 	if (
@@ -1039,6 +1052,12 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 				instbuf.src.params.immed = *encoded;
 			}
 			uint16_t m68k_size = (next-encoded)*2;
+			if (m68k_is_smc_interp(context, address, m68k_size)) {
+				code_ptr start = code->cur;
+				m68k_make_smc_stub(opts, address);
+				map_native_address(context, address, start, m68k_size, code->cur - start);
+				break;
+			}
 			address += m68k_size;
 			//char disbuf[1024];
 			//m68k_disasm(&instbuf, disbuf);
@@ -1047,8 +1066,10 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 			//make sure the beginning of the code for an instruction is contiguous
 			check_code_prologue(code);
 			code_ptr start = code->cur;
+			profile_begin(&opts->gen, instbuf.address);
 			translate_m68k(context, &instbuf);
 			code_ptr after = code->cur;
+			profile_end(&opts->gen, m68k_size, after-start, m68k_ends_block(&instbuf));
 			map_native_address(context, instbuf.address, start, m68k_size, after-start);
 		} while(!m68k_is_terminal(&instbuf) && !(address & 1));
 		process_deferred(&opts->gen.deferred, context, (native_addr_func)get_native_from_context);
@@ -1058,6 +1079,40 @@ void translate_m68k_stream(uint32_t address, m68k_context * context)
 	} while(opts->gen.deferred);
 }
 
+//Instructions in pages that get modified too often aren't kept in the translation map, they're
+//translated into a small cache that's checked against the instruction words on every execution
+void * m68k_smc_interp_handler(uint32_t address, m68k_context * context)
+{
+	m68k_options * opts = context->options;
+	code_info *code = &opts->gen.code;
+	uint16_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+	m68kinst instbuf;
+	after = m68k_decode(inst, &instbuf, address);
+	if (instbuf.op == M68K_INVALID) {
+		instbuf.src.params.immed = *inst;
+	}
+	if (!m68k_is_smc_interp(context, address, (after-inst)*2)) {
+		//the page hasn't been modified for a while so this instruction can be cached normally again
+		return m68k_retranslate_inst(address, context);
+	}
+	code_ptr slot;
+	code_ptr native = smc_cache_lookup(&opts->gen, address, inst, (after-inst)*2, context->current_cycle, MAX_NATIVE_SIZE + 5, &slot);
+	if (native) {
+		return native;
+	}
+	code_info tmp = *code;
+	code->cur = slot;
+	code->last = slot + MAX_NATIVE_SIZE + 5;
+	translate_m68k(context, &instbuf);
+	code_info buffer = *code;
+	*code = tmp;
+	if (!m68k_is_terminal(&instbuf)) {
+		jmp(&buffer, get_native_address_trans(context, address + (after-inst)*2));
+	}
+	m68k_handle_deferred(context);
+	return slot;
+}
+
 void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 {
 	m68k_options * opts = context->options;
@@ -1069,14 +1124,23 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 	uint16_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 	m68kinst instbuf;
 	after = m68k_decode(inst, &instbuf, orig);
+	if (m68k_is_smc_interp(context, address, (after-inst)*2)) {
+		code_ptr stub = code->cur;
+		m68k_make_smc_stub(opts, address);
+		map_native_address(context, address, stub, (after-inst)*2, code->cur - stub);
+		jmp(&orig_code, stub);
+		return stub;
+	}
 	if (orig_size != MAX_NATIVE_SIZE) {
 		deferred_addr * orig_deferred = opts->gen.deferred;
 
 		//make sure we have enough code space for the max size instruction
 		check_alloc_code(code, MAX_NATIVE_SIZE);
 		code_ptr native_start = code->cur;
+		profile_begin(&opts->gen, instbuf.address);
 		translate_m68k(context, &instbuf);
 		code_ptr native_end = code->cur;
+		profile_end(&opts->gen, (after-inst)*2, native_end - native_start, m68k_ends_block(&instbuf));
 		/*uint8_t is_terminal = m68k_is_terminal(&instbuf);
 		if ((native_end - native_start) <= orig_size) {
 			code_ptr native_next;
@@ -1124,9 +1188,13 @@ void * m68k_retranslate_inst(uint32_t address, m68k_context * context)
 	} else {
 		code_info tmp = *code;
 		*code = orig_code;
+		profile_begin(&opts->gen, instbuf.address);
 		translate_m68k(context, &instbuf);
+		profile_end(&opts->gen, (after-inst)*2, code->cur - orig_start, m68k_ends_block(&instbuf));
 		orig_code = *code;
 		*code = tmp;
+		//the page flag was cleared when this instruction was invalidated
+		flag_code_pages(&opts->gen, context->ram_code_flags, orig, (after-inst)*2);
 		if (!m68k_is_terminal(&instbuf)) {
 			jmp(&orig_code, get_native_address_trans(context, orig + (after-inst)*2));
 		}
@@ -1195,11 +1263,34 @@ void m68k_reset(m68k_context * context)
 	context->status = 0x27;
 	context->aregs[7] = reset_vec[0] << 16 | reset_vec[1];
 	uint32_t address = reset_vec[2] << 16 | reset_vec[3];
+	//whatever runs after a reset is unrelated to the code that was being modified before
+	reset_code_page_counts(&context->options->gen);
 	//interrupt mask may have changed so force a sync
 	sync_components(context, address);
 	start_68k_context(context, address);
 }
 
+//Throws away all translated code so the code space can be reused
+//Must only be called while the 68K is stopped and resume_pc should be recalculated from resume_address afterwards
+//Memory for code chunks allocated after init_m68k_opts is not released here, that's handled by the arena
+void m68k_flush_code(m68k_context *context)
+{
+	m68k_options *opts = context->options;
+	for (uint32_t chunk = 0; chunk < NATIVE_MAP_CHUNKS; chunk++)
+	{
+		if (opts->gen.native_code_map[chunk].base) {
+			free(opts->gen.native_code_map[chunk].offsets);
+			opts->gen.native_code_map[chunk].base = NULL;
+			opts->gen.native_code_map[chunk].offsets = NULL;
+		}
+	}
+	reset_translated_code(&opts->gen, context->ram_code_flags);
+	//movem implementations live in their own code chunk which also gets discarded
+	opts->num_movem = 0;
+	opts->extra_code.cur = opts->extra_code.last = NULL;
+	context->resume_pc = NULL;
+}
+
 void m68k_options_free(m68k_options *opts)
 {
 	for (uint32_t address = 0; address < opts->gen.address_mask; address += NATIVE_CHUNK_SIZE)
@@ -1216,6 +1307,8 @@ void m68k_options_free(m68k_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	free(opts->gen.smc_counts);
+	free(opts->gen.smc_cycles);
 	free(opts->big_movem);
 	free(opts);
 }
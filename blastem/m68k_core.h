@@ -53,6 +53,7 @@ typedef struct {
 	code_ptr        trap;
 	start_fun       start_context;
 	code_ptr        retrans_stub;
+	code_ptr        smc_stub;
 	code_ptr        native_addr;
 	code_ptr        native_addr_and_sync;
 	code_ptr		get_sr;
@@ -94,6 +95,7 @@ struct m68k_context {
 	m68k_breakpoint *breakpoints;
 	uint32_t        num_breakpoints;
 	uint32_t        bp_storage;
+	uint32_t        resume_address; //68K address corresponding to resume_pc
 	uint8_t         int_pending;
 	uint8_t         trace_pending;
 	uint8_t         should_return;
@@ -117,6 +119,7 @@ uint32_t get_instruction_start(m68k_options *opts, uint32_t address);
 uint16_t m68k_get_ir(m68k_context *context);
 void m68k_print_regs(m68k_context * context);
 void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t end);
+void m68k_flush_code(m68k_context *context);
 void m68k_serialize(m68k_context *context, uint32_t pc, serialize_buffer *buf);
 void m68k_deserialize(deserialize_buffer *buf, void *vcontext);
 
@@ -2489,17 +2489,27 @@ void nop_fill_or_jmp_next(code_info *code, code_ptr old_end, code_ptr next_inst)
 	}
 }
 
-#define M68K_MAX_INST_SIZE (2*(1+2+2))
-
 m68k_context * m68k_handle_code_write(uint32_t address, m68k_context * context)
 {
 	m68k_options * options = context->options;
-	uint32_t inst_start = get_instruction_start(options, address);
-	while (inst_start && (address - inst_start) < M68K_MAX_INST_SIZE) {
-		code_ptr dst = get_native_address(context->options, inst_start);
-		patch_for_retranslate(&options->gen, dst, options->retrans_stub);
-		inst_start = get_instruction_start(options, inst_start - 2);
-	}
+	uint32_t page = code_page_index(&options->gen, address);
+	if (!code_page_flagged(&options->gen, context->ram_code_flags, page)) {
+		//nothing has been translated in this page since it was last invalidated
+		return context;
+	}
+	if (!get_instruction_start(options, address)) {
+		//data that shares a page with code doesn't affect any translated instructions
+		return context;
+	}
+	uint32_t page_size = 1 << options->gen.ram_flags_shift;
+	uint32_t page_start = address & ~(page_size - 1);
+	//an instruction that starts in the previous page may extend into this one
+	uint32_t inst_start = get_instruction_start(options, page_start);
+	if (inst_start && (inst_start & (page_size - 1)) != 0) {
+		patch_for_retranslate(&options->gen, get_native_address(options, inst_start), options->retrans_stub);
+	}
+	m68k_invalidate_code_range(context, page_start, page_start + page_size);
+	code_page_invalidated(&options->gen, context->ram_code_flags, page, context->current_cycle);
 	return context;
 }
 
@@ -2512,13 +2522,14 @@ void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t
 		//calculate the lowest alias for this address
 		start = mem_chunk->start + ((start - mem_chunk->start) & mem_chunk->mask);
 	}
-	mem_chunk = find_map_chunk(end, &opts->gen, 0, NULL);
+	//end is exclusive so use the alias of the last byte in the range
+	mem_chunk = find_map_chunk(end - 1, &opts->gen, 0, NULL);
 	if (mem_chunk) {
 		//calculate the lowest alias for this address
-		end = mem_chunk->start + ((end - mem_chunk->start) & mem_chunk->mask);
+		end = mem_chunk->start + ((end - 1 - mem_chunk->start) & mem_chunk->mask) + 1;
 	}
 	uint32_t start_chunk = start / NATIVE_CHUNK_SIZE, end_chunk = end / NATIVE_CHUNK_SIZE;
-	for (uint32_t chunk = start_chunk; chunk <= end_chunk; chunk++)
+	for (uint32_t chunk = start_chunk; chunk <= end_chunk && chunk < NATIVE_MAP_CHUNKS; chunk++)
 	{
 		if (native_code_map[chunk].base) {
 			uint32_t start_offset = chunk == start_chunk ? start % NATIVE_CHUNK_SIZE : 0;
@@ -2539,6 +2550,14 @@ void m68k_invalidate_code_range(m68k_context *context, uint32_t start, uint32_t
 	}
 }
 
+void m68k_make_smc_stub(m68k_options *opts, uint32_t address)
+{
+	code_info *code = &opts->gen.code;
+	check_code_prologue(code);
+	mov_ir(code, address, opts->gen.scratch1, SZ_D);
+	jmp(code, opts->smc_stub);
+}
+
 void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_handler bp_handler, code_ptr native_addr)
 {
 	m68k_options * opts = context->options;
@@ -2621,6 +2640,8 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	uint32_t inst_size_size = sizeof(uint8_t *) * ram_size(&opts->gen) / 1024;
 	opts->gen.ram_inst_sizes = malloc(inst_size_size);
 	memset(opts->gen.ram_inst_sizes, 0, inst_size_size);
+	opts->gen.smc_counts = calloc(ram_size(&opts->gen) >> opts->gen.ram_flags_shift, sizeof(uint32_t));
+	opts->gen.smc_cycles = calloc(ram_size(&opts->gen) >> opts->gen.ram_flags_shift, sizeof(uint32_t));
 
 	code_info *code = &opts->gen.code;
 	init_code_info(code);
@@ -2991,6 +3012,8 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	retn(code);
 	*do_ret = code->cur - (do_ret+1);
 	uint32_t tmp_stack_off = code->stack_off;
+	//save 68K address so the native resume address can be recalculated if needed
+	mov_rrdisp(code, opts->gen.scratch1, opts->gen.context_reg, offsetof(m68k_context, resume_address), SZ_D);
 	//fetch return address and adjust RSP
 	pop_r(code, opts->gen.scratch1);
 	add_ir(code, 16-sizeof(void *), RSP, SZ_PTR);
@@ -3186,6 +3209,15 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR);
 	call(code, opts->gen.load_context);
 	jmp_r(code, opts->gen.scratch1);
+
+	opts->smc_stub = code->cur;
+	call(code, opts->gen.save_context);
+	push_r(code, opts->gen.context_reg);
+	call_args(code,(code_ptr)m68k_smc_interp_handler, 2, opts->gen.scratch1, opts->gen.context_reg);
+	pop_r(code, opts->gen.context_reg);
+	mov_rr(code, RAX, opts->gen.scratch1, SZ_PTR);
+	call(code, opts->gen.load_context);
+	jmp_r(code, opts->gen.scratch1);
 	
 	
 	check_code_prologue(code);
@@ -3226,4 +3258,5 @@ void init_m68k_opts(m68k_options * opts, memmap_chunk * memmap, uint32_t num_chu
 	code->stack_off = tmp_stack_off;
 	
 	retranslate_calc(&opts->gen);
+	opts->gen.flush_code = opts->gen.code;
 }
@@ -37,6 +37,7 @@ void translate_m68k_odd(m68k_options *opts, m68kinst *inst);
 void m68k_trap_if_not_supervisor(m68k_options *opts, m68kinst *inst);
 void m68k_breakpoint_patch(m68k_context *context, uint32_t address, m68k_debug_handler bp_handler, code_ptr native_addr);
 void m68k_check_cycles_int_latch(m68k_options *opts);
+void m68k_make_smc_stub(m68k_options *opts, uint32_t address);
 uint8_t translate_m68k_op(m68kinst * inst, host_ea * ea, m68k_options * opts, uint8_t dst);
 
 //functions implemented in m68k_core.c
@@ -53,6 +54,7 @@ code_ptr get_native_address(m68k_options *opts, uint32_t address);
 uint8_t m68k_is_terminal(m68kinst * inst);
 code_ptr get_native_address_trans(m68k_context * context, uint32_t address);
 void * m68k_retranslate_inst(uint32_t address, m68k_context * context);
+void * m68k_smc_interp_handler(uint32_t address, m68k_context * context);
 m68k_context *m68k_bp_dispatcher(m68k_context *context, uint32_t address);
 
 //individual instructions
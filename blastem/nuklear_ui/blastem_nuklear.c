@@ -452,11 +452,11 @@ void view_key_bindings(struct nk_context *context)
 		"gamepads.2.start", "gamepads.2.mode"
 	};
 	const char *general_binds[] = {
-		"ui.exit", "ui.save_state", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
+		"ui.exit", "ui.save_state", "ui.rewind", "ui.toggle_fullscreen", "ui.soft_reset", "ui.reload",
 		"ui.screenshot", "ui.vgm_log", "ui.sms_pause", "ui.toggle_keyboard_cpatured", "ui.release_mouse"
 	};
 	const char *general_names[] = {
-		"Show Menu", "Quick Save", "Toggle Fullscreen", "Soft Reset", "Reload Media",
+		"Show Menu", "Quick Save", "Rewind", "Toggle Fullscreen", "Soft Reset", "Reload Media",
 		"Internal Screenshot", "Toggle VGM Log", "SMS Pause", "Capture Keyboard", "Release Mouse"
 	};
 	const char *speed_binds[] = {
@@ -607,6 +607,7 @@ const char *translate_binding_option(const char *option)
 		conf_names = tern_insert_ptr(conf_names, "ui.vgm_log", "Toggle VGM Log");
 		conf_names = tern_insert_ptr(conf_names, "ui.exit", "Show Menu");
 		conf_names = tern_insert_ptr(conf_names, "ui.save_state", "Quick Save");
+		conf_names = tern_insert_ptr(conf_names, "ui.rewind", "Rewind");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.0", "Set Speed 0");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.1", "Set Speed 1");
 		conf_names = tern_insert_ptr(conf_names, "ui.set_speed.2", "Set Speed 2");
@@ -670,6 +671,7 @@ static void view_button_binding(struct nk_context *context)
 	};
 	static const char *emu_control[] = {
 		"ui.save_state",
+		"ui.rewind",
 		"ui.exit",
 		"ui.toggle_fullscreen",
 		"ui.screenshot",
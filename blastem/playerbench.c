@@ -0,0 +1,341 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures how many event log recordings gen_player can get through per minute on one core, both with
+//normal playback and in batch mode with and without rendering. The batch runs use a frame hook that
+//decodes the sprite table and follows one sprite the way an analysis tool tracking a ball would.
+//Without a recording on the command line, a one minute recording with a similar mix of events to a
+//sports game is generated first
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "gen_player.h"
+#include "render_audio.h"
+#include "blastem.h"
+#include "util.h"
+
+tern_node *config;
+int headless = 1;
+system_header *current_system;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+//the benchmark acts as a render backend with no video or audio output
+uint32_t render_map_color(uint8_t r, uint8_t g, uint8_t b)
+{
+	return r << 16 | g << 8 | b;
+}
+
+static uint32_t framebuffer[512 * LINEBUF_SIZE];
+uint32_t *render_get_framebuffer(uint8_t which, int *pitch)
+{
+	*pitch = LINEBUF_SIZE * sizeof(uint32_t);
+	return framebuffer;
+}
+
+void render_framebuffer_updated(uint8_t which, int width)
+{
+}
+
+uint8_t render_get_active_framebuffer(void)
+{
+	return FRAMEBUFFER_ODD;
+}
+
+uint8_t render_create_window(char *caption, uint32_t width, uint32_t height, window_close_handler close_handler)
+{
+	return 0;
+}
+
+void render_destroy_window(uint8_t which)
+{
+}
+
+uint32_t render_overscan_top()
+{
+	return 0;
+}
+
+uint32_t render_overscan_bot()
+{
+	return 0;
+}
+
+void render_set_video_standard(vid_std std)
+{
+}
+
+void render_set_external_sync(uint8_t ext_sync_on)
+{
+}
+
+uint8_t render_create_thread(render_thread *thread, const char *name, render_thread_fun fun, void *data)
+{
+	return 0;
+}
+
+uint8_t render_is_audio_sync(void)
+{
+	return 0;
+}
+
+void render_buffer_consumed(audio_source *src)
+{
+}
+
+void *render_new_audio_opaque(void)
+{
+	return NULL;
+}
+
+void render_free_audio_opaque(void *opaque)
+{
+}
+
+void render_lock_audio(void)
+{
+}
+
+void render_unlock_audio(void)
+{
+}
+
+uint32_t render_min_buffered(void)
+{
+	return 512;
+}
+
+uint32_t render_audio_syncs_per_sec(void)
+{
+	return 0;
+}
+
+void render_audio_created(audio_source *src)
+{
+}
+
+void render_do_audio_ready(audio_source *src)
+{
+}
+
+void render_source_paused(audio_source *src, uint8_t remaining_sources)
+{
+}
+
+void render_source_resumed(audio_source *src)
+{
+}
+
+uint16_t read_dma_value(uint32_t address)
+{
+	return 0;
+}
+
+void init_terminal()
+{
+}
+
+#define MCLKS_FRAME (262 * 3420)
+#define RECORDING_FRAMES (60 * 60)
+#define TILE_WORDS_PER_FRAME 1200
+#define YM_WRITES_PER_FRAME 60
+#define PSG_WRITES_PER_FRAME 20
+#define SAT_ADDRESS 0xD800
+#define NUM_SPRITES 80
+#define BALL_SPRITE 37
+
+static void vdp_reg(uint32_t cycle, uint8_t reg, uint8_t value)
+{
+	uint8_t payload[] = {reg, value};
+	event_log(EVENT_VDP_REG, cycle, sizeof(payload), payload);
+}
+
+static void generate_frame(uint32_t frame, uint32_t start)
+{
+	uint32_t cycle = start + 1000;
+	//tiles and plane updates
+	uint16_t base = (frame * 0x400) & 0xBFFF;
+	for (uint32_t i = 0; i < TILE_WORDS_PER_FRAME; i++, cycle += 40)
+	{
+		event_vram_word(cycle, (base + i * 2) & 0xFFFF, (rand() % 16) * 0x1111);
+	}
+	//players and a ball moving around the field
+	for (uint32_t i = 0; i < NUM_SPRITES; i++, cycle += 160)
+	{
+		uint16_t x = 128 + (i * 37 + frame * (i % 5 + 1)) % 320;
+		uint16_t y = 128 + (i * 53 + frame * (i % 3)) % 224;
+		uint16_t address = SAT_ADDRESS + i * 8;
+		event_vram_word(cycle, address, y);
+		event_vram_word(cycle + 40, address + 2, (i == BALL_SPRITE ? 0 : 5) << 8 | (i + 1) % NUM_SPRITES);
+		event_vram_word(cycle + 80, address + 4, 0x2000 | (i * 4));
+		event_vram_word(cycle + 120, address + 6, x);
+	}
+	for (uint32_t i = 0; i < 16; i++, cycle += 40)
+	{
+		uint16_t color = (frame + i) & 0xEEE;
+		uint8_t payload[] = {i * 2, color >> 8, color};
+		event_log(EVENT_VDP_INTRAM, cycle, sizeof(payload), payload);
+	}
+	cycle = start + MCLKS_FRAME / 2;
+	for (uint32_t i = 0; i < YM_WRITES_PER_FRAME; i++)
+	{
+		uint8_t ym[] = {i & 1, 0x30 + i % 0x80, frame * 3 + i};
+		event_log(EVENT_YM_REG, cycle + i * 2000, sizeof(ym), ym);
+	}
+	for (uint32_t i = 0; i < PSG_WRITES_PER_FRAME; i++)
+	{
+		uint8_t psg = 0x80 | ((frame + i) & 0x7F);
+		event_log(EVENT_PSG_REG, cycle + i * 5000 + 300, sizeof(psg), &psg);
+	}
+	event_flush(start + MCLKS_FRAME);
+}
+
+//event logs are finished by an exit handler, so the recording is made in a child process
+static void generate_recording(char *fname)
+{
+	pid_t child = fork();
+	if (child < 0) {
+		fatal_error("Failed to fork\n");
+	}
+	if (child) {
+		int status;
+		waitpid(child, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+			fatal_error("Failed to generate recording\n");
+		}
+		return;
+	}
+	current_system = calloc(1, sizeof(system_header));
+	event_log_file(fname);
+	event_system_start(SYSTEM_GENESIS, VID_NTSC, "playerbench");
+	vdp_reg(100, REG_MODE_1, 0x04);
+	vdp_reg(120, REG_MODE_2, BIT_DISP_EN | BIT_MODE_5);
+	vdp_reg(140, REG_SCROLL_A, 0xC000 >> 10);
+	vdp_reg(160, REG_WINDOW, 0xD000 >> 10);
+	vdp_reg(180, REG_SCROLL_B, 0xE000 >> 13);
+	vdp_reg(200, REG_SAT, SAT_ADDRESS >> 9);
+	vdp_reg(220, REG_MODE_4, BIT_H40 | 0x80);
+	vdp_reg(240, REG_HSCROLL, 0xFC00 >> 10);
+	vdp_reg(260, REG_AUTOINC, 2);
+	vdp_reg(280, REG_SCROLL, 0x01);
+	for (uint32_t frame = 0; frame < RECORDING_FRAMES; frame++)
+	{
+		generate_frame(frame, frame * MCLKS_FRAME);
+	}
+	exit(0);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+typedef struct {
+	uint64_t checksum;
+	uint32_t frames;
+} ball_track;
+
+static void track_ball(gen_player *player, void *data)
+{
+	ball_track *track = data;
+	vdp_sprite sprites[MAX_DECODED_SPRITES];
+	uint8_t count = vdp_decode_sprites(player->vdp, sprites);
+	for (uint8_t i = 0; i < count; i++)
+	{
+		if (sprites[i].index == BALL_SPRITE) {
+			track->checksum = track->checksum * 31 + (sprites[i].x << 16 | sprites[i].y);
+			break;
+		}
+	}
+	track->checksum += player->vdp->cram[0] + player->vdp->vdpmem[SAT_ADDRESS];
+	track->frames++;
+}
+
+static void free_player(gen_player *player)
+{
+	vdp_free(player->vdp);
+	ym_free(player->ym);
+	psg_free(player->psg);
+	inflateEnd(&player->reader.input_stream);
+	free(player->reader.buffer.data);
+	free(player->reader.keyframes);
+	free(player->header.info.name);
+	free(player);
+}
+
+enum {
+	MODE_NORMAL,
+	MODE_BATCH,
+	MODE_BATCH_NO_VIDEO
+};
+
+static void bench(uint8_t *data, long size, int mode, uint32_t recordings)
+{
+	static const char *names[] = {"normal playback", "batch", "batch, no video"};
+	ball_track track = {0};
+	double start = now();
+	for (uint32_t i = 0; i < recordings; i++)
+	{
+		gen_player *player = alloc_config_gen_player(data, size);
+		if (mode == MODE_NORMAL) {
+			player->header.start_context(&player->header, NULL);
+			track.frames += player->vdp->frame;
+		} else {
+			gen_player_batch(player, mode == MODE_BATCH_NO_VIDEO ? PLAYER_NO_VIDEO : 0, track_ball, &track);
+		}
+		free_player(player);
+	}
+	double elapsed = now() - start;
+	printf("%-16s %8.1f recordings/min per core, %6.1f us/frame, checksum %016llX\n", names[mode],
+		recordings * 60.0 / elapsed, elapsed * 1000000.0 / track.frames, (unsigned long long)track.checksum);
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t recordings = argc > 1 ? strtoul(argv[1], NULL, 10) : 10;
+	char *fname = argc > 2 ? argv[2] : "playerbench.bin";
+	if (!recordings) {
+		fputs("usage: playerbench [recordings] [event log file]\n", stderr);
+		return 1;
+	}
+	if (argc <= 2) {
+		generate_recording(fname);
+	}
+	FILE *f = fopen(fname, "rb");
+	if (!f) {
+		fatal_error("Failed to open %s\n", fname);
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = malloc(size);
+	if (fread(data, 1, size, f) != size) {
+		fatal_error("Failed to read %s\n", fname);
+	}
+	fclose(f);
+	if (size < 9 || memcmp(data, "BLSTEL", 6)) {
+		fatal_error("%s is not an event log\n", fname);
+	}
+	bench(data, size, MODE_NORMAL, recordings);
+	bench(data, size, MODE_BATCH, recordings);
+	bench(data, size, MODE_BATCH_NO_VIDEO, recordings);
+	free(data);
+	return 0;
+}
@@ -22,6 +22,7 @@ void psg_init(psg_context * context, uint32_t master_clock, uint32_t clock_div)
 
 void psg_free(psg_context *context)
 {
+	psg_stop_stems(context);
 	render_free_source(context->audio);
 	free(context);
 }
@@ -33,7 +34,8 @@ void psg_adjust_master_clock(psg_context * context, uint32_t master_clock)
 
 void psg_write(psg_context * context, uint8_t value)
 {
-	if (context->vgm) {
+	//frames that are run again or only run ahead don't end up in captures or logs either
+	if (context->vgm && !context->audio->discard) {
 		vgm_sn76489_write(context->vgm, context->cycles, value);
 	}
 	event_log(EVENT_PSG_REG, context->cycles, sizeof(value), &value);
@@ -87,9 +89,53 @@ static int16_t volume_table[16] = {
 	2067/PSG_VOL_DIV, 1642/PSG_VOL_DIV, 1304/PSG_VOL_DIV, 0
 };
 
+static int16_t psg_output(psg_context *context)
+{
+	int16_t accum = 0;
+	for (int i = 0; i < 3; i++) {
+		if (context->output_state[i]) {
+			accum += volume_table[context->volume[i]];
+		}
+	}
+	if (context->noise_out) {
+		accum += volume_table[context->volume[3]];
+	}
+	return accum;
+}
+
+//captured channels are box filtered down from the PSG clock to a more manageable rate
+#define PSG_STEM_DECIMATION 4
+
+static void psg_stem_span(psg_context *context, uint32_t count)
+{
+	for (int i = 0; i < 4; i++) {
+		uint8_t on = i == 3 ? context->noise_out : context->output_state[i];
+		stem_put_span(context->stems, i, on ? volume_table[context->volume[i]] : 0, count);
+	}
+}
+
 void psg_run(psg_context * context, uint32_t cycles)
 {
 	while (context->cycles < cycles) {
+		//output can only change on a clock where a counter reaches zero so the clocks before
+		//the first of those are emitted as a single span
+		uint32_t steady = (cycles - context->cycles + context->clock_inc - 1) / context->clock_inc;
+		for (int i = 0; i < 4; i++) {
+			if (context->counters[i] <= steady) {
+				steady = context->counters[i] ? context->counters[i] - 1 : 0;
+			}
+		}
+		if (steady) {
+			for (int i = 0; i < 4; i++) {
+				context->counters[i] -= steady;
+			}
+			render_put_mono_span(context->audio, psg_output(context), steady);
+			if (context->stems && !context->audio->discard) {
+				psg_stem_span(context, steady);
+			}
+			context->cycles += steady * context->clock_inc;
+			continue;
+		}
 		for (int i = 0; i < 4; i++) {
 			if (context->counters[i]) {
 				context->counters[i] -= 1;
@@ -109,19 +155,10 @@ void psg_run(psg_context * context, uint32_t cycles)
 				}
 			}
 		}
-
-		int16_t accum = 0;
-		
-		for (int i = 0; i < 3; i++) {
-			if (context->output_state[i]) {
-				accum += volume_table[context->volume[i]];
-			}
-		}
-		if (context->noise_out) {
-			accum += volume_table[context->volume[3]];
+		render_put_mono_span(context->audio, psg_output(context), 1);
+		if (context->stems && !context->audio->discard) {
+			psg_stem_span(context, 1);
 		}
-		
-		render_put_mono_sample(context->audio, accum);
 
 		context->cycles += context->clock_inc;
 	}
@@ -151,6 +188,31 @@ void psg_vgm_log(psg_context *context, uint32_t master_clock, vgm_writer *vgm)
 	}
 }
 
+//Starts capturing the output of each channel to psg_channel_N.wav, channel 3 is the noise channel
+void psg_start_stems(psg_context *context, uint32_t master_clock)
+{
+	if (context->stems) {
+		return;
+	}
+	char names[4][32];
+	char *filenames[4];
+	for (int i = 0; i < 4; i++)
+	{
+		sprintf(names[i], "psg_channel_%d.wav", i);
+		filenames[i] = names[i];
+	}
+	context->stems = stem_capture_start(filenames, 4, master_clock / context->clock_inc, PSG_STEM_DECIMATION, &context->stems);
+}
+
+void psg_stop_stems(psg_context *context)
+{
+	if (!context->stems) {
+		return;
+	}
+	stem_capture_stop(context->stems);
+	context->stems = NULL;
+}
+
 void psg_serialize(psg_context *context, serialize_buffer *buf)
 {
 	save_int16(buf, context->lsfr);
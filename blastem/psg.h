@@ -10,10 +10,12 @@
 #include "serialize.h"
 #include "render_audio.h"
 #include "vgm.h"
+#include "stem.h"
 
 typedef struct {
 	audio_source *audio;
 	vgm_writer   *vgm;
+	stem_capture *stems;
 	uint32_t clock_inc;
 	uint32_t cycles;
 	uint16_t lsfr;
@@ -34,6 +36,8 @@ void psg_adjust_master_clock(psg_context * context, uint32_t master_clock);
 void psg_write(psg_context * context, uint8_t value);
 void psg_run(psg_context * context, uint32_t cycles);
 void psg_vgm_log(psg_context *context, uint32_t master_clock, vgm_writer *vgm);
+void psg_start_stems(psg_context *context, uint32_t master_clock);
+void psg_stop_stems(psg_context *context);
 void psg_serialize(psg_context *context, serialize_buffer *buf);
 void psg_deserialize(deserialize_buffer *buf, void *vcontext);
 
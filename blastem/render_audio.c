@@ -15,11 +15,23 @@ static audio_source *inactive_audio_sources[8];
 static uint8_t num_audio_sources;
 static uint8_t num_inactive_audio_sources;
 
-static float overall_gain_mult, *mix_buf;
+static float overall_gain_mult;
 static int sample_size;
 
+typedef float audio_vec __attribute__((vector_size(16)));
+typedef int32_t audio_ivec __attribute__((vector_size(16)));
+
+//Output is produced in blocks small enough to stay in cache. Every source is added into the
+//block and then the block is clamped and converted straight into the output stream
+#define MIX_BLOCK_SAMPLES 1024
+
 typedef void (*conv_func)(float *samples, void *vstream, int sample_count);
 
+static audio_vec audio_select(audio_ivec mask, audio_vec a, audio_vec b)
+{
+	return (audio_vec)(((audio_ivec)a & mask) | ((audio_ivec)b & ~mask));
+}
+
 static void convert_null(float *samples, void *vstream, int sample_count)
 {
 	memset(vstream, 0, sample_count * sample_size);
@@ -28,9 +40,25 @@ static void convert_null(float *samples, void *vstream, int sample_count)
 static void convert_s16(float *samples, void *vstream, int sample_count)
 {
 	int16_t *stream = vstream;
-	for (int16_t *end = stream + sample_count; stream < end; stream++, samples++)
+	int i = 0;
+	audio_vec one = {1.0f, 1.0f, 1.0f, 1.0f}, neg_one = {-1.0f, -1.0f, -1.0f, -1.0f};
+	audio_vec max = {0x7FFF, 0x7FFF, 0x7FFF, 0x7FFF}, min = {-0x8000, -0x8000, -0x8000, -0x8000};
+	for (; i + 4 <= sample_count; i += 4)
 	{
-		float sample = *samples;
+		audio_vec sample;
+		memcpy(&sample, samples + i, sizeof(sample));
+		audio_vec scaled = sample * max;
+		scaled = audio_select(sample >= one, max, scaled);
+		scaled = audio_select(sample <= neg_one, min, scaled);
+		audio_ivec out = __builtin_convertvector(scaled, audio_ivec);
+		stream[i] = out[0];
+		stream[i + 1] = out[1];
+		stream[i + 2] = out[2];
+		stream[i + 3] = out[3];
+	}
+	for (; i < sample_count; i++)
+	{
+		float sample = samples[i];
 		int16_t out_sample;
 		if (sample >= 1.0f) {
 			out_sample = 0x7FFF;
@@ -39,60 +67,83 @@ static void convert_s16(float *samples, void *vstream, int sample_count)
 		} else {
 			out_sample = sample * 0x7FFF;
 		}
-		*stream = out_sample;
+		stream[i] = out_sample;
 	}
 }
 
 static void clamp_f32(float *samples, void *vstream, int sample_count)
 {
-	for (; sample_count > 0; sample_count--, samples++)
+	float *stream = vstream;
+	int i = 0;
+	audio_vec one = {1.0f, 1.0f, 1.0f, 1.0f}, neg_one = {-1.0f, -1.0f, -1.0f, -1.0f};
+	for (; i + 4 <= sample_count; i += 4)
+	{
+		audio_vec sample;
+		memcpy(&sample, samples + i, sizeof(sample));
+		sample = audio_select(sample > one, one, sample);
+		sample = audio_select(sample < neg_one, neg_one, sample);
+		memcpy(stream + i, &sample, sizeof(sample));
+	}
+	for (; i < sample_count; i++)
 	{
-		float sample = *samples;
+		float sample = samples[i];
 		if (sample > 1.0f) {
 			sample = 1.0f;
 		} else if (sample < -1.0f) {
 			sample = -1.0f;
 		}
-		*samples = sample;
+		stream[i] = sample;
 	}
 }
 
-static int32_t mix_f32(audio_source *audio, float *stream, int samples)
+//Adds frames samples from a contiguous part of a source buffer to dest, scale includes the
+//conversion from 16-bit to the -1.0 to 1.0 range used for mixing
+static void mix_span(float *dest, int16_t *src, uint32_t frames, uint8_t src_channels, float scale)
 {
-	float *end = stream + samples;
-	int16_t *src = audio->front;
-	uint32_t i = audio->read_start;
-	uint32_t i_end = audio->read_end;
-	float *cur = stream;
-	float gain_mult = audio->gain_mult * overall_gain_mult;
-	size_t first_add = output_channels > 1 ? 1 : 0, second_add = output_channels > 1 ? output_channels - 1 : 1;
-	if (audio->num_channels == 1) {
-		while (cur < end && i != i_end)
+	audio_vec scale_vec = {scale, scale, scale, scale};
+	uint32_t i = 0;
+	if (output_channels == 2 && src_channels == 2) {
+		uint32_t count = frames * 2;
+		for (; i + 4 <= count; i += 4)
 		{
-			*cur += gain_mult * ((float)src[i]) / 0x7FFF;
-			cur += first_add;
-			*cur += gain_mult * ((float)src[i++]) / 0x7FFF;
-			cur += second_add;
-			i &= audio->mask;
+			audio_vec in = {src[i], src[i + 1], src[i + 2], src[i + 3]};
+			audio_vec out;
+			memcpy(&out, dest + i, sizeof(out));
+			out += in * scale_vec;
+			memcpy(dest + i, &out, sizeof(out));
 		}
-	} else {
-		while(cur < end && i != i_end)
+		for (; i < count; i++)
 		{
-			*cur += gain_mult * ((float)src[i++]) / 0x7FFF;
-			cur += first_add;
-			*cur += gain_mult * ((float)src[i++]) / 0x7FFF;
-			cur += second_add;
-			i &= audio->mask;
+			dest[i] += scale * src[i];
+		}
+	} else if (output_channels == 2 && src_channels == 1) {
+		for (; i + 4 <= frames; i += 4)
+		{
+			audio_vec in = {src[i], src[i + 1], src[i + 2], src[i + 3]};
+			in *= scale_vec;
+			audio_vec first = {in[0], in[0], in[1], in[1]}, second = {in[2], in[2], in[3], in[3]};
+			audio_vec out[2];
+			memcpy(out, dest + i * 2, sizeof(out));
+			out[0] += first;
+			out[1] += second;
+			memcpy(dest + i * 2, out, sizeof(out));
+		}
+		for (; i < frames; i++)
+		{
+			dest[i * 2] += scale * src[i];
+			dest[i * 2 + 1] += scale * src[i];
 		}
-	}
-	if (!render_is_audio_sync()) {
-		audio->read_start = i;
-	}
-	if (cur != end) {
-		debug_message("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", (int)(end-cur)/2, audio->read_start, audio->read_end, audio->mask);
-		return (cur-end)/2;
 	} else {
-		return ((i_end - i) & audio->mask) / audio->num_channels;
+		//mono output sums both channels of a stereo source, extra output channels are left empty
+		size_t first_add = output_channels > 1 ? 1 : 0, second_add = output_channels > 1 ? output_channels - 1 : 1;
+		size_t src_add = src_channels > 1 ? 1 : 0;
+		for (; i < frames; i++, src += src_channels)
+		{
+			*dest += scale * src[0];
+			dest += first_add;
+			*dest += scale * src[src_add];
+			dest += second_add;
+		}
 	}
 }
 
@@ -102,33 +153,115 @@ static conv_func convert;
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out)
 {
 	int samples = len / sample_size;
-	float *mix_dest = mix_buf ? mix_buf : (float *)byte_stream;
-	memset(mix_dest, 0, samples * sizeof(float));
+	uint32_t frames = samples / output_channels;
+	uint32_t read_pos[8], read_end[8], available[8], mixed[8];
+	float scale[8];
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		audio_source *audio = audio_sources[i];
+		read_pos[i] = audio->read_start;
+		//pairs with the release store in the backend's render_do_audio_ready so the samples
+		//before read_end are visible
+		read_end[i] = __atomic_load_n(&audio->read_end, __ATOMIC_ACQUIRE);
+		available[i] = ((read_end[i] - read_pos[i]) & audio->mask) / audio->num_channels;
+		mixed[i] = 0;
+		scale[i] = audio->gain_mult * overall_gain_mult / 0x7FFF;
+	}
+	float block[MIX_BLOCK_SAMPLES];
+	uint32_t block_frames = MIX_BLOCK_SAMPLES / output_channels;
+	for (uint32_t frame = 0; frame < frames; frame += block_frames)
+	{
+		uint32_t cur_frames = frames - frame < block_frames ? frames - frame : block_frames;
+		memset(block, 0, cur_frames * output_channels * sizeof(float));
+		for (uint8_t i = 0; i < num_audio_sources; i++)
+		{
+			audio_source *audio = audio_sources[i];
+			uint32_t todo = available[i] - mixed[i];
+			if (todo > cur_frames) {
+				todo = cur_frames;
+			}
+			mixed[i] += todo;
+			float *dest = block;
+			//the readable part of a ring buffer is at most two contiguous spans
+			while (todo)
+			{
+				uint64_t contiguous = (((uint64_t)audio->mask) + 1 - read_pos[i]) / audio->num_channels;
+				uint32_t span = todo < contiguous ? todo : contiguous;
+				mix_span(dest, audio->front + read_pos[i], span, audio->num_channels, scale[i]);
+				dest += span * output_channels;
+				todo -= span;
+				read_pos[i] = (read_pos[i] + span * audio->num_channels) & audio->mask;
+			}
+		}
+		convert(block, byte_stream + frame * output_channels * sample_size, cur_frames * output_channels);
+	}
 	int min_buffered = INT_MAX;
 	int min_remaining_buffer = INT_MAX;
 	for (uint8_t i = 0; i < num_audio_sources; i++)
 	{
-		int buffered = mix_f32(audio_sources[i], mix_dest, samples);
-		int remaining = (audio_sources[i]->mask + 1) / audio_sources[i]->num_channels - buffered;
+		audio_source *audio = audio_sources[i];
+		if (!render_is_audio_sync()) {
+			//the producer may reuse the space before read_start once it sees this store
+			__atomic_store_n(&audio->read_start, read_pos[i], __ATOMIC_RELEASE);
+		}
+		int buffered;
+		if (mixed[i] < frames) {
+			int missing = (frames - mixed[i]) * output_channels / 2;
+			__atomic_store_n(&audio->underruns, audio->underruns + 1, __ATOMIC_RELAXED);
+			debug_message("Underflow of %d samples, read_start: %d, read_end: %d, mask: %X\n", missing, audio->read_start, read_end[i], audio->mask);
+			buffered = -missing;
+		} else {
+			buffered = ((read_end[i] - read_pos[i]) & audio->mask) / audio->num_channels;
+		}
+		int remaining = (audio->mask + 1) / audio->num_channels - buffered;
 		min_buffered = buffered < min_buffered ? buffered : min_buffered;
 		min_remaining_buffer = remaining < min_remaining_buffer ? remaining : min_remaining_buffer;
-		audio_sources[i]->front_populated = 0;
-		render_buffer_consumed(audio_sources[i]);
+		__atomic_store_n(&audio->front_populated, 0, __ATOMIC_RELEASE);
+		render_buffer_consumed(audio);
 	}
-	convert(mix_dest, byte_stream, samples);
 	if (min_remaining_out) {
 		*min_remaining_out = min_remaining_buffer;
 	}
 	return min_buffered;
 }
 
+//Used by backends that would rather output silence than wait for sources that haven't
+//finished their buffer, counts an underrun for each of those sources
+void mix_silence(unsigned char *byte_stream, int len)
+{
+	memset(byte_stream, 0, len);
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		audio_source *audio = audio_sources[i];
+		if (!__atomic_load_n(&audio->front_populated, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&audio->underruns, audio->underruns + 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+void render_audio_stats(uint32_t *underruns, uint32_t *overruns)
+{
+	//the source lists are only changed by the emulation thread so no lock is needed here
+	*underruns = *overruns = 0;
+	for (uint8_t i = 0; i < num_audio_sources; i++)
+	{
+		*underruns += __atomic_load_n(&audio_sources[i]->underruns, __ATOMIC_RELAXED);
+		*overruns += __atomic_load_n(&audio_sources[i]->overruns, __ATOMIC_RELAXED);
+	}
+	for (uint8_t i = 0; i < num_inactive_audio_sources; i++)
+	{
+		*underruns += inactive_audio_sources[i]->underruns;
+		*overruns += inactive_audio_sources[i]->overruns;
+	}
+}
+
 uint8_t all_sources_ready(void)
 {
 	uint8_t num_populated = 0;
 	num_populated = 0;
 	for (uint8_t i = 0; i < num_audio_sources; i++)
 	{
-		if (audio_sources[i]->front_populated) {
+		if (__atomic_load_n(&audio_sources[i]->front_populated, __ATOMIC_ACQUIRE)) {
 			num_populated++;
 		}
 	}
@@ -137,9 +270,151 @@ uint8_t all_sources_ready(void)
 
 #define BUFFER_INC_RES 0x40000000UL
 
+//Sources are resampled to the output rate with a windowed sinc filter that is precomputed
+//at RESAMPLE_PHASES fractional positions between input samples
+#define RESAMPLE_PHASE_BITS 8
+#define RESAMPLE_PHASES (1 << RESAMPLE_PHASE_BITS)
+//zero crossings of the sinc on each side of the center
+#define RESAMPLE_ZERO_CROSSINGS 8
+//sources running at less than twice the output rate, like the YM2612, use a filter half as long,
+//it rolls off sooner above 15kHz but still keeps images of anything below 20kHz 45dB down
+#define RESAMPLE_SHORT_ZERO_CROSSINGS 4
+//passband as a fraction of the output Nyquist frequency
+#define RESAMPLE_ROLLOFF 0.9
+//input samples kept in the history beyond the filter length, the history is compacted once per block
+#define RESAMPLE_BLOCK 256
+//output samples produced together when none of them completes a buffer, running the filter for
+//several at once lets their multiply-add chains overlap and keeps it off the input just written
+#define RESAMPLE_BATCH 16
+
+static double windowed_sinc(double t, double cutoff, double half_width)
+{
+	if (fabs(t) >= half_width) {
+		return 0.0;
+	}
+	double x = 2.0 * cutoff * t;
+	double value = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+	//Blackman window
+	double w = (t + half_width) / (2.0 * half_width);
+	return value * (0.42 - 0.5 * cos(2.0 * M_PI * w) + 0.08 * cos(4.0 * M_PI * w));
+}
+
+static void resample_calc_coefs(audio_source *src, double ratio)
+{
+	//cutoff as a fraction of the input sample rate
+	double cutoff = 0.5 * RESAMPLE_ROLLOFF * (ratio > 1.0 ? 1.0 / ratio : 1.0);
+	double half_width = (ratio < 2.0 ? RESAMPLE_SHORT_ZERO_CROSSINGS : RESAMPLE_ZERO_CROSSINGS) / (2.0 * cutoff);
+	//rounded up to a multiple of 4 for the vector loop
+	uint32_t taps = ((uint32_t)ceil(2.0 * half_width) + 1 + 3) & ~3;
+	if (taps != src->num_taps) {
+		free(src->coefs);
+		src->coefs = malloc(RESAMPLE_PHASES * taps * sizeof(float));
+		uint32_t history_size = RESAMPLE_BLOCK + taps;
+		float *history = calloc(src->num_channels * history_size, sizeof(float));
+		//start with a filter's worth of context, made up of the most recent input if there is any
+		uint32_t keep = src->history_len < taps ? src->history_len : taps;
+		for (uint8_t ch = 0; ch < src->num_channels && keep; ch++)
+		{
+			memcpy(
+				history + ch * history_size + taps - keep,
+				src->history + ch * src->history_size + src->history_len - keep,
+				keep * sizeof(float)
+			);
+		}
+		free(src->history);
+		src->history = history;
+		src->history_size = history_size;
+		src->history_len = taps;
+		src->resample_pos = 0;
+		src->resample_ready = 0;
+		src->num_taps = taps;
+	}
+	double center = (taps - 1) / 2.0;
+	for (uint32_t phase = 0; phase < RESAMPLE_PHASES; phase++)
+	{
+		float *coefs = src->coefs + phase * taps;
+		double frac = (double)phase / RESAMPLE_PHASES;
+		double sum = 0.0;
+		for (uint32_t tap = 0; tap < taps; tap++)
+		{
+			double value = windowed_sinc(tap - center - frac, cutoff, half_width);
+			coefs[tap] = value;
+			sum += value;
+		}
+		//normalize each phase to unity gain so the interpolated positions don't ripple
+		for (uint32_t tap = 0; tap < taps; tap++)
+		{
+			coefs[tap] /= sum;
+		}
+	}
+	src->filter_ratio = ratio;
+}
+
+//Span sources are synthesized as band-limited steps, each change in level adds the difference
+//between two samples of a windowed sinc step response to the output samples around it and the
+//output is the running sum. The kernel is in output samples so one table serves every source
+static int32_t *step_kernel;
+static uint32_t step_taps;
+//steps are stored with this many fractional bits, a kernel phase sums to exactly one
+#define STEP_FRAC_BITS 15
+//output samples the step buffer holds beyond the kernel length, it is compacted once per block
+#define STEP_BLOCK 256
+
+static void step_calc_kernel(void)
+{
+	double cutoff = 0.5 * RESAMPLE_ROLLOFF;
+	double half_width = RESAMPLE_ZERO_CROSSINGS / (2.0 * cutoff);
+	//tap k covers the impulse response from k to k + 1 samples after the start of the window,
+	//shifted back by the position of the step within the output sample
+	step_taps = (uint32_t)ceil(2.0 * half_width) + 1;
+	step_kernel = malloc(RESAMPLE_PHASES * step_taps * sizeof(int32_t));
+	double *area = malloc(step_taps * sizeof(double));
+	for (uint32_t phase = 0; phase < RESAMPLE_PHASES; phase++)
+	{
+		double frac = (double)phase / RESAMPLE_PHASES;
+		double sum = 0.0;
+		uint32_t peak = 0;
+		for (uint32_t tap = 0; tap < step_taps; tap++)
+		{
+			//midpoint rule, the impulse response is smooth enough that 16 points per sample is plenty
+			double start = tap - frac - half_width;
+			area[tap] = 0.0;
+			for (int i = 0; i < 16; i++)
+			{
+				area[tap] += windowed_sinc(start + (i + 0.5) / 16.0, cutoff, half_width) / 16.0;
+			}
+			sum += area[tap];
+			if (fabs(area[tap]) > fabs(area[peak])) {
+				peak = tap;
+			}
+		}
+		//rounding error goes to the largest tap so a step always settles at exactly its height
+		int32_t *coefs = step_kernel + phase * step_taps;
+		int32_t total = 0;
+		for (uint32_t tap = 0; tap < step_taps; tap++)
+		{
+			coefs[tap] = lround(area[tap] / sum * (1 << STEP_FRAC_BITS));
+			total += coefs[tap];
+		}
+		coefs[peak] += (1 << STEP_FRAC_BITS) - total;
+	}
+	free(area);
+}
+
+static void resample_update_step(audio_source *src)
+{
+	//buffer_inc is output samples per input sample scaled by BUFFER_INC_RES
+	src->resample_step = src->buffer_inc ? (((uint64_t)BUFFER_INC_RES) << 32) / src->buffer_inc : 0;
+}
+
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
 {
 	src->buffer_inc = ((BUFFER_INC_RES * (uint64_t)sample_rate) / master_clock) * sample_divider;
+	resample_update_step(src);
+	double ratio = src->buffer_inc ? (double)BUFFER_INC_RES / src->buffer_inc : 1.0;
+	if (!src->coefs || fabs(ratio - src->filter_ratio) > src->filter_ratio * 0.01) {
+		resample_calc_coefs(src, ratio);
+	}
 }
 
 void render_audio_adjust_speed(float adjust_ratio)
@@ -147,6 +422,8 @@ void render_audio_adjust_speed(float adjust_ratio)
 	for (uint8_t i = 0; i < num_audio_sources; i++)
 	{
 		audio_sources[i]->buffer_inc = ((double)audio_sources[i]->buffer_inc) + ((double)audio_sources[i]->buffer_inc) * adjust_ratio + 0.5;
+		//these adjustments are small so only the step changes, the filter stays the same
+		resample_update_step(audio_sources[i]);
 	}
 }
 
@@ -164,6 +441,9 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 			ret->num_channels = channels;
 			audio_sources[num_audio_sources++] = ret;
 		}
+		if (!step_kernel) {
+			step_calc_kernel();
+		}
 	render_unlock_audio();
 	if (!ret) {
 		fatal_error("Too many audio sources!");
@@ -171,11 +451,11 @@ audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider
 		render_audio_adjust_clock(ret, master_clock, sample_divider);
 		double lowpass_cutoff = get_lowpass_cutoff(config);
 		double rc = (1.0 / lowpass_cutoff) / (2.0 * M_PI);
-		ret->dt = 1.0 / ((double)master_clock / (double)(sample_divider));
+		//the lowpass filter is applied to the resampled output
+		ret->dt = sample_rate ? 1.0 / sample_rate : 1.0 / ((double)master_clock / (double)(sample_divider));
 		double alpha = ret->dt / (ret->dt + rc);
 		ret->lowpass_alpha = (int32_t)(((double)0x10000) * alpha);
 		ret->buffer_pos = 0;
-		ret->buffer_fraction = 0;
 		ret->last_left = ret->last_right = 0;
 		ret->read_start = 0;
 		ret->read_end = render_is_audio_sync() ? buffer_samples * channels : 0;
@@ -235,6 +515,21 @@ void render_resume_source(audio_source *src)
 	render_source_resumed(src);
 }
 
+//Removes src from the mixer without pausing it, render_do_audio_ready is still called for it
+//Lets programs that consume each source's output directly use more sources than the mixer holds
+void render_audio_detach_source(audio_source *src)
+{
+	render_lock_audio();
+		for (uint8_t i = 0; i < num_audio_sources; i++)
+		{
+			if (audio_sources[i] == src) {
+				audio_sources[i] = audio_sources[--num_audio_sources];
+				break;
+			}
+		}
+	render_unlock_audio();
+}
+
 void render_free_source(audio_source *src)
 {
 	uint8_t found = 0;
@@ -256,6 +551,9 @@ void render_free_source(audio_source *src)
 		free(src->back);
 		render_free_audio_opaque(src->opaque);
 	}
+	free(src->coefs);
+	free(src->history);
+	free(src->steps);
 	free(src);
 }
 
@@ -266,52 +564,283 @@ static int16_t lowpass_sample(audio_source *src, int16_t last, int16_t current)
 	return current;
 }
 
-static void interp_sample(audio_source *src, int16_t last, int16_t current)
+static uint32_t sync_samples;
+static void output_sample(audio_source *src, int16_t *values, uint8_t is_sync)
 {
-	int64_t tmp = last * ((src->buffer_fraction << 16) / src->buffer_inc);
-	tmp += current * (0x10000 - ((src->buffer_fraction << 16) / src->buffer_inc));
-	src->back[src->buffer_pos++] = tmp >> 16;
+	uint32_t base = is_sync ? 0 : src->read_end;
+	if (!is_sync) {
+		//one frame is always left unused so a full ring can be told apart from an empty one
+		uint32_t used = (src->buffer_pos - __atomic_load_n(&src->read_start, __ATOMIC_ACQUIRE)) & src->mask;
+		if (used + src->num_channels > src->mask) {
+			__atomic_store_n(&src->overruns, src->overruns + 1, __ATOMIC_RELAXED);
+			return;
+		}
+	}
+	for (uint8_t ch = 0; ch < src->num_channels; ch++)
+	{
+		src->back[src->buffer_pos++] = values[ch];
+	}
+	if (((src->buffer_pos - base) & src->mask) >> (src->num_channels - 1) >= sync_samples) {
+		render_do_audio_ready(src);
+	}
+	src->buffer_pos &= src->mask;
 }
 
-static uint32_t sync_samples;
-void render_put_mono_sample(audio_source *src, int16_t value)
+//Returns how many frames can be added to src before one has to go through output_sample to be
+//handed off to the audio output or counted as an overrun
+static uint32_t output_room(audio_source *src, uint8_t is_sync)
 {
-	value = lowpass_sample(src, src->last_left, value);
-	src->buffer_fraction += src->buffer_inc;
-	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
-	while (src->buffer_fraction > BUFFER_INC_RES)
+	uint32_t base = is_sync ? 0 : src->read_end;
+	uint32_t buffered = ((src->buffer_pos - base) & src->mask) >> (src->num_channels - 1);
+	uint32_t room = buffered + 1 < sync_samples ? sync_samples - buffered - 1 : 0;
+	if (!is_sync) {
+		//read_start only moves forward so this can only underestimate the free space
+		uint32_t used = (src->buffer_pos - __atomic_load_n(&src->read_start, __ATOMIC_ACQUIRE)) & src->mask;
+		uint32_t free_frames = (src->mask - used) >> (src->num_channels - 1);
+		if (free_frames < room) {
+			room = free_frames;
+		}
+	}
+	return room;
+}
+
+static int16_t resample_clamp(float value)
+{
+	if (value >= 32767.0f) {
+		return 32767;
+	} else if (value <= -32768.0f) {
+		return -32768;
+	}
+	return value < 0.0f ? value - 0.5f : value + 0.5f;
+}
+
+//Produces every output sample whose filter window is covered by the collected input
+static void resample_run(audio_source *src)
+{
+	uint32_t taps = src->num_taps;
+	float *left = src->history, *right = src->history + src->history_size;
+	if (!src->resample_step) {
+		//no output rate yet
+		src->history_len = 0;
+		return;
+	}
+	uint8_t is_sync = render_is_audio_sync();
+	uint32_t room = output_room(src, is_sync);
+	while ((src->resample_pos >> 32) + taps <= src->history_len)
 	{
-		src->buffer_fraction -= BUFFER_INC_RES;
-		interp_sample(src, src->last_left, value);
-		
-		if (((src->buffer_pos - base) & src->mask) >= sync_samples) {
-			render_do_audio_ready(src);
+		uint32_t index = src->resample_pos >> 32;
+		float *coefs = src->coefs + (((uint32_t)src->resample_pos) >> (32 - RESAMPLE_PHASE_BITS)) * taps;
+		//two accumulators per channel so consecutive multiply-adds don't wait on each other
+		audio_vec acc_left[2] = {{0, 0, 0, 0}, {0, 0, 0, 0}}, acc_right[2] = {{0, 0, 0, 0}, {0, 0, 0, 0}};
+		int16_t values[2];
+		uint32_t tap;
+		if (src->num_channels == 2) {
+			for (tap = 0; tap + 8 <= taps; tap += 8)
+			{
+				audio_vec c0, c1, l0, l1, r0, r1;
+				memcpy(&c0, coefs + tap, sizeof(c0));
+				memcpy(&c1, coefs + tap + 4, sizeof(c1));
+				memcpy(&l0, left + index + tap, sizeof(l0));
+				memcpy(&l1, left + index + tap + 4, sizeof(l1));
+				memcpy(&r0, right + index + tap, sizeof(r0));
+				memcpy(&r1, right + index + tap + 4, sizeof(r1));
+				acc_left[0] += c0 * l0;
+				acc_left[1] += c1 * l1;
+				acc_right[0] += c0 * r0;
+				acc_right[1] += c1 * r1;
+			}
+			if (tap < taps) {
+				audio_vec c0, l0, r0;
+				memcpy(&c0, coefs + tap, sizeof(c0));
+				memcpy(&l0, left + index + tap, sizeof(l0));
+				memcpy(&r0, right + index + tap, sizeof(r0));
+				acc_left[1] += c0 * l0;
+				acc_right[1] += c0 * r0;
+			}
+			acc_right[0] += acc_right[1];
+			values[1] = resample_clamp(acc_right[0][0] + acc_right[0][1] + acc_right[0][2] + acc_right[0][3]);
+		} else {
+			for (tap = 0; tap + 8 <= taps; tap += 8)
+			{
+				audio_vec c0, c1, l0, l1;
+				memcpy(&c0, coefs + tap, sizeof(c0));
+				memcpy(&c1, coefs + tap + 4, sizeof(c1));
+				memcpy(&l0, left + index + tap, sizeof(l0));
+				memcpy(&l1, left + index + tap + 4, sizeof(l1));
+				acc_left[0] += c0 * l0;
+				acc_left[1] += c1 * l1;
+			}
+			if (tap < taps) {
+				audio_vec c0, l0;
+				memcpy(&c0, coefs + tap, sizeof(c0));
+				memcpy(&l0, left + index + tap, sizeof(l0));
+				acc_left[1] += c0 * l0;
+			}
 		}
-		src->buffer_pos &= src->mask;
+		acc_left[0] += acc_left[1];
+		values[0] = resample_clamp(acc_left[0][0] + acc_left[0][1] + acc_left[0][2] + acc_left[0][3]);
+		//the lowpass filter runs at the output rate so it only costs anything per output sample
+		values[0] = src->last_left = lowpass_sample(src, src->last_left, values[0]);
+		if (src->num_channels == 2) {
+			values[1] = src->last_right = lowpass_sample(src, src->last_right, values[1]);
+		}
+		if (room) {
+			//most samples neither complete the buffer nor overflow it, skip the checks for those
+			room--;
+			src->back[src->buffer_pos] = values[0];
+			if (src->num_channels == 2) {
+				src->back[src->buffer_pos + 1] = values[1];
+			}
+			src->buffer_pos = (src->buffer_pos + src->num_channels) & src->mask;
+		} else {
+			output_sample(src, values, is_sync);
+			room = output_room(src, is_sync);
+		}
+		src->resample_pos += src->resample_step;
+	}
+	//run again once there is input for a batch, or sooner if a smaller number of output samples
+	//completes the buffer so the hand off to the audio output never waits on extra input
+	uint32_t base = is_sync ? 0 : src->read_end;
+	uint32_t buffered = ((src->buffer_pos - base) & src->mask) >> (src->num_channels - 1);
+	uint32_t batch = buffered < sync_samples && sync_samples - buffered < RESAMPLE_BATCH ? sync_samples - buffered : RESAMPLE_BATCH;
+	uint64_t ready = ((src->resample_pos + (batch - 1) * src->resample_step) >> 32) + taps;
+	src->resample_ready = ready < src->history_size ? ready : src->history_size;
+}
+
+//Moves the input that is still needed to the start of the history buffer, only done when the
+//buffer fills so the copy is spread over RESAMPLE_BLOCK input samples
+static void resample_compact(audio_source *src)
+{
+	uint32_t consumed = src->resample_pos >> 32;
+	if (consumed > src->history_len) {
+		//step is larger than a block, skip the input we don't have yet
+		consumed = src->history_len;
+	}
+	src->history_len -= consumed;
+	src->resample_pos -= ((uint64_t)consumed) << 32;
+	src->resample_ready = src->resample_ready > consumed ? src->resample_ready - consumed : 0;
+	for (uint8_t ch = 0; ch < src->num_channels; ch++)
+	{
+		float *history = src->history + ch * src->history_size;
+		memmove(history, history + consumed, src->history_len * sizeof(float));
+	}
+}
+
+void render_put_mono_sample(audio_source *src, int16_t value)
+{
+	if (src->discard) {
+		return;
+	}
+	if (src->history_len == src->history_size) {
+		resample_compact(src);
+	}
+	src->history[src->history_len++] = value;
+	if (src->history_len >= src->resample_ready) {
+		resample_run(src);
 	}
-	src->last_left = value;
 }
 
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
 {
-	left = lowpass_sample(src, src->last_left, left);
-	right = lowpass_sample(src, src->last_right, right);
-	src->buffer_fraction += src->buffer_inc;
-	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
-	while (src->buffer_fraction > BUFFER_INC_RES)
+	if (src->discard) {
+		return;
+	}
+	if (src->history_len == src->history_size) {
+		resample_compact(src);
+	}
+	src->history[src->history_len] = left;
+	src->history[src->history_size + src->history_len++] = right;
+	if (src->history_len >= src->resample_ready) {
+		resample_run(src);
+	}
+}
+
+//Sums the steps for every output sample that no later step can change
+static void step_output(audio_source *src)
+{
+	uint8_t is_sync = render_is_audio_sync();
+	uint32_t end = src->step_pos >> 32;
+	while (src->steps_read < end)
 	{
-		src->buffer_fraction -= BUFFER_INC_RES;
-		
-		interp_sample(src, src->last_left, left);
-		interp_sample(src, src->last_right, right);
-		
-		if (((src->buffer_pos - base) & src->mask)/2 >= sync_samples) {
-			render_do_audio_ready(src);
+		uint32_t stop = end < STEP_BLOCK ? end : STEP_BLOCK;
+		for (; src->steps_read < stop; src->steps_read++)
+		{
+			src->step_accum += src->steps[src->steps_read];
+			//the sum wraps like the steps do, only the final level has to fit
+			int32_t level = ((int32_t)src->step_accum + (1 << (STEP_FRAC_BITS - 1))) >> STEP_FRAC_BITS;
+			int16_t out = level > 32767 ? 32767 : level < -32768 ? -32768 : level;
+			out = src->last_left = lowpass_sample(src, src->last_left, out);
+			output_sample(src, &out, is_sync);
+		}
+		if (src->steps_read == STEP_BLOCK) {
+			//the steps that reach past the block move to the start and the rest is cleared
+			memmove(src->steps, src->steps + STEP_BLOCK, step_taps * sizeof(uint32_t));
+			memset(src->steps + step_taps, 0, STEP_BLOCK * sizeof(uint32_t));
+			src->steps_read = 0;
+			src->step_pos -= ((uint64_t)STEP_BLOCK) << 32;
+			end -= STEP_BLOCK;
+		}
+	}
+}
+
+//Adds count input samples that all have the same value. Sources fed this way are synthesized as
+//band-limited steps so the cost depends on the number of level changes and output samples
+//rather than the number of input samples. A source should be fed either with spans or with
+//render_put_mono_sample, not both
+void render_put_mono_span(audio_source *src, int16_t value, uint32_t count)
+{
+	if (!src->resample_step || src->discard) {
+		//no output rate yet
+		return;
+	}
+	if (!src->steps) {
+		src->steps = calloc(STEP_BLOCK + step_taps, sizeof(uint32_t));
+	}
+	if (value != src->step_level) {
+		//step_output leaves step_pos inside the block so the whole kernel fits
+		uint32_t index = src->step_pos >> 32;
+		int32_t *coefs = step_kernel + (((uint32_t)src->step_pos) >> (32 - RESAMPLE_PHASE_BITS)) * step_taps;
+		uint32_t delta = value - src->step_level;
+		for (uint32_t tap = 0; tap < step_taps; tap++)
+		{
+			//unsigned so overlapping steps can wrap without undefined behavior
+			src->steps[index + tap] += delta * (uint32_t)coefs[tap];
 		}
-		src->buffer_pos &= src->mask;
+		src->step_level = value;
 	}
-	src->last_left = left;
-	src->last_right = right;
+	//buffer_inc is output samples per input sample with 30 fractional bits
+	src->step_pos += count * (src->buffer_inc << 2);
+	step_output(src);
+}
+
+//While discard is set, samples put into src are dropped, for when emulation has to be run again
+//over a stretch that has already been heard
+void render_audio_discard(audio_source *src, uint8_t discard)
+{
+	src->discard = discard;
+}
+
+//Returns how many more input samples src can take before it reaches the point where its
+//buffer is handed off to the audio output, lets sources that synthesize lazily know when
+//their samples are actually needed
+uint32_t render_audio_samples_until_sync(audio_source *src)
+{
+	uint32_t base = render_is_audio_sync() ? 0 : src->read_end;
+	uint32_t buffered = ((src->buffer_pos - base) & src->mask) / src->num_channels;
+	if (buffered >= sync_samples) {
+		return 0;
+	}
+	if (src->steps) {
+		//span source, an output sample is complete once the input has passed it
+		uint64_t target = ((uint64_t)(src->steps_read + sync_samples - buffered)) << 32;
+		uint64_t inc = src->buffer_inc << 2;
+		return inc && target > src->step_pos ? (target - src->step_pos + inc - 1) / inc : 0;
+	}
+	//input needed for the filter to reach the last output sample before the hand off, resample_run
+	//is called as soon as the output sample that completes the buffer can be produced
+	uint64_t last = src->resample_pos + (sync_samples - buffered - 1) * src->resample_step;
+	uint64_t needed = (last >> 32) + src->num_taps;
+	return needed > src->history_len ? needed - src->history_len : 0;
 }
 
 static void update_source(audio_source *src, double rc, uint8_t sync_changed)
@@ -342,22 +871,16 @@ void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t
 	output_channels = channels;
 	buffer_samples = buffer_size;
 	sample_size = sample_size_in;
-	if (mix_buf) {
-		free(mix_buf);
-		mix_buf = NULL;
-	}
 	switch(format)
 	{
 	case RENDER_AUDIO_S16:
 		convert = convert_s16;
-		mix_buf = calloc(output_channels * buffer_samples, sizeof(float));
 		break;
 	case RENDER_AUDIO_FLOAT:
 		convert = clamp_f32;
 		break;
 	case RENDER_AUDIO_UNKNOWN:
 		convert = convert_null;
-		mix_buf = calloc(output_channels * buffer_samples, sizeof(float));
 		break;
 	}
 	uint32_t syncs = render_audio_syncs_per_sec();
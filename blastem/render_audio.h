@@ -2,29 +2,57 @@
 #define RENDER_AUDIO_H_
 
 #include <stdint.h>
+
+#define AUDIO_CACHE_LINE 64
+
 typedef enum {
 	RENDER_AUDIO_S16,
 	RENDER_AUDIO_FLOAT,
 	RENDER_AUDIO_UNKNOWN
 } render_audio_format;
 
+//When the output runs asynchronously to emulation back is a single producer, single consumer
+//ring. The emulation thread writes at buffer_pos and publishes completed samples by storing
+//read_end, the audio output consumes them and advances read_start. Both indices are accessed
+//with atomic loads and stores so neither side needs a lock. When output is synchronized to
+//audio front and back are swapped whole and front_populated hands them off
 typedef struct {
 	void     *opaque;
 	int16_t  *front;
 	int16_t  *back;
+	float    *coefs;      //polyphase resampling filter, RESAMPLE_PHASES sets of num_taps coefficients
+	float    *history;    //input samples waiting to be resampled, one run per channel
 	double   dt;
-	uint64_t buffer_fraction;
 	uint64_t buffer_inc;
+	uint64_t resample_pos;  //32.32 fixed point position of the next output sample in history
+	uint64_t resample_step; //32.32 fixed point input samples per output sample
+	uint64_t step_pos;      //32.32 fixed point position of span input in steps, in output samples
+	uint32_t *steps;        //band-limited steps waiting to be summed into output for span sources
 	float    gain_mult;
+	float    filter_ratio;  //input/output ratio coefs was computed for
+	uint32_t num_taps;
+	uint32_t history_len;
+	uint32_t history_size;
+	uint32_t resample_ready; //history_len at which there is enough input to run the filter again
+	uint32_t steps_read;    //next entry of steps to be summed into an output sample
+	uint32_t step_accum;    //running sum of steps, the current level with STEP_FRAC_BITS fractional bits
 	uint32_t buffer_pos;
-	uint32_t read_start;
 	uint32_t read_end;
+	uint32_t overruns;      //output samples dropped because the ring was full
 	uint32_t lowpass_alpha;
 	uint32_t mask;
 	int16_t  last_left;
 	int16_t  last_right;
+	int16_t  step_level;    //value of the last span
 	uint8_t  num_channels;
 	uint8_t  front_populated;
+	uint8_t  discard;       //samples are dropped instead of being output
+	//fields below are written by the audio output, the padding keeps them off the cache lines
+	//the emulation thread writes
+	uint8_t  consumer_pad[AUDIO_CACHE_LINE];
+	uint32_t read_start;
+	uint32_t underruns;     //times the output needed more samples than were available
+	uint8_t  consumer_pad_end[AUDIO_CACHE_LINE - 2 * sizeof(uint32_t)];
 } audio_source;
 
 //public interface
@@ -33,12 +61,18 @@ void render_audio_source_gaindb(audio_source *src, float gain);
 void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider);
 void render_put_mono_sample(audio_source *src, int16_t value);
 void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right);
+void render_put_mono_span(audio_source *src, int16_t value, uint32_t count);
+uint32_t render_audio_samples_until_sync(audio_source *src);
+void render_audio_discard(audio_source *src, uint8_t discard);
+void render_audio_stats(uint32_t *underruns, uint32_t *overruns);
 void render_pause_source(audio_source *src);
 void render_resume_source(audio_source *src);
 void render_free_source(audio_source *src);
+void render_audio_detach_source(audio_source *src);
 //interface for render backends
 void render_audio_initialized(render_audio_format format, uint32_t rate, uint8_t channels, uint32_t buffer_size, int sample_size);
 int mix_and_convert(unsigned char *byte_stream, int len, int *min_remaining_out);
+void mix_silence(unsigned char *byte_stream, int len);
 uint8_t all_sources_ready(void);
 void render_audio_adjust_speed(float adjust_ratio);
 //to be implemented by render backend
@@ -19,6 +19,7 @@
 #include "png.h"
 #include "config.h"
 #include "controller_info.h"
+#include "drc.h"
 
 #ifndef DISABLE_OPENGL
 #ifdef USE_GLES
@@ -47,8 +48,8 @@ static uint8_t scanlines = 0;
 
 static uint32_t last_frame = 0;
 
-static SDL_mutex *audio_mutex, *frame_mutex, *free_buffer_mutex;
-static SDL_cond *audio_ready, *frame_ready;
+static SDL_mutex *frame_mutex, *free_buffer_mutex;
+static SDL_cond *frame_ready;
 static uint8_t quitting = 0;
 
 enum {
@@ -82,40 +83,35 @@ uint8_t render_should_release_on_exit(void)
 
 void render_buffer_consumed(audio_source *src)
 {
-	SDL_CondSignal(src->opaque);
+	if (sync_src == SYNC_AUDIO) {
+		SDL_SemPost(src->opaque);
+	}
 }
 
 static void audio_callback(void * userdata, uint8_t *byte_stream, int len)
 {
-	SDL_LockMutex(audio_mutex);
-		uint8_t all_ready;
-		do {
-			all_ready = all_sources_ready();
-			if (!quitting && !all_ready) {
-				SDL_CondWait(audio_ready, audio_mutex);
-			}
-		} while(!quitting && !all_ready);
-		if (!quitting) {
-			mix_and_convert(byte_stream, len, NULL);
-		}
-	SDL_UnlockMutex(audio_mutex);
+	//never waits for the emulation thread, if a source hasn't finished its buffer in time
+	//the device gets silence, mix_silence counts an underrun for the source and its buffer is
+	//picked up by the next callback
+	if (__atomic_load_n(&quitting, __ATOMIC_ACQUIRE)) {
+		memset(byte_stream, 0, len);
+	} else if (all_sources_ready()) {
+		mix_and_convert(byte_stream, len, NULL);
+	} else {
+		mix_silence(byte_stream, len);
+	}
 }
 
-#define NO_LAST_BUFFERED -2000000000
-static int32_t last_buffered = NO_LAST_BUFFERED;
-static float average_change;
-#define BUFFER_FRAMES_THRESHOLD 6
-#define BASE_MAX_ADJUST 0.0125
-static float max_adjust;
-static int32_t cur_min_buffered;
-static uint32_t min_remaining_buffer;
+static drc_state drc;
 static void audio_callback_drc(void *userData, uint8_t *byte_stream, int len)
 {
-	if (cur_min_buffered < 0) {
+	if (drc_underflow_pending(&drc)) {
 		//underflow last frame, but main thread hasn't gotten a chance to call SDL_PauseAudio yet
 		return;
 	}
-	cur_min_buffered = mix_and_convert(byte_stream, len, &min_remaining_buffer);
+	int min_remaining;
+	int buffered = mix_and_convert(byte_stream, len, &min_remaining);
+	drc_report_levels(&drc, buffered, min_remaining);
 }
 
 static void audio_callback_run_on_audio(void *user_data, uint8_t *byte_stream, int len)
@@ -126,31 +122,27 @@ static void audio_callback_run_on_audio(void *user_data, uint8_t *byte_stream, i
 	mix_and_convert(byte_stream, len, NULL);
 }
 
+//only needed when the set of audio sources changes, samples are handed to the callback without locking
 void render_lock_audio()
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_LockMutex(audio_mutex);
-	} else {
-		SDL_LockAudio();
-	}
+	SDL_LockAudio();
 }
 
 void render_unlock_audio()
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_UnlockMutex(audio_mutex);
-	} else {
-		SDL_UnlockAudio();
-	}
+	SDL_UnlockAudio();
 }
 
 static void render_close_audio()
 {
-	SDL_LockMutex(audio_mutex);
-		quitting = 1;
-		SDL_CondSignal(audio_ready);
-	SDL_UnlockMutex(audio_mutex);
+	__atomic_store_n(&quitting, 1, __ATOMIC_RELEASE);
 	SDL_CloseAudio();
+	uint32_t underruns, overruns;
+	render_audio_stats(&underruns, &overruns);
+	debug_message("Audio underruns: %u, overruns: %u\n", underruns, overruns);
+	if (!render_is_audio_sync()) {
+		drc_print_stats(&drc);
+	}
 	/*
 	FIXME: move this to render_audio.c
 	if (mix_buf) {
@@ -162,21 +154,18 @@ static void render_close_audio()
 
 void *render_new_audio_opaque(void)
 {
-	return SDL_CreateCond();
+	//posted by the audio callback each time it is done with a source's front buffer
+	return SDL_CreateSemaphore(0);
 }
 
 void render_free_audio_opaque(void *opaque)
 {
-	SDL_DestroyCond(opaque);
+	SDL_DestroySemaphore(opaque);
 }
 
 void render_audio_created(audio_source *source)
 {
 	if (sync_src == SYNC_AUDIO) {
-		//SDL_PauseAudio acquires the audio device lock, which is held while the callback runs
-		//since our callback can itself be stuck waiting on the audio_ready condition variable
-		//calling SDL_PauseAudio(0) again for audio sources after the first can deadlock
-		//fortunately SDL_GetAudioStatus does not acquire the lock so is safe to call here
 		if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
 			SDL_PauseAudio(0);
 		}
@@ -188,9 +177,6 @@ void render_audio_created(audio_source *source)
 
 void render_source_paused(audio_source *src, uint8_t remaining_sources)
 {
-	if (sync_src == SYNC_AUDIO) {
-		SDL_CondSignal(audio_ready);
-	}
 	if (!remaining_sources && render_is_audio_sync()) {
 		SDL_PauseAudio(1);
 		if (sync_src == SYNC_AUDIO_THREAD) {
@@ -202,10 +188,6 @@ void render_source_paused(audio_source *src, uint8_t remaining_sources)
 void render_source_resumed(audio_source *src)
 {
 	if (sync_src == SYNC_AUDIO) {
-		//SDL_PauseAudio acquires the audio device lock, which is held while the callback runs
-		//since our callback can itself be stuck waiting on the audio_ready condition variable
-		//calling SDL_PauseAudio(0) again for audio sources after the first can deadlock
-		//fortunately SDL_GetAudioStatus does not acquire the lock so is safe to call here
 		if (SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
 			SDL_PauseAudio(0);
 		}
@@ -228,23 +210,20 @@ void render_do_audio_ready(audio_source *src)
 			system_request_exit(current_system, 0);
 		}
 	} else if (sync_src == SYNC_AUDIO) {
-		SDL_LockMutex(audio_mutex);
-			while (src->front_populated) {
-				SDL_CondWait(src->opaque, audio_mutex);
-			}
-			int16_t *tmp = src->front;
-			src->front = src->back;
-			src->back = tmp;
-			src->front_populated = 1;
-			src->buffer_pos = 0;
-			SDL_CondSignal(audio_ready);
-		SDL_UnlockMutex(audio_mutex);
+		//wait for the callback to finish with the previous buffer, this is what paces emulation
+		while (__atomic_load_n(&src->front_populated, __ATOMIC_ACQUIRE))
+		{
+			SDL_SemWait(src->opaque);
+		}
+		int16_t *tmp = src->front;
+		src->front = src->back;
+		src->back = tmp;
+		src->buffer_pos = 0;
+		__atomic_store_n(&src->front_populated, 1, __ATOMIC_RELEASE);
 	} else {
-		uint32_t num_buffered;
-		SDL_LockAudio();
-			src->read_end = src->buffer_pos;
-			num_buffered = ((src->read_end - src->read_start) & src->mask) / src->num_channels;
-		SDL_UnlockAudio();
+		uint32_t read_end = src->buffer_pos & src->mask;
+		__atomic_store_n(&src->read_end, read_end, __ATOMIC_RELEASE);
+		uint32_t num_buffered = ((read_end - __atomic_load_n(&src->read_start, __ATOMIC_ACQUIRE)) & src->mask) / src->num_channels;
 		if (num_buffered >= min_buffered && SDL_GetAudioStatus() == SDL_AUDIO_PAUSED) {
 			SDL_PauseAudio(0);
 		}
@@ -1486,9 +1465,6 @@ void render_init(int width, int height, char * title, uint8_t fullscreen)
 	
 	window_setup();
 
-	audio_mutex = SDL_CreateMutex();
-	audio_ready = SDL_CreateCond();
-	
 	init_audio();
 	
 	uint32_t db_size;
@@ -1581,7 +1557,7 @@ void render_config_updated(void)
 
 	uint8_t was_paused = SDL_GetAudioStatus() == SDL_AUDIO_PAUSED;
 	render_close_audio();
-	quitting = 0;
+	__atomic_store_n(&quitting, 0, __ATOMIC_RELEASE);
 	init_audio();
 	render_set_video_standard(video_standard);
 	
@@ -1639,7 +1615,7 @@ void render_set_video_standard(vid_std std)
 	min_buffered = (((float)max_repeat * (float)sample_rate/(float)source_hz)/* / (float)buffer_samples*/);// + 0.9999;
 	//min_buffered *= buffer_samples;
 	debug_message("Min samples buffered before audio start: %d\n", min_buffered);
-	max_adjust = BASE_MAX_ADJUST / source_hz;
+	drc_init(&drc, min_buffered, sample_rate);
 }
 
 void render_update_caption(char *title)
@@ -2279,49 +2255,14 @@ static void process_framebuffer(uint32_t *buffer, uint8_t which, int width, uint
 		}
 	}
 	if (!render_is_audio_sync()) {
-		int32_t local_cur_min, local_min_remaining;
-		SDL_LockAudio();
-			if (last_buffered > NO_LAST_BUFFERED) {
-				average_change *= 0.9f;
-				average_change += (cur_min_buffered - last_buffered) * 0.1f;
-			}
-			local_cur_min = cur_min_buffered;
-			local_min_remaining = min_remaining_buffer;
-			last_buffered = cur_min_buffered;
-		SDL_UnlockAudio();
-		float frames_to_problem;
-		if (average_change < 0) {
-			frames_to_problem = (float)local_cur_min / -average_change;
-		} else {
-			frames_to_problem = (float)local_min_remaining / average_change;
-		}
-		float adjust_ratio = 0.0f;
-		if (
-			frames_to_problem < BUFFER_FRAMES_THRESHOLD
-			|| (average_change < 0 && local_cur_min < 3*min_buffered / 4)
-			|| (average_change >0 && local_cur_min > 5 * min_buffered / 4)
-			|| cur_min_buffered < 0
-		) {
-			
-			if (cur_min_buffered < 0) {
-				adjust_ratio = max_adjust;
-				SDL_PauseAudio(1);
-				last_buffered = NO_LAST_BUFFERED;
-				cur_min_buffered = 0;
-			} else {
-				adjust_ratio = -1.0 * average_change / ((float)sample_rate / (float)source_hz);
-				adjust_ratio /= 2.5 * source_hz;
-				if (fabsf(adjust_ratio) > max_adjust) {
-					adjust_ratio = adjust_ratio > 0 ? max_adjust : -max_adjust;
-				}
-			}
-		} else if (local_cur_min < min_buffered / 2) {
-			adjust_ratio = max_adjust;
+		uint8_t underflow;
+		float adjust_ratio = drc_frame(&drc, &underflow);
+		if (underflow) {
+			SDL_PauseAudio(1);
+			drc_clear_underflow(&drc);
 		}
 		if (adjust_ratio != 0.0f) {
-			average_change = 0;
 			render_audio_adjust_speed(adjust_ratio);
-			
 		}
 		while (source_frame_count > 0)
 		{
@@ -0,0 +1,270 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+
+//Records are a sequence of tokens, each a varint count of bytes that match the reference followed
+//by a varint count of bytes that don't and then those bytes XORed with the reference. The reference
+//for a keyframe is all zeros
+
+rewind_buffer *rewind_new(size_t budget, uint32_t keyframe_interval)
+{
+	rewind_buffer *rw = calloc(1, sizeof(rewind_buffer));
+	rw->budget = budget;
+	rw->storage = malloc(budget);
+	rw->entry_storage = 256;
+	rw->entries = malloc(rw->entry_storage * sizeof(rewind_entry));
+	rw->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+	return rw;
+}
+
+void rewind_free(rewind_buffer *rw)
+{
+	free(rw->storage);
+	free(rw->entries);
+	free(rw->keyframe);
+	free(rw->zeros);
+	free(rw->restored);
+	free(rw->scratch);
+	free(rw);
+}
+
+static uint64_t load_word(uint8_t *src)
+{
+	uint64_t word;
+	memcpy(&word, src, sizeof(word));
+	return word;
+}
+
+static uint8_t *write_varint(uint8_t *dst, size_t value)
+{
+	while (value >= 0x80)
+	{
+		*(dst++) = value | 0x80;
+		value >>= 7;
+	}
+	*(dst++) = value;
+	return dst;
+}
+
+static uint8_t *read_varint(uint8_t *src, size_t *value)
+{
+	size_t out = 0;
+	uint8_t shift = 0;
+	uint8_t byte;
+	do {
+		byte = *(src++);
+		out |= (size_t)(byte & 0x7F) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	*value = out;
+	return src;
+}
+
+//worst case is a single literal run covering the whole state
+static size_t max_encoded_size(size_t size)
+{
+	return size + 2 * (sizeof(size_t) * 8 / 7 + 1);
+}
+
+static size_t encode(uint8_t *dst, uint8_t *state, uint8_t *ref, size_t size)
+{
+	uint8_t *out = dst;
+	size_t pos = 0;
+	while (pos < size)
+	{
+		size_t run_start = pos;
+		while (pos + 8 <= size && load_word(state + pos) == load_word(ref + pos))
+		{
+			pos += 8;
+		}
+		while (pos < size && state[pos] == ref[pos])
+		{
+			pos++;
+		}
+		size_t literal_start = pos;
+		//a literal only ends at a whole matching word, shorter matches cost more in token overhead than they save
+		while (pos < size)
+		{
+			if (pos + 8 <= size) {
+				if (load_word(state + pos) == load_word(ref + pos)) {
+					break;
+				}
+				pos += 8;
+			} else {
+				if (state[pos] == ref[pos]) {
+					break;
+				}
+				pos++;
+			}
+		}
+		out = write_varint(out, literal_start - run_start);
+		out = write_varint(out, pos - literal_start);
+		for (size_t i = literal_start; i < pos; i++)
+		{
+			*(out++) = state[i] ^ ref[i];
+		}
+	}
+	return out - dst;
+}
+
+static void decode(uint8_t *dst, uint8_t *src, uint8_t *ref, size_t size)
+{
+	size_t pos = 0;
+	while (pos < size)
+	{
+		size_t run, literal;
+		src = read_varint(src, &run);
+		src = read_varint(src, &literal);
+		memcpy(dst + pos, ref + pos, run);
+		pos += run;
+		for (size_t end = pos + literal; pos < end; pos++)
+		{
+			dst[pos] = *(src++) ^ ref[pos];
+		}
+	}
+}
+
+static uint8_t *zeros(rewind_buffer *rw, size_t size)
+{
+	if (size > rw->zeros_size) {
+		free(rw->zeros);
+		rw->zeros = calloc(1, size);
+		rw->zeros_size = size;
+	}
+	return rw->zeros;
+}
+
+static rewind_entry *entry(rewind_buffer *rw, uint32_t index)
+{
+	return rw->entries + (rw->first_entry + index) % rw->entry_storage;
+}
+
+//Drops the oldest keyframe along with the deltas that depend on it
+static void evict_oldest(rewind_buffer *rw)
+{
+	do {
+		rw->first_entry = (rw->first_entry + 1) % rw->entry_storage;
+		rw->num_entries--;
+	} while (rw->num_entries && !entry(rw, 0)->keyframe);
+	if (!rw->num_entries) {
+		//the newest keyframe is gone, so the next state can't be stored as a delta
+		rw->since_keyframe = rw->keyframe_interval;
+	}
+}
+
+//Finds room for len contiguous bytes after the newest record, evicting old records as needed
+static size_t alloc_record(rewind_buffer *rw, size_t len)
+{
+	while (rw->num_entries)
+	{
+		rewind_entry *newest = entry(rw, rw->num_entries - 1);
+		size_t head = newest->offset + newest->len;
+		size_t tail = entry(rw, 0)->offset;
+		if (tail < head) {
+			if (rw->budget - head >= len) {
+				return head;
+			}
+			if (tail >= len) {
+				return 0;
+			}
+		} else if (tail - head >= len) {
+			return head;
+		}
+		evict_oldest(rw);
+	}
+	return 0;
+}
+
+static void store_record(rewind_buffer *rw, uint8_t *state, size_t size)
+{
+	uint8_t keyframe = rw->since_keyframe >= rw->keyframe_interval || size != rw->state_size;
+	size_t len = encode(rw->scratch, state, keyframe ? zeros(rw, size) : rw->keyframe, size);
+	size_t offset = alloc_record(rw, len);
+	if (!keyframe && !rw->num_entries) {
+		//making room evicted the keyframe this delta is against
+		keyframe = 1;
+		len = encode(rw->scratch, state, zeros(rw, size), size);
+		offset = 0;
+	}
+	if (len > rw->budget) {
+		return;
+	}
+	memcpy(rw->storage + offset, rw->scratch, len);
+	if (rw->num_entries == rw->entry_storage) {
+		//unwrap the ring into a larger array
+		rewind_entry *entries = malloc(rw->entry_storage * 2 * sizeof(rewind_entry));
+		for (uint32_t i = 0; i < rw->num_entries; i++)
+		{
+			entries[i] = *entry(rw, i);
+		}
+		free(rw->entries);
+		rw->entries = entries;
+		rw->first_entry = 0;
+		rw->entry_storage *= 2;
+	}
+	*entry(rw, rw->num_entries++) = (rewind_entry){
+		.offset = offset,
+		.len = len,
+		.size = size,
+		.keyframe = keyframe
+	};
+	if (keyframe) {
+		memcpy(rw->keyframe, state, size);
+		rw->state_size = size;
+		rw->since_keyframe = 1;
+	} else {
+		rw->since_keyframe++;
+	}
+}
+
+void rewind_push(rewind_buffer *rw, uint8_t *state, size_t size)
+{
+	if (size > rw->buffer_size) {
+		//a state of a different size is always stored as a keyframe so the old contents don't need to be kept
+		free(rw->keyframe);
+		free(rw->restored);
+		free(rw->scratch);
+		rw->keyframe = malloc(size);
+		rw->restored = malloc(size);
+		rw->scratch = malloc(max_encoded_size(size));
+		rw->buffer_size = size;
+	}
+	store_record(rw, state, size);
+}
+
+//Returns the newest state and removes it from the buffer, or NULL if there are none left
+//The returned buffer is only valid until the next call
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out)
+{
+	if (!rw->num_entries) {
+		return NULL;
+	}
+	rewind_entry *newest = entry(rw, --rw->num_entries);
+	*size_out = newest->size;
+	if (!newest->keyframe) {
+		decode(rw->restored, rw->storage + newest->offset, rw->keyframe, newest->size);
+		rw->since_keyframe--;
+		return rw->restored;
+	}
+	memcpy(rw->restored, rw->keyframe, newest->size);
+	//deltas stored after this point are against the keyframe before this one
+	uint32_t index = rw->num_entries;
+	while (index && !entry(rw, index - 1)->keyframe)
+	{
+		index--;
+	}
+	if (index) {
+		rewind_entry *prev = entry(rw, index - 1);
+		decode(rw->keyframe, rw->storage + prev->offset, zeros(rw, prev->size), prev->size);
+		rw->state_size = prev->size;
+		rw->since_keyframe = rw->num_entries - index + 1;
+	} else {
+		rw->since_keyframe = rw->keyframe_interval;
+	}
+	return rw->restored;
+}
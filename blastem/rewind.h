@@ -0,0 +1,47 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Keeps recent save states in a fixed amount of memory so emulation can be stepped backwards
+//Every keyframe_interval states a keyframe is stored, the states in between are stored as the
+//difference from the keyframe before them. Both are run length encoded so the parts that match
+//the keyframe, or are zero in the case of keyframes, take very little space
+
+typedef struct {
+	size_t   offset;
+	uint32_t len;
+	uint32_t size;
+	uint8_t  keyframe;
+} rewind_entry;
+
+typedef struct {
+	uint8_t      *storage;
+	size_t       budget;
+	rewind_entry *entries; //ring of stored states, oldest first
+	uint32_t     first_entry;
+	uint32_t     num_entries;
+	uint32_t     entry_storage;
+	uint32_t     keyframe_interval;
+	uint32_t     since_keyframe; //states stored since the newest keyframe
+	uint8_t      *keyframe;      //decoded copy of the newest keyframe
+	size_t       state_size;     //size of the newest keyframe, states of other sizes can't be deltas against it
+	uint8_t      *restored;
+	uint8_t      *scratch;
+	size_t       buffer_size;    //size of the keyframe, restored and scratch allocations
+	uint8_t      *zeros;
+	size_t       zeros_size;
+} rewind_buffer;
+
+rewind_buffer *rewind_new(size_t budget, uint32_t keyframe_interval);
+void rewind_free(rewind_buffer *rw);
+void rewind_push(rewind_buffer *rw, uint8_t *state, size_t size);
+uint8_t *rewind_pop(rewind_buffer *rw, size_t *size_out);
+
+#endif //REWIND_H_
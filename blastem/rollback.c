@@ -0,0 +1,566 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifdef _WIN32
+#define WINVER 0x501
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rollback.h"
+#include "util.h"
+#include "blastem.h"
+
+//Messages are a command byte followed by big endian fields
+//CMD_INPUT: 32-bit frame number, 16-bit button mask
+//CMD_CHECK: 32-bit frame number, 32-bit hash of the state at the start of that frame
+//CMD_STATE: 32-bit size, state the host started with
+enum {
+	CMD_INPUT,
+	CMD_CHECK,
+	CMD_STATE
+};
+
+#define INPUT_MSG_SIZE 7
+#define CHECK_MSG_SIZE 9
+#define CHECK_INTERVAL 60
+#define PEER_TIMEOUT_MS 10000
+#define MAX_WAIT_MS 100
+
+static const char rb_ident[] = "BLSTRB\x01\x00";
+
+static rollback_session *unclaimed;
+
+static uint32_t now_ms(void)
+{
+#ifdef _WIN32
+	return GetTickCount();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+static void write_be32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
+
+static uint32_t read_be32(uint8_t *src)
+{
+	return src[0] << 24 | src[1] << 16 | src[2] << 8 | src[3];
+}
+
+static uint8_t send_all(int sock, uint8_t *data, size_t size)
+{
+	while (size)
+	{
+		int sent = send(sock, (const char *)data, size, 0);
+		if (sent <= 0) {
+			return 0;
+		}
+		data += sent;
+		size -= sent;
+	}
+	return 1;
+}
+
+static void disconnect(rollback_session *session, char *reason)
+{
+	if (session->sock < 0) {
+		return;
+	}
+	warning("Netplay %s, the other player's input will no longer change\n", reason);
+	socket_close(session->sock);
+	session->sock = -1;
+	session->num_outgoing = 0;
+	session->awaiting_state = 0;
+}
+
+static uint32_t state_hash(uint8_t *data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+#ifdef BLASTEM_BIG_ENDIAN
+		//both sides need to agree on the hash regardless of their byte order
+		word = __builtin_bswap64(word);
+#endif
+		hash = (hash ^ word) * 0x100000001B3ULL;
+	}
+	for (; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x100000001B3ULL;
+	}
+	return hash ^ hash >> 32;
+}
+
+static void compare_checks(rollback_session *session)
+{
+	if (session->local_check_frame == ROLLBACK_NO_FRAME || session->local_check_frame != session->remote_check_frame) {
+		return;
+	}
+	session->checks++;
+	if (session->local_check != session->remote_check && !session->desynced) {
+		session->desynced = 1;
+		warning("Netplay desync, the two sides had different states at frame %u\n", session->local_check_frame);
+	}
+}
+
+static void flush_outgoing(rollback_session *session)
+{
+	uint32_t now = now_ms();
+	while (session->num_outgoing)
+	{
+		rollback_packet *packet = session->outgoing + session->first_outgoing;
+		if ((int32_t)(packet->due - now) > 0) {
+			break;
+		}
+		if (!send_all(session->sock, packet->data, packet->len)) {
+			disconnect(session, "peer could not be reached");
+			return;
+		}
+		session->first_outgoing = (session->first_outgoing + 1) % session->outgoing_storage;
+		session->num_outgoing--;
+	}
+}
+
+//Messages are held back by the configured latency plus a random amount up to the configured jitter
+//They still go out in order since they share a TCP stream
+static void queue_message(rollback_session *session, uint8_t *data, uint8_t len)
+{
+	if (session->sock < 0) {
+		return;
+	}
+	uint32_t due = now_ms() + session->latency;
+	if (session->jitter) {
+		due += rand() % (session->jitter + 1);
+	}
+	if (session->num_outgoing && (int32_t)(due - session->last_due) < 0) {
+		due = session->last_due;
+	}
+	session->last_due = due;
+	if (session->num_outgoing == session->outgoing_storage) {
+		uint32_t old_storage = session->outgoing_storage;
+		session->outgoing_storage = old_storage ? old_storage * 2 : 16;
+		session->outgoing = realloc(session->outgoing, session->outgoing_storage * sizeof(rollback_packet));
+		//unwrap so the ring is contiguous in the larger allocation
+		if (session->first_outgoing) {
+			memcpy(session->outgoing + old_storage, session->outgoing, session->first_outgoing * sizeof(rollback_packet));
+		}
+	}
+	rollback_packet *packet = session->outgoing + (session->first_outgoing + session->num_outgoing++) % session->outgoing_storage;
+	packet->due = due;
+	packet->len = len;
+	memcpy(packet->data, data, len);
+	flush_outgoing(session);
+}
+
+static void handle_input(rollback_session *session, uint32_t frame, uint16_t input)
+{
+	if (frame != session->remote_frames) {
+		warning("Netplay input for frame %u arrived when frame %u was expected\n", frame, session->remote_frames);
+		return;
+	}
+	session->remote_inputs[frame % ROLLBACK_INPUT_RING] = input;
+	session->remote_frames++;
+	//frames that haven't been run again since the last rollback pick up the new input when they are
+	if (frame < session->frame && frame < session->rollback_to) {
+		if (session->frames[frame % ROLLBACK_MAX_FRAMES].inputs[!session->local_player] != input) {
+			session->rollback_to = frame;
+		}
+	}
+}
+
+static void process_messages(rollback_session *session)
+{
+	size_t pos = 0;
+	while (pos < session->recv_size)
+	{
+		uint8_t *msg = session->recv_buffer + pos;
+		size_t avail = session->recv_size - pos;
+		size_t len;
+		switch (msg[0])
+		{
+		case CMD_INPUT:
+			len = INPUT_MSG_SIZE;
+			break;
+		case CMD_CHECK:
+			len = CHECK_MSG_SIZE;
+			break;
+		case CMD_STATE:
+			if (avail < 5) {
+				len = 5;
+			} else {
+				len = 5 + read_be32(msg + 1);
+			}
+			break;
+		default:
+			warning("Unrecognized netplay command %X\n", msg[0]);
+			session->recv_size = 0;
+			disconnect(session, "peer sent invalid data");
+			return;
+		}
+		if (avail < len) {
+			if (len > session->recv_storage) {
+				memmove(session->recv_buffer, msg, avail);
+				session->recv_size = avail;
+				pos = 0;
+				session->recv_storage = len;
+				session->recv_buffer = realloc(session->recv_buffer, session->recv_storage);
+			}
+			break;
+		}
+		switch (msg[0])
+		{
+		case CMD_INPUT:
+			handle_input(session, read_be32(msg + 1), msg[5] << 8 | msg[6]);
+			break;
+		case CMD_CHECK:
+			session->remote_check_frame = read_be32(msg + 1);
+			session->remote_check = read_be32(msg + 5);
+			compare_checks(session);
+			break;
+		case CMD_STATE:
+			if (session->awaiting_state) {
+				rollback_frame *first = session->frames;
+				first->size = len - 5;
+				if (first->size > first->storage) {
+					first->storage = first->size;
+					first->state = realloc(first->state, first->storage);
+				}
+				memcpy(first->state, msg + 5, first->size);
+				session->awaiting_state = 0;
+			}
+			break;
+		}
+		pos += len;
+	}
+	if (pos) {
+		memmove(session->recv_buffer, session->recv_buffer + pos, session->recv_size - pos);
+		session->recv_size -= pos;
+	}
+}
+
+//Reads whatever the peer has sent, waiting up to timeout milliseconds for something to arrive
+static void receive(rollback_session *session, uint32_t timeout)
+{
+	if (session->sock < 0) {
+		return;
+	}
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(session->sock, &readable);
+	struct timeval tv = {
+		.tv_sec = timeout / 1000,
+		.tv_usec = (timeout % 1000) * 1000
+	};
+	if (select(session->sock + 1, &readable, NULL, NULL, &tv) <= 0) {
+		if (now_ms() - session->last_recv > PEER_TIMEOUT_MS) {
+			disconnect(session, "peer stopped responding");
+		}
+		return;
+	}
+	if (session->recv_storage - session->recv_size < 4096) {
+		session->recv_storage *= 2;
+		session->recv_buffer = realloc(session->recv_buffer, session->recv_storage);
+	}
+	int bytes = recv(session->sock, (char *)session->recv_buffer + session->recv_size, session->recv_storage - session->recv_size, 0);
+	if (bytes <= 0) {
+		disconnect(session, "peer disconnected");
+		return;
+	}
+	session->recv_size += bytes;
+	session->last_recv = now_ms();
+	process_messages(session);
+}
+
+static void wait_for_peer(rollback_session *session)
+{
+	uint32_t timeout = MAX_WAIT_MS;
+	if (session->num_outgoing) {
+		int32_t until_due = session->outgoing[session->first_outgoing].due - now_ms();
+		if (until_due < 0) {
+			until_due = 0;
+		}
+		if ((uint32_t)until_due < timeout) {
+			timeout = until_due;
+		}
+	}
+	receive(session, timeout);
+	if (session->sock >= 0) {
+		flush_outgoing(session);
+	}
+}
+
+static void start_session(int sock, uint8_t local_player)
+{
+	uint8_t ident[sizeof(rb_ident) - 1];
+	if (!send_all(sock, (uint8_t *)rb_ident, sizeof(ident))) {
+		fatal_error("Failed to send netplay handshake\n");
+	}
+	for (size_t got = 0; got < sizeof(ident);)
+	{
+		int bytes = recv(sock, (char *)ident + got, sizeof(ident) - got, 0);
+		if (bytes <= 0) {
+			fatal_error("Netplay peer disconnected during handshake\n");
+		}
+		got += bytes;
+	}
+	if (memcmp(ident, rb_ident, sizeof(ident))) {
+		fatal_error("Netplay peer is not running a compatible version of BlastEm\n");
+	}
+	int flag = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&flag, sizeof(flag));
+
+	rollback_session *session = calloc(1, sizeof(rollback_session));
+	session->sock = sock;
+	session->local_player = local_player;
+	session->rollback_to = ROLLBACK_NO_FRAME;
+	session->local_check_frame = session->remote_check_frame = ROLLBACK_NO_FRAME;
+	session->awaiting_state = local_player != 0;
+	session->recv_storage = 64 * 1024;
+	session->recv_buffer = malloc(session->recv_storage);
+	session->last_recv = now_ms();
+	char *max_rollback = tern_find_path_default(config, "netplay\0max_rollback\0", (tern_val){.ptrval = "8"}, TVAL_PTR).ptrval;
+	session->max_rollback = atoi(max_rollback);
+	if (session->max_rollback < 1) {
+		session->max_rollback = 1;
+	} else if (session->max_rollback > ROLLBACK_MAX_FRAMES) {
+		session->max_rollback = ROLLBACK_MAX_FRAMES;
+	}
+	char *latency = tern_find_path_default(config, "netplay\0latency\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval;
+	session->latency = atoi(latency);
+	char *jitter = tern_find_path_default(config, "netplay\0jitter\0", (tern_val){.ptrval = "0"}, TVAL_PTR).ptrval;
+	session->jitter = atoi(jitter);
+	printf("Netplay connected, playing as player %d\n", local_player + 1);
+	unclaimed = session;
+}
+
+void rollback_listen(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	socket_init();
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	request.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(address, port, &request, &result)) {
+		fatal_error("Failed to resolve netplay address %s:%s\n", address ? address : "*", port);
+	}
+	int listen_sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (listen_sock < 0) {
+		fatal_error("Failed to open netplay listen socket on port %s\n", port);
+	}
+	int param = 1;
+	setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&param, sizeof(param));
+	if (bind(listen_sock, result->ai_addr, result->ai_addrlen) < 0) {
+		fatal_error("Failed to bind netplay listen socket on port %s\n", port);
+	}
+	freeaddrinfo(result);
+	if (listen(listen_sock, 1) < 0) {
+		fatal_error("Failed to listen for netplay connections on port %s\n", port);
+	}
+	printf("Waiting for netplay peer on port %s\n", port);
+	int sock = accept(listen_sock, NULL, NULL);
+	socket_close(listen_sock);
+	if (sock < 0) {
+		fatal_error("Failed to accept netplay connection on port %s\n", port);
+	}
+	start_session(sock, 0);
+}
+
+void rollback_connect(char *address, char *port)
+{
+	struct addrinfo request, *result;
+	socket_init();
+	memset(&request, 0, sizeof(request));
+	request.ai_family = AF_INET;
+	request.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(address, port, &request, &result)) {
+		fatal_error("Failed to resolve netplay address %s:%s\n", address, port);
+	}
+	int sock = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+	if (sock < 0) {
+		fatal_error("Failed to create socket for netplay connection to %s:%s\n", address, port);
+	}
+	if (connect(sock, result->ai_addr, result->ai_addrlen) < 0) {
+		fatal_error("Failed to connect to netplay host %s:%s\n", address, port);
+	}
+	freeaddrinfo(result);
+	start_session(sock, 1);
+}
+
+//Hands the connected session to the system that will run it, only the first system created gets it
+rollback_session *rollback_claim(void)
+{
+	rollback_session *session = unclaimed;
+	unclaimed = NULL;
+	return session;
+}
+
+void rollback_free(rollback_session *session)
+{
+	printf(
+		"Netplay: %u frames, %u rollbacks, %u frames run again, %u stalls, %u state checks\n",
+		session->present, session->rollbacks, session->resimulated, session->stalls, session->checks
+	);
+	if (session->sock >= 0) {
+		flush_outgoing(session);
+		socket_close(session->sock);
+	}
+	for (int i = 0; i < ROLLBACK_MAX_FRAMES; i++)
+	{
+		free(session->frames[i].state);
+	}
+	free(session->outgoing);
+	free(session->recv_buffer);
+	free(session);
+}
+
+void rollback_local_input(rollback_session *session, uint8_t gamepad_num, uint8_t button, uint8_t down)
+{
+	//each side plays with its first gamepad, other devices would make the two sides diverge
+	if (gamepad_num != 1 || button >= 16) {
+		return;
+	}
+	if (down) {
+		session->local_input |= 1 << button;
+	} else {
+		session->local_input &= ~(1 << button);
+	}
+}
+
+//Picks the inputs for the frame that starts with the most recently stored state
+static void next_inputs(rollback_session *session, uint16_t *inputs_out)
+{
+	uint32_t frame = session->frame;
+	rollback_frame *cur = session->frames + frame % ROLLBACK_MAX_FRAMES;
+	uint8_t remote = !session->local_player;
+	if (frame == session->present) {
+		cur->inputs[session->local_player] = session->local_input;
+		uint8_t msg[INPUT_MSG_SIZE] = {CMD_INPUT};
+		write_be32(msg + 1, frame);
+		msg[5] = session->local_input >> 8;
+		msg[6] = session->local_input;
+		queue_message(session, msg, sizeof(msg));
+		session->present++;
+		session->catching_up = 0;
+	} else {
+		session->resimulated++;
+		session->catching_up = 1;
+	}
+	if (frame < session->remote_frames) {
+		cur->inputs[remote] = session->remote_inputs[frame % ROLLBACK_INPUT_RING];
+	} else if (session->remote_frames) {
+		cur->inputs[remote] = session->remote_inputs[(session->remote_frames - 1) % ROLLBACK_INPUT_RING];
+	} else {
+		cur->inputs[remote] = 0;
+	}
+	inputs_out[0] = cur->inputs[0];
+	inputs_out[1] = cur->inputs[1];
+	session->frame++;
+}
+
+//Called with the state at the start of each frame. Returns 1 if an earlier frame needs to be run
+//again, in which case the state should be replaced with the one from rollback_restore. Otherwise
+//inputs_out is filled with the button masks for each player to use for the frame
+uint8_t rollback_frame_start(rollback_session *session, uint8_t *state, size_t size, uint16_t *inputs_out)
+{
+	uint32_t frame = session->frame;
+	if (session->sock >= 0) {
+		flush_outgoing(session);
+		receive(session, 0);
+	}
+	if (session->rollback_to < frame) {
+		return 1;
+	}
+	rollback_frame *cur = session->frames + frame % ROLLBACK_MAX_FRAMES;
+	if (frame == session->present) {
+		if (session->sock >= 0 && frame >= session->remote_frames + session->max_rollback) {
+			//too far ahead of the other side to be able to correct a wrong prediction
+			session->stalls++;
+			do {
+				wait_for_peer(session);
+			} while (session->sock >= 0 && frame >= session->remote_frames + session->max_rollback);
+			if (session->rollback_to < frame) {
+				return 1;
+			}
+		}
+		if (session->awaiting_state) {
+			while (session->awaiting_state)
+			{
+				wait_for_peer(session);
+			}
+			if (session->sock >= 0) {
+				//start from the same state as the host
+				session->rollback_to = frame;
+				return 1;
+			}
+		}
+		if (frame >= ROLLBACK_MAX_FRAMES) {
+			//the state being replaced can no longer be rolled back to, so both sides should agree on it
+			uint32_t old_frame = frame - ROLLBACK_MAX_FRAMES;
+			if (!(old_frame % CHECK_INTERVAL) && session->sock >= 0) {
+				session->local_check_frame = old_frame;
+				session->local_check = state_hash(cur->state, cur->size);
+				uint8_t msg[CHECK_MSG_SIZE] = {CMD_CHECK};
+				write_be32(msg + 1, old_frame);
+				write_be32(msg + 5, session->local_check);
+				queue_message(session, msg, sizeof(msg));
+				compare_checks(session);
+			}
+		}
+	}
+	if (size > cur->storage) {
+		cur->storage = size;
+		cur->state = realloc(cur->state, cur->storage);
+	}
+	memcpy(cur->state, state, size);
+	cur->size = size;
+	if (!session->present && !session->local_player && session->sock >= 0) {
+		uint8_t header[5] = {CMD_STATE};
+		write_be32(header + 1, size);
+		if (!send_all(session->sock, header, sizeof(header)) || !send_all(session->sock, state, size)) {
+			disconnect(session, "peer could not be reached");
+		}
+	}
+	next_inputs(session, inputs_out);
+	return 0;
+}
+
+//Returns the state to continue from after rollback_frame_start returned 1 and fills inputs_out
+//with the inputs for the frame it starts
+uint8_t *rollback_restore(rollback_session *session, size_t *size_out, uint16_t *inputs_out)
+{
+	session->frame = session->rollback_to;
+	session->rollback_to = ROLLBACK_NO_FRAME;
+	if (session->frame < session->present) {
+		session->rollbacks++;
+	}
+	rollback_frame *cur = session->frames + session->frame % ROLLBACK_MAX_FRAMES;
+	*size_out = cur->size;
+	next_inputs(session, inputs_out);
+	return cur->state;
+}
@@ -0,0 +1,78 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef ROLLBACK_H_
+#define ROLLBACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Two player netplay where each side runs the full emulation and only gamepad state is exchanged
+//Input from the other side is predicted to be unchanged from the last frame it was known for and
+//a state is kept for the start of each frame that might still be wrong. When the real input turns
+//out to differ from the prediction, the state from the start of that frame is restored and the
+//frames since then are run again with output suppressed
+
+#define ROLLBACK_MAX_FRAMES 32
+#define ROLLBACK_INPUT_RING 64
+#define ROLLBACK_NO_FRAME 0xFFFFFFFF
+
+typedef struct {
+	uint8_t  *state;
+	size_t   size;
+	size_t   storage;
+	uint16_t inputs[2]; //button masks the frame that starts with state was run with
+} rollback_frame;
+
+typedef struct {
+	uint32_t due; //time in milliseconds after which it is sent
+	uint8_t  len;
+	uint8_t  data[9];
+} rollback_packet;
+
+typedef struct {
+	rollback_frame  frames[ROLLBACK_MAX_FRAMES];
+	uint16_t        remote_inputs[ROLLBACK_INPUT_RING];
+	rollback_packet *outgoing; //ring of messages held back to simulate latency
+	uint32_t        first_outgoing;
+	uint32_t        num_outgoing;
+	uint32_t        outgoing_storage;
+	uint8_t         *recv_buffer;
+	size_t          recv_size;
+	size_t          recv_storage;
+	int             sock;
+	uint32_t        frame;          //frame the next state passed to rollback_frame starts
+	uint32_t        present;        //first frame that hasn't been run yet
+	uint32_t        remote_frames;  //number of frames the remote input is known for
+	uint32_t        rollback_to;    //earliest frame that was run with a wrong prediction
+	uint32_t        max_rollback;
+	uint32_t        latency;
+	uint32_t        jitter;
+	uint32_t        last_due;
+	uint32_t        last_recv;
+	uint32_t        local_check_frame;
+	uint32_t        local_check;
+	uint32_t        remote_check_frame;
+	uint32_t        remote_check;
+	uint32_t        rollbacks;
+	uint32_t        resimulated;
+	uint32_t        stalls;
+	uint32_t        checks;
+	uint16_t        local_input;
+	uint8_t         local_player;
+	uint8_t         catching_up;    //frame about to run has been shown before, output should be suppressed
+	uint8_t         desynced;
+	uint8_t         awaiting_state;
+} rollback_session;
+
+void rollback_listen(char *address, char *port);
+void rollback_connect(char *address, char *port);
+rollback_session *rollback_claim(void);
+void rollback_free(rollback_session *session);
+void rollback_local_input(rollback_session *session, uint8_t gamepad_num, uint8_t button, uint8_t down);
+uint8_t rollback_frame_start(rollback_session *session, uint8_t *state, size_t size, uint16_t *inputs_out);
+uint8_t *rollback_restore(rollback_session *session, size_t *size_out, uint16_t *inputs_out);
+
+#endif //ROLLBACK_H_
@@ -0,0 +1,201 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include "runahead.h"
+#include "util.h"
+
+runahead_session *runahead_new(uint32_t frames, uint8_t mode)
+{
+	runahead_session *ra = calloc(1, sizeof(runahead_session));
+	ra->frames = frames;
+#ifdef _WIN32
+	if (mode == RUNAHEAD_INSTANCE) {
+		warning("Run-ahead with a second instance is not supported on Windows, using snapshots instead\n");
+		mode = RUNAHEAD_SNAPSHOT;
+	}
+#endif
+	ra->mode = mode;
+	ra->requests = ra->replies = -1;
+	return ra;
+}
+
+void runahead_free(runahead_session *ra)
+{
+	runahead_instance_stop(ra);
+	free(ra);
+}
+
+void runahead_local_input(runahead_session *ra, uint8_t gamepad_num, uint8_t button, uint8_t down)
+{
+	if (gamepad_num < 1 || gamepad_num > 2 || button >= 16) {
+		return;
+	}
+	if (down) {
+		ra->pads[gamepad_num - 1] |= 1 << button;
+	} else {
+		ra->pads[gamepad_num - 1] &= ~(1 << button);
+	}
+}
+
+#ifndef _WIN32
+static void read_all(int fd, void *data, size_t size)
+{
+	uint8_t *cur = data;
+	while (size)
+	{
+		ssize_t bytes = read(fd, cur, size);
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes <= 0) {
+			fatal_error("Run-ahead instance exited unexpectedly\n");
+		}
+		cur += bytes;
+		size -= bytes;
+	}
+}
+
+static uint8_t write_all(int fd, void *data, size_t size)
+{
+	uint8_t *cur = data;
+	while (size)
+	{
+		ssize_t bytes = write(fd, cur, size);
+		if (bytes < 0 && errno == EINTR) {
+			continue;
+		}
+		if (bytes <= 0) {
+			return 0;
+		}
+		cur += bytes;
+		size -= bytes;
+	}
+	return 1;
+}
+
+//Forks off the process that runs the real timeline, returns 1 in that process and 0 in the original
+uint8_t runahead_instance_start(runahead_session *ra, size_t max_state_size)
+{
+	int requests[2], replies[2];
+	ra->shared_size = max_state_size;
+	ra->shared = mmap(NULL, max_state_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ra->shared == MAP_FAILED || pipe(requests) || pipe(replies)) {
+		fatal_error("Failed to set up run-ahead instance\n");
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		fatal_error("Failed to start run-ahead instance\n");
+	}
+	ra->is_instance = !pid;
+	if (ra->is_instance) {
+		close(requests[1]);
+		close(replies[0]);
+		ra->requests = requests[0];
+		ra->replies = replies[1];
+	} else {
+		close(requests[0]);
+		close(replies[1]);
+		ra->requests = requests[1];
+		ra->replies = replies[0];
+		ra->instance = pid;
+	}
+	ra->started = 1;
+	return ra->is_instance;
+}
+
+void runahead_instance_stop(runahead_session *ra)
+{
+	if (!ra->started) {
+		return;
+	}
+	//the instance exits once it sees its request pipe close
+	close(ra->requests);
+	close(ra->replies);
+	waitpid(ra->instance, NULL, 0);
+	munmap(ra->shared, ra->shared_size);
+	ra->requests = ra->replies = -1;
+	ra->shared = NULL;
+	ra->started = 0;
+}
+
+//Has the instance run the next frame of the real timeline with the current gamepad state
+void runahead_instance_run(runahead_session *ra)
+{
+	if (!write_all(ra->requests, ra->pads, sizeof(ra->pads))) {
+		fatal_error("Run-ahead instance exited unexpectedly\n");
+	}
+}
+
+//Waits for the state at the end of the frame requested by the last call to runahead_instance_run,
+//or the state the instance started with before the first call
+uint8_t *runahead_instance_state(runahead_session *ra, size_t *size_out)
+{
+	uint32_t size;
+	read_all(ra->replies, &size, sizeof(size));
+	*size_out = size;
+	return ra->shared;
+}
+
+void runahead_instance_wait(runahead_session *ra, uint16_t *pads_out)
+{
+	ssize_t bytes;
+	do {
+		bytes = read(ra->requests, pads_out, sizeof(ra->pads));
+	} while (bytes < 0 && errno == EINTR);
+	if (bytes != sizeof(ra->pads)) {
+		//the process running ahead is gone, so nothing this one does is used anymore
+		//exit handlers belong to the other process and are skipped
+		_exit(0);
+	}
+}
+
+void runahead_instance_publish(runahead_session *ra, uint8_t *state, size_t size)
+{
+	if (size > ra->shared_size) {
+		fatal_error("Save state of %u bytes is too big to hand over to the run-ahead instance\n", (uint32_t)size);
+	}
+	memcpy(ra->shared, state, size);
+	uint32_t size32 = size;
+	if (!write_all(ra->replies, &size32, sizeof(size32))) {
+		_exit(0);
+	}
+}
+#else
+uint8_t runahead_instance_start(runahead_session *ra, size_t max_state_size)
+{
+	return 0;
+}
+
+void runahead_instance_stop(runahead_session *ra)
+{
+}
+
+void runahead_instance_run(runahead_session *ra)
+{
+}
+
+uint8_t *runahead_instance_state(runahead_session *ra, size_t *size_out)
+{
+	*size_out = 0;
+	return NULL;
+}
+
+void runahead_instance_wait(runahead_session *ra, uint16_t *pads_out)
+{
+}
+
+void runahead_instance_publish(runahead_session *ra, uint8_t *state, size_t size)
+{
+}
+#endif
@@ -0,0 +1,51 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef RUNAHEAD_H_
+#define RUNAHEAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Cuts input lag by showing a frame from a few frames in the future. After each frame of the real
+//timeline emulation keeps going with video and audio suppressed, the last frame it runs is shown
+//and then it goes back to where the real timeline left off. In snapshot mode that means restoring
+//a state taken at the end of the real frame. In instance mode a second copy of the emulator in
+//another process owns the real timeline. Each time this one goes back, it loads the state the
+//instance handed over at the end of its last frame. Once the input for the next frame is read it's
+//sent to the instance, which runs that frame while this one runs the same frame and the ones after
+//it ahead, so the real timeline is a frame behind and this process never takes a state of its own
+
+enum {
+	RUNAHEAD_SNAPSHOT,
+	RUNAHEAD_INSTANCE
+};
+
+typedef struct {
+	uint8_t  *shared;     //state handed over by the instance running the real timeline
+	size_t   shared_size;
+	int      requests;    //pipe the button masks for the next real frame are sent over
+	int      replies;     //pipe the size of each handed over state is sent back over
+	int      instance;    //process ID of the instance running the real timeline
+	uint32_t frames;      //how many frames past the real timeline the frame that's shown is
+	uint32_t phase;       //frames run since going back to the real timeline
+	uint16_t pads[2];     //current button masks of the first two gamepads
+	uint8_t  mode;
+	uint8_t  started;     //instance mode: the other process is running
+	uint8_t  input_sent;  //instance mode: the other process has the input for the frame it runs next
+	uint8_t  is_instance; //this process is the one running the real timeline
+} runahead_session;
+
+runahead_session *runahead_new(uint32_t frames, uint8_t mode);
+void runahead_free(runahead_session *ra);
+void runahead_local_input(runahead_session *ra, uint8_t gamepad_num, uint8_t button, uint8_t down);
+uint8_t runahead_instance_start(runahead_session *ra, size_t max_state_size);
+void runahead_instance_stop(runahead_session *ra);
+void runahead_instance_run(runahead_session *ra);
+uint8_t *runahead_instance_state(runahead_session *ra, size_t *size_out);
+void runahead_instance_wait(runahead_session *ra, uint16_t *pads_out);
+void runahead_instance_publish(runahead_session *ra, uint8_t *state, size_t size);
+
+#endif //RUNAHEAD_H_
@@ -0,0 +1,216 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures how long each presented frame takes with run-ahead in snapshot and second instance mode
+//for increasing numbers of frames, and reports the most frames of run-ahead each mode can do while
+//staying inside a 60Hz frame. Every configuration runs in its own process through the libretro
+//interface so one run can't warm up caches or leave an instance behind for the next
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libretro.h"
+#include "system.h"
+#include "tern.h"
+#include "util.h"
+
+#define FRAME_BUDGET (1000.0 / 60.0)
+#define WARMUP_FRAMES 30
+#define MAX_RUNAHEAD 8
+
+extern tern_node *config;
+
+static uint32_t presented, polled;
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+	presented++;
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	return frames;
+}
+
+static void input_poll(void)
+{
+	polled++;
+}
+
+//changes the buttons held every few frames so both the real timeline and the frames run ahead see input
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	if (port) {
+		return 0;
+	}
+	uint32_t hash = (polled / 6) * 2654435761U;
+	return hash >> (id + 8) & 1;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+	double left = *(const double *)a, right = *(const double *)b;
+	return left < right ? -1 : left > right;
+}
+
+static void set_config(char *key, char *value)
+{
+	config = tern_insert_path(config, key, (tern_val){.ptrval = strdup(value)}, TVAL_PTR);
+}
+
+typedef struct {
+	double  average;
+	double  p95;
+	uint8_t ok;
+} bench_result;
+
+static void run_config(char *rom_path, uint8_t *rom, long rom_size, char *mode, uint32_t frames, uint32_t num_runs, int out)
+{
+	char frames_str[16];
+	sprintf(frames_str, "%u", frames);
+	set_config("system\0runahead\0", frames_str);
+	set_config("system\0runahead_mode\0", mode);
+
+	retro_set_environment(environment);
+	retro_set_video_refresh(video_refresh);
+	retro_set_audio_sample(audio_sample);
+	retro_set_audio_sample_batch(audio_sample_batch);
+	retro_set_input_poll(input_poll);
+	retro_set_input_state(input_state);
+	retro_init();
+	struct retro_game_info info = {
+		.path = rom_path,
+		.data = rom,
+		.size = rom_size
+	};
+	bench_result result = {0};
+	if (retro_load_game(&info)) {
+		for (uint32_t i = 0; i < WARMUP_FRAMES; i++)
+		{
+			retro_run();
+		}
+		presented = 0;
+		double *times = malloc(num_runs * sizeof(double));
+		double total = 0;
+		for (uint32_t i = 0; i < num_runs; i++)
+		{
+			double start = now();
+			retro_run();
+			times[i] = now() - start;
+			total += times[i];
+		}
+		qsort(times, num_runs, sizeof(double), compare_times);
+		result.average = total / num_runs;
+		result.p95 = times[num_runs * 95 / 100];
+		//every host frame should present exactly one frame no matter how far ahead emulation runs
+		result.ok = presented == num_runs;
+		free(times);
+		//stops the second instance if there is one
+		retro_deinit();
+	}
+	if (write(out, &result, sizeof(result)) != sizeof(result)) {
+		_exit(1);
+	}
+	_exit(0);
+}
+
+static bench_result bench_config(char *rom_path, uint8_t *rom, long rom_size, char *mode, uint32_t frames, uint32_t num_runs)
+{
+	bench_result result = {0};
+	int fds[2];
+	if (pipe(fds)) {
+		fatal_error("Failed to create pipe\n");
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		fatal_error("Failed to fork\n");
+	}
+	if (!pid) {
+		close(fds[0]);
+		run_config(rom_path, rom, rom_size, mode, frames, num_runs, fds[1]);
+	}
+	close(fds[1]);
+	if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+		result.ok = 0;
+	}
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fputs("Usage: runaheadbench ROM [FRAMES]\n", stderr);
+		return 1;
+	}
+	uint32_t num_runs = argc > 2 ? atoi(argv[2]) : 600;
+	if (num_runs < 20) {
+		num_runs = 20;
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		fatal_error("Failed to open %s\n", argv[1]);
+	}
+	long rom_size = file_size(f);
+	uint8_t *rom = malloc(rom_size);
+	if (fread(rom, 1, rom_size, f) != rom_size) {
+		fatal_error("Failed to read %s\n", argv[1]);
+	}
+	fclose(f);
+
+	static char *modes[] = {"snapshot", "instance"};
+	int max_fit[2] = {-1, -1};
+	printf("%-9s %6s %10s %10s\n", "mode", "frames", "avg ms", "p95 ms");
+	for (int m = 0; m < 2; m++)
+	{
+		for (uint32_t frames = 0; frames <= MAX_RUNAHEAD; frames++)
+		{
+			//no run-ahead is the same in both modes
+			if (m && !frames) {
+				max_fit[m] = max_fit[0] >= 0 ? 0 : -1;
+				continue;
+			}
+			bench_result result = bench_config(argv[1], rom, rom_size, modes[m], frames, num_runs);
+			if (!result.average) {
+				printf("%-9s %6u     failed\n", modes[m], frames);
+				break;
+			}
+			printf("%-9s %6u %10.3f %10.3f%s\n", modes[m], frames, result.average, result.p95, result.ok ? "" : "  (frames presented != frames run)");
+			if (result.p95 > FRAME_BUDGET) {
+				break;
+			}
+			max_fit[m] = frames;
+		}
+	}
+	for (int m = 0; m < 2; m++)
+	{
+		if (max_fit[m] < 0) {
+			printf("%s: no run-ahead setting fits in a %.2fms frame\n", modes[m], FRAME_BUDGET);
+		} else {
+			printf("%s: up to %d frames of run-ahead fit in a %.2fms frame\n", modes[m], max_fit[m], FRAME_BUDGET);
+		}
+	}
+	free(rom);
+	return 0;
+}
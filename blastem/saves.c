@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include "saves.h"
+#include "state_file.h"
 #include "util.h"
 
 #ifdef _WIN32
@@ -37,6 +38,8 @@ save_slot_info *get_slot_info(system_header *system, uint32_t *num_out)
 	save_slot_info *dst = calloc(11, sizeof(save_slot_info));
 	time_t modtime;
 	struct tm ltime;
+	//slots with a save still being written would otherwise show their old time
+	state_file_wait();
 	for (uint32_t i = 0; i <= QUICK_SAVE_SLOT; i++)
 	{
 		char * cur = dst[i].desc = malloc(MAX_DESC_SIZE);
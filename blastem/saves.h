@@ -8,6 +8,12 @@
 #define QUICK_SAVE_SLOT 10
 #define SERIALIZE_SLOT 11
 #define EVENTLOG_SLOT 12
+#define REWIND_SLOT 13
+#define ROLLBACK_SLOT 14
+#define RUNAHEAD_SLOT 15
+//slots from EVENTLOG_SLOT on are consumed internally and are requested through the
+//snapshot_requests bitmask so several consumers can each get the same state
+#define SNAPSHOT_BIT(slot) (1 << ((slot) - EVENTLOG_SLOT))
 
 typedef struct {
 	char   *desc;
@@ -11,14 +11,40 @@
 
 void init_serialize(serialize_buffer *buf)
 {
-	buf->storage = SERIALIZE_DEFAULT_SIZE;
+	init_serialize_sized(buf, SERIALIZE_DEFAULT_SIZE);
+}
+
+void init_serialize_sized(serialize_buffer *buf, size_t size)
+{
+	buf->storage = size;
+	buf->size = 0;
+	buf->current_section_start = 0;
+	buf->data = malloc(size);
+}
+
+//A dry run only counts how many bytes would be written so a buffer of the right size can be
+//allocated once and reused with reset_serialize
+void init_serialize_dry_run(serialize_buffer *buf)
+{
+	buf->storage = 0;
 	buf->size = 0;
 	buf->current_section_start = 0;
-	buf->data = malloc(SERIALIZE_DEFAULT_SIZE);
+	buf->data = NULL;
 }
 
-static void reserve(serialize_buffer *buf, size_t amount)
+void reset_serialize(serialize_buffer *buf)
 {
+	buf->size = 0;
+	buf->current_section_start = 0;
+}
+
+//Returns where the next amount bytes should be written or NULL for a dry run
+static uint8_t *claim(serialize_buffer *buf, size_t amount)
+{
+	if (!buf->data) {
+		buf->size += amount;
+		return NULL;
+	}
 	if (amount > (buf->storage - buf->size)) {
 		if (amount < buf->storage) {
 			buf->storage *= 2;
@@ -28,28 +54,37 @@ static void reserve(serialize_buffer *buf, size_t amount)
 		}
 		buf->data = realloc(buf->data, buf->storage + sizeof(*buf));
 	}
+	uint8_t *dst = buf->data + buf->size;
+	buf->size += amount;
+	return dst;
 }
 
 void save_int32(serialize_buffer *buf, uint32_t val)
 {
-	reserve(buf, sizeof(val));
-	buf->data[buf->size++] = val >> 24;
-	buf->data[buf->size++] = val >> 16;
-	buf->data[buf->size++] = val >> 8;
-	buf->data[buf->size++] = val;
+	uint8_t *dst = claim(buf, sizeof(val));
+	if (dst) {
+		dst[0] = val >> 24;
+		dst[1] = val >> 16;
+		dst[2] = val >> 8;
+		dst[3] = val;
+	}
 }
 
 void save_int16(serialize_buffer *buf, uint16_t val)
 {
-	reserve(buf, sizeof(val));
-	buf->data[buf->size++] = val >> 8;
-	buf->data[buf->size++] = val;
+	uint8_t *dst = claim(buf, sizeof(val));
+	if (dst) {
+		dst[0] = val >> 8;
+		dst[1] = val;
+	}
 }
 
 void save_int8(serialize_buffer *buf, uint8_t val)
 {
-	reserve(buf, sizeof(val));
-	buf->data[buf->size++] = val;
+	uint8_t *dst = claim(buf, sizeof(val));
+	if (dst) {
+		*dst = val;
+	}
 }
 
 void save_string(serialize_buffer *buf, char *val)
@@ -60,28 +95,83 @@ void save_string(serialize_buffer *buf, char *val)
 
 void save_buffer8(serialize_buffer *buf, void *val, size_t len)
 {
-	reserve(buf, len);
-	memcpy(&buf->data[buf->size], val, len);
-	buf->size += len;
+	uint8_t *dst = claim(buf, len);
+	if (dst) {
+		memcpy(dst, val, len);
+	}
+}
+
+//States are big endian, on little endian hosts bulk data is swapped 8 bytes at a time
+#ifndef BLASTEM_BIG_ENDIAN
+static uint64_t swap_words16(uint64_t val)
+{
+	return (val >> 8 & 0x00FF00FF00FF00FFULL) | (val << 8 & 0xFF00FF00FF00FF00ULL);
+}
+
+static uint64_t swap_words32(uint64_t val)
+{
+	val = swap_words16(val);
+	return (val >> 16 & 0x0000FFFF0000FFFFULL) | (val << 16 & 0xFFFF0000FFFF0000ULL);
+}
+#endif
+
+static void copy_swap16(uint8_t *dst, uint8_t *src, size_t len)
+{
+#ifdef BLASTEM_BIG_ENDIAN
+	memcpy(dst, src, len * sizeof(uint16_t));
+#else
+	size_t bytes = len * sizeof(uint16_t), i;
+	for (i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t))
+	{
+		uint64_t val;
+		memcpy(&val, src + i, sizeof(val));
+		val = swap_words16(val);
+		memcpy(dst + i, &val, sizeof(val));
+	}
+	for (; i < bytes; i += sizeof(uint16_t))
+	{
+		dst[i] = src[i + 1];
+		dst[i + 1] = src[i];
+	}
+#endif
+}
+
+static void copy_swap32(uint8_t *dst, uint8_t *src, size_t len)
+{
+#ifdef BLASTEM_BIG_ENDIAN
+	memcpy(dst, src, len * sizeof(uint32_t));
+#else
+	size_t bytes = len * sizeof(uint32_t), i;
+	for (i = 0; i + sizeof(uint64_t) <= bytes; i += sizeof(uint64_t))
+	{
+		uint64_t val;
+		memcpy(&val, src + i, sizeof(val));
+		val = swap_words32(val);
+		memcpy(dst + i, &val, sizeof(val));
+	}
+	for (; i < bytes; i += sizeof(uint32_t))
+	{
+		dst[i] = src[i + 3];
+		dst[i + 1] = src[i + 2];
+		dst[i + 2] = src[i + 1];
+		dst[i + 3] = src[i];
+	}
+#endif
 }
 
 void save_buffer16(serialize_buffer *buf, uint16_t *val, size_t len)
 {
-	reserve(buf, len * sizeof(*val));
-	for(; len != 0; len--, val++) {
-		buf->data[buf->size++] = *val >> 8;
-		buf->data[buf->size++] = *val;
+	uint8_t *dst = claim(buf, len * sizeof(*val));
+	if (dst) {
+		copy_swap16(dst, (uint8_t *)val, len);
 	}
 }
 
 void save_buffer32(serialize_buffer *buf, uint32_t *val, size_t len)
 {
-	reserve(buf, len * sizeof(*val));
-	for(; len != 0; len--, val++) {
-		buf->data[buf->size++] = *val >> 24;
-		buf->data[buf->size++] = *val >> 16;
-		buf->data[buf->size++] = *val >> 8;
-		buf->data[buf->size++] = *val;
+	uint8_t *dst = claim(buf, len * sizeof(*val));
+	if (dst) {
+		copy_swap32(dst, (uint8_t *)val, len);
 	}
 }
 
@@ -89,8 +179,7 @@ void start_section(serialize_buffer *buf, uint16_t section_id)
 {
 	save_int16(buf, section_id);
 	//reserve some space for size once we end this section
-	reserve(buf, sizeof(uint32_t));
-	buf->size += sizeof(uint32_t);
+	claim(buf, sizeof(uint32_t));
 	//save start point for use in end_device
 	buf->current_section_start = buf->size;
 }
@@ -101,12 +190,14 @@ void end_section(serialize_buffer *buf)
 	if (section_size > 0xFFFFFFFFU) {
 		fatal_error("Sections larger than 4GB are not supported");
 	}
-	uint32_t size = section_size;
-	uint8_t *field = buf->data + buf->current_section_start - sizeof(uint32_t);
-	*(field++) = size >> 24;
-	*(field++) = size >> 16;
-	*(field++) = size >> 8;
-	*(field++) = size;
+	if (buf->data) {
+		uint32_t size = section_size;
+		uint8_t *field = buf->data + buf->current_section_start - sizeof(uint32_t);
+		*(field++) = size >> 24;
+		*(field++) = size >> 16;
+		*(field++) = size >> 8;
+		*(field++) = size;
+	}
 	buf->current_section_start = 0;
 }
 
@@ -185,24 +276,16 @@ void load_buffer16(deserialize_buffer *buf, uint16_t *dst, size_t len)
 	if ((buf->size - buf->cur_pos) < len * sizeof(uint16_t)) {
 		fatal_error("Failed to load required buffer of size %d\n", len);
 	}
-	for(; len != 0; len--, dst++) {
-		uint16_t value = buf->data[buf->cur_pos++] << 8;
-		value |= buf->data[buf->cur_pos++];
-		*dst = value;
-	}
+	copy_swap16((uint8_t *)dst, buf->data + buf->cur_pos, len);
+	buf->cur_pos += len * sizeof(uint16_t);
 }
 void load_buffer32(deserialize_buffer *buf, uint32_t *dst, size_t len)
 {
 	if ((buf->size - buf->cur_pos) < len * sizeof(uint32_t)) {
 		fatal_error("Failed to load required buffer of size %d\n", len);
 	}
-	for(; len != 0; len--, dst++) {
-		uint32_t value = buf->data[buf->cur_pos++] << 24;
-		value |= buf->data[buf->cur_pos++] << 16;
-		value |= buf->data[buf->cur_pos++] << 8;
-		value |= buf->data[buf->cur_pos++];
-		*dst = value;
-	}
+	copy_swap32((uint8_t *)dst, buf->data + buf->cur_pos, len);
+	buf->cur_pos += len * sizeof(uint32_t);
 }
 
 void load_section(deserialize_buffer *buf)
@@ -225,58 +308,3 @@ void load_section(deserialize_buffer *buf)
 	buf->handlers[section_id].fun(&section, buf->handlers[section_id].data);
 	buf->cur_pos += size;
 }
-
-static const char sz_ident[] = "BLSTSZ\x01\x07";
-
-uint8_t save_to_file(serialize_buffer *buf, char *path)
-{
-	FILE *f = fopen(path, "wb");
-	if (!f) {
-		return 0;
-	}
-	if (fwrite(sz_ident, 1, sizeof(sz_ident)-1, f) != sizeof(sz_ident)-1) {
-		fclose(f);
-		return 0;
-	}
-	if (fwrite(buf->data, 1, buf->size, f) != buf->size) {
-		fclose(f);
-		return 0;
-	}
-	fclose(f);
-	return 1;
-}
-
-uint8_t load_from_file(deserialize_buffer *buf, char *path)
-{
-	FILE *f = fopen(path, "rb");
-	if (!f) {
-		return 0;
-	}
-	char ident[sizeof(sz_ident)-1];
-	long size = file_size(f);
-	if (size < sizeof(ident)) {
-		fclose(f);
-		return 0;
-	}
-	if (fread(ident, 1, sizeof(ident), f) != sizeof(ident)) {
-		fclose(f);
-		return 0;
-	}
-	if (memcmp(ident, sz_ident, sizeof(ident))) {
-		return 0;
-	}
-	buf->size = size - sizeof(ident);
-	buf->cur_pos = 0;
-	buf->data = malloc(buf->size);
-	buf->handlers = NULL;
-	buf->max_handler = 8;
-	if (fread(buf->data, 1, buf->size, f) != buf->size) {
-		fclose(f);
-		free(buf->data);
-		buf->data = NULL;
-		buf->size = 0;
-		return 0;
-	}
-	fclose(f);
-	return 1;
-}
@@ -47,6 +47,9 @@ enum {
 };
 
 void init_serialize(serialize_buffer *buf);
+void init_serialize_sized(serialize_buffer *buf, size_t size);
+void init_serialize_dry_run(serialize_buffer *buf);
+void reset_serialize(serialize_buffer *buf);
 void save_int32(serialize_buffer *buf, uint32_t val);
 void save_int16(serialize_buffer *buf, uint16_t val);
 void save_int8(serialize_buffer *buf, uint8_t val);
@@ -65,6 +68,4 @@ void load_buffer8(deserialize_buffer *buf, void *dst, size_t len);
 void load_buffer16(deserialize_buffer *buf, uint16_t *dst, size_t len);
 void load_buffer32(deserialize_buffer *buf, uint32_t *dst, size_t len);
 void load_section(deserialize_buffer *buf);
-uint8_t save_to_file(serialize_buffer *buf, char *path);
-uint8_t load_from_file(deserialize_buffer *buf, char *path);
 #endif //SERIALIZE_H
@@ -0,0 +1,160 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Measures how long it takes to snapshot and restore a state with the same layout as a Genesis
+//save state, both with a freshly allocated buffer each frame and with one that's sized by a dry
+//run and then reused the way rewind and event logging do
+//Measures how long it takes to snapshot and restore a Genesis, both with a freshly allocated
+//buffer each frame and with one that's sized by a dry run and then reused the way rewind and
+//event logging do. The state is taken from a ROM run for a while through the libretro interface
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libretro.h"
+#include "blastem.h"
+#include "genesis.h"
+#include "util.h"
+
+//long enough for a typical ROM to be past its boot code and have VRAM and RAM filled in
+#define WARMUP_FRAMES 300
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	return frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void report(char *what, uint32_t frames, double elapsed)
+{
+	printf("%-28s %8.2f us/frame\n", what, elapsed * 1000000.0 / frames);
+}
+
+static void restore(genesis_context *gen, serialize_buffer *buf)
+{
+	deserialize_buffer state;
+	init_deserialize(&state, buf->data, buf->size);
+	genesis_deserialize(&state, gen);
+}
+
+int main(int argc, char ** argv)
+{
+	if (argc < 2) {
+		fputs("Usage: serializebench ROM [FRAMES]\n", stderr);
+		return 1;
+	}
+	uint32_t frames = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000;
+	if (!frames) {
+		frames = 1;
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		fatal_error("Failed to open %s\n", argv[1]);
+	}
+	long rom_size = file_size(f);
+	uint8_t *rom = malloc(rom_size);
+	if (fread(rom, 1, rom_size, f) != rom_size) {
+		fatal_error("Failed to read %s\n", argv[1]);
+	}
+	fclose(f);
+
+	retro_set_environment(environment);
+	retro_set_video_refresh(video_refresh);
+	retro_set_audio_sample(audio_sample);
+	retro_set_audio_sample_batch(audio_sample_batch);
+	retro_set_input_poll(input_poll);
+	retro_set_input_state(input_state);
+	retro_init();
+	struct retro_game_info info = {
+		.path = argv[1],
+		.data = rom,
+		.size = rom_size
+	};
+	if (!retro_load_game(&info)) {
+		fatal_error("Failed to load %s\n", argv[1]);
+	}
+	if (current_system->type != SYSTEM_GENESIS) {
+		fatal_error("%s is not a Genesis ROM\n", argv[1]);
+	}
+	for (uint32_t i = 0; i < WARMUP_FRAMES; i++)
+	{
+		retro_run();
+	}
+	genesis_context *gen = (genesis_context *)current_system;
+	uint32_t pc = gen->m68k->last_prefetch_address;
+
+	double start = now();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		serialize_buffer buf;
+		init_serialize(&buf);
+		genesis_serialize(gen, &buf, pc, 1);
+		free(buf.data);
+	}
+	report("snapshot, new buffer", frames, now() - start);
+
+	serialize_buffer buf;
+	init_serialize_dry_run(&buf);
+	genesis_serialize(gen, &buf, pc, 1);
+	init_serialize_sized(&buf, buf.size);
+	start = now();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		reset_serialize(&buf);
+		genesis_serialize(gen, &buf, pc, 1);
+	}
+	report("snapshot, preallocated", frames, now() - start);
+
+	start = now();
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		restore(gen, &buf);
+	}
+	report("restore", frames, now() - start);
+	printf("state size: %zu bytes, buffer storage: %zu bytes\n", buf.size, buf.storage);
+
+	//make sure the state survived the round trips
+	serialize_buffer check;
+	init_serialize(&check);
+	genesis_serialize(gen, &check, gen->m68k->last_prefetch_address, 1);
+	int ret = 0;
+	if (check.size != buf.size || memcmp(check.data, buf.data, buf.size)) {
+		fputs("restored state does not match the original\n", stderr);
+		ret = 1;
+	}
+	free(check.data);
+	free(buf.data);
+	retro_deinit();
+	free(rom);
+	return ret;
+}
@@ -7,6 +7,7 @@
 #include "util.h"
 #include "debug.h"
 #include "saves.h"
+#include "state_file.h"
 #include "bindings.h"
 
 #ifdef NEW_CORE
@@ -335,9 +336,9 @@ static void save_state(sms_context *sms, uint8_t slot)
 	init_serialize(&state);
 	sms_serialize(sms, &state);
 	save_to_file(&state, save_path);
-	printf("Saved state to %s\n", save_path);
+	//the file is written in the background
+	printf("Saving state to %s\n", save_path);
 	free(save_path);
-	free(state.data);
 }
 
 static uint8_t load_state_path(sms_context *sms, char *path)
@@ -359,6 +360,7 @@ static uint8_t load_state(system_header *system, uint8_t slot)
 	uint8_t ret;
 #ifndef NEW_CORE
 	if (!sms->z80->native_pc) {
+		state_file_wait();
 		ret = get_modification_time(statepath) != 0;
 		if (ret) {
 			system->delayed_load_slot = slot + 1;
@@ -610,6 +612,11 @@ sms_context *alloc_configure_sms(system_media *media, uint32_t opts, uint8_t for
 	sms->z80 = init_z80_context(zopts);
 	sms->z80->system = sms;
 	sms->z80->Z80_OPTS->gen.debug_cmd_handler = debug_commands;
+#ifndef NEW_CORE
+	if (opts & OPT_BLOCK_PROFILE) {
+		zopts->gen.profile = calloc(1, sizeof(block_profile));
+	}
+#endif
 	
 	sms->rom = media->buffer;
 	sms->rom_size = rom_size;
@@ -0,0 +1,322 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "state_file.h"
+#include "util.h"
+#include "zlib/zlib.h"
+
+//version 1 files are the ident followed by the raw state
+//version 2 files add a compression type and the uncompressed size of the state
+static const char sz_ident_v1[] = "BLSTSZ\x01\x07";
+static const char sz_ident[] = "BLSTSZ\x02\x07";
+#define IDENT_SIZE (sizeof(sz_ident)-1)
+#define HEADER_SIZE (IDENT_SIZE + 1 + sizeof(uint32_t))
+#define MAX_STATE_SIZE (64*1024*1024)
+#define IO_CHUNK (64*1024)
+
+enum {
+	STATE_RAW,
+	STATE_ZLIB
+};
+
+typedef struct state_job state_job;
+struct state_job {
+	state_job *next;
+	char      *path;
+	uint8_t   *data;
+	size_t    size;
+};
+
+static state_job *job_head, *job_tail;
+static uint8_t writer_started, writer_busy;
+static pthread_t writer;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+
+static uint8_t write_state(state_job *job)
+{
+	char *tmp_path = alloc_concat(job->path, ".tmp");
+	FILE *f = fopen(tmp_path, "wb");
+	if (!f) {
+		free(tmp_path);
+		return 0;
+	}
+	uint8_t header[HEADER_SIZE];
+	memcpy(header, sz_ident, IDENT_SIZE);
+	header[IDENT_SIZE] = STATE_ZLIB;
+	header[IDENT_SIZE + 1] = job->size >> 24;
+	header[IDENT_SIZE + 2] = job->size >> 16;
+	header[IDENT_SIZE + 3] = job->size >> 8;
+	header[IDENT_SIZE + 4] = job->size;
+	uint8_t ok = fwrite(header, 1, sizeof(header), f) == sizeof(header);
+
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	//states are mostly sparse RAM and register arrays, so the fastest level gets most of the savings
+	deflateInit(&stream, Z_BEST_SPEED);
+	stream.next_in = job->data;
+	stream.avail_in = job->size;
+	uint8_t out[IO_CHUNK];
+	int result = Z_OK;
+	while (ok && result != Z_STREAM_END)
+	{
+		stream.next_out = out;
+		stream.avail_out = sizeof(out);
+		result = deflate(&stream, Z_FINISH);
+		size_t produced = sizeof(out) - stream.avail_out;
+		ok = (result == Z_OK || result == Z_STREAM_END) && fwrite(out, 1, produced, f) == produced;
+	}
+	deflateEnd(&stream);
+	ok = !fclose(f) && ok;
+	//the state is written under a temporary name so an interrupted save never clobbers the previous one
+	if (ok) {
+#ifdef _WIN32
+		delete_file(job->path);
+#endif
+		ok = !rename(tmp_path, job->path);
+	}
+	if (!ok) {
+		delete_file(tmp_path);
+	}
+	free(tmp_path);
+	return ok;
+}
+
+static void free_job(state_job *job)
+{
+	free(job->path);
+	free(job->data);
+	free(job);
+}
+
+static void *state_writer(void *data)
+{
+	pthread_mutex_lock(&job_lock);
+	for (;;)
+	{
+		while (!job_head)
+		{
+			pthread_cond_wait(&job_ready, &job_lock);
+		}
+		state_job *job = job_head;
+		job_head = job->next;
+		if (!job_head) {
+			job_tail = NULL;
+		}
+		writer_busy = 1;
+		pthread_mutex_unlock(&job_lock);
+		if (!write_state(job)) {
+			warning("Failed to write save state to %s\n", job->path);
+		}
+		free_job(job);
+		pthread_mutex_lock(&job_lock);
+		writer_busy = 0;
+		pthread_cond_broadcast(&job_done);
+	}
+	return NULL;
+}
+
+void state_file_wait(void)
+{
+	pthread_mutex_lock(&job_lock);
+		while (job_head || writer_busy)
+		{
+			pthread_cond_wait(&job_done, &job_lock);
+		}
+	pthread_mutex_unlock(&job_lock);
+}
+
+uint8_t save_to_file(serialize_buffer *buf, char *path)
+{
+	state_job *job = malloc(sizeof(state_job));
+	job->next = NULL;
+	job->path = strdup(path);
+	job->data = buf->data;
+	job->size = buf->size;
+	buf->data = NULL;
+	buf->size = buf->storage = 0;
+
+	pthread_mutex_lock(&job_lock);
+		if (!writer_started) {
+			if (pthread_create(&writer, NULL, state_writer, NULL)) {
+				pthread_mutex_unlock(&job_lock);
+				uint8_t ret = write_state(job);
+				free_job(job);
+				return ret;
+			}
+			pthread_detach(writer);
+			//queued saves still need to land on disk when the emulator exits right after saving
+			atexit(state_file_wait);
+			writer_started = 1;
+		}
+		//a newer save to a slot that hasn't been written yet makes the older one redundant
+		state_job *cur;
+		for (cur = job_head; cur; cur = cur->next)
+		{
+			if (!strcmp(cur->path, path)) {
+				free(cur->data);
+				cur->data = job->data;
+				cur->size = job->size;
+				job->data = NULL;
+				break;
+			}
+		}
+		if (cur) {
+			free_job(job);
+		} else {
+			if (job_tail) {
+				job_tail->next = job;
+			} else {
+				job_head = job;
+			}
+			job_tail = job;
+			pthread_cond_signal(&job_ready);
+		}
+	pthread_mutex_unlock(&job_lock);
+	return 1;
+}
+
+typedef struct {
+	uint8_t *data;
+	size_t  size;
+	uint8_t mapped;
+} state_map;
+
+static uint8_t map_state(state_map *map, char *path)
+{
+#ifndef _WIN32
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || !st.st_size) {
+		close(fd);
+		return 0;
+	}
+	map->size = st.st_size;
+	map->data = mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map->data != MAP_FAILED) {
+		//the file is only ever read front to back
+		madvise(map->data, map->size, MADV_SEQUENTIAL);
+		map->mapped = 1;
+		return 1;
+	}
+#endif
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		return 0;
+	}
+	map->size = file_size(f);
+	map->data = malloc(map->size);
+	map->mapped = 0;
+	if (fread(map->data, 1, map->size, f) != map->size) {
+		fclose(f);
+		free(map->data);
+		return 0;
+	}
+	fclose(f);
+	return 1;
+}
+
+static void unmap_state(state_map *map)
+{
+#ifndef _WIN32
+	if (map->mapped) {
+		munmap(map->data, map->size);
+		return;
+	}
+#endif
+	free(map->data);
+}
+
+//Inflates the state a chunk of the mapping at a time so only the pages being decompressed need to be resident
+static uint8_t inflate_state(uint8_t *dst, uint32_t dst_size, uint8_t *src, size_t src_size)
+{
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit(&stream) != Z_OK) {
+		return 0;
+	}
+	stream.next_out = dst;
+	stream.avail_out = dst_size;
+	int result = Z_OK;
+	while (result == Z_OK && src_size)
+	{
+		uint32_t chunk = src_size > IO_CHUNK ? IO_CHUNK : src_size;
+		stream.next_in = src;
+		stream.avail_in = chunk;
+		result = inflate(&stream, Z_NO_FLUSH);
+		size_t consumed = chunk - stream.avail_in;
+		src += consumed;
+		src_size -= consumed;
+	}
+	inflateEnd(&stream);
+	return result == Z_STREAM_END && stream.total_out == dst_size;
+}
+
+uint8_t load_from_file(deserialize_buffer *buf, char *path)
+{
+	//a save to this file may still be in flight
+	state_file_wait();
+	state_map map;
+	if (!map_state(&map, path)) {
+		return 0;
+	}
+	uint8_t ok = 0;
+	buf->data = NULL;
+	if (map.size >= IDENT_SIZE && !memcmp(map.data, sz_ident_v1, IDENT_SIZE)) {
+		buf->size = map.size - IDENT_SIZE;
+		buf->data = malloc(buf->size);
+		memcpy(buf->data, map.data + IDENT_SIZE, buf->size);
+		ok = 1;
+	} else if (map.size >= HEADER_SIZE && !memcmp(map.data, sz_ident, IDENT_SIZE)) {
+		uint8_t *header = map.data + IDENT_SIZE;
+		uint32_t size = header[1] << 24 | header[2] << 16 | header[3] << 8 | header[4];
+		uint8_t *payload = map.data + HEADER_SIZE;
+		size_t payload_size = map.size - HEADER_SIZE;
+		if (size && size <= MAX_STATE_SIZE) {
+			buf->size = size;
+			buf->data = malloc(size);
+			switch (header[0])
+			{
+			case STATE_RAW:
+				if (payload_size >= size) {
+					memcpy(buf->data, payload, size);
+					ok = 1;
+				}
+				break;
+			case STATE_ZLIB:
+				ok = inflate_state(buf->data, size, payload, payload_size);
+				break;
+			default:
+				warning("Save state %s uses an unknown compression type, it may be from a newer version\n", path);
+			}
+		}
+	}
+	unmap_state(&map);
+	if (!ok) {
+		free(buf->data);
+		buf->data = NULL;
+		buf->size = 0;
+		return 0;
+	}
+	buf->cur_pos = 0;
+	buf->handlers = NULL;
+	buf->max_handler = 8;
+	return 1;
+}
@@ -0,0 +1,19 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef STATE_FILE_H_
+#define STATE_FILE_H_
+
+#include "serialize.h"
+
+//Takes ownership of buf->data, which is compressed and written to path on a background thread.
+//Returns once the save is queued, so a non-zero result only means it was queued. A write that
+//fails later is reported as a warning by the background thread
+uint8_t save_to_file(serialize_buffer *buf, char *path);
+//Blocks until every queued save has been written
+void state_file_wait(void);
+uint8_t load_from_file(deserialize_buffer *buf, char *path);
+
+#endif //STATE_FILE_H_
@@ -0,0 +1,212 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "stem.h"
+#include "wave.h"
+
+//captures still running at exit are stopped so their WAVE headers get filled in
+static stem_capture *active;
+static pthread_mutex_t active_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void stop_active(void)
+{
+	while (active)
+	{
+		//the sound chip may still run after this, it has to stop writing to the capture first
+		*active->owner = NULL;
+		stem_capture_stop(active);
+	}
+}
+
+static void *stem_writer(void *data)
+{
+	stem_capture *cap = data;
+	pthread_mutex_lock(&cap->lock);
+	for (;;)
+	{
+		while (!cap->write_head && !cap->quit)
+		{
+			pthread_cond_wait(&cap->work_ready, &cap->lock);
+		}
+		stem_buffer *buf = cap->write_head;
+		if (!buf) {
+			break;
+		}
+		cap->write_head = buf->next;
+		if (!cap->write_head) {
+			cap->write_tail = NULL;
+		}
+		pthread_mutex_unlock(&cap->lock);
+		if (fwrite(buf->samples, sizeof(int16_t), buf->len, buf->file) != buf->len) {
+			fputs("Failed to write channel capture\n", stderr);
+		}
+		pthread_mutex_lock(&cap->lock);
+		buf->next = cap->free_buffers;
+		cap->free_buffers = buf;
+		pthread_cond_signal(&cap->buffer_free);
+	}
+	pthread_mutex_unlock(&cap->lock);
+	return NULL;
+}
+
+stem_capture *stem_capture_start(char **filenames, uint32_t num_channels, uint32_t sample_rate, uint32_t decimation, stem_capture **owner)
+{
+	stem_capture *cap = calloc(1, sizeof(stem_capture));
+	cap->channels = calloc(num_channels, sizeof(stem_channel));
+	cap->num_channels = num_channels;
+	cap->decimation = decimation;
+	cap->owner = owner;
+	for (uint32_t i = 0; i < num_channels; i++)
+	{
+		FILE *f = fopen(filenames[i], "wb");
+		if (!f || !wave_init(f, sample_rate / decimation, 16, 1)) {
+			fprintf(stderr, "Failed to open WAVE log file %s for writing\n", filenames[i]);
+			if (f) {
+				fclose(f);
+			}
+			for (uint32_t j = 0; j < i; j++)
+			{
+				fclose(cap->channels[j].file);
+			}
+			free(cap->channels);
+			free(cap);
+			return NULL;
+		}
+		cap->channels[i].file = f;
+	}
+	for (uint32_t i = 0; i < num_channels * STEM_BUFFERS_PER_CHANNEL; i++)
+	{
+		stem_buffer *buf = malloc(sizeof(stem_buffer));
+		buf->next = cap->free_buffers;
+		cap->free_buffers = buf;
+	}
+	for (uint32_t i = 0; i < num_channels; i++)
+	{
+		cap->channels[i].cur = cap->free_buffers;
+		cap->free_buffers = cap->free_buffers->next;
+		cap->channels[i].cur->len = 0;
+	}
+	pthread_mutex_init(&cap->lock, NULL);
+	pthread_cond_init(&cap->work_ready, NULL);
+	pthread_cond_init(&cap->buffer_free, NULL);
+	pthread_create(&cap->writer, NULL, stem_writer, cap);
+
+	static uint8_t registered_stop;
+	pthread_mutex_lock(&active_lock);
+		cap->next_active = active;
+		active = cap;
+		if (!registered_stop) {
+			atexit(stop_active);
+			registered_stop = 1;
+		}
+	pthread_mutex_unlock(&active_lock);
+	return cap;
+}
+
+//Hands the current buffer of a channel to the writer thread and starts filling a free one
+static void submit(stem_capture *cap, uint32_t channel, uint8_t replace)
+{
+	stem_channel *chan = cap->channels + channel;
+	stem_buffer *buf = chan->cur;
+	buf->file = chan->file;
+	buf->next = NULL;
+	pthread_mutex_lock(&cap->lock);
+		if (cap->write_tail) {
+			cap->write_tail->next = buf;
+		} else {
+			cap->write_head = buf;
+		}
+		cap->write_tail = buf;
+		pthread_cond_signal(&cap->work_ready);
+		if (replace) {
+			if (!cap->free_buffers) {
+				cap->stalls++;
+				while (!cap->free_buffers)
+				{
+					pthread_cond_wait(&cap->buffer_free, &cap->lock);
+				}
+			}
+			chan->cur = cap->free_buffers;
+			cap->free_buffers = chan->cur->next;
+			chan->cur->len = 0;
+		} else {
+			chan->cur = NULL;
+		}
+	pthread_mutex_unlock(&cap->lock);
+}
+
+void stem_capture_stop(stem_capture *cap)
+{
+	pthread_mutex_lock(&active_lock);
+		for (stem_capture **cur = &active; *cur; cur = &(*cur)->next_active)
+		{
+			if (*cur == cap) {
+				*cur = cap->next_active;
+				break;
+			}
+		}
+	pthread_mutex_unlock(&active_lock);
+	for (uint32_t i = 0; i < cap->num_channels; i++)
+	{
+		submit(cap, i, 0);
+	}
+	pthread_mutex_lock(&cap->lock);
+		cap->quit = 1;
+		pthread_cond_signal(&cap->work_ready);
+	pthread_mutex_unlock(&cap->lock);
+	pthread_join(cap->writer, NULL);
+	for (uint32_t i = 0; i < cap->num_channels; i++)
+	{
+		wave_finalize(cap->channels[i].file);
+	}
+	if (cap->stalls) {
+		fprintf(stderr, "Channel capture waited on the disk %u times\n", cap->stalls);
+	}
+	while (cap->free_buffers)
+	{
+		stem_buffer *next = cap->free_buffers->next;
+		free(cap->free_buffers);
+		cap->free_buffers = next;
+	}
+	pthread_mutex_destroy(&cap->lock);
+	pthread_cond_destroy(&cap->work_ready);
+	pthread_cond_destroy(&cap->buffer_free);
+	free(cap->channels);
+	free(cap);
+}
+
+void stem_put(stem_capture *cap, uint32_t channel, int16_t value)
+{
+	stem_buffer *buf = cap->channels[channel].cur;
+	buf->samples[buf->len++] = value;
+	if (buf->len == STEM_BUFFER_SAMPLES) {
+		submit(cap, channel, 1);
+	}
+}
+
+//Adds count input samples with the same value, each captured sample is the average of
+//decimation input samples
+void stem_put_span(stem_capture *cap, uint32_t channel, int16_t value, uint32_t count)
+{
+	stem_channel *chan = cap->channels + channel;
+	if (chan->phase) {
+		uint32_t fill = cap->decimation - chan->phase;
+		if (count < fill) {
+			chan->accum += value * (int32_t)count;
+			chan->phase += count;
+			return;
+		}
+		stem_put(cap, channel, (chan->accum + value * (int32_t)fill) / (int32_t)cap->decimation);
+		count -= fill;
+	}
+	for (; count >= cap->decimation; count -= cap->decimation)
+	{
+		stem_put(cap, channel, value);
+	}
+	chan->accum = value * (int32_t)count;
+	chan->phase = count;
+}
@@ -0,0 +1,57 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef STEM_H_
+#define STEM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+//samples in each capture buffer, about a second of audio at the sound chips' native rates
+#define STEM_BUFFER_SAMPLES 65536
+//buffers preallocated per channel, one being filled while the rest wait for or are being written
+#define STEM_BUFFERS_PER_CHANNEL 4
+
+typedef struct stem_buffer {
+	struct stem_buffer *next;
+	FILE               *file;
+	uint32_t           len;
+	int16_t            samples[STEM_BUFFER_SAMPLES];
+} stem_buffer;
+
+typedef struct {
+	FILE        *file;
+	stem_buffer *cur;
+	int32_t     accum; //input accumulated towards the next sample when decimating
+	uint32_t    phase; //input samples in accum
+} stem_channel;
+
+//Captures the output of each channel of a sound chip to its own WAVE file. Samples are written
+//to preallocated buffers by the emulation thread, full buffers are handed to a writer thread
+//that does the file I/O so the emulation thread never waits on it unless the disk falls behind
+typedef struct stem_capture {
+	struct stem_capture *next_active;
+	struct stem_capture **owner; //cleared when a capture is stopped at exit
+	stem_channel        *channels;
+	stem_buffer         *free_buffers;
+	stem_buffer         *write_head;
+	stem_buffer         *write_tail;
+	pthread_mutex_t     lock;
+	pthread_cond_t      work_ready;
+	pthread_cond_t      buffer_free;
+	pthread_t           writer;
+	uint32_t            num_channels;
+	uint32_t            decimation;
+	uint32_t            stalls; //times the emulation thread had to wait for a free buffer
+	uint8_t             quit;
+} stem_capture;
+
+stem_capture *stem_capture_start(char **filenames, uint32_t num_channels, uint32_t sample_rate, uint32_t decimation, stem_capture **owner);
+void stem_capture_stop(stem_capture *cap);
+void stem_put(stem_capture *cap, uint32_t channel, int16_t value);
+void stem_put_span(stem_capture *cap, uint32_t channel, int16_t value, uint32_t count);
+
+#endif //STEM_H_
@@ -22,9 +22,10 @@ system_type detect_system_type(system_media *media)
 	) {
 		return SYSTEM_SMS;
 	}
-	if (safe_cmp("BLSTEL\x02", 0, media->buffer, media->size)) {
+	if (safe_cmp("BLSTEL", 0, media->buffer, media->size)) {
+		//versions 2 through 4 only added things to the format so they can all be played back
 		uint8_t *buffer = media->buffer;
-		if (media->size > 9 && buffer[7] == 0) {
+		if (media->size > 9 && buffer[6] >= 2 && buffer[6] <= 4 && buffer[7] == 0) {
 			return buffer[8] + 1;
 		}
 	}
@@ -70,7 +70,9 @@ struct system_header {
 	uint8_t                 enter_debugger;
 	uint8_t                 should_exit;
 	uint8_t                 save_state;
+	uint8_t                 snapshot_requests; //SNAPSHOT_BIT of each internal slot that wants a state
 	uint8_t                 delayed_load_slot;
+	uint8_t                 rewinding; //step back through recent states instead of running forward
 	uint8_t                 has_keyboard;
 	uint8_t                 vgm_logging;
 	uint8_t                 force_release;
@@ -88,6 +90,7 @@ struct system_media {
 };
 
 #define OPT_ADDRESS_LOG (1U << 31U)
+#define OPT_BLOCK_PROFILE (1U << 30U)
 
 system_type detect_system_type(system_media *media);
 system_header *alloc_config_system(system_type stype, system_media *media, uint32_t opts, uint8_t force_region);
@@ -0,0 +1,258 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Runs both sides of a netplay session over loopback, each in its own process through the libretro
+//interface, with simulated latency so the inputs they send each other are regularly predicted
+//wrong. Both sides stop changing their input for the last frames so every prediction is settled,
+//then the states they end up with are compared along with the periodic checks the sides exchange
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libretro.h"
+#include "genesis.h"
+#include "blastem.h"
+#include "rollback.h"
+#include "tern.h"
+#include "util.h"
+
+//long enough for the input of both sides to have arrived with the latency below and some to spare
+#define SETTLE_FRAMES 60
+#define DEFAULT_FRAMES 600
+
+extern tern_node *config;
+
+static uint32_t frame, input_frames;
+static uint8_t side;
+
+static bool environment(unsigned cmd, void *data)
+{
+	return false;
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+	return frames;
+}
+
+static void input_poll(void)
+{
+}
+
+//each side changes its buttons every few frames in its own pattern, only the first gamepad is
+//played over netplay
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+	if (port || frame >= input_frames) {
+		return 0;
+	}
+	uint32_t hash = ((frame / 5) * 2 + side) * 2654435761U;
+	return hash >> (id + 8) & 1;
+}
+
+static void set_config(char *key, char *value)
+{
+	config = tern_insert_path(config, key, (tern_val){.ptrval = strdup(value)}, TVAL_PTR);
+}
+
+static uint32_t hash_state(uint8_t *data, size_t size)
+{
+	uint32_t hash = 0x811C9DC5;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ data[i]) * 0x01000193;
+	}
+	return hash;
+}
+
+typedef struct {
+	uint32_t present;
+	uint32_t rollbacks;
+	uint32_t resimulated;
+	uint32_t checks;
+	uint32_t state_size;
+	uint32_t state_hash;
+	uint8_t  desynced;
+	uint8_t  ok;
+} side_result;
+
+static void run_side(char *port, uint8_t *rom, long rom_size, uint32_t frames, int out)
+{
+	set_config("netplay\0latency\0", "10");
+	set_config("netplay\0jitter\0", "10");
+	if (side) {
+		rollback_connect("127.0.0.1", port);
+	} else {
+		//the parent waits for the listen message before it starts the other side
+		int saved = dup(STDOUT_FILENO);
+		dup2(out, STDOUT_FILENO);
+		setvbuf(stdout, NULL, _IONBF, 0);
+		rollback_listen("127.0.0.1", port);
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+	}
+	input_frames = frames - SETTLE_FRAMES;
+
+	retro_set_environment(environment);
+	retro_set_video_refresh(video_refresh);
+	retro_set_audio_sample(audio_sample);
+	retro_set_audio_sample_batch(audio_sample_batch);
+	retro_set_input_poll(input_poll);
+	retro_set_input_state(input_state);
+	retro_init();
+	struct retro_game_info info = {
+		.path = "test.bin",
+		.data = rom,
+		.size = rom_size
+	};
+	side_result result = {0};
+	if (retro_load_game(&info)) {
+		for (frame = 0; frame < frames; frame++)
+		{
+			retro_run();
+		}
+		genesis_context *gen = (genesis_context *)current_system;
+		if (gen->rollback) {
+			rollback_session *session = gen->rollback;
+			result.present = session->present;
+			result.rollbacks = session->rollbacks;
+			result.resimulated = session->resimulated;
+			result.checks = session->checks;
+			result.desynced = session->desynced;
+			size_t size = retro_serialize_size();
+			uint8_t *state = malloc(size);
+			if (retro_serialize(state, size)) {
+				result.state_size = size;
+				result.state_hash = hash_state(state, size);
+				result.ok = 1;
+			}
+			free(state);
+		}
+		retro_deinit();
+	}
+	if (write(out, &result, sizeof(result)) != sizeof(result)) {
+		_exit(1);
+	}
+	_exit(0);
+}
+
+static pid_t start_side(uint8_t which, char *port, uint8_t *rom, long rom_size, uint32_t frames, int *fd_out)
+{
+	int fds[2];
+	if (pipe(fds)) {
+		fatal_error("Failed to create pipe\n");
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		fatal_error("Failed to fork\n");
+	}
+	if (!pid) {
+		close(fds[0]);
+		side = which;
+		run_side(port, rom, rom_size, frames, fds[1]);
+	}
+	close(fds[1]);
+	*fd_out = fds[0];
+	return pid;
+}
+
+//Reads the result a side sends when it's done, skipping anything it printed while it was listening
+static side_result finish_side(pid_t pid, int fd)
+{
+	side_result result = {0};
+	uint8_t buffer[4096];
+	size_t size = 0;
+	for (;;)
+	{
+		ssize_t bytes = read(fd, buffer + size, sizeof(buffer) - size);
+		if (bytes <= 0) {
+			break;
+		}
+		size += bytes;
+	}
+	close(fd);
+	waitpid(pid, NULL, 0);
+	if (size >= sizeof(result)) {
+		memcpy(&result, buffer + size - sizeof(result), sizeof(result));
+	}
+	return result;
+}
+
+static void print_side(char *name, side_result *result)
+{
+	printf(
+		"%s: %u frames, %u rollbacks, %u frames run again, %u state checks%s, final state %08X\n",
+		name, result->present, result->rollbacks, result->resimulated, result->checks,
+		result->desynced ? " (desynced)" : "", result->state_hash
+	);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fputs("Usage: test_rollback ROM [FRAMES]\n", stderr);
+		return 1;
+	}
+	uint32_t frames = argc > 2 ? atoi(argv[2]) : DEFAULT_FRAMES;
+	if (frames < 2 * SETTLE_FRAMES) {
+		frames = 2 * SETTLE_FRAMES;
+	}
+	FILE *f = fopen(argv[1], "rb");
+	if (!f) {
+		fatal_error("Failed to open %s\n", argv[1]);
+	}
+	long rom_size = file_size(f);
+	uint8_t *rom = malloc(rom_size);
+	if (fread(rom, 1, rom_size, f) != rom_size) {
+		fatal_error("Failed to read %s\n", argv[1]);
+	}
+	fclose(f);
+
+	char port[16];
+	sprintf(port, "%d", 20000 + getpid() % 20000);
+	int host_fd, client_fd;
+	pid_t host = start_side(0, port, rom, rom_size, frames, &host_fd);
+	//the client can only connect once the host is listening, which it reports before waiting
+	char c;
+	if (read(host_fd, &c, 1) != 1) {
+		fatal_error("Host side exited before listening on port %s\n", port);
+	}
+	pid_t client = start_side(1, port, rom, rom_size, frames, &client_fd);
+	side_result results[2];
+	results[0] = finish_side(host, host_fd);
+	results[1] = finish_side(client, client_fd);
+	free(rom);
+
+	print_side("host", results);
+	print_side("client", results + 1);
+	int ok = results[0].ok && results[1].ok;
+	if (!ok) {
+		puts("FAIL: a side did not finish the session");
+	} else if (results[0].present != results[1].present) {
+		puts("FAIL: the sides ran a different number of frames");
+		ok = 0;
+	} else if (results[0].desynced || results[1].desynced || !results[0].checks) {
+		puts("FAIL: the periodic state checks did not match");
+		ok = 0;
+	} else if (results[0].state_size != results[1].state_size || results[0].state_hash != results[1].state_hash) {
+		puts("FAIL: the final states differ");
+		ok = 0;
+	} else if (!results[0].rollbacks && !results[1].rollbacks) {
+		puts("FAIL: no input was predicted wrong, add latency or frames");
+		ok = 0;
+	} else {
+		puts("pass");
+	}
+	return !ok;
+}
@@ -0,0 +1,165 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Checks that code which keeps rewriting an instruction in the same page sees every new value on
+//both dynarecs, including after the page has been invalidated often enough to be interpreted and
+//once it has cooled off again, and that storing data next to code doesn't invalidate anything
+#include "cpu_harness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//enough writes to take the page well past SMC_INTERP_THRESHOLD
+#define ITERATIONS 40
+//cycles after which the rewrite loop is done but the delay loop that follows it isn't
+#define REWRITE_CYCLES 5000
+//enough to run the delay loops, which take a few SMC_DECAY_CYCLES periods
+#define DELAY_CYCLES 400000
+
+static const uint8_t z80_program[] = {
+	0x21, 0x06, 0x00, //ld hl, target+1
+	0x06, ITERATIONS, //ld b, ITERATIONS
+	//target:
+	0x3E, 0x00,       //ld a, 0
+	0x34,             //inc (hl)
+	0x10, 0xFB,       //djnz target
+	0x0E, 0x40,       //ld c, 64
+	//delay:
+	0x10, 0xFE,       //djnz delay
+	0x0D,             //dec c
+	0x20, 0xFB,       //jr nz, delay
+	0x76              //halt
+};
+
+static const uint8_t z80_data_program[] = {
+	0x21, 0x0B, 0x00, //ld hl, data
+	0x06, ITERATIONS, //ld b, ITERATIONS
+	//loop:
+	0x34,             //inc (hl)
+	0x10, 0xFD,       //djnz loop
+	0x7E,             //ld a, (hl)
+	0x18, 0xFE,       //jr *
+	//data:
+	0x00
+};
+
+static const uint16_t m68k_program[] = {
+	0x207C, 0x00E0, 0x000A, //movea.l #target+2, a0
+	0x7200 | (ITERATIONS - 1), //moveq #ITERATIONS-1, d1
+	//target:
+	0x303C, 0x0000,         //move.w #0, d0
+	0x5250,                 //addq.w #1, (a0)
+	0x51C9, 0xFFF8,         //dbra d1, target
+	0x343C, 0x7FFF,         //move.w #$7FFF, d2
+	//delay:
+	0x51CA, 0xFFFE,         //dbra d2, delay
+	0x60FE                  //bra.s *
+};
+
+static const uint16_t m68k_data_program[] = {
+	0x207C, 0x00E0, 0x0012, //movea.l #data, a0
+	0x7200 | (ITERATIONS - 1), //moveq #ITERATIONS-1, d1
+	//loop:
+	0x5250,                 //addq.w #1, (a0)
+	0x51C9, 0xFFFC,         //dbra d1, loop
+	0x3010,                 //move.w (a0), d0
+	0x60FE,                 //bra.s *
+	//data:
+	0x0000
+};
+
+static uint16_t m68k_rom[HARNESS_M68K_ROM_SIZE / 2];
+
+static int check(char *cpu, uint32_t result, uint32_t smc_count)
+{
+	//the last pass through the loop runs the instruction after it was rewritten ITERATIONS-1 times
+	int ok = result == ITERATIONS - 1 && smc_count >= SMC_INTERP_THRESHOLD;
+	printf("%s: result %u (expected %u), page invalidated %u times (interpreted after %u): %s\n",
+		cpu, result, ITERATIONS - 1, smc_count, SMC_INTERP_THRESHOLD, ok ? "pass" : "FAIL");
+	return ok;
+}
+
+static int check_cooled(char *cpu, uint32_t delay_done, uint32_t smc_count)
+{
+	//the delay loop shares the page, it only finishes if its instructions work after being translated normally again
+	int ok = delay_done && smc_count < SMC_INTERP_THRESHOLD;
+	printf("%s: delay loop %s, invalidation count decayed to %u: %s\n",
+		cpu, delay_done ? "finished" : "did not finish", smc_count, ok ? "pass" : "FAIL");
+	return ok;
+}
+
+static int check_data(char *cpu, uint32_t result, uint32_t smc_count)
+{
+	int ok = result == ITERATIONS && !smc_count;
+	printf("%s: data stored next to code %u times (expected %u), page invalidated %u times (expected 0): %s\n",
+		cpu, result, ITERATIONS, smc_count, ok ? "pass" : "FAIL");
+	return ok;
+}
+
+static int test_z80(void)
+{
+	z80_options opts;
+	memcpy(harness_z80_ram, z80_program, sizeof(z80_program));
+	z80_context *context = harness_z80_init(&opts);
+	z80_run(context, REWRITE_CYCLES);
+	int ok = check("Z80", context->regs[Z80_A], opts.gen.smc_counts[0]);
+	z80_run(context, DELAY_CYCLES);
+	return check_cooled("Z80", !context->regs[Z80_C], opts.gen.smc_counts[0]) && ok;
+}
+
+static int test_z80_data(void)
+{
+	z80_options opts;
+	memset(harness_z80_ram, 0, sizeof(harness_z80_ram));
+	memcpy(harness_z80_ram, z80_data_program, sizeof(z80_data_program));
+	z80_context *context = harness_z80_init(&opts);
+	z80_run(context, REWRITE_CYCLES);
+	return check_data("Z80", context->regs[Z80_A], opts.gen.smc_counts[0]);
+}
+
+static void init_m68k_rom(void)
+{
+	//initial SSP and PC
+	m68k_rom[0] = 0x00FF;
+	m68k_rom[2] = HARNESS_M68K_RAM_START >> 16;
+	m68k_rom[3] = HARNESS_M68K_RAM_START & 0xFFFF;
+}
+
+static int test_m68k(void)
+{
+	m68k_options opts;
+	init_m68k_rom();
+	memcpy(harness_m68k_ram, m68k_program, sizeof(m68k_program));
+
+	m68k_context *context = harness_m68k_init(&opts, m68k_rom, NULL);
+	context->target_cycle = context->sync_cycle = REWRITE_CYCLES;
+	m68k_reset(context);
+	int ok = check("68K", context->dregs[0] & 0xFFFF, opts.gen.smc_counts[0]);
+	context->target_cycle = context->sync_cycle = DELAY_CYCLES;
+	resume_68k(context);
+	return check_cooled("68K", (context->dregs[2] & 0xFFFF) == 0xFFFF, opts.gen.smc_counts[0]) && ok;
+}
+
+static int test_m68k_data(void)
+{
+	m68k_options opts;
+	init_m68k_rom();
+	memset(harness_m68k_ram, 0, sizeof(harness_m68k_ram));
+	memcpy(harness_m68k_ram, m68k_data_program, sizeof(m68k_data_program));
+
+	m68k_context *context = harness_m68k_init(&opts, m68k_rom, NULL);
+	context->target_cycle = context->sync_cycle = REWRITE_CYCLES;
+	m68k_reset(context);
+	return check_data("68K", context->dregs[0] & 0xFFFF, opts.gen.smc_counts[0]);
+}
+
+int main(int argc, char ** argv)
+{
+	int ok = test_z80();
+	ok = test_z80_data() && ok;
+	ok = test_m68k() && ok;
+	ok = test_m68k_data() && ok;
+	return !ok;
+}
@@ -0,0 +1,199 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Drives the YM2612 through a fixed register script and compares a hash of every sample it outputs
+//against one recorded with the per-tick synthesis loop, so changes to the faster paths in ym_run
+//that alter the output get caught. The samples are taken before the resampler so changes to the
+//audio output don't affect the hash
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ym2612.h"
+#include "render_audio.h"
+#include "system.h"
+#include "tern.h"
+
+#define MCLKS_NTSC 53693175
+#define MCLKS_PER_YM 7
+//a little over 2 seconds of output
+#define SCRIPT_STEPS 6000
+#define EXPECTED_SAMPLES 124428
+#define EXPECTED_HASH 0xB09B439D070DDAA8ULL
+
+tern_node *config;
+int headless = 1;
+system_header *current_system;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+static uint64_t hash = 14695981039346656037ULL;
+static uint32_t samples;
+
+static void hash_sample(int16_t value)
+{
+	uint16_t bits = value;
+	hash = (hash ^ (bits & 0xFF)) * 1099511628211ULL;
+	hash = (hash ^ (bits >> 8)) * 1099511628211ULL;
+}
+
+//only the parts of the audio output the YM2612 uses, samples are hashed as they come out of the chip
+audio_source *render_audio_source(uint64_t master_clock, uint64_t sample_divider, uint8_t channels)
+{
+	return calloc(1, sizeof(audio_source));
+}
+
+void render_free_source(audio_source *src)
+{
+	free(src);
+}
+
+void render_audio_adjust_clock(audio_source *src, uint64_t master_clock, uint64_t sample_divider)
+{
+}
+
+uint32_t render_audio_samples_until_sync(audio_source *src)
+{
+	return 0;
+}
+
+void render_put_stereo_sample(audio_source *src, int16_t left, int16_t right)
+{
+	hash_sample(left);
+	hash_sample(right);
+	samples++;
+}
+
+static uint32_t seed = 0x1234567;
+
+static uint32_t next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+static void write_reg(ym2612_context *ym, uint8_t part, uint8_t reg, uint8_t value)
+{
+	if (part) {
+		ym_address_write_part2(ym, reg);
+	} else {
+		ym_address_write_part1(ym, reg);
+	}
+	ym_data_write(ym, value);
+}
+
+//Sets up every channel with a different patch so all algorithms and feedback levels are heard
+static void setup_voices(ym2612_context *ym)
+{
+	for (uint8_t channel = 0; channel < 6; channel++)
+	{
+		uint8_t part = channel / 3, base = channel % 3;
+		for (uint8_t op = 0; op < 4; op++)
+		{
+			uint8_t reg = base + op * 4;
+			write_reg(ym, part, REG_DETUNE_MULT + reg, (op * 0x13 + channel) & 0x7F);
+			write_reg(ym, part, REG_TOTAL_LEVEL + reg, op == 3 ? 0x08 : 0x18 + channel * 4);
+			write_reg(ym, part, REG_ATTACK_KS + reg, 0x1C + op);
+			write_reg(ym, part, REG_DECAY_AM + reg, 0x08 + channel + (op == 1 ? 0x80 : 0));
+			write_reg(ym, part, REG_SUSTAIN_RATE + reg, 0x04);
+			write_reg(ym, part, REG_S_LVL_R_RATE + reg, 0x26);
+		}
+		write_reg(ym, part, REG_ALG_FEEDBACK + base, channel + (channel << 3 & 0x38));
+		write_reg(ym, part, REG_LR_AMS_PMS + base, 0xC0 | (channel & 3) << 4 | channel);
+		write_reg(ym, part, REG_BLOCK_FNUM_H + base, 0x20 + channel);
+		write_reg(ym, part, REG_FNUM_LOW + base, 0x69 + channel * 16);
+	}
+	write_reg(ym, 0, REG_LFO, 0x0B);
+	//timer A runs so CSM mode has something to key channel 3 with
+	write_reg(ym, 0, REG_TIMERA_HIGH, 0xF0);
+	write_reg(ym, 0, REG_TIMERA_LOW, 0x02);
+	write_reg(ym, 0, REG_TIME_CTRL, 0x15);
+}
+
+//Writes one register chosen from the ones a sound driver touches while playing
+static void random_write(ym2612_context *ym)
+{
+	uint32_t r = next_random();
+	uint8_t channel = r % 6, part = channel / 3, base = channel % 3;
+	uint8_t value = r >> 8;
+	uint8_t reg = base + (r >> 16 & 3) * 4;
+	switch (r >> 20 & 15)
+	{
+	case 0:
+	case 1:
+	case 2:
+		write_reg(ym, 0, REG_KEY_ONOFF, (value & 0xF0) | base | part << 2);
+		break;
+	case 3:
+		write_reg(ym, part, REG_FNUM_LOW + base, value);
+		break;
+	case 4:
+		write_reg(ym, part, REG_BLOCK_FNUM_H + base, value & 0x3F);
+		break;
+	case 5:
+		write_reg(ym, part, REG_TOTAL_LEVEL + reg, value & 0x7F);
+		break;
+	case 6:
+		//only the modes with SSG-EG enabled, turning it off again is left to case 7
+		write_reg(ym, part, REG_SSG_EG + reg, 8 | (value & 7));
+		break;
+	case 7:
+		write_reg(ym, part, REG_SSG_EG + reg, 0);
+		break;
+	case 8:
+		write_reg(ym, 0, REG_DAC_ENABLE, value & 0x80);
+		break;
+	case 9:
+	case 10:
+		write_reg(ym, 0, REG_DAC, value);
+		break;
+	case 11:
+		//channel 3 special mode, with or without CSM, keeps the timers running
+		write_reg(ym, 0, REG_TIME_CTRL, (value & 0xC0) | 0x15);
+		break;
+	case 12:
+		write_reg(ym, 0, REG_FNUM_LOW_CH3 + value % 3, value);
+		break;
+	case 13:
+		write_reg(ym, 0, REG_LFO, value & 0x0F);
+		break;
+	case 14:
+		write_reg(ym, part, REG_ALG_FEEDBACK + base, value & 0x3F);
+		break;
+	default:
+		write_reg(ym, part, REG_LR_AMS_PMS + base, value);
+		break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	ym2612_context *ym = malloc(sizeof(ym2612_context));
+	ym_init(ym, MCLKS_NTSC, MCLKS_PER_YM, 0);
+	uint32_t cycle = 0;
+	setup_voices(ym);
+	for (uint32_t step = 0; step < SCRIPT_STEPS; step++)
+	{
+		//run lengths that aren't a multiple of a sample so writes land at every point within one
+		cycle += next_random() % 40000;
+		ym_run(ym, cycle);
+		random_write(ym);
+	}
+	ym_run(ym, cycle + MCLKS_NTSC / 10);
+	int ok = samples == EXPECTED_SAMPLES && hash == EXPECTED_HASH;
+	printf("YM2612: %u samples (expected %u), hash %016llX (expected %016llX): %s\n",
+		samples, EXPECTED_SAMPLES, (unsigned long long)hash, (unsigned long long)EXPECTED_HASH, ok ? "pass" : "FAIL");
+	ym_free(ym);
+	return !ok;
+}
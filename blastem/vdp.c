@@ -467,6 +467,54 @@ void vdp_print_sprite_table(vdp_context * context)
 	}
 }
 
+uint8_t vdp_decode_sprites(vdp_context *context, vdp_sprite *sprites)
+{
+	uint8_t count = 0;
+	if (context->regs[REG_MODE_2] & BIT_MODE_5) {
+		uint16_t sat_address = mode5_sat_address(context);
+		uint16_t current_index = 0;
+		do {
+			uint16_t address = current_index * 8 + sat_address;
+			uint16_t cache_address = current_index * 4;
+			vdp_sprite *sprite = sprites + count++;
+			sprite->index = current_index;
+			sprite->height = ((context->sat_cache[cache_address+2] & 0x3) + 1) * 8;
+			sprite->width = (((context->sat_cache[cache_address+2]  >> 2) & 0x3) + 1) * 8;
+			sprite->y = ((context->sat_cache[cache_address] & 0x3) << 8 | context->sat_cache[cache_address+1]) & 0x1FF;
+			sprite->x = ((context->vdpmem[address+ 6] & 0x3) << 8 | context->vdpmem[address + 7]) & 0x1FF;
+			sprite->palette = context->vdpmem[address + 4] >> 5 & 0x3;
+			sprite->priority = context->vdpmem[address + 4] >> 7;
+			sprite->v_flip = context->vdpmem[address + 4] >> 4 & 1;
+			sprite->h_flip = context->vdpmem[address + 4] >> 3 & 1;
+			sprite->pattern = ((context->vdpmem[address + 4] << 8 | context->vdpmem[address + 5]) & 0x7FF) << 5;
+			current_index = context->sat_cache[cache_address+3] & 0x7F;
+		} while (current_index != 0 && count < 80);
+	} else {
+		uint16_t sat_address = (context->regs[REG_SAT] & 0x7E) << 7;
+		for (int i = 0; i < 64; i++)
+		{
+			uint8_t y = context->vdpmem[mode4_address_map[sat_address + (i ^ 1)]];
+			if (y == 0xD0) {
+				break;
+			}
+			vdp_sprite *sprite = sprites + count++;
+			memset(sprite, 0, sizeof(vdp_sprite));
+			sprite->index = i;
+			sprite->y = y;
+			sprite->x = context->vdpmem[mode4_address_map[sat_address + 0x80 + i*2 + 1]];
+			sprite->pattern = context->vdpmem[mode4_address_map[sat_address + 0x80 + i*2]] * 32
+				+ (context->regs[REG_STILE_BASE] << 11 & 0x2000);
+			sprite->width = 8;
+			sprite->height = 8;
+			if (context->regs[REG_MODE_2] & BIT_SPRITE_SZ) {
+				sprite->pattern &= ~32;
+				sprite->height = 16;
+			}
+		}
+	}
+	return count;
+}
+
 #define VRAM_READ 0 //0000
 #define VRAM_WRITE 1 //0001
 //2 would trigger register write 0010
@@ -930,7 +978,11 @@ static void external_slot(vdp_context * context)
 			} else {
 				uint8_t byte = start->partial == 1 ? start->value >> 8 : start->value;
 				uint32_t address = start->address ^ 1;
-				event_vram_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC]);
+				if (start->cd & 0x20) {
+					event_vram_block_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC], 0);
+				} else {
+					event_vram_byte(context->cycles, start->address, byte, context->regs[REG_AUTOINC]);
+				}
 				vdp_check_update_sat_byte(context, address, byte);
 				write_vram_byte(context, address, byte);
 				if (!start->partial) {
@@ -954,8 +1006,12 @@ static void external_slot(vdp_context * context)
 			} else {
 				val = start->partial ? context->fifo[context->fifo_write].value : start->value;
 			}
-			uint8_t buffer[3] = {start->address & 127, val >> 8, val};
-			event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+			if (start->cd & 0x20) {
+				event_intram_block_word(context->cycles, start->address & 127, val);
+			} else {
+				uint8_t buffer[3] = {start->address & 127, val >> 8, val};
+				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+			}
 			write_cram(context, start->address, val);
 			break;
 		}
@@ -973,8 +1029,12 @@ static void external_slot(vdp_context * context)
 				} else {
 					context->vsram[(start->address/2) & 63] = start->partial ? context->fifo[context->fifo_write].value : start->value;
 				}
-				uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
-				event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+				if (start->cd & 0x20) {
+					event_intram_block_word(context->cycles, ((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63]);
+				} else {
+					uint8_t buffer[3] = {((start->address/2) & 63) + 128, context->vsram[(start->address/2) & 63] >> 8, context->vsram[(start->address/2) & 63]};
+					event_log(EVENT_VDP_INTRAM, context->cycles, sizeof(buffer), buffer);
+				}
 			}
 
 			break;
@@ -988,6 +1048,7 @@ static void external_slot(vdp_context * context)
 		}
 	} else if ((context->flags & FLAG_DMA_RUN) && (context->regs[REG_DMASRC_H] & DMA_TYPE_MASK) == DMA_COPY) {
 		if (context->flags & FLAG_READ_FETCHED) {
+			event_vram_block_byte(context->cycles, context->address, context->prefetch, context->regs[REG_AUTOINC], EVENT_BLOCK_COPY);
 			write_vram_byte(context, context->address ^ 1, context->prefetch);
 			
 			//Update DMA state
@@ -2141,14 +2202,17 @@ static void advance_output_line(vdp_context *context)
 	if (context->output_lines >= lines_max || (!context->pushed_frame && output_line == context->inactive_start + context->border_top)) {
 		//we've either filled up a full frame or we're at the bottom of screen in the current defined mode + border crop
 		if (!headless) {
-			render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
-			uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
-			if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
-				is_even = !is_even;
+			if (!context->suppress_output) {
+				render_framebuffer_updated(context->cur_buffer, context->h40_lines > (context->inactive_start + context->border_top) / 2 ? LINEBUF_SIZE : (256+HORIZ_BORDER));
+				uint8_t is_even = context->flags2 & FLAG2_EVEN_FIELD;
+				if (context->vcounter <= context->inactive_start && (context->regs[REG_MODE_4] & BIT_INTERLACE)) {
+					is_even = !is_even;
+				}
+				context->cur_buffer = is_even ? FRAMEBUFFER_EVEN : FRAMEBUFFER_ODD;
+				context->fb = NULL;
 			}
-			context->cur_buffer = is_even ? FRAMEBUFFER_EVEN : FRAMEBUFFER_ODD;
+			//a suppressed frame still has to end at the same point as one that's shown
 			context->pushed_frame = 1;
-			context->fb = NULL;
 		}
 		vdp_update_per_frame_debug(context);
 		context->h40_lines = 0;
@@ -4650,7 +4714,73 @@ void vdp_inc_debug_mode(vdp_context *context)
 	}
 }
 
-void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader)
+//Block events hold runs of cycle deltas between writes, so the VDP can be run up to each of them
+//when run is set
+static void replay_block(vdp_context *context, uint8_t event, event_reader *reader, uint8_t run)
+{
+	deserialize_buffer *buffer = &reader->buffer;
+	uint16_t address;
+	uint8_t stride, flags = 0;
+	if (event == EVENT_VRAM_BLOCK) {
+		reader_ensure_data(reader, 5);
+		address = load_int16(buffer);
+		stride = load_int8(buffer);
+		flags = load_int8(buffer);
+	} else {
+		reader_ensure_data(reader, 3);
+		address = load_int8(buffer);
+		stride = load_int8(buffer);
+	}
+	uint16_t count = load_int8(buffer) + 1;
+	reader_ensure_data(reader, 1);
+	uint8_t runs = load_int8(buffer);
+	uint16_t run_delta[256];
+	uint8_t run_length[256];
+	for (uint16_t i = 0; i < runs; i++)
+	{
+		reader_ensure_data(reader, 2);
+		run_delta[i] = load_int8(buffer);
+		if (run_delta[i] == 255) {
+			reader_ensure_data(reader, 3);
+			run_delta[i] = load_int16(buffer);
+		}
+		run_length[i] = load_int8(buffer);
+	}
+	reader_ensure_data(reader, count * (event == EVENT_VRAM_BLOCK ? 1 : 2));
+	uint32_t cycle = reader->last_cycle;
+	uint16_t cur_run = 0, run_remaining = 0;
+	for (uint16_t i = 0; i < count; i++)
+	{
+		if (i) {
+			if (!run_remaining) {
+				run_remaining = run_length[cur_run++] + 1;
+			}
+			run_remaining--;
+			cycle += run_delta[cur_run - 1];
+			if (run) {
+				vdp_run_context(context, cycle);
+			}
+		}
+		if (event == EVENT_VRAM_BLOCK) {
+			uint8_t byte = load_int8(buffer);
+			if (!(flags & EVENT_BLOCK_COPY)) {
+				vdp_check_update_sat_byte(context, address ^ 1, byte);
+			}
+			write_vram_byte(context, address ^ 1, byte);
+			reader->last_byte_address = address;
+		} else {
+			uint16_t value = load_int16(buffer);
+			if ((address & 0xFF) < 128) {
+				write_cram(context, address & 0xFF, value);
+			} else {
+				context->vsram[address & 63] = value;
+			}
+		}
+		address += stride;
+	}
+}
+
+void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader, uint8_t run)
 {
 	uint32_t address;
 	deserialize_buffer *buffer = &reader->buffer;
@@ -4673,7 +4803,7 @@ void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader)
 		address = reader->last_byte_address + context->regs[REG_AUTOINC];
 		break;
 	case EVENT_VRAM_WORD:
-		reader_ensure_data(reader, 4);
+		reader_ensure_data(reader, 5);
 		address = load_int8(buffer) << 16;
 		address |= load_int16(buffer);
 		break;
@@ -4686,6 +4816,10 @@ void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader)
 		reader_ensure_data(reader, event == EVENT_VDP_REG ? 2 : 3);
 		address = load_int8(buffer);
 		break;
+	case EVENT_VRAM_BLOCK:
+	case EVENT_INTRAM_BLOCK:
+		replay_block(context, event, reader, run);
+		return;
 	}
 	
 	switch (event)
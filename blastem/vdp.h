@@ -163,6 +163,21 @@ enum {
 	VDP_NUM_DEBUG_TYPES
 };
 
+//sprite attributes as read from the sprite table, positions are raw so 128 is the top/left edge in mode 5
+typedef struct {
+	int16_t  x;
+	int16_t  y;
+	uint16_t pattern; //VRAM address of the first tile
+	uint8_t  index;
+	uint8_t  width;
+	uint8_t  height;
+	uint8_t  palette;
+	uint8_t  priority;
+	uint8_t  h_flip;
+	uint8_t  v_flip;
+} vdp_sprite;
+#define MAX_DECODED_SPRITES 80
+
 typedef struct {
 	system_header  *system;
 	//pointer to current line in framebuffer
@@ -245,6 +260,7 @@ typedef struct {
 	uint8_t        debug_fb_indices[VDP_NUM_DEBUG_TYPES];
 	uint8_t        debug_modes[VDP_NUM_DEBUG_TYPES];
 	uint8_t        pushed_frame;
+	uint8_t        suppress_output; //frames are still rendered but never handed to the frontend
 	uint8_t        vdpmem[];
 } vdp_context;
 
@@ -277,6 +293,8 @@ uint32_t vdp_next_vint_z80(vdp_context * context);
 uint32_t vdp_next_nmi(vdp_context *context);
 void vdp_int_ack(vdp_context * context);
 void vdp_print_sprite_table(vdp_context * context);
+//fills sprites in link order, which needs room for MAX_DECODED_SPRITES, and returns how many there are
+uint8_t vdp_decode_sprites(vdp_context *context, vdp_sprite *sprites);
 void vdp_print_reg_explain(vdp_context * context);
 void latch_mode(vdp_context * context);
 uint32_t vdp_cycles_to_frame_end(vdp_context * context);
@@ -292,6 +310,6 @@ void vdp_toggle_debug_view(vdp_context *context, uint8_t debug_type);
 void vdp_inc_debug_mode(vdp_context *context);
 //to be implemented by the host system
 uint16_t read_dma_value(uint32_t address);
-void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader);
+void vdp_replay_event(vdp_context *context, uint8_t event, event_reader *reader, uint8_t run);
 
 #endif //VDP_H_
@@ -0,0 +1,235 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "vgm_reader.h"
+
+#ifdef DISABLE_ZLIB
+#define VGMFILE FILE*
+#define vgmopen fopen
+#define vgmread fread
+#define vgmseek fseek
+#define vgmclose fclose
+#else
+#include "zlib/zlib.h"
+#define VGMFILE gzFile
+#define vgmopen gzopen
+#define vgmread gzfread
+#define vgmseek gzseek
+#define vgmclose gzclose
+#endif
+
+uint8_t vgm_reader_open(vgm_reader *reader, char *filename)
+{
+	memset(reader, 0, sizeof(*reader));
+	VGMFILE f = vgmopen(filename, "rb");
+	if (!f) {
+		return 0;
+	}
+	if (vgmread(&reader->header, sizeof(reader->header), 1, f) != 1 || memcmp(reader->header.ident, "Vgm ", 4)) {
+		vgmclose(f);
+		return 0;
+	}
+	if (reader->header.version < 0x150 || !reader->header.data_offset) {
+		reader->header.data_offset = 0xC;
+	}
+	uint32_t data_start = reader->header.data_offset + 0x34;
+	if (reader->header.eof_offset + 4 <= data_start || vgmseek(f, data_start, SEEK_SET) < 0) {
+		vgmclose(f);
+		return 0;
+	}
+	reader->data_size = reader->header.eof_offset + 4 - data_start;
+	reader->data = malloc(reader->data_size);
+	//a short read just means the header overstates the size
+	reader->data_size = vgmread(reader->data, 1, reader->data_size, f);
+	vgmclose(f);
+	reader->cur = reader->data;
+	reader->end = reader->data + reader->data_size;
+	return 1;
+}
+
+void vgm_reader_close(vgm_reader *reader)
+{
+	while (reader->blocks)
+	{
+		data_block *next = reader->blocks->next;
+		free(reader->blocks);
+		reader->blocks = next;
+	}
+	free(reader->data);
+	reader->data = reader->cur = reader->end = NULL;
+}
+
+static uint32_t read_le32(uint8_t *src)
+{
+	return src[0] | src[1] << 8 | src[2] << 16 | (uint32_t)src[3] << 24;
+}
+
+static void add_data_block(vgm_reader *reader, uint8_t type, uint8_t *data, uint32_t size)
+{
+	data_block **cur = &reader->blocks;
+	while (*cur)
+	{
+		cur = &((*cur)->next);
+	}
+	*cur = malloc(sizeof(data_block));
+	(*cur)->size = size;
+	(*cur)->type = type;
+	(*cur)->data = data;
+	(*cur)->next = NULL;
+}
+
+static void data_seek(vgm_reader *reader, uint32_t new_offset)
+{
+	if (!reader->seek_block || new_offset < reader->seek_offset) {
+		reader->seek_block = reader->blocks;
+		reader->seek_offset = 0;
+		reader->block_offset = 0;
+	}
+	while (reader->seek_block && (reader->seek_offset - reader->block_offset + reader->seek_block->size) <= new_offset)
+	{
+		reader->seek_offset += reader->seek_block->size - reader->block_offset;
+		reader->seek_block = reader->seek_block->next;
+		reader->block_offset = 0;
+	}
+	reader->block_offset += new_offset - reader->seek_offset;
+	reader->seek_offset = new_offset;
+}
+
+//Decodes the command at the current position and advances past it. YM2612 PCM data blocks
+//and data seeks are also tracked here so vgm_reader_dac_sample can follow them. Commands
+//that are not recognized are returned with a size of 1 for the caller to report.
+//Returns 0 once the data is exhausted or the next command is truncated
+uint8_t vgm_next_command(vgm_reader *reader, vgm_command *command)
+{
+	if (reader->cur >= reader->end) {
+		return 0;
+	}
+	uint8_t *cur = reader->cur;
+	uint32_t avail = reader->end - cur;
+	command->raw = cur;
+	command->cmd = cur[0];
+	command->size = 1;
+	command->wait = 0;
+	command->data_size = 0;
+	command->reg = command->value = 0;
+	switch (command->cmd)
+	{
+	case CMD_PSG_STEREO:
+	case CMD_PSG:
+		command->size = 2;
+		break;
+	case CMD_WAIT:
+		command->size = 3;
+		break;
+	case CMD_WAIT_60:
+		command->wait = 735;
+		break;
+	case CMD_WAIT_50:
+		command->wait = 882;
+		break;
+	case CMD_END:
+		break;
+	case CMD_DATA:
+		command->size = 7;
+		break;
+	case CMD_PCM_WRITE:
+		command->size = 12;
+		break;
+	case CMD_DAC_STREAM_SETUP:
+	case CMD_DAC_STREAM_DATA:
+	case CMD_DAC_STREAM_STARTFAST:
+	case CMD_DATA_SEEK:
+		command->size = 5;
+		break;
+	case CMD_DAC_STREAM_FREQ:
+		command->size = 6;
+		break;
+	case CMD_DAC_STREAM_START:
+		command->size = 11;
+		break;
+	case CMD_DAC_STREAM_STOP:
+		command->size = 2;
+		break;
+	default:
+		if (command->cmd >= CMD_YM2413 && command->cmd <= CMD_YMF262_1) {
+			command->size = 3;
+		} else if (command->cmd >= CMD_WAIT_SHORT && command->cmd < CMD_YM2612_DAC) {
+			command->wait = (command->cmd & 0xF) + 1;
+		} else if (command->cmd >= CMD_YM2612_DAC && command->cmd < CMD_DAC_STREAM_SETUP) {
+			command->wait = command->cmd & 0xF;
+		}
+	}
+	if (command->size > avail) {
+		return 0;
+	}
+	if (command->size > 1) {
+		command->reg = cur[1];
+		if (command->size > 2) {
+			command->value = cur[2];
+		}
+	}
+	switch (command->cmd)
+	{
+	case CMD_WAIT:
+		command->wait = cur[1] | cur[2] << 8;
+		break;
+	case CMD_DATA:
+		//skip the compatibility command
+		command->reg = cur[2];
+		command->data_size = read_le32(cur + 3);
+		if (command->data_size > avail - command->size) {
+			command->data_size = avail - command->size;
+		}
+		if (command->reg == DATA_YM2612_PCM) {
+			add_data_block(reader, command->reg, cur + command->size, command->data_size);
+		}
+		command->size += command->data_size;
+		break;
+	case CMD_DATA_SEEK:
+		command->data_size = read_le32(cur + 1);
+		data_seek(reader, command->data_size);
+		break;
+	}
+	reader->cur = cur + command->size;
+	return 1;
+}
+
+//Moves back to the loop point, returns 0 if the file does not loop
+uint8_t vgm_reader_loop(vgm_reader *reader)
+{
+	uint32_t data_start = reader->header.data_offset + 0x34;
+	if (!reader->header.loop_offset || reader->header.loop_offset + 0x1C < data_start) {
+		return 0;
+	}
+	uint32_t offset = reader->header.loop_offset + 0x1C - data_start;
+	if (offset >= reader->data_size) {
+		return 0;
+	}
+	reader->cur = reader->data + offset;
+	return 1;
+}
+
+//Fetches the next byte of YM2612 PCM data for a CMD_YM2612_DAC command
+//Returns 0 if the data seek pointer is not valid
+uint8_t vgm_reader_dac_sample(vgm_reader *reader, uint8_t *sample)
+{
+	if (!reader->seek_block) {
+		return 0;
+	}
+	*sample = reader->seek_block->data[reader->block_offset++];
+	reader->seek_offset++;
+	if (reader->block_offset >= reader->seek_block->size) {
+		reader->seek_block = reader->seek_block->next;
+		reader->block_offset = 0;
+	}
+	return 1;
+}
+
+uint32_t vgm_command_offset(vgm_reader *reader, vgm_command *command)
+{
+	return command->raw - reader->data;
+}
@@ -0,0 +1,40 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+#ifndef VGM_READER_H_
+#define VGM_READER_H_
+
+#include "vgm.h"
+
+typedef struct {
+	vgm_header header;
+	uint8_t    *data;
+	uint8_t    *cur;
+	uint8_t    *end;
+	data_block *blocks;
+	data_block *seek_block;
+	uint32_t   data_size;
+	uint32_t   seek_offset;
+	uint32_t   block_offset;
+} vgm_reader;
+
+typedef struct {
+	uint8_t  *raw;       //start of the command in the file data
+	uint32_t size;       //total size of the command including any data block payload
+	uint32_t wait;       //samples at 44.1 kHz that pass after the command
+	uint32_t data_size;  //payload size for CMD_DATA, new offset for CMD_DATA_SEEK
+	uint8_t  cmd;
+	uint8_t  reg;        //register or data block type
+	uint8_t  value;
+} vgm_command;
+
+uint8_t vgm_reader_open(vgm_reader *reader, char *filename);
+void vgm_reader_close(vgm_reader *reader);
+uint8_t vgm_next_command(vgm_reader *reader, vgm_command *command);
+uint8_t vgm_reader_loop(vgm_reader *reader);
+uint8_t vgm_reader_dac_sample(vgm_reader *reader, uint8_t *sample);
+uint32_t vgm_command_offset(vgm_reader *reader, vgm_command *command);
+
+#endif //VGM_READER_H_
@@ -12,7 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "vgm.h"
+#include "vgm_reader.h"
 #include "system.h"
 
 #define MCLKS_NTSC 53693175
@@ -24,23 +24,6 @@
 #define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
 
 
-#ifdef DISABLE_ZLIB
-#define VGMFILE FILE*
-#define vgmopen fopen
-#define vgmread fread
-#define vgmseek fseek
-#define vgmgetc fgetc
-#define vgmclose fclose
-#else
-#include "zlib/zlib.h"
-#define VGMFILE gzFile
-#define vgmopen gzopen
-#define vgmread gzfread
-#define vgmseek gzseek
-#define vgmgetc gzgetc
-#define vgmclose gzclose
-#endif
-
 
 system_header *current_system;
 
@@ -108,7 +91,7 @@ void vgm_wait(ym2612_context * y_context, psg_context * p_context, uint32_t * cu
 	if (*current_cycle > CYCLE_LIMIT) {
 		*current_cycle -= CYCLE_LIMIT;
 		p_context->cycles -= CYCLE_LIMIT;
-		y_context->current_cycle -= CYCLE_LIMIT;
+		ym_adjust_cycles(y_context, CYCLE_LIMIT);
 		process_events();
 	}
 }
@@ -116,10 +99,6 @@ void vgm_wait(ym2612_context * y_context, psg_context * p_context, uint32_t * cu
 int main(int argc, char ** argv)
 {
 	set_exe_str(argv[0]);
-	data_block *blocks = NULL;
-	data_block *seek_block = NULL;
-	uint32_t seek_offset;
-	uint32_t block_offset;
 
 	uint32_t fps = 60;
 	config = load_config(argv[0]);
@@ -138,135 +117,73 @@ int main(int argc, char ** argv)
 
 	psg_context p_context;
 	psg_init(&p_context, MCLKS_NTSC, MCLKS_PER_PSG);
+	if (opts & YM_OPT_WAVE_LOG) {
+		psg_start_stems(&p_context, MCLKS_NTSC);
+	}
 
-	VGMFILE * f = vgmopen(argv[1], "rb");
-	vgm_header header;
-	vgmread(&header, sizeof(header), 1, f);
-	if (header.version < 0x150 || !header.data_offset) {
-		header.data_offset = 0xC;
+	vgm_reader reader;
+	if (!vgm_reader_open(&reader, argv[1])) {
+		fatal_error("Failed to load VGM file %s\n", argv[1]);
 	}
-	vgmseek(f, header.data_offset + 0x34, SEEK_SET);
-	uint32_t data_size = header.eof_offset + 4 - (header.data_offset + 0x34);
-	uint8_t * data = malloc(data_size);
-	vgmread(data, 1, data_size, f);
-	vgmclose(f);
 
 	uint32_t mclks_sample = MCLKS_NTSC / 44100;
 	uint32_t loop_count = 2;
 
-	uint8_t * end = data + data_size;
-	uint8_t * cur = data;
 	uint32_t current_cycle = 0;
-	while (cur < end) {
-		uint8_t cmd = *(cur++);
-		switch(cmd)
+	vgm_command cmd;
+	while (vgm_next_command(&reader, &cmd)) {
+		switch(cmd.cmd)
 		{
 		case CMD_PSG_STEREO:
 			//ignore for now
-			cur++;
 			break;
 		case CMD_PSG:
-			psg_write(&p_context, *(cur++));
+			psg_write(&p_context, cmd.reg);
 			break;
 		case CMD_YM2612_0:
-			ym_address_write_part1(&y_context, *(cur++));
-			ym_data_write(&y_context, *(cur++));
+			ym_address_write_part1(&y_context, cmd.reg);
+			ym_data_write(&y_context, cmd.value);
 			break;
 		case CMD_YM2612_1:
-			ym_address_write_part2(&y_context, *(cur++));
-			ym_data_write(&y_context, *(cur++));
+			ym_address_write_part2(&y_context, cmd.reg);
+			ym_data_write(&y_context, cmd.value);
 			break;
-		case CMD_WAIT: {
-			uint32_t wait_time = *(cur++);
-			wait_time |= *(cur++) << 8;
-			wait_time *= mclks_sample;
-			vgm_wait(&y_context, &p_context, &current_cycle, wait_time);
-			break;
-		}
+		case CMD_WAIT:
 		case CMD_WAIT_60:
-			vgm_wait(&y_context, &p_context, &current_cycle, 735 * mclks_sample);
-			break;
 		case CMD_WAIT_50:
-			vgm_wait(&y_context, &p_context, &current_cycle, 882 * mclks_sample);
+			vgm_wait(&y_context, &p_context, &current_cycle, cmd.wait * mclks_sample);
 			break;
 		case CMD_END:
-			if (header.loop_offset && --loop_count) {
-				cur = data + header.loop_offset + 0x1C - (header.data_offset + 0x34);
-			} else {
+			if (!--loop_count || !vgm_reader_loop(&reader)) {
 				//TODO: fade out
 				return 0;
 			}
 			break;
-		case CMD_DATA: {
-			cur++; //skip compat command
-			uint8_t data_type = *(cur++);
-			uint32_t data_size = *(cur++);
-			data_size |= *(cur++) << 8;
-			data_size |= *(cur++) << 16;
-			data_size |= *(cur++) << 24;
-			if (data_type == DATA_YM2612_PCM) {
-				data_block ** curblock = &blocks;
-				while(*curblock)
-				{
-					curblock = &((*curblock)->next);
-				}
-				*curblock = malloc(sizeof(data_block));
-				(*curblock)->size = data_size;
-				(*curblock)->type = data_type;
-				(*curblock)->data = cur;
-				(*curblock)->next = NULL;
-			} else {
-				fprintf(stderr, "Skipping data block with unrecognized type %X\n", data_type);
+		case CMD_DATA:
+			if (cmd.reg != DATA_YM2612_PCM) {
+				fprintf(stderr, "Skipping data block with unrecognized type %X\n", cmd.reg);
 			}
-			cur += data_size;
 			break;
-		}
-		case CMD_DATA_SEEK: {
-			uint32_t new_offset = *(cur++);
-			new_offset |= *(cur++) << 8;
-			new_offset |= *(cur++) << 16;
-			new_offset |= *(cur++) << 24;
-			if (!seek_block || new_offset < seek_offset) {
-				seek_block = blocks;
-				seek_offset = 0;
-				block_offset = 0;
-			}
-			while (seek_block && (seek_offset - block_offset + seek_block->size) < new_offset)
-			{
-				seek_offset += seek_block->size - block_offset;
-				seek_block = seek_block->next;
-				block_offset = 0;
-			}
-			block_offset += new_offset-seek_offset;
-			seek_offset = new_offset;
+		case CMD_DATA_SEEK:
 			break;
-		}
 
 		default:
-			if (cmd >= CMD_WAIT_SHORT && cmd < (CMD_WAIT_SHORT + 0x10)) {
-				uint32_t wait_time = (cmd & 0xF) + 1;
-				wait_time *= mclks_sample;
-				vgm_wait(&y_context, &p_context, &current_cycle, wait_time);
-			} else if (cmd >= CMD_YM2612_DAC && cmd < CMD_DAC_STREAM_SETUP) {
-				if (seek_block) {
+			if (cmd.cmd >= CMD_WAIT_SHORT && cmd.cmd < (CMD_WAIT_SHORT + 0x10)) {
+				vgm_wait(&y_context, &p_context, &current_cycle, cmd.wait * mclks_sample);
+			} else if (cmd.cmd >= CMD_YM2612_DAC && cmd.cmd < CMD_DAC_STREAM_SETUP) {
+				uint8_t sample;
+				if (vgm_reader_dac_sample(&reader, &sample)) {
 					ym_address_write_part1(&y_context, 0x2A);
-					ym_data_write(&y_context, seek_block->data[block_offset++]);
-					seek_offset++;
-					if (block_offset > seek_block->size) {
-						seek_block = seek_block->next;
-						block_offset = 0;
-					}
+					ym_data_write(&y_context, sample);
 				} else {
 					fputs("Encountered DAC write command but data seek pointer is invalid!\n", stderr);
 				}
-				uint32_t wait_time = (cmd & 0xF);
-				if (wait_time)
+				if (cmd.wait)
 				{
-					wait_time *= mclks_sample;
-					vgm_wait(&y_context, &p_context, &current_cycle, wait_time);
+					vgm_wait(&y_context, &p_context, &current_cycle, cmd.wait * mclks_sample);
 				}
 			} else {
-				fatal_error("unimplemented command: %X at offset %X\n", cmd, (unsigned int)(cur - data - 1));
+				fatal_error("unimplemented command: %X at offset %X\n", cmd.cmd, vgm_command_offset(&reader, &cmd));
 			}
 		}
 	}
@@ -0,0 +1,401 @@
+/*
+ Copyright 2026 agent
+ This file is part of BlastEm.
+ BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
+*/
+//Renders VGM files to WAV as fast as the host allows, without an audio device
+//Each worker thread has its own YM2612 and PSG so several files can be rendered at once
+#include "render_audio.h"
+#include "ym2612.h"
+#include "psg.h"
+#include "config.h"
+#include "util.h"
+#include "wave.h"
+#include "vgm_reader.h"
+#include "system.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MCLKS_NTSC 53693175
+#define MCLKS_PER_68K 7
+#define MCLKS_PER_YM  MCLKS_PER_68K
+#define MCLKS_PER_Z80 15
+#define MCLKS_PER_PSG (MCLKS_PER_Z80*16)
+#define VGM_RATE 44100
+
+//chips run this far before their cycle counters are rebased, large to keep synthesis in long batches
+#define CYCLE_LIMIT 0x10000000
+//output frames each source buffers before handing them to the worker
+#define SOURCE_FRAMES 4096
+#define MAX_WORKERS 64
+
+system_header *current_system;
+tern_node *config;
+int headless = 1;
+
+void render_errorbox(char * title, char * buf)
+{
+}
+
+void render_infobox(char * title, char * buf)
+{
+}
+
+void render_warnbox(char * title, char * buf)
+{
+}
+
+typedef struct {
+	int16_t  *samples;
+	uint32_t frames;
+	uint32_t storage;
+} source_output;
+
+typedef struct {
+	ym2612_context *ym;
+	psg_context    *psg;
+	source_output  ym_out;
+	source_output  psg_out;
+	int16_t        *mix;
+	uint32_t       mix_storage;
+	FILE           *wav;
+	uint64_t       samples;
+	uint64_t       cycle_base;
+	uint32_t       cycle;
+} render_worker;
+
+//the audio source registry and the YM2612 tables are shared, chips are created and freed under this lock
+static pthread_mutex_t chip_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **files;
+static char *out_dir;
+static uint32_t num_files;
+static uint32_t next_file;
+static uint32_t loops = 2;
+static uint32_t failures;
+
+//this program acts as an asynchronous render backend, render_do_audio_ready hands each
+//source's samples to the worker that owns it instead of a mixer
+uint8_t render_is_audio_sync(void)
+{
+	return 0;
+}
+
+void render_buffer_consumed(audio_source *src)
+{
+}
+
+void *render_new_audio_opaque(void)
+{
+	return NULL;
+}
+
+void render_free_audio_opaque(void *opaque)
+{
+}
+
+void render_lock_audio(void)
+{
+}
+
+void render_unlock_audio(void)
+{
+}
+
+uint32_t render_min_buffered(void)
+{
+	return SOURCE_FRAMES;
+}
+
+uint32_t render_audio_syncs_per_sec(void)
+{
+	return 0;
+}
+
+void render_audio_created(audio_source *src)
+{
+}
+
+void render_do_audio_ready(audio_source *src)
+{
+	source_output *out = src->opaque;
+	uint32_t start = src->read_end;
+	uint32_t end = src->buffer_pos & src->mask;
+	uint32_t count = (end - start) & src->mask;
+	uint32_t needed = out->frames * src->num_channels + count;
+	if (needed > out->storage) {
+		out->storage = needed * 2;
+		out->samples = realloc(out->samples, out->storage * sizeof(int16_t));
+	}
+	int16_t *dst = out->samples + out->frames * src->num_channels;
+	uint32_t first = count;
+	if (start + first > src->mask + 1) {
+		first = src->mask + 1 - start;
+	}
+	memcpy(dst, src->back + start, first * sizeof(int16_t));
+	memcpy(dst + first, src->back, (count - first) * sizeof(int16_t));
+	out->frames += count / src->num_channels;
+	src->read_start = src->read_end = end;
+}
+
+void render_source_paused(audio_source *src, uint8_t remaining_sources)
+{
+}
+
+void render_source_resumed(audio_source *src)
+{
+}
+
+static int16_t clamp_sample(float value)
+{
+	if (value >= 32767.0f) {
+		return 32767;
+	} else if (value <= -32768.0f) {
+		return -32768;
+	}
+	return value < 0.0f ? value - 0.5f : value + 0.5f;
+}
+
+//Mixes the frames both chips have produced and appends them to the WAV file
+static void write_output(render_worker *worker)
+{
+	uint32_t frames = worker->ym_out.frames < worker->psg_out.frames ? worker->ym_out.frames : worker->psg_out.frames;
+	if (!frames) {
+		return;
+	}
+	if (frames * 2 > worker->mix_storage) {
+		worker->mix_storage = frames * 2;
+		worker->mix = realloc(worker->mix, worker->mix_storage * sizeof(int16_t));
+	}
+	float ym_gain = worker->ym->audio->gain_mult, psg_gain = worker->psg->audio->gain_mult;
+	int16_t *ym = worker->ym_out.samples, *psg = worker->psg_out.samples;
+	for (uint32_t i = 0; i < frames; i++)
+	{
+		float mono = psg[i] * psg_gain;
+		worker->mix[i * 2] = clamp_sample(ym[i * 2] * ym_gain + mono);
+		worker->mix[i * 2 + 1] = clamp_sample(ym[i * 2 + 1] * ym_gain + mono);
+	}
+	fwrite(worker->mix, sizeof(int16_t) * 2, frames, worker->wav);
+	worker->ym_out.frames -= frames;
+	worker->psg_out.frames -= frames;
+	memmove(ym, ym + frames * 2, worker->ym_out.frames * 2 * sizeof(int16_t));
+	memmove(psg, psg + frames, worker->psg_out.frames * sizeof(int16_t));
+}
+
+static void render_wait(render_worker *worker, uint32_t samples)
+{
+	if (!samples) {
+		return;
+	}
+	//tracking the total keeps the fractional master clocks per sample from drifting
+	worker->samples += samples;
+	worker->cycle = worker->samples * MCLKS_NTSC / VGM_RATE - worker->cycle_base;
+	psg_run(worker->psg, worker->cycle);
+	ym_advance(worker->ym, worker->cycle);
+	if (worker->cycle > CYCLE_LIMIT) {
+		ym_adjust_cycles(worker->ym, CYCLE_LIMIT);
+		worker->psg->cycles -= CYCLE_LIMIT;
+		worker->cycle -= CYCLE_LIMIT;
+		worker->cycle_base += CYCLE_LIMIT;
+	}
+	if (worker->ym_out.frames >= SOURCE_FRAMES && worker->psg_out.frames >= SOURCE_FRAMES) {
+		write_output(worker);
+	}
+}
+
+static void worker_init(render_worker *worker)
+{
+	memset(worker, 0, sizeof(*worker));
+	worker->ym = malloc(sizeof(ym2612_context));
+	worker->psg = malloc(sizeof(psg_context));
+	pthread_mutex_lock(&chip_lock);
+		ym_init(worker->ym, MCLKS_NTSC, MCLKS_PER_YM, 0);
+		psg_init(worker->psg, MCLKS_NTSC, MCLKS_PER_PSG);
+		//the mixer only has room for a few sources and nothing mixes them here anyway
+		render_audio_detach_source(worker->ym->audio);
+		render_audio_detach_source(worker->psg->audio);
+	pthread_mutex_unlock(&chip_lock);
+	char *gain = tern_find_path(config, "audio\0psg_gain\0", TVAL_PTR).ptrval;
+	render_audio_source_gaindb(worker->psg->audio, gain ? atof(gain) : 0.0f);
+	gain = tern_find_path(config, "audio\0fm_gain\0", TVAL_PTR).ptrval;
+	render_audio_source_gaindb(worker->ym->audio, gain ? atof(gain) : 0.0f);
+	worker->ym->audio->opaque = &worker->ym_out;
+	worker->psg->audio->opaque = &worker->psg_out;
+}
+
+static void worker_free(render_worker *worker)
+{
+	pthread_mutex_lock(&chip_lock);
+		ym_free(worker->ym);
+		psg_free(worker->psg);
+	pthread_mutex_unlock(&chip_lock);
+	free(worker->ym_out.samples);
+	free(worker->psg_out.samples);
+	free(worker->mix);
+}
+
+//Replaces the extension of input with .wav, the file goes in out_dir if one was given
+static char *output_name(char *input)
+{
+	char *slash = strrchr(input, '/');
+	char *base = out_dir && slash ? slash + 1 : input;
+	char *ext = strrchr(base, '.');
+	if (ext && slash && ext < slash) {
+		ext = NULL;
+	}
+	int len = ext ? ext - base : strlen(base);
+	char *dir = out_dir ? out_dir : "";
+	char *sep = out_dir ? "/" : "";
+	char *ret = malloc(strlen(dir) + strlen(sep) + len + sizeof(".wav"));
+	sprintf(ret, "%s%s%.*s.wav", dir, sep, len, base);
+	return ret;
+}
+
+static uint8_t render_file(render_worker *worker, char *path)
+{
+	vgm_reader reader;
+	if (!vgm_reader_open(&reader, path)) {
+		fprintf(stderr, "Failed to load VGM file %s\n", path);
+		return 0;
+	}
+	char *out_path = output_name(path);
+	worker->wav = fopen(out_path, "wb");
+	if (!worker->wav || !wave_init(worker->wav, VGM_RATE, 16, 2)) {
+		fprintf(stderr, "Failed to open %s for writing\n", out_path);
+		if (worker->wav) {
+			fclose(worker->wav);
+		}
+		free(out_path);
+		vgm_reader_close(&reader);
+		return 0;
+	}
+	uint8_t ret = 1;
+	uint32_t loop_count = loops;
+	vgm_command cmd;
+	while (vgm_next_command(&reader, &cmd)) {
+		switch(cmd.cmd)
+		{
+		case CMD_PSG_STEREO:
+			//ignore for now
+			break;
+		case CMD_PSG:
+			psg_write(worker->psg, cmd.reg);
+			break;
+		case CMD_YM2612_0:
+			ym_address_write_part1(worker->ym, cmd.reg);
+			ym_data_write(worker->ym, cmd.value);
+			break;
+		case CMD_YM2612_1:
+			ym_address_write_part2(worker->ym, cmd.reg);
+			ym_data_write(worker->ym, cmd.value);
+			break;
+		case CMD_END:
+			if (!--loop_count || !vgm_reader_loop(&reader)) {
+				reader.cur = reader.end;
+			}
+			break;
+		case CMD_DATA:
+		case CMD_DATA_SEEK:
+			break;
+		default:
+			if (cmd.cmd >= CMD_YM2612_DAC && cmd.cmd < CMD_DAC_STREAM_SETUP) {
+				uint8_t sample;
+				if (vgm_reader_dac_sample(&reader, &sample)) {
+					ym_address_write_part1(worker->ym, REG_DAC);
+					ym_data_write(worker->ym, sample);
+				}
+			} else if (!cmd.wait && (cmd.cmd < CMD_WAIT || cmd.cmd > CMD_WAIT_50)) {
+				fprintf(stderr, "Unimplemented command %X at offset %X in %s\n", cmd.cmd, vgm_command_offset(&reader, &cmd), path);
+				reader.cur = reader.end;
+				ret = 0;
+			}
+		}
+		render_wait(worker, cmd.wait);
+	}
+	ym_run(worker->ym, worker->cycle);
+	//collect what is still sitting in the source buffers short of a full hand off
+	render_do_audio_ready(worker->ym->audio);
+	render_do_audio_ready(worker->psg->audio);
+	write_output(worker);
+	if (!wave_finalize(worker->wav)) {
+		fprintf(stderr, "Failed to write %s\n", out_path);
+		ret = 0;
+	}
+	worker->wav = NULL;
+	free(out_path);
+	vgm_reader_close(&reader);
+	return ret;
+}
+
+static void *worker_main(void *data)
+{
+	for (;;)
+	{
+		uint32_t index = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED);
+		if (index >= num_files) {
+			break;
+		}
+		//a fresh pair of chips per file so nothing carries over from the previous one
+		render_worker worker;
+		worker_init(&worker);
+		if (!render_file(&worker, files[index])) {
+			__atomic_fetch_add(&failures, 1, __ATOMIC_RELAXED);
+		}
+		worker_free(&worker);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	set_exe_str(argv[0]);
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++)
+	{
+		if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			loops = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			out_dir = argv[++i];
+		} else {
+			break;
+		}
+	}
+	if (i >= argc) {
+		fputs("usage: vgmrender [-j THREADS] [-l PLAY_COUNT] [-o OUTPUT_DIR] FILE.vgm [FILE.vgm ...]\n", stderr);
+		return 1;
+	}
+	files = argv + i;
+	num_files = argc - i;
+	if (threads < 1) {
+		threads = 1;
+	}
+	if (threads > num_files) {
+		threads = num_files;
+	}
+	if (threads > MAX_WORKERS) {
+		threads = MAX_WORKERS;
+	}
+	if (!loops) {
+		loops = 1;
+	}
+	config = load_config(argv[0]);
+	render_audio_initialized(RENDER_AUDIO_S16, VGM_RATE, 2, SOURCE_FRAMES, sizeof(int16_t));
+
+	pthread_t workers[MAX_WORKERS];
+	for (long t = 1; t < threads; t++)
+	{
+		pthread_create(workers + t, NULL, worker_main, NULL);
+	}
+	worker_main(NULL);
+	for (long t = 1; t < threads; t++)
+	{
+		pthread_join(workers[t], NULL);
+	}
+	return failures ? 1 : 0;
+}
@@ -4,7 +4,7 @@
  BlastEm is free software distributed under the terms of the GNU General Public License version 3 or greater. See COPYING for full license text.
 */
 #include "ym2612.h"
-#include "vgm.h"
+#include "vgm_reader.h"
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,27 +58,13 @@ void write_wait(uint8_t **out_buffer, uint32_t *delay)
 
 int main(int argc, char ** argv)
 {
-	data_block *blocks = NULL;
-	data_block *seek_block = NULL;
-	uint32_t seek_offset;
-	uint32_t block_offset;
-
-
-	FILE * f = fopen(argv[1], "rb");
-	vgm_header header;
-	size_t bytes = fread(&header, 1, sizeof(header), f);
-	if (bytes != sizeof(header)) {
+	vgm_reader reader;
+	if (!vgm_reader_open(&reader, argv[1])) {
 		fputs("Error reading file\n", stderr);
 		exit(1);
 	}
-	if (header.version < 0x150 || !header.data_offset) {
-		header.data_offset = 0xC;
-	}
-	fseek(f, header.data_offset + 0x34, SEEK_SET);
-	uint32_t data_size = header.eof_offset + 4 - (header.data_offset + 0x34);
-	uint8_t * data = malloc(data_size);
-	data_size = fread(data, 1, data_size, f);
-	fclose(f);
+	vgm_header header = reader.header;
+	uint32_t data_size = reader.data_size;
 	uint8_t *buffers[OUT_CHANNELS];
 	uint8_t *out_pos[OUT_CHANNELS];
 	uint8_t has_real_data[OUT_CHANNELS];
@@ -96,24 +82,21 @@ int main(int argc, char ** argv)
 		delay[i] = 0;
 	}
 
-	uint8_t * end = data + data_size;
-	uint8_t * cur = data;
-	uint32_t current_cycle = 0;
 	uint8_t psg_latch = 0;
 	uint8_t param,reg;
 	uint8_t channel;
 	uint32_t sample_count = 0;
 	uint8_t last_cmd;
-	while (cur < end) {
-		uint8_t cmd = *(cur++);
+	vgm_command command;
+	while (vgm_next_command(&reader, &command)) {
+		uint8_t cmd = command.cmd;
 		switch(cmd)
 		{
 		case CMD_PSG_STEREO:
 			//ignore for now
-			cur++;
 			break;
 		case CMD_PSG:
-			param = *(cur++);
+			param = command.reg;
 			if (param & 0x80) {
 				psg_latch = param;
 				channel = param >> 5 & 3;
@@ -126,8 +109,8 @@ int main(int argc, char ** argv)
 			has_real_data[PSG_BASE+channel] = 1;
 			break;
 		case CMD_YM2612_0:
-			reg = *(cur++);
-			param = *(cur++);
+			reg = command.reg;
+			param = command.value;
 			if (reg < REG_KEY_ONOFF) {
 				for (int i = 0; i < 6; i++)
 				{
@@ -157,8 +140,8 @@ int main(int argc, char ** argv)
 			}
 		case CMD_YM2612_1:
 			if (cmd == CMD_YM2612_1) {
-				reg = *(cur++);
-				param = *(cur++);
+				reg = command.reg;
+				param = command.value;
 				channel = 255;
 			}
 			if (channel >= PSG_BASE) {
@@ -177,17 +160,10 @@ int main(int argc, char ** argv)
 				*(out_pos[channel]++) = param;
 			}
 			break;
-		case CMD_WAIT: {
-			uint32_t wait_time = *(cur++);
-			wait_time |= *(cur++) << 8;
-			accum_wait(delay, wait_time);
-			break;
-		}
+		case CMD_WAIT:
 		case CMD_WAIT_60:
-			accum_wait(delay, 735);
-			break;
 		case CMD_WAIT_50:
-			accum_wait(delay, 882);
+			accum_wait(delay, command.wait);
 			break;
 		case CMD_END:
 			for (int i = 0; i < OUT_CHANNELS; i++)
@@ -195,40 +171,26 @@ int main(int argc, char ** argv)
 				write_wait(out_pos + i, delay + i);
 				*(out_pos[i]++) = cmd;
 			}
-			cur = end;
+			reader.cur = reader.end;
 			break;
-		case CMD_DATA: {
-			uint8_t * start = cur - 1;
-			cur++; //skip compat command
-			uint8_t data_type = *(cur++);
-			uint32_t data_size = *(cur++);
-			data_size |= *(cur++) << 8;
-			data_size |= *(cur++) << 16;
-			data_size |= *(cur++) << 24;
-			if (cur + data_size > end) {
-				data_size = end - cur;
-			}
-			cur += data_size;
-			if (data_type == DATA_YM2612_PCM) {
+		case CMD_DATA:
+			if (command.reg == DATA_YM2612_PCM) {
 				write_wait(out_pos + DAC_CHANNEL, delay + DAC_CHANNEL);
-				memcpy(out_pos[DAC_CHANNEL], start, cur-start);
-				out_pos[DAC_CHANNEL] += cur-start;
+				memcpy(out_pos[DAC_CHANNEL], command.raw, command.size);
+				out_pos[DAC_CHANNEL] += command.size;
 			} else {
-				fprintf(stderr, "WARNING: Skipping data block with unrecognized type %X\n", data_type);
+				fprintf(stderr, "WARNING: Skipping data block with unrecognized type %X\n", command.reg);
 			}
 			break;
-		}
-		case CMD_DATA_SEEK: {
+		case CMD_DATA_SEEK:
 			write_wait(out_pos + DAC_CHANNEL, delay + DAC_CHANNEL);
-			memcpy(out_pos[DAC_CHANNEL], cur-1, 5);
-			out_pos[DAC_CHANNEL] += 5;
-			cur += 4;
+			memcpy(out_pos[DAC_CHANNEL], command.raw, command.size);
+			out_pos[DAC_CHANNEL] += command.size;
 			break;
-		}
 
 		default:
 			if (cmd >= CMD_WAIT_SHORT && cmd < (CMD_WAIT_SHORT + 0x10)) {
-				accum_wait(delay, (cmd & 0xF) + 1);
+				accum_wait(delay, command.wait);
 			} else if (cmd >= CMD_YM2612_DAC && cmd < CMD_DAC_STREAM_SETUP) {
 				write_wait(out_pos + DAC_CHANNEL, delay + DAC_CHANNEL);
 				*(out_pos[DAC_CHANNEL]++) = cmd;
@@ -236,12 +198,12 @@ int main(int argc, char ** argv)
 				{
 					if (i != DAC_CHANNEL)
 					{
-						delay[i] += cmd & 0xF;
+						delay[i] += command.wait;
 					}
 				}
 				sample_count++;
 			} else {
-				fprintf(stderr, "unimplemented command: %X at offset %X, last valid command was %X\n", cmd, (unsigned int)(cur - data - 1), last_cmd);
+				fprintf(stderr, "unimplemented command: %X at offset %X, last valid command was %X\n", cmd, vgm_command_offset(&reader, &command), last_cmd);
 				exit(1);
 			}
 		}
@@ -255,7 +217,7 @@ int main(int argc, char ** argv)
 		if (has_real_data[i]) {
 			char fname[11];
 			sprintf(fname, i < PSG_BASE ? "ym_%d.vgm" : "psg_%d.vgm", i < PSG_BASE ? i : i - PSG_BASE);
-			f = fopen(fname, "wb");
+			FILE *f = fopen(fname, "wb");
 			if (!f) {
 				fprintf(stderr, "Failed to open %s for writing\n", fname);
 				exit(1);
@@ -9,7 +9,6 @@
 #include <stdlib.h>
 #include "ym2612.h"
 #include "render.h"
-#include "wave.h"
 #include "blastem.h"
 #include "event_log.h"
 
@@ -99,22 +98,6 @@ static uint16_t round_fixed_point(double value, int dec_bits)
 }
 
 static FILE * debug_file = NULL;
-static uint32_t first_key_on=0;
-
-static ym2612_context * log_context = NULL;
-
-static void ym_finalize_log()
-{
-	if (!log_context) {
-		return;
-	}
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		if (log_context->channels[i].logfile) {
-			wave_finalize(log_context->channels[i].logfile);
-		}
-	}
-	log_context = NULL;
-}
 
 void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock)
 {
@@ -123,7 +106,11 @@ void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock)
 
 void ym_adjust_cycles(ym2612_context *context, uint32_t deduction)
 {
+	//queued writes are not adjusted so synthesis needs to catch up first
+	ym_run(context, context->run_cycle);
 	context->current_cycle -= deduction;
+	context->run_cycle -= deduction;
+	context->timer_cycle -= deduction;
 	if (context->write_cycle != CYCLE_NEVER && context->write_cycle >= deduction) {
 		context->write_cycle -= deduction;
 	} else {
@@ -152,19 +139,15 @@ void ym_adjust_cycles(ym2612_context *context, uint32_t deduction)
 
 void ym_reset(ym2612_context *context)
 {
+	ym_run(context, context->run_cycle);
 	memset(context->part1_regs, 0, sizeof(context->part1_regs));
 	memset(context->part2_regs, 0, sizeof(context->part2_regs));
 	memset(context->operators, 0, sizeof(context->operators));
-	FILE* savedlogs[NUM_CHANNELS];
-	for (int i = 0; i < NUM_CHANNELS; i++)
-	{
-		savedlogs[i] = context->channels[i].logfile;
-	}
 	memset(context->channels, 0, sizeof(context->channels));
 	memset(context->ch3_supp, 0, sizeof(context->ch3_supp));
 	context->selected_reg = 0;
-	context->csm_keyon = 0;
-	context->ch3_mode = 0;
+	context->csm_keyon = context->timer_csm_keyon = 0;
+	context->ch3_mode = context->timer_ch3_mode = 0;
 	context->dac_enable = 0;
 	context->status = 0;
 	context->timer_a_load = 0;
@@ -178,7 +161,6 @@ void ym_reset(ym2612_context *context)
 	//some games seem to expect that the LR flags start out as 1
 	for (int i = 0; i < NUM_CHANNELS; i++) {
 		context->channels[i].lr = 0xC0;
-		context->channels[i].logfile = savedlogs[i];
 		if (i < 3) {
 			context->part1_regs[REG_LR_AMS_PMS - YM_PART1_START + i] = 0xC0;
 		} else {
@@ -194,7 +176,6 @@ void ym_reset(ym2612_context *context)
 
 void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div, uint32_t options)
 {
-	static uint8_t registered_finalize;
 	dfopen(debug_file, "ym_debug.txt", "w");
 	memset(context, 0, sizeof(*context));
 	context->clock_inc = clock_div * 6;
@@ -204,28 +185,8 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 	context->invalid_status_decay = 225000 * context->clock_inc;
 	context->status_address_mask = (options & YM_OPT_3834) ? 0 : 3;
 	
-	//some games seem to expect that the LR flags start out as 1
-	for (int i = 0; i < NUM_CHANNELS; i++) {
-		if (options & YM_OPT_WAVE_LOG) {
-			char fname[64];
-			sprintf(fname, "ym_channel_%d.wav", i);
-			FILE * f = context->channels[i].logfile = fopen(fname, "wb");
-			if (!f) {
-				fprintf(stderr, "Failed to open WAVE log file %s for writing\n", fname);
-				continue;
-			}
-			if (!wave_init(f, master_clock / (context->clock_inc * NUM_OPERATORS), 16, 1)) {
-				fclose(f);
-				context->channels[i].logfile = NULL;
-			}
-		}
-	}
 	if (options & YM_OPT_WAVE_LOG) {
-		log_context = context;
-		if (!registered_finalize) {
-			atexit(ym_finalize_log);
-			registered_finalize = 1;
-		}
+		ym_start_stems(context, master_clock);
 	}
 	if (!did_tbl_init) {
 		//populate sine table
@@ -283,6 +244,7 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 				}
 			}
 		}
+		did_tbl_init = 1;
 	}
 	ym_reset(context);
 	ym_enable_zero_offset(context, 1);
@@ -290,10 +252,8 @@ void ym_init(ym2612_context * context, uint32_t master_clock, uint32_t clock_div
 
 void ym_free(ym2612_context *context)
 {
+	ym_stop_stems(context);
 	render_free_source(context->audio);
-	if (context == log_context) {
-		ym_finalize_log();
-	}
 	free(context);
 }
 
@@ -367,13 +327,18 @@ static void csm_keyoff(ym2612_context *context)
 	}
 }
 
-void ym_run_timers(ym2612_context *context)
+static void ym_queue(ym2612_context *context, uint32_t cycle, uint8_t type, uint8_t reg, uint8_t value);
+
+//Timers only interact with synthesis through CSM key on/off so they are run ahead of it
+//with those events going through the write queue
+static void ym_run_timers(ym2612_context *context)
 {
 	if (context->timer_control & BIT_TIMERA_ENABLE) {
 		if (context->timer_a != TIMER_A_MAX) {
 			context->timer_a++;
-			if (context->csm_keyon) {
-				csm_keyoff(context);
+			if (context->timer_csm_keyon) {
+				context->timer_csm_keyon = 0;
+				ym_queue(context, context->timer_cycle, YM_QUEUE_CSM_KEYOFF, 0, 0);
 			}
 		} else {
 			if (context->timer_control & BIT_TIMERA_LOAD) {
@@ -382,15 +347,9 @@ void ym_run_timers(ym2612_context *context)
 				context->status |= BIT_STATUS_TIMERA;
 			}
 			context->timer_a = context->timer_a_load;
-			if (!context->csm_keyon && context->ch3_mode == CSM_MODE) {
-				context->csm_keyon = 0xF0;
-				uint8_t changes = 0xF0 ^ context->channels[2].keyon;;
-				for (uint8_t op = 2*4, bit = 0; op < 3*4; op++, bit++)
-				{
-					if (changes & keyon_bits[bit]) {
-						keyon(context->operators + op, context->channels + 2);
-					}
-				}
+			if (!context->timer_csm_keyon && context->timer_ch3_mode == CSM_MODE) {
+				context->timer_csm_keyon = 0xF0;
+				ym_queue(context, context->timer_cycle, YM_QUEUE_CSM_KEYON, 0, 0);
 			}
 		}
 	}
@@ -412,7 +371,28 @@ void ym_run_timers(ym2612_context *context)
 		context->timer_b = context->timer_b_load;
 	}
 	context->sub_timer_b += 0x10;
-	//Update LFO
+}
+
+static void ym_advance_timers(ym2612_context *context, uint32_t to_cycle)
+{
+	uint32_t period = NUM_OPERATORS * context->clock_inc;
+	if (context->timer_cycle < to_cycle && !(context->timer_control & (BIT_TIMERA_ENABLE | BIT_TIMERB_ENABLE | BIT_TIMERB_LOAD))) {
+		//nothing but the timer B prescaler changes while both timers are stopped
+		uint32_t samples = (to_cycle - context->timer_cycle + period - 1) / period;
+		context->sub_timer_b += samples * 0x10;
+		context->timer_cycle += samples * period;
+	}
+	for (; context->timer_cycle < to_cycle; context->timer_cycle += period)
+	{
+		ym_run_timers(context);
+	}
+	if (to_cycle > context->run_cycle) {
+		context->run_cycle += (to_cycle - context->run_cycle + context->clock_inc - 1) / context->clock_inc * context->clock_inc;
+	}
+}
+
+static void ym_run_lfo(ym2612_context *context)
+{
 	if (context->lfo_enable) {
 		if (context->lfo_counter) {
 			context->lfo_counter--;
@@ -437,7 +417,9 @@ void ym_run_timers(ym2612_context *context)
 	}
 }
 
-void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *operator)
+//ssg is a constant at each call site so the SSG-EG handling is compiled out of the copies used for
+//channels that have no operators in SSG-EG mode
+static inline void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *operator, uint8_t ssg)
 {
 	uint32_t env_cyc = context->env_counter;
 	uint8_t rate;
@@ -469,7 +451,7 @@ void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *
 				operator->env_phase = PHASE_DECAY;
 			}
 		} else {
-			if (operator->ssg) {
+			if (ssg && operator->ssg) {
 				if (operator->envelope < SSG_CENTER) {
 					envelope_inc *= 4;
 				} else {
@@ -489,7 +471,36 @@ void ym_run_envelope(ym2612_context *context, ym_channel *channel, ym_operator *
 	}
 }
 
-void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
+//Applies the SSG-EG repeat, alternate and hold behavior once the envelope passes the center point
+//and returns the envelope value to use for the operator's output
+static uint16_t ym_run_ssg(ym_operator *operator, ym_channel *chan, uint16_t *phase)
+{
+	uint16_t env = operator->envelope;
+	if (env >= SSG_CENTER) {
+		if (operator->ssg & SSG_ALTERNATE) {
+			if (operator->env_phase != PHASE_RELEASE && (
+				!(operator->ssg & SSG_HOLD) || ((operator->ssg ^ operator->inverted) & SSG_INVERT) == 0
+			)) {
+				operator->inverted ^= SSG_INVERT;
+			}
+		} else if (!(operator->ssg & SSG_HOLD)) {
+			*phase = operator->phase_counter = 0;
+		}
+		if (
+			(operator->env_phase == PHASE_DECAY || operator->env_phase == PHASE_SUSTAIN) 
+			&& !(operator->ssg & SSG_HOLD)
+		) {
+			start_envelope(operator, chan);
+			env = operator->envelope;
+		}
+	}
+	if (operator->inverted) {
+		env = (SSG_CENTER - env) & MAX_ENVELOPE;
+	}
+	return env;
+}
+
+static inline void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op, uint8_t ssg)
 {
 	if (channel != 5 || !context->dac_enable) {
 		//printf("updating operator %d of channel %d\n", op, channel);
@@ -511,30 +522,7 @@ void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
 				mod = (chan->op1_old + operator->output) >> (10-chan->feedback);
 			}
 		}
-		uint16_t env = operator->envelope;
-		if (operator->ssg) {
-			if (env >= SSG_CENTER) {
-				if (operator->ssg & SSG_ALTERNATE) {
-					if (operator->env_phase != PHASE_RELEASE && (
-						!(operator->ssg & SSG_HOLD) || ((operator->ssg ^ operator->inverted) & SSG_INVERT) == 0
-					)) {
-						operator->inverted ^= SSG_INVERT;
-					}
-				} else if (!(operator->ssg & SSG_HOLD)) {
-					phase = operator->phase_counter = 0;
-				}
-				if (
-					(operator->env_phase == PHASE_DECAY || operator->env_phase == PHASE_SUSTAIN) 
-					&& !(operator->ssg & SSG_HOLD)
-				) {
-					start_envelope(operator, chan);
-					env = operator->envelope;
-				}
-			}
-			if (operator->inverted) {
-				env = (SSG_CENTER - env) & MAX_ENVELOPE;
-			}
-		}
+		uint16_t env = ssg && operator->ssg ? ym_run_ssg(operator, chan, &phase) : operator->envelope;
 		env += operator->total_level;
 		if (operator->am) {
 			uint16_t base_am = (context->lfo_am_step & 0x80 ? context->lfo_am_step : ~context->lfo_am_step) & 0x7E;
@@ -547,7 +535,7 @@ void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
 		if (env > MAX_ENVELOPE) {
 			env = MAX_ENVELOPE;
 		}
-		if (first_key_on) {
+		if (context->first_key_on) {
 			dfprintf(debug_file, "op %d, base phase: %d, mod: %d, sine: %d, out: %d\n", op, phase, mod, sine_table[(phase+mod) & 0x1FF], pow_table[sine_table[phase & 0x1FF] + env]);
 		}
 		//if ((channel != 0 && channel != 4) || chan->algorithm != 5) {
@@ -577,7 +565,7 @@ void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
 				}
 				chan->output = output;
 			}
-			if (first_key_on) {
+			if (context->first_key_on) {
 				int16_t value = context->channels[channel].output & 0x3FE0;
 				if (value & 0x2000) {
 					value |= 0xC000;
@@ -591,6 +579,7 @@ void ym_run_phase(ym2612_context *context, uint32_t channel, uint32_t op)
 void ym_output_sample(ym2612_context *context)
 {
 	int16_t left = 0, right = 0;
+	int16_t offset = (context->zero_offset * context->volume_mult) / context->volume_div;
 	for (int i = 0; i < NUM_CHANNELS; i++) {
 		int16_t value = context->channels[i].output;
 		if (value > 0x1FE0) {
@@ -608,32 +597,121 @@ void ym_output_sample(ym2612_context *context)
 		} else {
 			value -= context->zero_offset;
 		}
-		if (context->channels[i].logfile) {
-			fwrite(&value, sizeof(value), 1, context->channels[i].logfile);
-		}
-		if (context->channels[i].lr & 0x80) {
-			left += (value * context->volume_mult) / context->volume_div;
-		} else if (context->zero_offset) {
-			if (value >= 0) {
-				left += (context->zero_offset * context->volume_mult) / context->volume_div;
+		//frames that are run again or only run ahead don't end up in captures or logs either
+		if (context->stems && !context->audio->discard) {
+			if (i == 5) {
+				//the DAC replaces channel 6 so only one of their stems gets its output
+				stem_put(context->stems, i, context->dac_enable ? 0 : value);
+				stem_put(context->stems, YM_DAC_STEM, context->dac_enable ? value : 0);
 			} else {
-				left -= (context->zero_offset * context->volume_mult) / context->volume_div;
+				stem_put(context->stems, i, value);
 			}
 		}
+		//a muted side still gets the zero offset for the sign of the channel output
+		int16_t scaled = (value * context->volume_mult) / context->volume_div;
+		int16_t muted = value >= 0 ? offset : -offset;
+		if (context->channels[i].lr & 0x80) {
+			left += scaled;
+		} else {
+			left += muted;
+		}
 		if (context->channels[i].lr & 0x40) {
-			right += (value * context->volume_mult) / context->volume_div;
-		} else if (context->zero_offset) {
-			if (value >= 0) {
-				right += (context->zero_offset * context->volume_mult) / context->volume_div;
+			right += scaled;
+		} else {
+			right += muted;
+		}
+	}
+	render_put_stereo_sample(context->audio, left, right);
+}
+
+//A channel that is keyed off and fully decayed outputs silence no matter what its
+//phase is so only its phase counters need to be advanced
+static uint8_t ym_channel_silent(ym2612_context *context, uint32_t channel)
+{
+	ym_channel *chan = context->channels + channel;
+	if (chan->output || chan->op1_old || chan->op2_old || chan->ssg_ops) {
+		return 0;
+	}
+	for (uint32_t op = channel * 4; op < (channel + 1) * 4; op++)
+	{
+		ym_operator *operator = context->operators + op;
+		if (
+			operator->env_phase != PHASE_RELEASE || operator->envelope != MAX_ENVELOPE
+			|| operator->output
+		) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static inline void ym_run_sample_op(ym2612_context *context, uint32_t channel, uint32_t op, uint32_t env_start, uint16_t env_counter, uint8_t ssg)
+{
+	uint32_t env_slot = (op + NUM_OPERATORS - env_start) % NUM_OPERATORS;
+	if (env_slot >= 8) {
+		ym_run_phase(context, channel, op, ssg);
+		return;
+	}
+	ym_channel *chan = context->channels + channel;
+	context->env_counter = env_counter + (env_start + env_slot >= NUM_OPERATORS);
+	if (env_slot * 3 <= op) {
+		ym_run_envelope(context, chan, context->operators + op, ssg);
+		ym_run_phase(context, channel, op, ssg);
+	} else {
+		ym_run_phase(context, channel, op, ssg);
+		ym_run_envelope(context, chan, context->operators + op, ssg);
+	}
+}
+
+//unrolled so the operator position within the channel is a constant in each copy of ym_run_phase
+static inline void ym_run_sample_channel(ym2612_context *context, uint32_t channel, uint32_t env_start, uint16_t env_counter, uint8_t ssg)
+{
+	ym_run_sample_op(context, channel, channel * 4, env_start, env_counter, ssg);
+	ym_run_sample_op(context, channel, channel * 4 + 1, env_start, env_counter, ssg);
+	ym_run_sample_op(context, channel, channel * 4 + 2, env_start, env_counter, ssg);
+	ym_run_sample_op(context, channel, channel * 4 + 3, env_start, env_counter, ssg);
+}
+
+//Runs whole output samples at a time so the per-tick bookkeeping in ym_run is only done once per sample
+//The envelope generator visits 8 operators per sample, one every 3 ticks starting at current_env_op,
+//and an operator's envelope and phase updates only interact with each other so each operator is
+//updated in the same order relative to its own envelope update as in the per-tick loop
+static void ym_run_samples(ym2612_context *context, uint32_t samples)
+{
+	for (; samples; samples--)
+	{
+		ym_run_lfo(context);
+		uint32_t env_start = context->current_env_op;
+		uint16_t env_counter = context->env_counter;
+		for (uint32_t channel = 0; channel < NUM_CHANNELS; channel++)
+		{
+			if (ym_channel_silent(context, channel)) {
+				//envelope updates can't change anything here either
+				if (channel != 5 || !context->dac_enable) {
+					for (uint32_t op = channel * 4; op < (channel + 1) * 4; op++)
+					{
+						context->operators[op].phase_counter += context->operators[op].phase_inc;
+					}
+				}
+				continue;
+			}
+			if (context->channels[channel].ssg_ops) {
+				ym_run_sample_channel(context, channel, env_start, env_counter, 1);
 			} else {
-				right -= (context->zero_offset * context->volume_mult) / context->volume_div;
+				ym_run_sample_channel(context, channel, env_start, env_counter, 0);
 			}
 		}
+		context->current_env_op = env_start + 8;
+		context->env_counter = env_counter;
+		if (context->current_env_op >= NUM_OPERATORS) {
+			context->current_env_op -= NUM_OPERATORS;
+			context->env_counter++;
+		}
+		ym_output_sample(context);
 	}
-	render_put_stereo_sample(context->audio, left, right);
 }
 
-void ym_run(ym2612_context * context, uint32_t to_cycle)
+static void ym_synthesize(ym2612_context * context, uint32_t to_cycle)
 {
 	if (context->current_cycle >= to_cycle) {
 		return;
@@ -641,16 +719,28 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 	//printf("Running YM2612 from cycle %d to cycle %d\n", context->current_cycle, to_cycle);
 	//TODO: Fix channel update order OR remap channels in register write
 	for (; context->current_cycle < to_cycle; context->current_cycle += context->clock_inc) {
-		//Update timers at beginning of 144 cycle period
 		if (!context->current_op) {
-			ym_run_timers(context);
+			//run as many whole samples as possible before falling back to single operator updates
+			uint32_t ticks = (to_cycle - context->current_cycle + context->clock_inc - 1) / context->clock_inc;
+			uint32_t samples = ticks / NUM_OPERATORS;
+			if (samples) {
+				ym_run_samples(context, samples);
+				context->current_cycle += samples * NUM_OPERATORS * context->clock_inc;
+				if (context->current_cycle >= to_cycle) {
+					break;
+				}
+			}
+		}
+		//Update LFO at beginning of 144 cycle period
+		if (!context->current_op) {
+			ym_run_lfo(context);
 		}
 		//Update Envelope Generator
 		if (!(context->current_op % 3)) {
 			uint32_t op = context->current_env_op;
 			ym_operator * operator = context->operators + op;
 			ym_channel * channel = context->channels + op/4;
-			ym_run_envelope(context, channel, operator);
+			ym_run_envelope(context, channel, operator, channel->ssg_ops != 0);
 			context->current_env_op++;
 			if (context->current_env_op == NUM_OPERATORS) {
 				context->current_env_op = 0;
@@ -659,7 +749,7 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 		}
 
 		//Update Phase Generator
-		ym_run_phase(context, context->current_op / 4, context->current_op);
+		ym_run_phase(context, context->current_op / 4, context->current_op, context->channels[context->current_op / 4].ssg_ops != 0);
 		context->current_op++;
 		if (context->current_op == NUM_OPERATORS) {
 			context->current_op = 0;
@@ -670,6 +760,57 @@ void ym_run(ym2612_context * context, uint32_t to_cycle)
 	//printf("Done running YM2612 at cycle %d\n", context->current_cycle, to_cycle);
 }
 
+static void ym_apply_write(ym2612_context *context, ym_queued_write *write);
+
+//Synthesizes up to to_cycle, applying queued writes as synthesis reaches them
+static void ym_run_queue(ym2612_context *context, uint32_t to_cycle)
+{
+	for (;;)
+	{
+		ym_queued_write *next = context->queue_pos < context->queue_len ? context->queue + context->queue_pos : NULL;
+		ym_synthesize(context, next && next->cycle < to_cycle ? next->cycle : to_cycle);
+		if (!next || next->cycle > context->current_cycle) {
+			break;
+		}
+		ym_apply_write(context, next);
+		context->queue_pos++;
+	}
+	if (context->queue_pos == context->queue_len) {
+		context->queue_pos = context->queue_len = 0;
+	}
+}
+
+static void ym_queue(ym2612_context *context, uint32_t cycle, uint8_t type, uint8_t reg, uint8_t value)
+{
+	if (context->queue_len == YM_QUEUE_SIZE) {
+		//everything in the queue is at or before cycle so this empties it
+		ym_run_queue(context, cycle);
+	}
+	ym_queued_write *write = context->queue + context->queue_len++;
+	write->cycle = cycle;
+	write->type = type;
+	write->reg = reg;
+	write->value = value;
+}
+
+void ym_run(ym2612_context * context, uint32_t to_cycle)
+{
+	ym_advance_timers(context, to_cycle);
+	ym_run_queue(context, to_cycle);
+}
+
+//Runs the chip up to to_cycle as far as the rest of the system can observe, i.e. the timers
+//and status register, but only synthesizes once the audio output needs more samples
+//Register writes made after this are queued and applied when synthesis reaches them
+void ym_advance(ym2612_context *context, uint32_t to_cycle)
+{
+	ym_advance_timers(context, to_cycle);
+	uint32_t pending = (context->run_cycle - context->current_cycle) / (NUM_OPERATORS * context->clock_inc);
+	if (pending && pending >= render_audio_samples_until_sync(context->audio)) {
+		ym_run_queue(context, context->run_cycle);
+	}
+}
+
 void ym_address_write_part1(ym2612_context * context, uint8_t address)
 {
 	//printf("address_write_part1: %X\n", address);
@@ -790,6 +931,7 @@ static uint32_t ym_calc_phase_inc(ym2612_context * context, ym_operator * operat
 
 void ym_vgm_log(ym2612_context *context, uint32_t master_clock, vgm_writer *vgm)
 {
+	ym_run(context, context->run_cycle);
 	vgm_ym2612_init(vgm, 6 * master_clock / context->clock_inc);
 	context->vgm = vgm;
 	for (uint8_t reg = YM_PART1_START; reg < YM_REG_END; reg++) {
@@ -809,10 +951,83 @@ void ym_vgm_log(ym2612_context *context, uint32_t master_clock, vgm_writer *vgm)
 	}
 }
 
+//Starts capturing the output of each channel to ym_channel_N.wav and the DAC to ym_dac.wav
+void ym_start_stems(ym2612_context *context, uint32_t master_clock)
+{
+	if (context->stems) {
+		return;
+	}
+	char names[YM_NUM_STEMS][32];
+	char *filenames[YM_NUM_STEMS];
+	for (int i = 0; i < YM_NUM_STEMS; i++)
+	{
+		if (i == YM_DAC_STEM) {
+			strcpy(names[i], "ym_dac.wav");
+		} else {
+			sprintf(names[i], "ym_channel_%d.wav", i);
+		}
+		filenames[i] = names[i];
+	}
+	context->stems = stem_capture_start(filenames, YM_NUM_STEMS, master_clock / (context->clock_inc * NUM_OPERATORS), 1, &context->stems);
+}
+
+void ym_stop_stems(ym2612_context *context)
+{
+	if (!context->stems) {
+		return;
+	}
+	//queued writes still need to be synthesized into the stems
+	ym_run(context, context->run_cycle);
+	stem_capture_stop(context->stems);
+	context->stems = NULL;
+}
+
+//Timer registers take effect immediately since the timers run ahead of synthesis
+static void ym_write_timer_reg(ym2612_context *context, uint8_t reg, uint8_t value)
+{
+	switch (reg)
+	{
+	case REG_TIMERA_HIGH:
+		context->timer_a_load &= 0x3;
+		context->timer_a_load |= value << 2;
+		break;
+	case REG_TIMERA_LOW:
+		context->timer_a_load &= 0xFFFC;
+		context->timer_a_load |= value & 0x3;
+		break;
+	case REG_TIMERB:
+		context->timer_b_load = value;
+		break;
+	case REG_TIME_CTRL:
+		if (value & BIT_TIMERA_ENABLE && !(context->timer_control & BIT_TIMERA_ENABLE)) {
+			context->timer_a = TIMER_A_MAX;
+			context->timer_control |= BIT_TIMERA_LOAD;
+		}
+		if (value & BIT_TIMERB_ENABLE && !(context->timer_control & BIT_TIMERB_ENABLE)) {
+			context->timer_b = TIMER_B_MAX;
+			context->timer_control |= BIT_TIMERB_LOAD;
+		}
+		context->timer_control &= (BIT_TIMERA_LOAD | BIT_TIMERB_LOAD);
+		context->timer_control |= value & 0xF;
+		if (value & BIT_TIMERA_RESET) {
+			context->status &= ~BIT_STATUS_TIMERA;
+		}
+		if (value & BIT_TIMERB_RESET) {
+			context->status &= ~BIT_STATUS_TIMERB;
+		}
+		if (context->timer_ch3_mode == CSM_MODE && (value & 0xC0) != CSM_MODE) {
+			context->timer_csm_keyon = 0;
+		}
+		context->timer_ch3_mode = value & 0xC0;
+		break;
+	}
+}
+
 void ym_data_write(ym2612_context * context, uint8_t value)
 {
-	context->write_cycle = context->current_cycle;
-	context->busy_start = context->current_cycle + context->clock_inc;
+	uint32_t cycle = context->run_cycle;
+	context->write_cycle = cycle;
+	context->busy_start = cycle + context->clock_inc;
 	
 	if (context->selected_reg >= YM_REG_END) {
 		return;
@@ -821,25 +1036,54 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 		if (context->selected_reg < YM_PART2_START) {
 			return;
 		}
-		if (context->vgm) {
-			vgm_ym2612_part2_write(context->vgm, context->current_cycle, context->selected_reg, value);
+		if (context->vgm && !context->audio->discard) {
+			vgm_ym2612_part2_write(context->vgm, cycle, context->selected_reg, value);
 		}
-		context->part2_regs[context->selected_reg - YM_PART2_START] = value;
 	} else {
 		if (context->selected_reg < YM_PART1_START) {
 			return;
 		}
-		if (context->vgm) {
-			vgm_ym2612_part1_write(context->vgm, context->current_cycle, context->selected_reg, value);
+		if (context->vgm && !context->audio->discard) {
+			vgm_ym2612_part1_write(context->vgm, cycle, context->selected_reg, value);
 		}
-		context->part1_regs[context->selected_reg - YM_PART1_START] = value;
 	}
 	uint8_t buffer[3] = {context->selected_part, context->selected_reg, value};
-	event_log(EVENT_YM_REG, context->current_cycle, sizeof(buffer), buffer);
-	dfprintf(debug_file, "write of %X to reg %X in part %d\n", value, context->selected_reg, context->selected_part+1);
-	if (context->selected_reg < 0x30) {
+	event_log(EVENT_YM_REG, cycle, sizeof(buffer), buffer);
+	if (!context->selected_part && context->selected_reg >= REG_TIMERA_HIGH && context->selected_reg <= REG_TIME_CTRL) {
+		ym_write_timer_reg(context, context->selected_reg, value);
+	}
+	ym_queue(context, cycle, context->selected_part ? YM_QUEUE_PART2 : YM_QUEUE_PART1, context->selected_reg, value);
+}
+
+static void ym_apply_write(ym2612_context *context, ym_queued_write *write)
+{
+	if (write->type == YM_QUEUE_CSM_KEYON) {
+		context->csm_keyon = 0xF0;
+		uint8_t changes = 0xF0 ^ context->channels[2].keyon;;
+		for (uint8_t op = 2*4, bit = 0; op < 3*4; op++, bit++)
+		{
+			if (changes & keyon_bits[bit]) {
+				keyon(context->operators + op, context->channels + 2);
+			}
+		}
+		return;
+	}
+	if (write->type == YM_QUEUE_CSM_KEYOFF) {
+		csm_keyoff(context);
+		return;
+	}
+	uint8_t part = write->type == YM_QUEUE_PART2;
+	uint8_t reg = write->reg;
+	uint8_t value = write->value;
+	if (part) {
+		context->part2_regs[reg - YM_PART2_START] = value;
+	} else {
+		context->part1_regs[reg - YM_PART1_START] = value;
+	}
+	dfprintf(debug_file, "write of %X to reg %X in part %d\n", value, reg, part+1);
+	if (reg < 0x30) {
 		//Shared regs
-		switch (context->selected_reg)
+		switch (reg)
 		{
 		//TODO: Test reg
 		case REG_LFO:
@@ -864,35 +1108,8 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 			}
 			context->lfo_freq = value & 0x7;
 
-			break;
-		case REG_TIMERA_HIGH:
-			context->timer_a_load &= 0x3;
-			context->timer_a_load |= value << 2;
-			break;
-		case REG_TIMERA_LOW:
-			context->timer_a_load &= 0xFFFC;
-			context->timer_a_load |= value & 0x3;
-			break;
-		case REG_TIMERB:
-			context->timer_b_load = value;
 			break;
 		case REG_TIME_CTRL: {
-			if (value & BIT_TIMERA_ENABLE && !(context->timer_control & BIT_TIMERA_ENABLE)) {
-				context->timer_a = TIMER_A_MAX;
-				context->timer_control |= BIT_TIMERA_LOAD;
-			}
-			if (value & BIT_TIMERB_ENABLE && !(context->timer_control & BIT_TIMERB_ENABLE)) {
-				context->timer_b = TIMER_B_MAX;
-				context->timer_control |= BIT_TIMERB_LOAD;
-			}
-			context->timer_control &= (BIT_TIMERA_LOAD | BIT_TIMERB_LOAD);
-			context->timer_control |= value & 0xF;
-			if (value & BIT_TIMERA_RESET) {
-				context->status &= ~BIT_STATUS_TIMERA;
-			}
-			if (value & BIT_TIMERB_RESET) {
-				context->status &= ~BIT_STATUS_TIMERB;
-			}
 			if (context->ch3_mode == CSM_MODE && (value & 0xC0) != CSM_MODE && context->csm_keyon) {
 				csm_keyoff(context);
 			}
@@ -919,7 +1136,7 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 				for (uint8_t op = channel * 4, bit = 0; op < (channel + 1) * 4; op++, bit++) {
 					if (changes & keyon_bits[bit]) {
 						if (value & keyon_bits[bit]) {
-							first_key_on = 1;
+							context->first_key_on = 1;
 							//printf("Key On for operator %d in channel %d\n", op, channel);
 							keyon(context->operators + op, context->channels + channel);
 						} else {
@@ -942,15 +1159,15 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 			context->dac_enable = value & 0x80;
 			break;
 		}
-	} else if (context->selected_reg < 0xA0) {
+	} else if (reg < 0xA0) {
 		//part
-		uint8_t op = context->selected_part ? (NUM_OPERATORS/2) : 0;
+		uint8_t op = part ? (NUM_OPERATORS/2) : 0;
 		//channel in part
-		if ((context->selected_reg & 0x3) != 0x3) {
-			op += 4 * (context->selected_reg & 0x3) + ((context->selected_reg & 0xC) / 4);
+		if ((reg & 0x3) != 0x3) {
+			op += 4 * (reg & 0x3) + ((reg & 0xC) / 4);
 			//printf("write targets operator %d (%d of channel %d)\n", op, op % 4, op / 4);
 			ym_operator * operator = context->operators + op;
-			switch (context->selected_reg & 0xF0)
+			switch (reg & 0xF0)
 			{
 			case REG_DETUNE_MULT:
 				operator->detune = value >> 4 & 0x7;
@@ -986,17 +1203,22 @@ void ym_data_write(ym2612_context * context, uint8_t value)
 					operator->inverted ^= SSG_INVERT;
 				}
 				operator->ssg = value;
+				if (value) {
+					context->channels[op / 4].ssg_ops |= 1 << (op & 3);
+				} else {
+					context->channels[op / 4].ssg_ops &= ~(1 << (op & 3));
+				}
 				break;
 			}
 		}
 	} else {
-		uint8_t channel = context->selected_reg & 0x3;
+		uint8_t channel = reg & 0x3;
 		if (channel != 3) {
-			if (context->selected_part) {
+			if (part) {
 				channel += 3;
 			}
 			//printf("write targets channel %d\n", channel);
-			switch (context->selected_reg & 0xFC)
+			switch (reg & 0xFC)
 			{
 			case REG_FNUM_LOW:
 				context->channels[channel].block = context->channels[channel].block_fnum_latch >> 3 & 0x7;
@@ -1187,6 +1409,7 @@ uint8_t ym_read_status(ym2612_context * context, uint32_t cycle, uint32_t port)
 
 void ym_print_channel_info(ym2612_context *context, int channel)
 {
+	ym_run(context, context->run_cycle);
 	ym_channel *chan = context->channels + channel;
 	printf("\n***Channel %d***\n"
 	       "Algorithm: %d\n"
@@ -1253,6 +1476,7 @@ void ym_print_timer_info(ym2612_context *context)
 
 void ym_serialize(ym2612_context *context, serialize_buffer *buf)
 {
+	ym_run(context, context->run_cycle);
 	save_buffer8(buf, context->part1_regs, YM_PART1_REGS);
 	save_buffer8(buf, context->part2_regs, YM_PART2_REGS);
 	for (int i = 0; i < NUM_OPERATORS; i++)
@@ -1304,13 +1528,15 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 {
 	ym2612_context *context = vcontext;
 	uint8_t temp_regs[YM_PART1_REGS];
+	//pending writes are superseded by the loaded state
+	context->queue_pos = context->queue_len = 0;
 	load_buffer8(buf, temp_regs, YM_PART1_REGS);
 	context->selected_part = 0;
 	for (int i = 0; i < YM_PART1_REGS; i++)
 	{
 		uint8_t reg = YM_PART1_START + i;
 		if (reg == REG_TIME_CTRL) {
-			context->ch3_mode = temp_regs[i] & 0xC0;
+			context->ch3_mode = context->timer_ch3_mode = temp_regs[i] & 0xC0;
 		} else if (reg != REG_FNUM_LOW && reg != REG_KEY_ONOFF) {
 			context->selected_reg = reg;
 			ym_data_write(context, temp_regs[i]);
@@ -1326,6 +1552,11 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 			ym_data_write(context, temp_regs[i]);
 		}
 	}
+	for (; context->queue_pos < context->queue_len; context->queue_pos++)
+	{
+		ym_apply_write(context, context->queue + context->queue_pos);
+	}
+	context->queue_pos = context->queue_len = 0;
 	for (int i = 0; i < NUM_OPERATORS; i++)
 	{
 		context->operators[i].phase_counter = load_int32(buf);
@@ -1366,11 +1597,15 @@ void ym_deserialize(deserialize_buffer *buf, void *vcontext)
 		context->current_env_op = 0;
 	}
 	context->lfo_counter = load_int8(buf);
-	context->csm_keyon = load_int8(buf);
+	context->csm_keyon = context->timer_csm_keyon = load_int8(buf);
 	context->status = load_int8(buf);
 	context->selected_reg = load_int8(buf);
 	context->selected_part = load_int8(buf);
-	context->current_cycle = load_int32(buf);
+	context->current_cycle = context->run_cycle = load_int32(buf);
+	context->timer_cycle = context->current_cycle;
+	if (context->current_op) {
+		context->timer_cycle += (NUM_OPERATORS - context->current_op) * context->clock_inc;
+	}
 	context->write_cycle = load_int32(buf);
 	context->busy_start = load_int32(buf);
 	if (buf->size > buf->cur_pos) {
@@ -11,6 +11,7 @@
 #include "serialize.h"
 #include "render_audio.h"
 #include "vgm.h"
+#include "stem.h"
 
 #define NUM_PART_REGS (0xB7-0x30)
 #define NUM_CHANNELS 6
@@ -38,7 +39,6 @@ typedef struct {
 } ym_operator;
 
 typedef struct {
-	FILE *   logfile;
 	uint16_t fnum;
 	int16_t  output;
 	int16_t  op1_old;
@@ -52,6 +52,7 @@ typedef struct {
 	uint8_t  pms;
 	uint8_t  lr;
 	uint8_t  keyon;
+	uint8_t  ssg_ops; //operators with SSG-EG enabled, channels with any are run through the slower SSG-EG path
 } ym_channel;
 
 typedef struct {
@@ -67,11 +68,35 @@ typedef struct {
 #define YM_PART1_REGS (YM_REG_END-YM_PART1_START)
 #define YM_PART2_REGS (YM_REG_END-YM_PART2_START)
 
+//pending register writes and CSM key events waiting for synthesis to catch up to them
+#define YM_QUEUE_SIZE 1024
+
+//channel capture has a stem for each FM channel followed by one for the DAC
+#define YM_DAC_STEM NUM_CHANNELS
+#define YM_NUM_STEMS (NUM_CHANNELS + 1)
+
+enum {
+	YM_QUEUE_PART1,
+	YM_QUEUE_PART2,
+	YM_QUEUE_CSM_KEYON,
+	YM_QUEUE_CSM_KEYOFF
+};
+
+typedef struct {
+	uint32_t cycle;
+	uint8_t  type;
+	uint8_t  reg;
+	uint8_t  value;
+} ym_queued_write;
+
 typedef struct {
 	audio_source *audio;
 	vgm_writer  *vgm;
+	stem_capture *stems;
     uint32_t    clock_inc;
 	uint32_t    current_cycle;
+	uint32_t    run_cycle;   //cycle the chip has been run to, synthesis at current_cycle can lag behind it
+	uint32_t    timer_cycle; //start of the next sample period whose timer update has not been run
 	uint32_t    write_cycle;
 	uint32_t    busy_start;
 	uint32_t    busy_cycles;
@@ -106,8 +131,15 @@ typedef struct {
 	uint8_t     last_status;
 	uint8_t     selected_reg;
 	uint8_t     selected_part;
+	uint8_t     first_key_on; //debug output starts at the first key on
 	uint8_t     part1_regs[YM_PART1_REGS];
 	uint8_t     part2_regs[YM_PART2_REGS];
+	//timers run ahead of synthesis so they keep their own copy of the CSM state
+	uint8_t     timer_csm_keyon;
+	uint8_t     timer_ch3_mode;
+	uint16_t    queue_pos;
+	uint16_t    queue_len;
+	ym_queued_write queue[YM_QUEUE_SIZE];
 } ym2612_context;
 
 enum {
@@ -143,10 +175,13 @@ void ym_enable_zero_offset(ym2612_context *context, uint8_t enabled);
 void ym_adjust_master_clock(ym2612_context * context, uint32_t master_clock);
 void ym_adjust_cycles(ym2612_context *context, uint32_t deduction);
 void ym_run(ym2612_context * context, uint32_t to_cycle);
+void ym_advance(ym2612_context *context, uint32_t to_cycle);
 void ym_address_write_part1(ym2612_context * context, uint8_t address);
 void ym_address_write_part2(ym2612_context * context, uint8_t address);
 void ym_data_write(ym2612_context * context, uint8_t value);
 void ym_vgm_log(ym2612_context *context, uint32_t master_clock, vgm_writer *vgm);
+void ym_start_stems(ym2612_context *context, uint32_t master_clock);
+void ym_stop_stems(ym2612_context *context);
 uint8_t ym_read_status(ym2612_context * context, uint32_t cycle, uint32_t port);
 uint8_t ym_load_gst(ym2612_context * context, FILE * gstfile);
 uint8_t ym_save_gst(ym2612_context * context, FILE * gstfile);
@@ -17,6 +17,12 @@
 #define MAX_MCYCLE_LENGTH 6
 #define NATIVE_CHUNK_SIZE 1024
 #define NATIVE_MAP_CHUNKS (0x10000 / NATIVE_CHUNK_SIZE)
+//values for the interp argument of translate_z80inst
+#define Z80_TRANS_NORMAL 0
+#define Z80_TRANS_INTERP 1
+#define Z80_TRANS_SUPERBLOCK 2
+//maximum number of instructions covered by a single superblock cycle check
+#define Z80_MAX_SUPERBLOCK 32
 
 //#define DO_DEBUG_PRINT
 
@@ -27,6 +33,7 @@
 #endif
 
 uint32_t zbreakpoint_patch(z80_context * context, uint16_t address, code_ptr dst);
+void zcreate_stub(z80_context * context);
 void z80_handle_deferred(z80_context * context);
 
 uint8_t z80_size(z80inst * inst)
@@ -331,11 +338,15 @@ void translate_z80inst(z80inst * inst, z80_context * context, uint16_t address,
 	z80_options *opts = context->options;
 	uint8_t * start = opts->gen.code.cur;
 	code_info *code = &opts->gen.code;
-	if (!interp) {
-		check_cycles_int(&opts->gen, address);
-		if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
-			zbreakpoint_patch(context, address, start);
+	if (interp != Z80_TRANS_INTERP) {
+		//the cycle check for superblock instructions is done once at the start of the block
+		if (interp != Z80_TRANS_SUPERBLOCK) {
+			check_cycles_int(&opts->gen, address);
+			if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
+				zbreakpoint_patch(context, address, start);
+			}
 		}
+		profile_count(&opts->gen);
 		num_cycles = 4 * inst->opcode_bytes;
 		add_ir(code, inst->opcode_bytes > 1 ? 2 : 1, opts->regs[Z80_R], SZ_B);
 #ifdef Z80_LOG_ADDRESS
@@ -2847,7 +2858,7 @@ uint8_t * z80_interp_handler(uint8_t opcode, z80_context * context)
 		code_info *code = &opts->gen.code;
 		check_alloc_code(code, ZMAX_NATIVE_SIZE);
 		context->interp_code[opcode] = code->cur;
-		translate_z80inst(&inst, context, 0, 1);
+		translate_z80inst(&inst, context, 0, Z80_TRANS_INTERP);
 		mov_rdispr(code, opts->gen.context_reg, offsetof(z80_context, pc), opts->gen.scratch1, SZ_W);
 		add_ir(code, after - codebuf, opts->gen.scratch1, SZ_W);
 		call(code, opts->native_addr);
@@ -2918,14 +2929,14 @@ uint8_t z80_get_native_inst_size(z80_options * opts, uint32_t address)
 void z80_map_native_address(z80_context * context, uint32_t address, uint8_t * native_address, uint8_t size, uint8_t native_size)
 {
 	z80_options * opts = context->options;
+	account_translated_code(&opts->gen, native_size);
 	uint32_t meta_off;
 	memmap_chunk const *mem_chunk = find_map_chunk(address, &opts->gen, MMAP_CODE, &meta_off);
 	if (mem_chunk) {
 		if (mem_chunk->flags & MMAP_CODE) {
 			uint32_t masked = (address & mem_chunk->mask);
 			uint32_t final_off = masked + meta_off;
-			uint32_t ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			flag_code_page(&opts->gen, context->ram_code_flags, final_off);
 
 			uint32_t slot = final_off / 1024;
 			if (!opts->gen.ram_inst_sizes[slot]) {
@@ -2936,8 +2947,7 @@ void z80_map_native_address(z80_context * context, uint32_t address, uint8_t * n
 			//TODO: Deal with case in which end of instruction is in a different memory chunk
 			masked = (address + size - 1) & mem_chunk->mask;
 			final_off = masked + meta_off;
-			ram_flags_off = final_off >> (opts->gen.ram_flags_shift + 3);
-			context->ram_code_flags[ram_flags_off] |= 1 << ((final_off >> opts->gen.ram_flags_shift) & 7);
+			flag_code_page(&opts->gen, context->ram_code_flags, final_off);
 		}
 		//calculate the lowest alias for this address
 		address = mem_chunk->start + ((address - mem_chunk->start) & mem_chunk->mask);
@@ -2997,21 +3007,38 @@ uint32_t z80_get_instruction_start(z80_context *context, uint32_t address)
 	return address;
 }
 
-//Technically unbounded due to redundant prefixes, but this is the max useful size
-#define Z80_MAX_INST_SIZE 4
+static void z80_patch_for_retranslate(z80_context *context, uint32_t inst_start)
+{
+	z80_options * opts = context->options;
+	code_ptr dst = z80_get_native_address(context, inst_start);
+	code_info code = {dst, dst+32, 0};
+	dprintf("patching code at %p for Z80 instruction at %X\n", code.cur, inst_start);
+	mov_ir(&code, inst_start, opts->gen.scratch1, SZ_D);
+	call(&code, opts->retrans_stub);
+}
 
 z80_context * z80_handle_code_write(uint32_t address, z80_context * context)
 {
-	uint32_t inst_start = z80_get_instruction_start(context, address);
-	while (inst_start != INVALID_INSTRUCTION_START && (address - inst_start) < Z80_MAX_INST_SIZE) {
-		code_ptr dst = z80_get_native_address(context, inst_start);
-		code_info code = {dst, dst+32, 0};
-		z80_options * opts = context->options;
-		dprintf("patching code at %p for Z80 instruction at %X due to write to %X\n", code.cur, inst_start, address);
-		mov_ir(&code, inst_start, opts->gen.scratch1, SZ_D);
-		call(&code, opts->retrans_stub);
-		inst_start = z80_get_instruction_start(context, inst_start - 1);
+	z80_options * opts = context->options;
+	uint32_t page = code_page_index(&opts->gen, address);
+	if (!code_page_flagged(&opts->gen, context->ram_code_flags, page)) {
+		//nothing has been translated in this page since it was last invalidated
+		return context;
+	}
+	if (z80_get_instruction_start(context, address) == INVALID_INSTRUCTION_START) {
+		//data that shares a page with code doesn't affect any translated instructions
+		return context;
 	}
+	dprintf("invalidating Z80 code page %d due to write to %X\n", page, address);
+	uint32_t page_size = 1 << opts->gen.ram_flags_shift;
+	uint32_t page_start = address & ~(page_size - 1);
+	//an instruction that starts in the previous page may extend into this one
+	uint32_t inst_start = z80_get_instruction_start(context, page_start);
+	if (inst_start != INVALID_INSTRUCTION_START && inst_start != page_start) {
+		z80_patch_for_retranslate(context, inst_start);
+	}
+	z80_invalidate_code_range(context, page_start, page_start + page_size);
+	code_page_invalidated(&opts->gen, context->ram_code_flags, page, context->current_cycle);
 	return context;
 }
 
@@ -3024,13 +3051,14 @@ void z80_invalidate_code_range(z80_context *context, uint32_t start, uint32_t en
 		//calculate the lowest alias for this address
 		start = mem_chunk->start + ((start - mem_chunk->start) & mem_chunk->mask);
 	}
-	mem_chunk = find_map_chunk(end, &opts->gen, 0, NULL);
+	//end is exclusive so use the alias of the last byte in the range
+	mem_chunk = find_map_chunk(end - 1, &opts->gen, 0, NULL);
 	if (mem_chunk) {
 		//calculate the lowest alias for this address
-		end = mem_chunk->start + ((end - mem_chunk->start) & mem_chunk->mask);
+		end = mem_chunk->start + ((end - 1 - mem_chunk->start) & mem_chunk->mask) + 1;
 	}
 	uint32_t start_chunk = start / NATIVE_CHUNK_SIZE, end_chunk = end / NATIVE_CHUNK_SIZE;
-	for (uint32_t chunk = start_chunk; chunk <= end_chunk; chunk++)
+	for (uint32_t chunk = start_chunk; chunk <= end_chunk && chunk < NATIVE_MAP_CHUNKS; chunk++)
 	{
 		if (native_code_map[chunk].base) {
 			uint32_t start_offset = chunk == start_chunk ? start % NATIVE_CHUNK_SIZE : 0;
@@ -3038,12 +3066,7 @@ void z80_invalidate_code_range(z80_context *context, uint32_t start, uint32_t en
 			for (uint32_t offset = start_offset; offset < end_offset; offset++)
 			{
 				if (native_code_map[chunk].offsets[offset] != INVALID_OFFSET && native_code_map[chunk].offsets[offset] != EXTENSION_WORD) {
-					code_info code;
-					code.cur = native_code_map[chunk].base + native_code_map[chunk].offsets[offset];
-					code.last = code.cur + 32;
-					code.stack_off = 0;
-					mov_ir(&code, chunk * NATIVE_CHUNK_SIZE + offset, opts->gen.scratch1, SZ_D);
-					call(&code, opts->retrans_stub);
+					z80_patch_for_retranslate(context, chunk * NATIVE_CHUNK_SIZE + offset);
 				}
 			}
 		}
@@ -3072,17 +3095,109 @@ void z80_handle_deferred(z80_context * context)
 	}
 }
 
+static uint8_t z80_is_smc_interp(z80_context *context, uint32_t address, uint32_t size)
+{
+	z80_options *opts = context->options;
+	return code_page_interpreted(&opts->gen, address, context->current_cycle)
+		|| code_page_interpreted(&opts->gen, address + size - 1, context->current_cycle);
+}
+
+static code_info z80_make_smc_stub(z80_context * context, uint32_t address)
+{
+	z80_options *opts = context->options;
+	code_info * code = &opts->gen.code;
+	check_code_prologue(code);
+	code_info stub = {code->cur, NULL};
+	mov_ir(code, address, opts->gen.scratch1, SZ_D);
+	jmp(code, opts->smc_stub);
+	stub.last = code->cur;
+	return stub;
+}
+
+//instructions that end a straight-line run of code as far as the block profiler is concerned
+static uint8_t z80_ends_block(z80inst *inst)
+{
+	switch (inst->op)
+	{
+	case Z80_JPCC:
+	case Z80_JRCC:
+	case Z80_DJNZ:
+	case Z80_CALL:
+	case Z80_CALLCC:
+	case Z80_RETCC:
+	case Z80_RST:
+	case Z80_HALT:
+	case Z80_LDIR:
+	case Z80_LDDR:
+	case Z80_CPIR:
+	case Z80_CPDR:
+	case Z80_INIR:
+	case Z80_INDR:
+	case Z80_OTIR:
+	case Z80_OTDR:
+		return 1;
+	default:
+		return z80_is_terminal(inst);
+	}
+}
+
+//Size of the slot an instruction gets when it's retranslated
+static uint8_t z80_max_native_size(z80_options *opts)
+{
+	return ZMAX_NATIVE_SIZE + (opts->gen.profile ? ZPROFILE_NATIVE_SIZE : 0);
+}
+
 extern void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * orig_start) asm("z80_retranslate_inst");
+//Instructions in pages that get modified too often aren't kept in the translation map, they're
+//translated into a small cache that's checked against the instruction bytes on every execution
+uint8_t * z80_smc_interp_handler(uint32_t address, z80_context * context)
+{
+	z80_options *opts = context->options;
+	code_info *code = &opts->gen.code;
+	uint8_t max_size = z80_max_native_size(opts);
+	uint8_t *after, *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+	z80inst instbuf;
+	after = z80_decode(encoded, &instbuf);
+	if (!z80_is_smc_interp(context, address, after-encoded)) {
+		//the page hasn't been modified for a while so this instruction can be cached normally again
+		return z80_retranslate_inst(address, context, z80_get_native_address(context, address));
+	}
+	code_ptr slot;
+	code_ptr native = smc_cache_lookup(&opts->gen, address, encoded, after-encoded, context->current_cycle, max_size + 5, &slot);
+	if (native) {
+		return native;
+	}
+	code_info tmp_code = *code;
+	code->cur = slot;
+	code->last = slot + max_size + 5;
+	translate_z80inst(&instbuf, context, address, 0);
+	code_info buffer = *code;
+	*code = tmp_code;
+	if (!z80_is_terminal(&instbuf)) {
+		jmp(&buffer, z80_get_native_address_trans(context, address + after-encoded));
+	}
+	z80_handle_deferred(context);
+	return slot;
+}
+
 void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * orig_start)
 {
 	char disbuf[80];
 	z80_options * opts = context->options;
 	uint8_t orig_size = z80_get_native_inst_size(opts, address);
+	uint8_t max_size = z80_max_native_size(opts);
 	code_info *code = &opts->gen.code;
 	uint8_t *after, *inst = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
 	z80inst instbuf;
 	dprintf("Retranslating code at Z80 address %X, native address %p\n", address, orig_start);
 	after = z80_decode(inst, &instbuf);
+	if (z80_is_smc_interp(context, address, after-inst)) {
+		code_info stub = z80_make_smc_stub(context, address);
+		z80_map_native_address(context, address, stub.cur, after-inst, stub.last - stub.cur);
+		code_info tmp_code = {orig_start, orig_start + 16};
+		jmp(&tmp_code, stub.cur);
+		return stub.cur;
+	}
 	#ifdef DO_DEBUG_PRINT
 	z80_disasm(&instbuf, disbuf, address);
 	if (instbuf.op == Z80_NOP) {
@@ -3091,11 +3206,13 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 		printf("%X\t%s\n", address, disbuf);
 	}
 	#endif
-	if (orig_size != ZMAX_NATIVE_SIZE) {
-		check_alloc_code(code, ZMAX_NATIVE_SIZE);
+	if (orig_size != max_size) {
+		check_alloc_code(code, max_size);
 		code_ptr start = code->cur;
 		deferred_addr * orig_deferred = opts->gen.deferred;
+		profile_begin(&opts->gen, address);
 		translate_z80inst(&instbuf, context, address, 0);
+		profile_end(&opts->gen, after-inst, code->cur - start, z80_ends_block(&instbuf));
 		/*
 		if ((native_end - dst) <= orig_size) {
 			uint8_t * native_next = z80_get_native_address(context, address + after-inst);
@@ -3113,11 +3230,11 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 				return orig_start;
 			}
 		}*/
-		z80_map_native_address(context, address, start, after-inst, ZMAX_NATIVE_SIZE);
+		z80_map_native_address(context, address, start, after-inst, max_size);
 		code_info tmp_code = {orig_start, orig_start + 16};
 		jmp(&tmp_code, start);
 		tmp_code = *code;
-		code->cur = start + ZMAX_NATIVE_SIZE;
+		code->cur = start + max_size;
 		if (!z80_is_terminal(&instbuf)) {
 			jmp(&tmp_code, z80_get_native_address_trans(context, address + after-inst));
 		}
@@ -3126,10 +3243,14 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 	} else {
 		code_info tmp_code = *code;
 		code->cur = orig_start;
-		code->last = orig_start + ZMAX_NATIVE_SIZE;
+		code->last = orig_start + max_size;
+		profile_begin(&opts->gen, address);
 		translate_z80inst(&instbuf, context, address, 0);
+		profile_end(&opts->gen, after-inst, code->cur - orig_start, z80_ends_block(&instbuf));
 		code_info tmp2 = *code;
 		*code = tmp_code;
+		//the page flag was cleared when this instruction was invalidated
+		flag_code_pages(&opts->gen, context->ram_code_flags, address, after-inst);
 		if (!z80_is_terminal(&instbuf)) {
 
 			jmp(&tmp2, z80_get_native_address_trans(context, address + after-inst));
@@ -3139,6 +3260,188 @@ void * z80_retranslate_inst(uint32_t address, z80_context * context, uint8_t * o
 	}
 }
 
+//Instructions in the body of a superblock can't touch memory, I/O or the interrupt state
+//so nothing they do can move the cycle limit that was checked at the start of the block
+static uint8_t z80_is_superblock_body(z80inst *inst)
+{
+	switch (inst->op)
+	{
+	case Z80_LD:
+	case Z80_EXX:
+	case Z80_ADD:
+	case Z80_ADC:
+	case Z80_SUB:
+	case Z80_SBC:
+	case Z80_AND:
+	case Z80_OR:
+	case Z80_XOR:
+	case Z80_CP:
+	case Z80_INC:
+	case Z80_DEC:
+	case Z80_DAA:
+	case Z80_CPL:
+	case Z80_NEG:
+	case Z80_CCF:
+	case Z80_SCF:
+	case Z80_RLC:
+	case Z80_RL:
+	case Z80_RRC:
+	case Z80_RR:
+	case Z80_SLA:
+	case Z80_SRA:
+	case Z80_SLL:
+	case Z80_SRL:
+	case Z80_BIT:
+	case Z80_SET:
+	case Z80_RES:
+	case Z80_JPCC:
+	case Z80_JRCC:
+	case Z80_DJNZ:
+		break;
+	case Z80_NOP:
+		return !z80_is_terminal(inst);
+	case Z80_EX:
+		return inst->addr_mode == Z80_REG;
+	default:
+		return 0;
+	}
+	uint8_t mode = inst->addr_mode & 0x1F;
+	return mode != Z80_REG_INDIRECT && mode != Z80_IMMED_INDIRECT && mode != Z80_IX_DISPLACE && mode != Z80_IY_DISPLACE;
+}
+
+static uint8_t z80_is_superblock_end(z80inst *inst)
+{
+	switch (inst->op)
+	{
+	//these jump back to their own start so they need to go through the normal per-instruction check
+	case Z80_LDIR:
+	case Z80_LDDR:
+	case Z80_CPIR:
+	case Z80_CPDR:
+	case Z80_INIR:
+	case Z80_INDR:
+	case Z80_OTIR:
+	case Z80_OTDR:
+	case Z80_HALT:
+		return 0;
+	default:
+		return 1;
+	}
+}
+
+static uint8_t z80_is_branch_target(uint16_t *targets, uint32_t num_targets, uint32_t address)
+{
+	for (uint32_t i = 0; i < num_targets; i++)
+	{
+		if (targets[i] == address) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+//Collects the destinations of direct branches in the straight-line code starting at address
+//so that loop heads get their own superblock even when they were reached by falling through
+static uint32_t z80_find_branch_targets(z80_context *context, uint32_t address, uint16_t *targets)
+{
+	z80_options *opts = context->options;
+	uint32_t num_targets = 0;
+	for (uint32_t i = 0; i < 256 && num_targets < Z80_MAX_SUPERBLOCK; i++)
+	{
+		uint8_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+		if (!encoded) {
+			break;
+		}
+		z80inst inst;
+		uint8_t *next = z80_decode(encoded, &inst);
+		if (inst.op == Z80_JR || inst.op == Z80_JRCC || inst.op == Z80_DJNZ) {
+			targets[num_targets++] = (address + inst.immed + 2) & 0xFFFF;
+		} else if ((inst.op == Z80_JP || inst.op == Z80_JPCC) && inst.addr_mode == Z80_IMMED) {
+			targets[num_targets++] = inst.immed;
+		}
+		if (z80_is_terminal(&inst)) {
+			break;
+		}
+		address = (address + next - encoded) & 0xFFFF;
+	}
+	return num_targets;
+}
+
+//Decodes the instructions of a superblock starting at address. A superblock never crosses
+//a code page boundary so invalidating the page of any of its instructions also invalidates
+//the entry point that guards its fast path
+static uint32_t z80_scan_superblock(z80_context *context, uint32_t address, uint16_t *targets, uint32_t num_targets, z80inst *insts, uint16_t *addresses)
+{
+	z80_options *opts = context->options;
+	uint32_t page_mask = ~((1 << opts->gen.ram_flags_shift) - 1);
+	uint32_t page = address & page_mask;
+	uint32_t count = 0;
+	while (count < Z80_MAX_SUPERBLOCK)
+	{
+		if (count && z80_is_branch_target(targets, num_targets, address)) {
+			break;
+		}
+		if (context->breakpoint_flags[address / 8] & (1 << (address % 8))) {
+			break;
+		}
+		uint8_t *encoded = get_native_pointer(address, (void **)context->mem_pointers, &opts->gen);
+		if (!encoded) {
+			break;
+		}
+		z80inst *inst = insts + count;
+		uint8_t *next = z80_decode(encoded, inst);
+		uint32_t size = next - encoded;
+		if (((address + size - 1) & page_mask) != page || z80_is_smc_interp(context, address, size)) {
+			break;
+		}
+		if (z80_is_superblock_body(inst)) {
+			addresses[count++] = address;
+			address = (address + size) & 0xFFFF;
+		} else {
+			if (z80_is_superblock_end(inst)) {
+				addresses[count++] = address;
+				address = (address + size) & 0xFFFF;
+			}
+			break;
+		}
+	}
+	//address of the instruction following the block
+	addresses[count] = address;
+	return count;
+}
+
+//Translates the fast path of a superblock. It has no per-instruction cycle checks
+//so it returns the cycles that need to be available for it to be safe to enter
+static uint32_t z80_translate_superblock(z80_context *context, z80inst *insts, uint16_t *addresses, uint32_t count)
+{
+	z80_options *opts = context->options;
+	code_info *code = &opts->gen.code;
+	uint32_t start_cycles = opts->gen.emitted_cycles, body_cycles = 0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (i == count - 1) {
+			//the last instruction's own cycles are consumed after its check would have happened
+			body_cycles = opts->gen.emitted_cycles - start_cycles;
+		}
+		check_code_prologue(code);
+		code_ptr start = code->cur;
+		profile_begin(&opts->gen, addresses[i]);
+		translate_z80inst(insts + i, context, addresses[i], Z80_TRANS_SUPERBLOCK);
+		profile_end(&opts->gen, (addresses[i+1] - addresses[i]) & 0xFFFF, code->cur - start, z80_ends_block(insts + i));
+	}
+	if (!z80_is_terminal(insts + count - 1)) {
+		uint16_t next = addresses[count];
+		code_ptr dst = z80_get_native_address(context, next);
+		if (!dst) {
+			opts->gen.deferred = defer_address(opts->gen.deferred, next, code->cur + 1);
+			//fake address to force large displacement
+			dst = code->cur + 256;
+		}
+		jmp(code, dst);
+	}
+	return body_cycles;
+}
+
 void translate_z80_stream(z80_context * context, uint32_t address)
 {
 	char disbuf[80];
@@ -3151,6 +3454,10 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 	do
 	{
 		z80inst inst;
+		uint16_t targets[Z80_MAX_SUPERBLOCK];
+		uint32_t num_targets = z80_find_branch_targets(context, address, targets);
+		uint32_t next_head = address;
+		start_address = address;
 		dprintf("translating Z80 code at address %X\n", address);
 		do {
 			uint8_t * existing = z80_get_native_address(context, address);
@@ -3168,6 +3475,11 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 			//make sure prologue is in a contiguous chunk of code
 			check_code_prologue(&opts->gen.code);
 			next = z80_decode(encoded, &inst);
+			if (z80_is_smc_interp(context, address, next-encoded)) {
+				code_info stub = z80_make_smc_stub(context, address);
+				z80_map_native_address(context, address, stub.cur, next-encoded, stub.last - stub.cur);
+				break;
+			}
 			#ifdef DO_DEBUG_PRINT
 			z80_disasm(&inst, disbuf, address);
 			if (inst.op == Z80_NOP) {
@@ -3176,8 +3488,41 @@ void translate_z80_stream(z80_context * context, uint32_t address)
 				printf("%X\t%s\n", address, disbuf);
 			}
 			#endif
+			code_ptr fast = NULL;
+			uint32_t body_cycles;
+			if (address == next_head || z80_is_branch_target(targets, num_targets, address)) {
+				z80inst block[Z80_MAX_SUPERBLOCK];
+				uint16_t block_addresses[Z80_MAX_SUPERBLOCK+1];
+				uint32_t count = z80_scan_superblock(context, address, targets, num_targets, block, block_addresses);
+				if (count > 1) {
+					code_ptr skip = NULL;
+					if (address != start_address) {
+						//previous instruction falls through to the guard so jump over the fast path
+						skip = opts->gen.code.cur + 1;
+						jmp(&opts->gen.code, skip + 512);//force 32-bit displacement
+					}
+					fast = opts->gen.code.cur;
+					body_cycles = z80_translate_superblock(context, block, block_addresses, count);
+					next_head = block_addresses[count];
+					//make sure the guard and the prologue are in a contiguous chunk of code
+					check_code_prologue(&opts->gen.code);
+					if (skip) {
+						*((uint32_t *)skip) = opts->gen.code.cur - (skip + 4);
+					}
+				} else {
+					next_head = (address + next - encoded) & 0xFFFF;
+				}
+			}
 			code_ptr start = opts->gen.code.cur;
+			if (fast) {
+				//the fast path is only safe when the cycle limit can't be reached before its last instruction
+				//this guard is what gets patched if the block needs to be retranslated
+				cmp_ir(&opts->gen.code, body_cycles + 1, opts->gen.cycles, SZ_D);
+				jcc(&opts->gen.code, CC_NS, fast);
+			}
+			profile_begin(&opts->gen, address);
 			translate_z80inst(&inst, context, address, 0);
+			profile_end(&opts->gen, next-encoded, opts->gen.code.cur - start, z80_ends_block(&inst));
 			z80_map_native_address(context, address, start, next-encoded, opts->gen.code.cur - start);
 			address += next-encoded;
 				address &= 0xFFFF;
@@ -3254,6 +3599,8 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	uint32_t inst_size_size = sizeof(uint8_t *) * ram_size(&options->gen) / 1024;
 	options->gen.ram_inst_sizes = malloc(inst_size_size);
 	memset(options->gen.ram_inst_sizes, 0, inst_size_size);
+	options->gen.smc_counts = calloc(ram_size(&options->gen) >> options->gen.ram_flags_shift, sizeof(uint32_t));
+	options->gen.smc_cycles = calloc(ram_size(&options->gen) >> options->gen.ram_flags_shift, sizeof(uint32_t));
 
 	code_info *code = &options->gen.code;
 	init_code_info(code);
@@ -3600,6 +3947,15 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	call(code, options->gen.load_context);
 	jmp_r(code, options->gen.scratch1);
 
+	options->smc_stub = code->cur;
+	call(code, options->gen.save_context);
+	push_r(code, options->gen.context_reg);
+	call_args(code, (code_ptr)z80_smc_interp_handler, 2, options->gen.scratch1, options->gen.context_reg);
+	mov_rr(code, RAX, options->gen.scratch1, SZ_PTR);
+	pop_r(code, options->gen.context_reg);
+	call(code, options->gen.load_context);
+	jmp_r(code, options->gen.scratch1);
+
 	options->run = (z80_ctx_fun)code->cur;
 	tmp_stack_off = code->stack_off;
 	save_callee_save_regs(code);
@@ -3618,6 +3974,7 @@ void init_z80_opts(z80_options * options, memmap_chunk const * chunks, uint32_t
 	*no_extra = code->cur - (no_extra + 1);
 	jmp_rind(code, options->gen.context_reg);
 	code->stack_off = tmp_stack_off;
+	options->gen.flush_code = *code;
 }
 
 z80_context *init_z80_context(z80_options * options)
@@ -3679,6 +4036,27 @@ void z80_run(z80_context * context, uint32_t target_cycle)
 	}
 }
 
+//Throws away all translated code so the code space can be reused
+//Must only be called when the Z80 is stopped at an instruction boundary
+void z80_flush_code(z80_context *context)
+{
+	z80_options *opts = context->options;
+	for (uint32_t chunk = 0; chunk < NATIVE_MAP_CHUNKS; chunk++)
+	{
+		if (opts->gen.native_code_map[chunk].base) {
+			free(opts->gen.native_code_map[chunk].offsets);
+			opts->gen.native_code_map[chunk].base = NULL;
+			opts->gen.native_code_map[chunk].offsets = NULL;
+		}
+	}
+	reset_translated_code(&opts->gen, context->ram_code_flags);
+	memset(context->interp_code, 0, sizeof(context->interp_code));
+	if (context->bp_stub) {
+		zcreate_stub(context);
+	}
+	context->native_pc = NULL;
+}
+
 void z80_options_free(z80_options *opts)
 {
 	for (uint32_t address = 0; address < opts->gen.address_mask; address += NATIVE_CHUNK_SIZE)
@@ -3695,6 +4073,8 @@ void z80_options_free(z80_options *opts)
 		free(opts->gen.ram_inst_sizes[i]);
 	}
 	free(opts->gen.ram_inst_sizes);
+	free(opts->gen.smc_counts);
+	free(opts->gen.smc_cycles);
 	free(opts);
 }
 
@@ -3702,6 +4082,8 @@ void z80_assert_reset(z80_context * context, uint32_t cycle)
 {
 	z80_run(context, cycle);
 	context->reset = 1;
+	//whatever gets loaded after a reset is unrelated to the code that was being modified before
+	reset_code_page_counts(&context->options->gen);
 }
 
 void z80_clear_reset(z80_context * context, uint32_t cycle)
@@ -3858,16 +4240,24 @@ void zinsert_breakpoint(z80_context * context, uint16_t address, uint8_t * bp_ha
 		if (!context->bp_stub) {
 			zcreate_stub(context);
 		}
-		uint8_t * native = z80_get_native_address(context, address);
-		if (native) {
-			zbreakpoint_patch(context, address, native);
+		if (z80_get_native_address(context, address)) {
+			//the address may be covered by the fast path of a superblock so retranslate
+			//the page it's in rather than patching the existing code
+			z80_options * opts = context->options;
+			uint32_t page_size = 1 << opts->gen.ram_flags_shift;
+			uint32_t page_start = address & ~(page_size - 1);
+			z80_invalidate_code_range(context, page_start, page_start + page_size);
 		}
 	}
 }
 
 void zremove_breakpoint(z80_context * context, uint16_t address)
 {
-	context->breakpoint_flags[address / 8] &= ~(1 << (address % 8));
+	uint8_t bit = 1 << (address % 8);
+	if (!(bit & context->breakpoint_flags[address / 8])) {
+		return;
+	}
+	context->breakpoint_flags[address / 8] &= ~bit;
 	uint8_t * native = z80_get_native_address(context, address);
 	if (native) {
 		z80_options * opts = context->options;
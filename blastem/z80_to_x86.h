@@ -12,8 +12,12 @@
 #define ZNUM_MEM_AREAS 4
 #ifdef Z80_LOG_ADDRESS
 #define ZMAX_NATIVE_SIZE 255
+//native sizes are stored in a byte so there's no more room to reserve
+#define ZPROFILE_NATIVE_SIZE 0
 #else
 #define ZMAX_NATIVE_SIZE 160
+//extra room for the execution counter emitted when block profiling is enabled
+#define ZPROFILE_NATIVE_SIZE 16
 #endif
 
 enum {
@@ -36,6 +40,7 @@ typedef struct {
 	code_ptr        load_context_scratch;
 	code_ptr        native_addr;
 	code_ptr        retrans_stub;
+	code_ptr        smc_stub;
 	code_ptr        do_sync;
 	code_ptr        read_8;
 	code_ptr        write_8;
@@ -99,6 +104,7 @@ code_ptr z80_get_native_address(z80_context * context, uint32_t address);
 code_ptr z80_get_native_address_trans(z80_context * context, uint32_t address);
 z80_context * z80_handle_code_write(uint32_t address, z80_context * context);
 void z80_invalidate_code_range(z80_context *context, uint32_t start, uint32_t end);
+void z80_flush_code(z80_context *context);
 void z80_reset(z80_context * context);
 void zinsert_breakpoint(z80_context * context, uint16_t address, uint8_t * bp_handler);
 void zremove_breakpoint(z80_context * context, uint16_t address);